@@ -0,0 +1,31 @@
+require 'rmagick'
+require 'benchmark'
+
+puts <<END_INFO
+
+This example times decoding the same image in one thread and in
+several. Image.from_blob and Image.read release Ruby's global lock
+while ImageMagick decodes, so on a machine with several CPUs the
+threads run in parallel.
+
+Usage:
+
+    ruby threaded_decode.rb <filename <threads>>
+
+where `filename' is the name of an image file and `threads' is the
+number of threads. The default is 4 threads. If you don't specify
+any arguments this script uses a default image.
+
+END_INFO
+
+file = ARGV[0] || '../doc/ex/images/Flower_Hat.jpg'
+nthreads = (ARGV[1] || 4).to_i
+
+blob = File.open(file, 'rb', &:read)
+decode = lambda { 5.times { Magick::Image.from_blob(blob).first.destroy! } }
+decode.call   # warm up the coder
+
+Benchmark.bm(10) do |bm|
+  bm.report('sequential') { nthreads.times { decode.call } }
+  bm.report('threaded') { Array.new(nthreads) { Thread.new { decode.call } }.each(&:join) }
+end
@@ -273,12 +273,16 @@ END_MSWIN
 
     def create_header_file
       have_func('snprintf', headers)
-      ['AcquireImage',                   # 6.4.1
+      ['AcquireCacheView',               # 6.4.?
+       'AcquireImage',                   # 6.4.1
+       'AcquirePixelCachePixels',        # release not recorded; Image memory views
+       'AcquireVirtualCacheView',        # 6.8.6
        'AffinityImage',                  # 6.4.3-6
        'AffinityImages',                 # 6.4.3-6
        'AutoGammaImageChannel',          # 6.5.5-1
        'AutoLevelImageChannel',          # 6.5.5-1
        'BlueShiftImage',                 # 6.5.4-3
+       'ClampToQuantum',                 # inline; release not recorded; colorize!
        'ColorMatrixImage',               # 6.6.1-0
        'ConstituteComponentTerminus',    # 6.5.7-9
        'DeskewImage',                    # 6.4.2-5
@@ -291,7 +295,9 @@ END_MSWIN
        'GetAuthenticIndexQueue',         # 6.4.5-6
        'GetAuthenticPixels',             # 6.4.5-6
        'GetImageAlphaChannel',           # 6.3.9-2
+       'GetImagePixelCacheType',         # release not recorded; Magick.memory_stats
        'GetMagickFeatures',              # 6.5.7-1
+       'GetVirtualIndexQueue',           # 6.4.5-6
        'GetVirtualPixels',               # 6.4.5-6
        'LevelImageColors',               # 6.4.2
        'LevelColorsImageChannel',        # 6.5.6-4
@@ -341,6 +347,17 @@ SRC
         end
       end
 
+      # The managed memory allocator counts bytes from any thread
+      checking_for('__sync_add_and_fetch') do
+        if try_link("int main() { long n = 0; return (int)__sync_add_and_fetch(&n, 1); }")
+          $defs.push('-DHAVE___SYNC_ADD_AND_FETCH')
+          true
+        else
+          false
+        end
+      end
+      have_func('sched_yield', 'sched.h')                   # managed memory lock waits
+
       have_struct_member('Image', 'type', headers)          # ???
       have_struct_member('DrawInfo', 'kerning', headers)    # 6.4.7-8
       have_struct_member('DrawInfo', 'interline_spacing', headers)   # 6.5.5-8
@@ -415,6 +432,10 @@ SRC
                                             'MergeLayer',                             # 6.3.6
                                             'MosaicLayer',                            # 6.3.6-2
                                             'TrimBoundsLayer' ], headers)             # 6.4.3-8
+      have_enum_values('ResourceType', ['TimeResource',                            # 6.4.?
+                                        'WidthResource',                           # 6.8.?
+                                        'HeightResource',                          # 6.8.?
+                                        'ListLengthResource'], headers)            # 6.9.10-?
       have_enum_values('VirtualPixelMethod', ['HorizontalTileVirtualPixelMethod',     # 6.4.2-6
                                               'VerticalTileVirtualPixelMethod',       # 6.4.2-6
                                               'HorizontalTileEdgeVirtualPixelMethod', # 6.5.0-1
@@ -432,6 +453,23 @@ SRC
 
       have_func('rb_frame_this_func', headers)
 
+      # Ruby 1.9.2 and 2.4.0 features. Used to report native memory to the GC.
+      have_type('rb_data_type_t', headers)
+      have_func('rb_gc_adjust_memory_usage', headers)
+
+      # Ruby 2.0.0 features. Used to release the GVL around ImageMagick calls.
+      if have_header('ruby/thread.h')
+        have_func('rb_thread_call_without_gvl', headers + ['ruby/thread.h'])
+        have_func('rb_thread_call_without_gvl2', headers + ['ruby/thread.h'])
+        have_func('rb_thread_call_with_gvl', headers + ['ruby/thread.h'])
+      end
+      have_func('ruby_thread_has_gvl_p')     # exported by libruby, but not declared
+
+      # Ruby 3.0.0 features. Used to export the pixel cache as a memory view.
+      if have_header('ruby/memory_view.h')
+        have_func('rb_memory_view_register', headers + ['ruby/memory_view.h'])
+      end
+
       # Miscellaneous constants
       $defs.push("-DRUBY_VERSION_STRING=\"ruby #{RUBY_VERSION}\"")
       $defs.push("-DRMAGICK_VERSION_STRING=\"RMagick #{RMAGICK_VERS}\"")
@@ -193,6 +193,79 @@ Magick_init_formats(VALUE class)
 }
 
 
+//! The resources known to Magick.limit_resource and Magick.memory_stats
+static const struct
+{
+    const char *name;           /**< the name */
+    ResourceType type;          /**< the resource */
+} Resources[] = {
+    { "area", AreaResource },
+    { "memory", MemoryResource },
+    { "map", MapResource },
+    { "disk", DiskResource },
+    { "file", FileResource },
+    // The resources above are reported by Magick.memory_stats
+    { "thread", ThreadResource },
+#if defined(HAVE_ENUM_TIMERESOURCE)
+    { "time", TimeResource },
+#endif
+#if defined(HAVE_ENUM_WIDTHRESOURCE)
+    { "width", WidthResource },
+#endif
+#if defined(HAVE_ENUM_HEIGHTRESOURCE)
+    { "height", HeightResource },
+#endif
+#if defined(HAVE_ENUM_LISTLENGTHRESOURCE)
+    { "list_length", ListLengthResource },
+#endif
+};
+#define N_RESOURCES (int)(sizeof(Resources)/sizeof(Resources[0]))
+#define N_STATS_RESOURCES 5
+
+
+/**
+ * Convert a resource name to a ResourceType.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param resource the name, a Symbol or String
+ * @return the ResourceType, or UndefinedResource for nil or ""
+ * @throw ArgumentError if the name is unknown
+ */
+static ResourceType
+resource_type(VALUE resource)
+{
+    const char *str;
+    int x;
+
+    if (NIL_P(resource))
+    {
+        return UndefinedResource;
+    }
+
+    str = SYMBOL_P(resource) ? rb_id2name(SYM2ID(resource)) : StringValuePtr(resource);
+    if (*str == '\0')
+    {
+        return UndefinedResource;
+    }
+
+    for (x = 0; x < N_RESOURCES; x++)
+    {
+        if (SYMBOL_P(resource) ? strcmp(Resources[x].name, str) == 0 : rm_strcasecmp(Resources[x].name, str) == 0)
+        {
+            return Resources[x].type;
+        }
+    }
+
+    if (SYMBOL_P(resource))
+    {
+        rb_raise(rb_eArgError, "unknown resource: `:%s'", str);
+    }
+    rb_raise(rb_eArgError, "unknown resource: `%s'", str);
+    return UndefinedResource;
+}
+
+
 /**
  * Get/set resource limits. If a limit is specified the old limit is set to the
  * new value. Either way the current/old limit is returned.
@@ -201,6 +274,10 @@ Magick_init_formats(VALUE class)
  *   - @verbatim Magick.limit_resource(resource) @endverbatim
  *   - @verbatim Magick.limit_resource(resource, limit) @endverbatim
  *
+ * Notes:
+ *   - resource is :area, :memory, :map, :disk, :file or :thread, plus
+ *     :time, :width, :height and :list_length if ImageMagick has them.
+ *
  * @param argc number of input arguments.
  * @param argv array of input arguments.
  * @param class the class on which the method is run.
@@ -211,76 +288,14 @@ Magick_limit_resource(int argc, VALUE *argv, VALUE class)
 {
     VALUE resource, limit;
     ResourceType res = UndefinedResource;
-    char *str;
-    ID id;
     unsigned long cur_limit;
 
     rb_scan_args(argc, argv, "11", &resource, &limit);
 
-    switch (TYPE(resource))
+    res = resource_type(resource);
+    if (res == UndefinedResource)
     {
-        case T_NIL:
-            return class;
-
-        case T_SYMBOL:
-            id = (ID)SYM2ID(resource);
-            if (id == rb_intern("area"))
-            {
-                res = AreaResource;
-            }
-            else if (id == rb_intern("memory"))
-            {
-                res = MemoryResource;
-            }
-            else if (id == rb_intern("map"))
-            {
-                res = MapResource;
-            }
-            else if (id == rb_intern("disk"))
-            {
-                res = DiskResource;
-            }
-            else if (id == rb_intern("file"))
-            {
-                res = FileResource;
-            }
-            else
-            {
-                rb_raise(rb_eArgError, "unknown resource: `:%s'", rb_id2name(id));
-            }
-            break;
-
-        default:
-            str = StringValuePtr(resource);
-            if (*str == '\0')
-            {
-                return class;
-            }
-            else if (rm_strcasecmp("area", str) == 0)
-            {
-                res = AreaResource;
-            }
-            else if (rm_strcasecmp("memory", str) == 0)
-            {
-                res = MemoryResource;
-            }
-            else if (rm_strcasecmp("map", str) == 0)
-            {
-                res = MapResource;
-            }
-            else if (rm_strcasecmp("disk", str) == 0)
-            {
-                res = DiskResource;
-            }
-            else if (rm_strcasecmp("file", str) == 0)
-            {
-                res = FileResource;
-            }
-            else
-            {
-                rb_raise(rb_eArgError, "unknown resource: `%s'", str);
-            }
-            break;
+        return class;
     }
 
     RB_GC_GUARD(resource);
@@ -298,6 +313,806 @@ Magick_limit_resource(int argc, VALUE *argv, VALUE class)
 }
 
 
+static MagickSizeType resource_peaks[N_STATS_RESOURCES];  /**< the peak use of each resource */
+static st_table *live_image_table = NULL;           /**< Image -> the number of Image objects for it */
+static SemaphoreInfo *live_image_semaphore = NULL;  /**< lock for live_image_table and the counts */
+static long live_images = 0;                        /**< the number of live Image objects */
+static long peak_images = 0;                        /**< the most live Image objects */
+
+
+/**
+ * Record the current resource use in the peaks.
+ *
+ * No Ruby usage (internal function)
+ */
+static void
+sample_resources(void)
+{
+    MagickSizeType current;
+    int x;
+
+    for (x = 0; x < N_STATS_RESOURCES; x++)
+    {
+        current = GetMagickResource(Resources[x].type);
+        resource_peaks[x] = max(resource_peaks[x], current);
+    }
+}
+
+
+/**
+ * Count a new Image object. Called from rm_trace_creation.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The table and its lock are created on first use, which is with the GVL
+ *     held.
+ *
+ * @param image the image the object wraps
+ */
+void
+rm_count_image_created(Image *image)
+{
+    st_data_t count = 0;
+
+    if (!live_image_semaphore)
+    {
+        live_image_semaphore = AcquireSemaphoreInfo();
+        live_image_table = st_init_numtable();
+    }
+
+    LockSemaphoreInfo(live_image_semaphore);
+    (void) st_lookup(live_image_table, (st_data_t)image, &count);
+    (void) st_insert(live_image_table, (st_data_t)image, count + 1);
+    live_images += 1;
+    peak_images = max(peak_images, live_images);
+    UnlockSemaphoreInfo(live_image_semaphore);
+
+    sample_resources();
+}
+
+
+/**
+ * Count a destroyed Image object. Called from rm_image_destroy.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - May be called from the GC, so it mustn't call Ruby.
+ *
+ * @param image the image the object wrapped
+ */
+void
+rm_count_image_destroyed(Image *image)
+{
+    st_data_t key = (st_data_t)image, count = 0;
+
+    if (!live_image_semaphore)
+    {
+        return;
+    }
+
+    LockSemaphoreInfo(live_image_semaphore);
+    if (st_lookup(live_image_table, key, &count))
+    {
+        if (count > 1)
+        {
+            (void) st_insert(live_image_table, key, count - 1);
+        }
+        else
+        {
+            (void) st_delete(live_image_table, &key, NULL);
+        }
+        live_images -= 1;
+    }
+    UnlockSemaphoreInfo(live_image_semaphore);
+}
+
+
+//! The pixel cache bytes of the live images, by cache type
+typedef struct
+{
+    MagickSizeType memory;      /**< in-memory caches */
+    MagickSizeType map;         /**< memory-mapped caches */
+    MagickSizeType disk;        /**< disk caches */
+    st_table *caches;           /**< the pixel caches already counted */
+} PixelCacheBytes;
+
+
+/**
+ * Add an image's pixel cache to the PixelCacheBytes. Called by st_foreach on
+ * the live images.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Images made by CloneImage share a pixel cache until one of them is
+ *     changed. A shared cache is counted once.
+ *
+ * @param key the image
+ * @param value the number of Image objects for the image (unused)
+ * @param data the PixelCacheBytes
+ * @return ST_CONTINUE
+ */
+static int
+count_pixel_cache(st_data_t key, st_data_t value, st_data_t data)
+{
+    PixelCacheBytes *bytes = (PixelCacheBytes *)data;
+    Image *image = (Image *)key;
+    MagickSizeType size;
+
+    value = value;  // defeat "unused argument" message
+
+    if (st_lookup(bytes->caches, (st_data_t)image->cache, NULL))
+    {
+        return ST_CONTINUE;
+    }
+    (void) st_insert(bytes->caches, (st_data_t)image->cache, 0);
+
+    size = (MagickSizeType)image->columns * image->rows * sizeof(PixelPacket);
+    if (image->storage_class == PseudoClass || image->colorspace == CMYKColorspace)
+    {
+        size += (MagickSizeType)image->columns * image->rows * sizeof(IndexPacket);
+    }
+
+#if defined(HAVE_GETIMAGEPIXELCACHETYPE)
+    switch (GetImagePixelCacheType(image))
+    {
+        case MapCache:
+            bytes->map += size;
+            break;
+        case DiskCache:
+            bytes->disk += size;
+            break;
+        case MemoryCache:
+            bytes->memory += size;
+            break;
+        default:
+            break;
+    }
+#else
+    bytes->memory += size;
+#endif
+
+    return ST_CONTINUE;
+}
+
+
+/**
+ * Add up the pixel caches of the live images.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param bytes the PixelCacheBytes (out)
+ */
+static void
+count_pixel_caches(PixelCacheBytes *bytes)
+{
+    memset(bytes, 0, sizeof(*bytes));
+    if (!live_image_semaphore)
+    {
+        return;
+    }
+
+    bytes->caches = st_init_numtable();
+    LockSemaphoreInfo(live_image_semaphore);
+    st_foreach(live_image_table, count_pixel_cache, (st_data_t)bytes);
+    UnlockSemaphoreInfo(live_image_semaphore);
+    st_free_table(bytes->caches);
+}
+
+
+/**
+ * Report ImageMagick resource use and RMagick's live images.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.memory_stats @endverbatim
+ *   - @verbatim Magick.resource_usage @endverbatim
+ *
+ * Notes:
+ *   - Returns a hash with these keys:
+ *     - :area, :memory, :map, :disk, :file - a hash of the :current use,
+ *       :peak use and :limit of the ImageMagick resource. Peaks are sampled
+ *       when images are created and when this method is called.
+ *     - :images - a hash of the :live and :peak number of Image objects.
+ *     - :pixel_cache - a hash of the pixel cache bytes of the live images in
+ *       :memory, :map and :disk caches. A cache shared by clones is counted
+ *       once.
+ *     - :managed - a hash of the :current and :peak bytes allocated by
+ *       ImageMagick and the :high_water mark, if Magick::MANAGED_MEMORY.
+ *
+ * @param class the class on which the method is run.
+ * @return the statistics
+ */
+VALUE
+Magick_memory_stats(VALUE class)
+{
+    VALUE stats, resource;
+    PixelCacheBytes bytes;
+    size_t current, peak, high_water;
+    int x;
+
+    sample_resources();
+
+    stats = rb_hash_new();
+    for (x = 0; x < N_STATS_RESOURCES; x++)
+    {
+        resource = rb_hash_new();
+        (void) rb_hash_aset(resource, CSTR2SYM("current"), ULL2NUM(GetMagickResource(Resources[x].type)));
+        (void) rb_hash_aset(resource, CSTR2SYM("peak"), ULL2NUM(resource_peaks[x]));
+        (void) rb_hash_aset(resource, CSTR2SYM("limit"), ULL2NUM(GetMagickResourceLimit(Resources[x].type)));
+        (void) rb_hash_aset(stats, CSTR2SYM(Resources[x].name), resource);
+    }
+
+    resource = rb_hash_new();
+    (void) rb_hash_aset(resource, CSTR2SYM("live"), LONG2NUM(live_images));
+    (void) rb_hash_aset(resource, CSTR2SYM("peak"), LONG2NUM(peak_images));
+    (void) rb_hash_aset(stats, CSTR2SYM("images"), resource);
+
+    count_pixel_caches(&bytes);
+    resource = rb_hash_new();
+    (void) rb_hash_aset(resource, CSTR2SYM("memory"), ULL2NUM(bytes.memory));
+    (void) rb_hash_aset(resource, CSTR2SYM("map"), ULL2NUM(bytes.map));
+    (void) rb_hash_aset(resource, CSTR2SYM("disk"), ULL2NUM(bytes.disk));
+    (void) rb_hash_aset(stats, CSTR2SYM("pixel_cache"), resource);
+
+    if (rm_managed_memory)
+    {
+        rm_managed_memory_usage(&current, &peak, &high_water);
+        resource = rb_hash_new();
+        (void) rb_hash_aset(resource, CSTR2SYM("current"), ULONG2NUM((unsigned long)current));
+        (void) rb_hash_aset(resource, CSTR2SYM("peak"), ULONG2NUM((unsigned long)peak));
+        (void) rb_hash_aset(resource, CSTR2SYM("high_water"), high_water ? ULONG2NUM((unsigned long)high_water) : Qnil);
+        (void) rb_hash_aset(stats, CSTR2SYM("managed"), resource);
+    }
+
+    RB_GC_GUARD(stats);
+    RB_GC_GUARD(resource);
+
+    class = class;  // defeat "never referenced" message
+    return stats;
+}
+
+
+//! The resources Magick.with_limits enforces, in the order of ImageLimits
+static const char *LimitNames[] = { "width", "height", "area", "list_length" };
+#define N_LIMITS (int)(sizeof(LimitNames)/sizeof(LimitNames[0]))
+#define NO_LIMIT (~(MagickSizeType)0)
+
+
+/**
+ * Convert a Magick.with_limits resource name to its index in LimitNames.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param resource the name, a Symbol or String
+ * @return the index
+ * @throw ArgumentError if the name is unknown or the resource can't be
+ *   limited per thread
+ */
+static int
+limit_index(VALUE resource)
+{
+    const char *str;
+    int x;
+
+    if (!NIL_P(resource))
+    {
+        str = SYMBOL_P(resource) ? rb_id2name(SYM2ID(resource)) : StringValuePtr(resource);
+        for (x = 0; x < N_LIMITS; x++)
+        {
+            if (rm_strcasecmp(LimitNames[x], str) == 0)
+            {
+                return x;
+            }
+        }
+    }
+
+    // Raises for unknown names
+    if (resource_type(resource) == UndefinedResource)
+    {
+        rb_raise(rb_eArgError, "resource name required");
+    }
+    rb_raise(rb_eArgError, "resource can't be limited per thread: %s; use Magick.limit_resource"
+             , RSTRING_PTR(rb_inspect(resource)));
+    return 0;
+}
+
+
+/**
+ * Return the name of the limit that an image size exceeds.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param limits the limits
+ * @param columns the number of columns
+ * @param rows the number of rows
+ * @return the ImageMagick message tag, or NULL if the size is within the
+ *   limits
+ */
+static const char *
+exceeded_limit(const ImageLimits *limits, MagickSizeType columns, MagickSizeType rows)
+{
+    if (columns > limits->width || rows > limits->height)
+    {
+        return "WidthOrHeightExceedsLimit";
+    }
+    if (columns * rows > limits->area)
+    {
+        return "AreaExceedsLimit";
+    }
+    return NULL;
+}
+
+
+/**
+ * Get the limits of the innermost Magick.with_limits block running in this
+ * thread.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param limits the limits (out)
+ * @return false if no block is running
+ */
+MagickBooleanType
+rm_get_limits(ImageLimits *limits)
+{
+    VALUE frame;
+
+    frame = rb_thread_local_aref(rb_thread_current(), rm_ID_limits);
+    if (NIL_P(frame))
+    {
+        return MagickFalse;
+    }
+
+    *limits = *(ImageLimits *) DATA_PTR(frame);
+    return MagickTrue;
+}
+
+
+/**
+ * Store limits in an Info, for rm_ping_within_limits and rm_limit_images.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called by rm_info_new, so every read of a Magick.with_limits block
+ *     carries the block's limits.
+ *   - Doesn't call Ruby.
+ *
+ * @param info the Info
+ * @param limits the limits
+ */
+void
+rm_set_info_limits(Info *info, const ImageLimits *limits)
+{
+    const MagickSizeType *limit = (const MagickSizeType *) limits;
+    char option[MaxTextExtent], value[50];
+    int x;
+
+    for (x = 0; x < N_LIMITS; x++)
+    {
+        if (limit[x] != NO_LIMIT)
+        {
+            snprintf(option, sizeof(option), "rmagick:limit-%s", LimitNames[x]);
+            snprintf(value, sizeof(value), "%.0f", (double) limit[x]);
+            (void) SetImageOption(info, option, value);
+        }
+    }
+}
+
+
+/**
+ * Get the limits stored in an Info by rm_set_info_limits.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param info the Info
+ * @param limits the limits (out)
+ * @return false if the Info has no limits
+ */
+static MagickBooleanType
+get_info_limits(const Info *info, ImageLimits *limits)
+{
+    MagickSizeType *limit = (MagickSizeType *) limits;
+    char option[MaxTextExtent];
+    const char *value;
+    MagickBooleanType limited = MagickFalse;
+    int x;
+
+    for (x = 0; x < N_LIMITS; x++)
+    {
+        snprintf(option, sizeof(option), "rmagick:limit-%s", LimitNames[x]);
+        value = GetImageOption(info, option);
+        limit[x] = value ? (MagickSizeType) strtod(value, NULL) : NO_LIMIT;
+        if (value)
+        {
+            limited = MagickTrue;
+        }
+    }
+
+    return limited;
+}
+
+
+/**
+ * Check images against limits, and record an error if they're over.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param limits the limits
+ * @param images the images
+ * @param exception the exception info
+ * @return false if the images are over the limits
+ */
+static MagickBooleanType
+within_limits(const ImageLimits *limits, const Image *images, ExceptionInfo *exception)
+{
+    const Image *image;
+    const char *tag;
+    MagickSizeType length = 0;
+
+    for (image = images; image; image = GetNextImageInList(image))
+    {
+        tag = exceeded_limit(limits, image->columns, image->rows);
+        if (tag)
+        {
+            (void) ThrowMagickException(exception, GetMagickModule(), ResourceLimitError
+                                 , tag, "`%s' (%lux%lu)", image->filename
+                                 , (unsigned long) image->columns, (unsigned long) image->rows);
+            return MagickFalse;
+        }
+        length += 1;
+    }
+
+    if (length > limits->list_length)
+    {
+        (void) ThrowMagickException(exception, GetMagickModule(), ResourceLimitError
+                             , "ListLengthExceedsLimit", "`%s' (%lu frames)", images->filename
+                             , (unsigned long) length);
+        return MagickFalse;
+    }
+
+    return MagickTrue;
+}
+
+
+/**
+ * Before a read, ping the input and check it against the limits stored in
+ * the Info.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Does nothing if the Info has no limits, or reads from a Ruby IO (which
+ *     can't be read twice). rm_limit_images checks those after the read.
+ *   - Ping errors are ignored. The read that follows reports them.
+ *   - Doesn't call Ruby, so it can be called without the GVL.
+ *
+ * @param info the Info for the read
+ * @param blob the blob to be read, or NULL if reading info->filename
+ * @param length the length of the blob
+ * @param exception the exception info for the read
+ * @return false if the input is over the limits
+ */
+MagickBooleanType
+rm_ping_within_limits(const Info *info, const void *blob, size_t length, ExceptionInfo *exception)
+{
+    ImageLimits limits;
+    Image *images;
+    ExceptionInfo *ping_exception;
+    MagickBooleanType okay = MagickTrue;
+
+    if (info->file || !get_info_limits(info, &limits))
+    {
+        return MagickTrue;
+    }
+
+    ping_exception = AcquireExceptionInfo();
+    images = blob ? PingBlob(info, blob, length, ping_exception) : PingImage(info, ping_exception);
+    (void) DestroyExceptionInfo(ping_exception);
+    if (images)
+    {
+        okay = within_limits(&limits, images, exception);
+        (void) DestroyImageList(images);
+    }
+
+    return okay;
+}
+
+
+/**
+ * After a read, check the images against the limits stored in the Info.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Doesn't call Ruby, so it can be called without the GVL.
+ *
+ * @param info the Info for the read
+ * @param images the images read, or NULL
+ * @param exception the exception info for the read
+ * @return the images, or NULL if they were over the limits and have been
+ *   destroyed
+ */
+Image *
+rm_limit_images(const Info *info, Image *images, ExceptionInfo *exception)
+{
+    ImageLimits limits;
+
+    if (images && get_info_limits(info, &limits) && !within_limits(&limits, images, exception))
+    {
+        images = DestroyImageList(images);
+    }
+
+    return images;
+}
+
+
+/**
+ * Before a transform, check the size of the image it will make against the
+ * limits of the innermost Magick.with_limits block running in this thread.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param columns the number of columns
+ * @param rows the number of rows
+ * @throw ImageMagickError if the size is over the limits
+ */
+void
+rm_check_size_limits(unsigned long columns, unsigned long rows)
+{
+    ImageLimits limits;
+    const char *tag;
+
+    if (!rm_get_limits(&limits))
+    {
+        return;
+    }
+
+    tag = exceeded_limit(&limits, columns, rows);
+    if (tag)
+    {
+        rb_raise(Class_ImageMagickError, "%s (%lux%lu)", tag, columns, rows);
+    }
+}
+
+
+/**
+ * Yield to the Magick.with_limits block.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg unused
+ * @return the block's result
+ */
+static VALUE
+with_limits_yield(VALUE arg)
+{
+    return rb_yield(arg);
+}
+
+
+/**
+ * Make the enclosing block's limits current again when a Magick.with_limits
+ * block exits.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param prev the enclosing block's limits, or nil
+ * @return nil
+ */
+static VALUE
+restore_limits(VALUE prev)
+{
+    (void) rb_thread_local_aset(rb_thread_current(), rm_ID_limits, prev);
+    return Qnil;
+}
+
+
+/**
+ * Run a block with image size limits that apply only to the current thread.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.with_limits(limits) { ... } @endverbatim
+ *
+ * Notes:
+ *   - limits is a hash of resource names and limits, e.g.
+ *     {:area => 1e8, :width => 20000}. The resources are :width, :height,
+ *     :area (columns * rows) and :list_length (the number of frames).
+ *   - Reads started in the block fail with an ImageMagickError if an image
+ *     is over the limits. Inputs that can be pinged are checked before
+ *     their pixels are decoded.
+ *   - Image.new and the resizing transforms (resize, scale, sample,
+ *     thumbnail, adaptive_resize) check the size of their result before
+ *     they run.
+ *   - The limits apply to the current thread (and fiber) only, and are
+ *     enforced by RMagick, not by ImageMagick's resource limits. Other
+ *     threads and Magick.limit_resource are unaffected. ImageMagick's
+ *     memory, map, disk, file, thread and time limits are process-wide and
+ *     can only be set with Magick.limit_resource.
+ *   - A limit can only be lowered: a nested block's limits are the smallest
+ *     of its own and the enclosing block's.
+ *
+ * @param class the class on which the method is run.
+ * @param limits the limits.
+ * @return the block's result
+ */
+VALUE
+Magick_with_limits(VALUE class, VALUE limits)
+{
+    VALUE keys, prev, frame;
+    ImageLimits *frame_limits;
+    MagickSizeType *limit;
+    long x, n;
+    int r;
+
+    rb_need_block();
+    limits = rb_convert_type(limits, T_HASH, "Hash", "to_hash");
+    keys = rb_funcall(limits, rb_intern("keys"), 0);
+    n = RARRAY_LEN(keys);
+
+    // Not hidden (class 0): Thread#[] can return it
+    frame = Data_Make_Struct(rb_cObject, ImageLimits, NULL, RUBY_DEFAULT_FREE, frame_limits);
+    limit = (MagickSizeType *) frame_limits;
+
+    prev = rb_thread_local_aref(rb_thread_current(), rm_ID_limits);
+    if (NIL_P(prev))
+    {
+        for (r = 0; r < N_LIMITS; r++)
+        {
+            limit[r] = NO_LIMIT;
+        }
+    }
+    else
+    {
+        *frame_limits = *(ImageLimits *) DATA_PTR(prev);
+    }
+
+    // Check all the limits before using any
+    for (x = 0; x < n; x++)
+    {
+        VALUE key = rb_ary_entry(keys, x);
+        VALUE value = rb_hash_aref(limits, key);
+        double new_limit;
+
+        r = limit_index(key);
+        if (rm_check_num2dbl(value) == 0 || NUM2DBL(value) < 0.0)
+        {
+            rb_raise(rb_eArgError, "invalid limit for resource: %s", RSTRING_PTR(rb_inspect(key)));
+        }
+        new_limit = NUM2DBL(value);
+        if (new_limit < (double) NO_LIMIT)
+        {
+            limit[r] = min(limit[r], (MagickSizeType) new_limit);
+        }
+    }
+
+    RB_GC_GUARD(keys);
+
+    (void) rb_thread_local_aset(rb_thread_current(), rm_ID_limits, frame);
+
+    class = class;  // defeat "never referenced" message
+    return rb_ensure(with_limits_yield, Qnil, restore_limits, prev);
+}
+
+
+static CompressionType marshal_compression = NoCompression;  /**< the compression used by Image#_dump */
+
+
+/**
+ * Return the compression Image#_dump uses for the pixels.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @return the compression type
+ */
+CompressionType
+rm_marshal_compression(void)
+{
+    return marshal_compression;
+}
+
+
+/**
+ * Get the compression used for the pixels of marshaled images.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.marshal_compression @endverbatim
+ *
+ * @param class the class on which the method is run.
+ * @return a CompressionType
+ */
+VALUE
+Magick_marshal_compression(VALUE class)
+{
+    class = class;  // defeat "never referenced" message
+    return CompressionType_new(marshal_compression);
+}
+
+
+/**
+ * Set the compression used for the pixels of marshaled images.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.marshal_compression = compression @endverbatim
+ *
+ * Notes:
+ *   - Default is NoCompression. ZipCompression and RLECompression trade
+ *     some speed for smaller dumps. Any compression the MIFF coder supports
+ *     can be used.
+ *
+ * @param class the class on which the method is run.
+ * @param compression a CompressionType
+ * @return compression
+ */
+VALUE
+Magick_marshal_compression_eq(VALUE class, VALUE compression)
+{
+    VALUE_TO_ENUM(compression, marshal_compression, CompressionType);
+
+    class = class;  // defeat "never referenced" message
+    return compression;
+}
+
+
+/**
+ * Get the managed memory high-water mark.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.memory_high_water @endverbatim
+ *
+ * @param class the class on which the method is run.
+ * @return the limit in bytes, or nil if there is no limit.
+ */
+VALUE
+Magick_memory_high_water(VALUE class)
+{
+    size_t current, peak, high_water;
+
+    rm_managed_memory_usage(&current, &peak, &high_water);
+
+    class = class;  // defeat "never referenced" message
+    return high_water ? ULONG2NUM((unsigned long)high_water) : Qnil;
+}
+
+
+/**
+ * Set the managed memory high-water mark.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.memory_high_water = bytes @endverbatim
+ *
+ * Notes:
+ *   - Requires managed memory (Magick::MANAGED_MEMORY).
+ *   - ImageMagick allocations of 64KB or more that would take the memory in
+ *     use past the mark fail, and the error is raised as a
+ *     Magick::MemoryLimitError. Smaller allocations always go ahead, so the
+ *     memory in use can pass the mark by a little.
+ *   - Pixel caches aren't allocated through the memory methods. Limit them
+ *     with Magick.limit_resource(:memory).
+ *   - nil or 0 removes the limit.
+ *
+ * @param class the class on which the method is run.
+ * @param high_water the limit in bytes.
+ * @return high_water
+ * @throw NotImplementedError if managed memory isn't enabled.
+ */
+VALUE
+Magick_memory_high_water_eq(VALUE class, VALUE high_water)
+{
+    size_t limit = NIL_P(high_water) ? 0 : (size_t) NUM2ULONG(high_water);
+
+    if (!rm_set_managed_memory_high_water(limit))
+    {
+        rb_raise(rb_eNotImpError, "managed memory is not enabled");
+    }
+
+    class = class;  // defeat "never referenced" message
+    return high_water;
+}
+
+
 /**
  * Set the amount of free memory allocated for the pixel cache.  Once this
  * threshold is exceeded, all subsequent pixels cache operations are to/from
@@ -53,6 +53,10 @@
 
 #include "extconf.h"
 
+#if defined(HAVE_RUBY_THREAD_H)
+#include "ruby/thread.h"    // >= 2.0.0
+#endif
+
 
 //! For quoting preprocessor symbols
 #define Q2(q) #q
@@ -60,9 +64,11 @@
 #define Q(q) Q2(q)
 
 
-//! Trace new image creation in bang methods
+//! Trace new image creation in bang methods. Discard the new image if the old one is pinned.
 #define UPDATE_DATA_PTR(_obj_, _new_) \
-    do { (void) rm_trace_creation(_new_);\
+    do { rm_check_pinned((Image *)DATA_PTR(_obj_), _new_);\
+    (void) rm_trace_creation(_new_);\
+    rm_image_memory_usage(_new_, 1);\
     DATA_PTR(_obj_) = (void *)(_new_);\
     } while(0)
 
@@ -102,6 +108,11 @@
 //! round to Quantum
 #define ROUND_TO_QUANTUM(value) ((Quantum) ((value) > (Quantum)QuantumRange ? QuantumRange : (value) + 0.5))
 
+#if !defined(HAVE_CLAMPTOQUANTUM)
+//! clamp to [0, QuantumRange] and round, as ImageMagick's ClampToQuantum does
+#define ClampToQuantum(value) ((Quantum) ((value) <= 0.0 ? 0 : ((value) >= (MagickRealType)QuantumRange ? QuantumRange : (value) + 0.5)))
+#endif
+
 
 // Ruby 1.9.0 changed the name to rb_frame_this_func
 #if defined(HAVE_RB_FRAME_THIS_FUNC)
@@ -144,6 +155,126 @@
 #define RB_GC_GUARD(x) (x)
 #endif
 
+// Zeroed allocation (2.2.0)
+#if !defined(ZALLOC_N)
+#define ZALLOC_N(type,n) ((type *)xcalloc((n), sizeof(type)))
+#endif
+
+// Typed data is new in 1.9.2. Before that the structs are wrapped untyped and
+// the GC doesn't know their size.
+#if !defined(HAVE_TYPE_RB_DATA_TYPE_T)
+typedef struct
+{
+    const char *wrap_struct_name;
+    struct
+    {
+        void (*dmark)(void *);
+        void (*dfree)(void *);
+        size_t (*dsize)(const void *);
+    } function;
+} rb_data_type_t;
+#define TypedData_Wrap_Struct(class, data_type, ptr) \
+    Data_Wrap_Struct(class, (data_type)->function.dmark, (data_type)->function.dfree, ptr)
+#define TypedData_Get_Struct(obj, type, data_type, ptr) Data_Get_Struct(obj, type, ptr)
+#endif
+
+// The typed data types. The DEF_ATTR macros find them by the struct name.
+extern const rb_data_type_t rm_Draw_data_type;      /**< Draw, DrawOptions and PolaroidOptions */
+extern const rb_data_type_t rm_Image_data_type;     /**< Image */
+extern const rb_data_type_t rm_Info_data_type;      /**< Image::Info */
+extern const rb_data_type_t rm_Montage_data_type;   /**< ImageList::Montage */
+extern const rb_data_type_t rm_Pixel_data_type;     /**< Pixel */
+extern const rb_data_type_t rm_Stream_data_type;    /**< Stream */
+extern const rb_data_type_t rm_View_data_type;      /**< Image::View */
+
+// ruby_thread_has_gvl_p is exported by libruby but not declared in its headers
+#if defined(HAVE_RUBY_THREAD_HAS_GVL_P)
+extern int ruby_thread_has_gvl_p(void);
+#endif
+
+//! A function that can be called without the GVL. See rm_call_without_gvl.
+typedef void *(gvl_function_t)(void *);
+
+//! Name of the GVL-free stub for an ImageMagick function
+#define GVL_FUNC(name) name##_gvl
+//! Name of the argument struct for the GVL-free stub for an ImageMagick function
+#define GVL_STRUCT_TYPE(name) name##_args_t
+//! Call an ImageMagick function through its GVL-free stub
+#define CALL_FUNC_WITHOUT_GVL(name, args) rm_call_without_gvl(GVL_FUNC(name), (void *)(args))
+
+/*
+ * Define a GVL-free stub and argument struct for an ImageMagick function that
+ * returns a pointer (usually a new Image). The stub must not call Ruby.
+ */
+//! Define a GVL-free stub for a 2-argument function
+#define DEFINE_GVL_STUB2(name, type1, type2) \
+    typedef struct { type1 arg1; type2 arg2; } GVL_STRUCT_TYPE(name); \
+    static void *GVL_FUNC(name)(void *p) \
+    { \
+        GVL_STRUCT_TYPE(name) *args = (GVL_STRUCT_TYPE(name) *)p; \
+        return (void *)name(args->arg1, args->arg2); \
+    }
+//! Define a GVL-free stub for a 3-argument function
+#define DEFINE_GVL_STUB3(name, type1, type2, type3) \
+    typedef struct { type1 arg1; type2 arg2; type3 arg3; } GVL_STRUCT_TYPE(name); \
+    static void *GVL_FUNC(name)(void *p) \
+    { \
+        GVL_STRUCT_TYPE(name) *args = (GVL_STRUCT_TYPE(name) *)p; \
+        return (void *)name(args->arg1, args->arg2, args->arg3); \
+    }
+//! Define a GVL-free stub for a 4-argument function
+#define DEFINE_GVL_STUB4(name, type1, type2, type3, type4) \
+    typedef struct { type1 arg1; type2 arg2; type3 arg3; type4 arg4; } GVL_STRUCT_TYPE(name); \
+    static void *GVL_FUNC(name)(void *p) \
+    { \
+        GVL_STRUCT_TYPE(name) *args = (GVL_STRUCT_TYPE(name) *)p; \
+        return (void *)name(args->arg1, args->arg2, args->arg3, args->arg4); \
+    }
+//! Define a GVL-free stub for a 5-argument function
+#define DEFINE_GVL_STUB5(name, type1, type2, type3, type4, type5) \
+    typedef struct { type1 arg1; type2 arg2; type3 arg3; type4 arg4; type5 arg5; } GVL_STRUCT_TYPE(name); \
+    static void *GVL_FUNC(name)(void *p) \
+    { \
+        GVL_STRUCT_TYPE(name) *args = (GVL_STRUCT_TYPE(name) *)p; \
+        return (void *)name(args->arg1, args->arg2, args->arg3, args->arg4, args->arg5); \
+    }
+//! Define a GVL-free stub for a 6-argument function
+#define DEFINE_GVL_STUB6(name, type1, type2, type3, type4, type5, type6) \
+    typedef struct { type1 arg1; type2 arg2; type3 arg3; type4 arg4; type5 arg5; type6 arg6; } GVL_STRUCT_TYPE(name); \
+    static void *GVL_FUNC(name)(void *p) \
+    { \
+        GVL_STRUCT_TYPE(name) *args = (GVL_STRUCT_TYPE(name) *)p; \
+        return (void *)name(args->arg1, args->arg2, args->arg3, args->arg4, args->arg5, args->arg6); \
+    }
+//! Define a GVL-free stub for a 2-argument function whose result is ignored (e.g. WriteImage)
+#define DEFINE_GVL_VOID_STUB2(name, type1, type2) \
+    typedef struct { type1 arg1; type2 arg2; } GVL_STRUCT_TYPE(name); \
+    static void *GVL_FUNC(name)(void *p) \
+    { \
+        GVL_STRUCT_TYPE(name) *args = (GVL_STRUCT_TYPE(name) *)p; \
+        (void) name(args->arg1, args->arg2); \
+        return NULL; \
+    }
+
+//! A task that rm_parallel runs without the GVL. See rm_parallel.
+typedef void (rm_task_function_t)(void *, long);
+
+/*
+ * ImageMagick 6.8.6 renamed AcquireCacheView to AcquireVirtualCacheView and
+ * added an ExceptionInfo argument, and added AcquireAuthenticCacheView for
+ * views that write. Each thread that uses the pixel cache needs its own cache
+ * view.
+ */
+#if defined(HAVE_ACQUIREVIRTUALCACHEVIEW)
+#define RM_THREADED_CACHE_VIEWS 1
+#define rm_acquire_cache_view(image, exception) AcquireVirtualCacheView(image, exception)
+#define rm_acquire_authentic_cache_view(image, exception) AcquireAuthenticCacheView(image, exception)
+#elif defined(HAVE_ACQUIRECACHEVIEW)
+#define RM_THREADED_CACHE_VIEWS 1
+#define rm_acquire_cache_view(image, exception) AcquireCacheView(image)
+#define rm_acquire_authentic_cache_view(image, exception) AcquireCacheView(image)
+#endif
+
 //! Convert a C string to a Ruby symbol. Used in marshal_dump/marshal_load methods
 #define CSTR2SYM(s) ID2SYM(rb_intern(s))
 //! Convert a C string to a Ruby String, or nil if the ptr is NULL
@@ -204,6 +335,20 @@ typedef struct
     MontageInfo *info; /**< montage info */
 } Montage;
 
+//! Image::View class. A copy-on-write cache of the rows in a region of an image.
+typedef struct
+{
+    VALUE image;                /**< the image */
+    long x;                     /**< x position of the region */
+    long y;                     /**< y position of the region */
+    unsigned long width;        /**< width of the region */
+    unsigned long height;       /**< height of the region */
+    VALUE rows;                 /**< Array of cached rows of Pixels, nil if not cached */
+    PixelPacket **originals;    /**< the original pixels of each cached row */
+    char *dirty;                /**< true for each row assigned to by Rows#[]= */
+    int force;                  /**< true if View#dirty= was set to true */
+} View;
+
 // Draw
 //! tmp filename linked list
 struct TmpFile_Name
@@ -259,7 +404,7 @@ typedef enum {
 typedef struct
 {
     unsigned char id;   /**< Dumped image id = 0xd1 */
-    unsigned char mj;   /**< Major format number = 1 */
+    unsigned char mj;   /**< Major format number = 1 or 2 */
     unsigned char mi;   /**< Minor format number = 0 */
     unsigned char len;  /**< Length of image magick string */
     char magick[MaxTextExtent]; /**< magick string */
@@ -268,6 +413,42 @@ typedef struct
 #define DUMPED_IMAGE_ID      0xd1 /**< ID of Dumped image id */
 #define DUMPED_IMAGE_MAJOR_VERS 1 /**< Dumped image major version */
 #define DUMPED_IMAGE_MINOR_VERS 0 /**< Dumped image minor version */
+#define DUMPED_IMAGE_V2_MAJOR_VERS 2 /**< Major version of dumps that hold MIFF pixels and artifacts */
+#define DUMPED_IMAGE_V2_MINOR_VERS 0 /**< Minor version of dumps that hold MIFF pixels and artifacts */
+
+//! An operation in an Image#pipeline or ImageList#parallel_map chain
+typedef enum
+{
+    BlurFrameOp,
+    CropFrameOp,
+    FlipFrameOp,
+    FlopFrameOp,
+    ModulateFrameOp,
+    QuantizeFrameOp,
+    ResizeFrameOp,
+    RotateFrameOp,
+    SampleFrameOp,
+    ScaleFrameOp,
+    SharpenFrameOp,
+    ThumbnailFrameOp
+} FrameOpType;
+
+//! An operation with its arguments converted to C
+typedef struct
+{
+    FrameOpType type;   /**< the operation */
+    int nargs;          /**< the number of arguments given */
+    double args[4];     /**< the arguments */
+} FrameOp;
+
+//! The image size limits set by Magick.with_limits
+typedef struct
+{
+    MagickSizeType width;       /**< the most columns */
+    MagickSizeType height;      /**< the most rows */
+    MagickSizeType area;        /**< the most pixels */
+    MagickSizeType list_length; /**< the most frames */
+} ImageLimits;
 
 #define MAGICK_LOC "magick_location"     /**< instance variable name in ImageMagickError class */
 
@@ -362,6 +543,7 @@ EXTERN VALUE Class_Image;
 EXTERN VALUE Class_Montage;
 EXTERN VALUE Class_ImageMagickError;
 EXTERN VALUE Class_FatalImageMagickError;
+EXTERN VALUE Class_MemoryLimitError;
 EXTERN VALUE Class_DestroyedImageError;
 EXTERN VALUE Class_GradientFill;
 EXTERN VALUE Class_TextureFill;
@@ -378,6 +560,10 @@ EXTERN VALUE Class_Primary;
 EXTERN VALUE Class_Rectangle;
 EXTERN VALUE Class_Segment;
 EXTERN VALUE Class_TypeMetric;
+EXTERN VALUE Class_View;
+EXTERN VALUE Class_ViewRows;
+EXTERN VALUE Class_ViewPixels;
+EXTERN VALUE Class_Stream;
 EXTERN VALUE Class_MetricType;
 EXTERN VALUE Class_QuantumExpressionOperator;
 
@@ -439,8 +625,11 @@ EXTERN ID rm_ID_has_key_q;         /**< "has_key?" */
 EXTERN ID rm_ID_height;            /**< "height" */
 EXTERN ID rm_ID_initialize_copy;   /**< "initialize_copy" */
 EXTERN ID rm_ID_length;            /**< "length" */
+EXTERN ID rm_ID_limits;            /**< "__rmagick_limits__" */
+EXTERN ID rm_ID_managed_limit_hits; /**< "__rmagick_managed_limit_hits__" */
 EXTERN ID rm_ID_notify_observers;  /**< "notify_observers" */
 EXTERN ID rm_ID_new;               /**< "new" */
+EXTERN ID rm_ID_pending_exception; /**< "__rmagick_pending_exception__" */
 EXTERN ID rm_ID_push;              /**< "push" */
 EXTERN ID rm_ID_spaceship;         /**< "<=>" */
 EXTERN ID rm_ID_to_i;              /**< "to_i" */
@@ -450,6 +639,11 @@ EXTERN ID rm_ID_width;             /**< "width" */
 EXTERN ID rm_ID_x;                 /**< "x" */
 EXTERN ID rm_ID_y;                 /**< "y" */
 
+/**
+*   Commonly-used flags
+*/
+EXTERN MagickBooleanType rm_managed_memory; /**< ImageMagick allocates through the counting allocator */
+
 #if !defined(min)
 #define min(a,b) ((a)<(b)?(a):(b)) /**< min of two values */
 #endif
@@ -504,7 +698,7 @@ EXTERN ID rm_ID_y;                 /**< "y" */
         if (rb_obj_is_kind_of(self, Class_Image) == Qtrue) {\
             (void) rm_check_destroyed(self); \
         }\
-        Data_Get_Struct(self, class, ptr);\
+        TypedData_Get_Struct(self, class, &rm_##class##_data_type, ptr);\
         return C_##type##_to_R_##type(ptr->attr);\
     }
 
@@ -514,7 +708,7 @@ EXTERN ID rm_ID_y;                 /**< "y" */
     {\
         class *ptr;\
         (void) rm_check_destroyed(self); \
-        Data_Get_Struct(self, class, ptr);\
+        TypedData_Get_Struct(self, class, &rm_##class##_data_type, ptr);\
         return C_##type##_to_R_##type(ptr->field);\
     }
 
@@ -527,7 +721,7 @@ EXTERN ID rm_ID_y;                 /**< "y" */
             (void) rm_check_destroyed(self); \
         }\
         rb_check_frozen(self);\
-        Data_Get_Struct(self, class, ptr);\
+        TypedData_Get_Struct(self, class, &rm_##class##_data_type, ptr);\
         ptr->attr = R_##type##_to_C_##type(val);\
         return self;\
     }
@@ -584,7 +778,7 @@ Pixel_##_channel_##_eq(VALUE self, VALUE v) \
     Pixel *pixel; \
  \
     rb_check_frozen(self); \
-    Data_Get_Struct(self, Pixel, pixel); \
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel); \
     pixel->_channel_ = APP2QUANTUM(v); \
     (void) rb_funcall(self, rm_ID_changed, 0); \
     (void) rb_funcall(self, rm_ID_notify_observers, 1, self); \
@@ -603,7 +797,7 @@ Pixel_##_cmyk_channel_##_eq(VALUE self, VALUE v) \
     Pixel *pixel; \
  \
     rb_check_frozen(self); \
-    Data_Get_Struct(self, Pixel, pixel); \
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel); \
     pixel->_rgb_channel_ = APP2QUANTUM(v); \
     (void) rb_funcall(self, rm_ID_changed, 0); \
     (void) rb_funcall(self, rm_ID_notify_observers, 1, self); \
@@ -615,7 +809,7 @@ Pixel_##_cmyk_channel_(VALUE self) \
 { \
     Pixel *pixel; \
  \
-    Data_Get_Struct(self, Pixel, pixel); \
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel); \
     return INT2NUM(pixel->_rgb_channel_); \
 }
 
@@ -670,6 +864,10 @@ Pixel_##_cmyk_channel_(VALUE self) \
 
 // rmmain.c
 extern void Init_RMagick2(void);
+extern void rm_managed_memory_usage(size_t *, size_t *, size_t *);
+extern MagickBooleanType rm_set_managed_memory_high_water(size_t);
+extern MagickBooleanType rm_managed_memory_limit_hit(void);
+extern void rm_sync_managed_memory(void);
 
 
 // rmagick.c
@@ -677,10 +875,29 @@ extern VALUE Magick_colors(VALUE);
 extern VALUE Magick_fonts(VALUE);
 extern VALUE Magick_init_formats(VALUE);
 extern VALUE Magick_limit_resource(int, VALUE *, VALUE);
+extern VALUE Magick_marshal_compression(VALUE);
+extern VALUE Magick_marshal_compression_eq(VALUE, VALUE);
+extern CompressionType rm_marshal_compression(void);
+extern VALUE Magick_memory_high_water(VALUE);
+extern VALUE Magick_memory_high_water_eq(VALUE, VALUE);
+extern VALUE Magick_memory_stats(VALUE);
+extern VALUE Magick_with_limits(VALUE, VALUE);
+extern MagickBooleanType rm_get_limits(ImageLimits *);
+extern void  rm_set_info_limits(Info *, const ImageLimits *);
+extern MagickBooleanType rm_ping_within_limits(const Info *, const void *, size_t, ExceptionInfo *);
+extern Image *rm_limit_images(const Info *, Image *, ExceptionInfo *);
+extern void  rm_check_size_limits(unsigned long, unsigned long);
+extern void  rm_count_image_created(Image *);
+extern void  rm_count_image_destroyed(Image *);
 extern VALUE Magick_set_cache_threshold(VALUE, VALUE);
 extern VALUE Magick_set_log_event_mask(int, VALUE *, VALUE);
 extern VALUE Magick_set_log_format(VALUE, VALUE);
 
+
+// rmbatch.c
+extern VALUE Magick_thumbnail_batch(int, VALUE *, VALUE);
+
+
 // rmdraw.c
 ATTR_WRITER(Draw, affine)
 ATTR_WRITER(Draw, align)
@@ -770,6 +987,7 @@ extern VALUE ImageList_montage(VALUE);
 extern VALUE ImageList_morph(VALUE, VALUE);
 extern VALUE ImageList_mosaic(VALUE);
 extern VALUE ImageList_optimize_layers(VALUE, VALUE);
+extern VALUE ImageList_parallel_map(int, VALUE *, VALUE);
 extern VALUE ImageList_quantize(int, VALUE*, VALUE);
 extern VALUE ImageList_remap(int, VALUE *, VALUE);
 extern VALUE ImageList_to_blob(VALUE);
@@ -788,6 +1006,7 @@ ATTR_ACCESSOR(Info, caption)
 ATTR_ACCESSOR(Info, colorspace)
 ATTR_ACCESSOR(Info, comment)
 ATTR_ACCESSOR(Info, compression)
+ATTR_ACCESSOR(Info, decode_size)
 ATTR_ACCESSOR(Info, delay)
 ATTR_ACCESSOR(Info, density)
 ATTR_ACCESSOR(Info, depth)
@@ -842,6 +1061,7 @@ extern VALUE Info_initialize(VALUE);
 extern VALUE rm_info_new(void);
 extern DisposeType rm_dispose_to_enum(const char *);
 extern GravityType rm_gravity_to_enum(const char *);
+extern void rm_select_decode_size(Info *, const void *, size_t);
 
 // rmimage.c
 ATTR_WRITER(Image, alpha)
@@ -961,6 +1181,7 @@ extern VALUE Image_clut_channel(int, VALUE *, VALUE);
 extern VALUE Image_color_flood_fill(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
 extern VALUE Image_color_histogram(VALUE);
 extern VALUE Image_colorize(int, VALUE *, VALUE);
+extern VALUE Image_colorize_bang(int, VALUE *, VALUE);
 extern VALUE Image_colormap(int, VALUE *, VALUE);
 extern VALUE Image_combine(int, VALUE *, VALUE);
 extern VALUE Image_composite(int, VALUE *, VALUE);
@@ -996,8 +1217,10 @@ extern VALUE Image_display(VALUE);
 extern VALUE Image_dissolve(int, VALUE *, VALUE);
 extern VALUE Image_distort(int, VALUE *, VALUE);
 extern VALUE Image_distortion_channel(int, VALUE *, VALUE);
+extern VALUE Image_dominant_colors(int, VALUE *, VALUE);
 extern VALUE Image__dump(VALUE, VALUE);
 extern VALUE Image_dup(VALUE);
+extern VALUE Image_each_pixel(VALUE);
 extern VALUE Image_each_profile(VALUE);
 extern VALUE Image_edge(int, VALUE *, VALUE);
 extern VALUE Image_emboss(int, VALUE *, VALUE);
@@ -1017,20 +1240,24 @@ extern VALUE Image_flip_bang(VALUE);
 extern VALUE Image_flop(VALUE);
 extern VALUE Image_flop_bang(VALUE);
 extern VALUE Image_frame(int, VALUE *, VALUE);
-extern VALUE Image_from_blob(VALUE, VALUE);
+extern VALUE Image_from_blob(int, VALUE *, VALUE);
 extern VALUE Image_function_channel(int, VALUE *, VALUE);
 extern VALUE Image_gamma_channel(int, VALUE *, VALUE);
 extern VALUE Image_gamma_correct(int, VALUE *, VALUE);
+extern VALUE Image_gamma_correct_bang(int, VALUE *, VALUE);
 extern VALUE Image_gaussian_blur(int, VALUE *, VALUE);
 extern VALUE Image_gaussian_blur_channel(int, VALUE *, VALUE);
 extern VALUE Image_get_pixels(VALUE, VALUE, VALUE, VALUE, VALUE);
+extern VALUE Image_get_pixels_packed(int, VALUE *, VALUE);
 extern VALUE Image_gray_q(VALUE);
+extern VALUE Image_histogram(int, VALUE *, VALUE);
 extern VALUE Image_histogram_q(VALUE);
 extern VALUE Image_implode(int, VALUE *, VALUE);
 extern VALUE Image_import_pixels(int, VALUE *, VALUE);
 extern VALUE Image_init_copy(VALUE, VALUE);
 extern VALUE Image_inspect(VALUE);
 extern VALUE Image_level2(int, VALUE *, VALUE);
+extern VALUE Image_level2_bang(int, VALUE *, VALUE);
 extern VALUE Image_level_channel(int, VALUE *, VALUE);
 extern VALUE Image_level_colors(int, VALUE *, VALUE);
 extern VALUE Image_levelize_channel(int, VALUE *, VALUE);
@@ -1040,6 +1267,7 @@ extern VALUE Image__load(VALUE, VALUE);
 extern VALUE Image_magnify(VALUE);
 extern VALUE Image_magnify_bang(VALUE);
 extern VALUE Image_map(int, VALUE *, VALUE);
+extern VALUE Image_map_pixels_bang(VALUE);
 extern VALUE Image_marshal_dump(VALUE);
 extern VALUE Image_marshal_load(VALUE, VALUE);
 extern VALUE Image_mask(int, VALUE *, VALUE);
@@ -1048,9 +1276,11 @@ extern VALUE Image_median_filter(int, VALUE *, VALUE);
 extern VALUE Image_minify(VALUE);
 extern VALUE Image_minify_bang(VALUE);
 extern VALUE Image_modulate(int, VALUE *, VALUE);
+extern VALUE Image_modulate_bang(int, VALUE *, VALUE);
 extern VALUE Image_monochrome_q(VALUE);
 extern VALUE Image_motion_blur(int, VALUE *, VALUE);
 extern VALUE Image_negate(int, VALUE *, VALUE);
+extern VALUE Image_negate_bang(int, VALUE *, VALUE);
 extern VALUE Image_negate_channel(int, VALUE *, VALUE);
 extern VALUE Image_normalize(VALUE);
 extern VALUE Image_normalize_channel(int, VALUE *, VALUE);
@@ -1061,6 +1291,8 @@ extern VALUE Image_opaque_q(VALUE);
 extern VALUE Image_ordered_dither(int, VALUE *, VALUE);
 extern VALUE Image_paint_transparent(int, VALUE *, VALUE);
 extern VALUE Image_palette_q(VALUE);
+extern VALUE Image_persist(VALUE, VALUE);
+extern VALUE Image_map_persisted(VALUE, VALUE);
 extern VALUE Image_ping(VALUE, VALUE);
 extern VALUE Image_pixel_color(int, VALUE *, VALUE);
 extern VALUE Image_polaroid(int, VALUE *, VALUE);
@@ -1074,8 +1306,8 @@ extern VALUE Image_radial_blur(VALUE, VALUE);
 extern VALUE Image_radial_blur_channel(int, VALUE *, VALUE);
 extern VALUE Image_raise(int, VALUE *, VALUE);
 extern VALUE Image_random_threshold_channel(int, VALUE *, VALUE);
-extern VALUE Image_read(VALUE, VALUE);
-extern VALUE Image_read_inline(VALUE, VALUE);
+extern VALUE Image_read(int, VALUE *, VALUE);
+extern VALUE Image_read_inline(int, VALUE *, VALUE);
 extern VALUE Image_recolor(VALUE, VALUE);
 extern VALUE Image_reduce_noise(VALUE, VALUE);
 extern VALUE Image_remap(int, VALUE *, VALUE);
@@ -1083,6 +1315,7 @@ extern VALUE Image_resample(int, VALUE *, VALUE);
 extern VALUE Image_resample_bang(int, VALUE *, VALUE);
 extern VALUE Image_resize(int, VALUE *, VALUE);
 extern VALUE Image_resize_bang(int, VALUE *, VALUE);
+extern VALUE Image_resize_many(int, VALUE *, VALUE);
 extern VALUE Image_roll(VALUE, VALUE, VALUE);
 extern VALUE Image_rotate(int, VALUE *, VALUE);
 extern VALUE Image_rotate_bang(int, VALUE *, VALUE);
@@ -1113,11 +1346,13 @@ extern VALUE Image_spread(int, VALUE *, VALUE);
 extern VALUE Image_stegano(VALUE, VALUE, VALUE);
 extern VALUE Image_stereo(VALUE, VALUE);
 extern VALUE Image_store_pixels(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
+extern VALUE Image_store_pixels_packed(int, VALUE *, VALUE);
 extern VALUE Image_strip_bang(VALUE);
 extern VALUE Image_swirl(VALUE, VALUE);
 extern VALUE Image_sync_profiles(VALUE);
 extern VALUE Image_texture_flood_fill(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
 extern VALUE Image_threshold(VALUE, VALUE);
+extern VALUE Image_threshold_bang(VALUE, VALUE);
 extern VALUE Image_thumbnail(int, VALUE *, VALUE);
 extern VALUE Image_thumbnail_bang(int, VALUE *, VALUE);
 extern VALUE Image_tint(int, VALUE *, VALUE);
@@ -1143,7 +1378,16 @@ extern VALUE Image_white_threshold(int, VALUE *, VALUE);
 extern VALUE Image_write(VALUE, VALUE);
 
 extern VALUE rm_image_new(Image *);
+extern Image *rm_thumbnail_image(Image *, const char *, ExceptionInfo *);
+extern void  rm_effect_args(int, VALUE *, double *, double *);
+extern void  rm_resize_args(int, VALUE *, double *, unsigned long *, unsigned long *, FilterTypes *, double *);
+extern size_t rm_packed_type_size(StorageType);
+extern size_t rm_check_packed_map(Image *, const char *);
+extern void  rm_pack_pixels(const Image *, const PixelPacket *, const IndexPacket *, unsigned long, const char *, StorageType, void *);
 extern void  rm_image_destroy(void *);
+extern Image *rm_release_image(VALUE, Image *);
+extern size_t rm_image_memsize(const void *);
+extern void  rm_image_memory_usage(const Image *, int);
 extern void  rm_trace_creation(Image *);
 
 
@@ -1151,6 +1395,10 @@ extern void  rm_trace_creation(Image *);
 extern VALUE  GradientFill_alloc(VALUE);
 extern VALUE  GradientFill_initialize(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
 extern VALUE  GradientFill_fill(VALUE, VALUE);
+extern VALUE  GradientFill_radial(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
+extern VALUE  GradientFill_conic(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
+extern VALUE  GradientFill_stops(VALUE);
+extern VALUE  GradientFill_stops_eq(VALUE, VALUE);
 
 extern VALUE  TextureFill_alloc(VALUE);
 extern VALUE  TextureFill_initialize(VALUE, VALUE);
@@ -1213,6 +1461,7 @@ extern VALUE  Import_ColorInfo(const ColorInfo *);
 extern VALUE  ClassType_new(ClassType);
 extern VALUE  ColorspaceType_new(ColorspaceType);
 extern VALUE  CompositeOperator_new(CompositeOperator);
+extern const char *CompressionType_name(CompressionType);
 extern VALUE  CompressionType_new(CompressionType);
 extern VALUE  DisposeType_new(DisposeType);
 extern VALUE  EndianType_new(EndianType);
@@ -1253,6 +1502,57 @@ extern VALUE  VirtualPixelMethod_new(VirtualPixelMethod);
 extern VALUE  LAYERMETHODTYPE_NEW(LAYERMETHODTYPE);
 
 
+// rmmemview.c
+extern void   rm_check_pinned(Image *, Image *);
+extern void   rm_unshare_pinned(Image *, Image *, ExceptionInfo *);
+extern void   rm_forget_pinned(Image *);
+extern void   rm_define_memory_view(void);
+
+
+// rmview.c
+ATTR_READER(View, x)
+ATTR_READER(View, y)
+ATTR_READER(View, width)
+ATTR_READER(View, height)
+extern VALUE  View_alloc(VALUE);
+extern VALUE  View_initialize(VALUE, VALUE, VALUE, VALUE, VALUE, VALUE);
+extern VALUE  View_aref(int, VALUE *, VALUE);
+extern VALUE  View_dirty(VALUE);
+extern VALUE  View_dirty_eq(VALUE, VALUE);
+extern VALUE  View_sync(int, VALUE *, VALUE);
+extern VALUE  ViewRows_alloc(VALUE);
+extern VALUE  ViewRows_aref(int, VALUE *, VALUE);
+extern VALUE  ViewRows_aset(int, VALUE *, VALUE);
+ATTR_ACCESSOR(ViewPixels, red)
+ATTR_ACCESSOR(ViewPixels, green)
+ATTR_ACCESSOR(ViewPixels, blue)
+ATTR_ACCESSOR(ViewPixels, opacity)
+
+
+// rmpipeline.c
+extern void   rm_frame_op(VALUE, FrameOp *);
+extern Image *rm_apply_frame_ops(Image *, const FrameOp *, long, MagickBooleanType, ExceptionInfo *);
+extern VALUE  Image_run_pipeline(int, VALUE *, VALUE);
+
+
+// rmstream.c
+ATTR_READER(Stream, band_rows)
+ATTR_READER(Stream, columns)
+ATTR_READER(Stream, rows)
+extern VALUE  Stream_alloc(VALUE);
+extern VALUE  Stream_initialize(VALUE, VALUE);
+extern VALUE  Stream_open(VALUE, VALUE);
+extern VALUE  Stream_band_rows_eq(VALUE, VALUE);
+extern VALUE  Stream_level(int, VALUE *, VALUE);
+extern VALUE  Stream_gamma(VALUE, VALUE);
+extern VALUE  Stream_negate(VALUE);
+extern VALUE  Stream_quantum_operator(int, VALUE *, VALUE);
+extern VALUE  Stream_colorspace(VALUE, VALUE);
+extern VALUE  Stream_each_band(int, VALUE *, VALUE);
+extern VALUE  Stream_run(VALUE);
+extern VALUE  Stream_write(VALUE, VALUE);
+
+
 // rmutil.c
 extern VALUE  ImageMagickError_initialize(int, VALUE *, VALUE);
 extern void  *magick_malloc(const size_t);
@@ -1290,6 +1590,14 @@ void          rm_set_magick_pixel_packet(Pixel *, MagickPixelPacket *);
 extern void   rm_sync_image_options(Image *, Info *);
 extern void   rm_split(Image *);
 extern void   rm_magick_error(const char *, const char *);
+extern void  *rm_call_without_gvl(gvl_function_t *, void *);
+extern void   rm_check_interrupts(ExceptionInfo *, Image *);
+extern void   rm_parallel(rm_task_function_t *, void *, long, long);
+extern void  *rm_buffer_new(VALUE, size_t);
+extern ExceptionInfo **rm_exceptions_new(VALUE, long);
+extern Image *rm_keep_image(VALUE, Image *);
+extern Image **rm_images_new(VALUE, long);
+extern VALUE  rm_pin_string(VALUE, VALUE);
 
 //! whether to retain on errors
 typedef enum
@@ -1300,6 +1608,8 @@ typedef enum
 
 extern void   rm_check_image_exception(Image *, ErrorRetention);
 extern void   rm_check_exception(ExceptionInfo *, Image *, ErrorRetention);
+extern void   rm_check_exceptions(ExceptionInfo **, long, Image *, ErrorRetention);
+extern VALUE  rm_exception_new(ExceptionInfo *);
 extern void   rm_ensure_result(Image *);
 extern Image *rm_clone_image(Image *);
 extern MagickBooleanType rm_progress_monitor(const char *, const MagickOffsetType, const MagickSizeType, void *);
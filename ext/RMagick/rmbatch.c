@@ -0,0 +1,476 @@
+/**************************************************************************//**
+ * Batch thumbnailing for RMagick.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmbatch.c
+ * @version  $Id$
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+
+/*
+ * Magick.thumbnail_batch decodes, thumbnails and encodes a list of inputs with
+ * rm_parallel. Each input is a task that runs without the GVL. Everything a
+ * task needs is converted to C strings and buffers before the tasks start,
+ * and everything it makes is owned by Ruby objects, so nothing leaks if an
+ * exception is raised before the batch is done.
+ */
+
+//! A thumbnail output spec
+typedef struct
+{
+    const char *geometry;       /**< the thumbnail geometry */
+    const char *magick;         /**< the output format, or NULL for the input format */
+    unsigned long quality;      /**< the output quality, or 0 for the default */
+} BatchSpec;
+
+//! One input and its outputs
+typedef struct
+{
+    const char *filename;       /**< the input filename, or NULL for a blob */
+    const void *blob;           /**< the input blob */
+    size_t length;              /**< the length of the input blob */
+    const char **outputs;       /**< the output filename for each spec, or NULL for a blob */
+    void **blobs;               /**< the output blob for each spec */
+    size_t *lengths;            /**< the length of each output blob */
+    long done;                  /**< the number of specs completed */
+    ExceptionInfo *exception;   /**< the first error */
+} BatchItem;
+
+//! A batch
+typedef struct
+{
+    BatchSpec *specs;           /**< the output specs */
+    long nspecs;                /**< the number of specs */
+    BatchItem *items;           /**< the inputs */
+    long nitems;                /**< the number of inputs */
+    ImageLimits limits;         /**< the Magick.with_limits limits */
+    MagickBooleanType limited;  /**< whether the batch runs in a Magick.with_limits block */
+} Batch;
+
+//! The output blobs of a batch
+typedef struct
+{
+    long count;                 /**< the number of blobs */
+    void **blobs;               /**< the blobs */
+} BatchBlobs;
+
+
+/**
+ * Return a C string that stays valid (and in place) until the batch is done.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param keep Array that keeps the String alive
+ * @param str the String
+ * @return the C string
+ */
+static const char *
+batch_string(VALUE keep, VALUE str)
+{
+    str = rm_pin_string(keep, str);
+    return StringValueCStr(str);
+}
+
+
+/**
+ * Free the output blobs that batch_item_results hasn't freed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the BatchBlobs
+ */
+static void
+destroy_BatchBlobs(void *p)
+{
+    BatchBlobs *blobs = (BatchBlobs *)p;
+    long n;
+
+    for (n = 0; n < blobs->count; n++)
+    {
+        if (blobs->blobs[n])
+        {
+            magick_free(blobs->blobs[n]);
+        }
+    }
+    xfree(blobs->blobs);
+    xfree(blobs);
+}
+
+
+/**
+ * Allocate the array of output blobs for a batch.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The blobs are freed by the GC with their owner, so they don't leak if
+ *     an exception is raised before the results are made.
+ *
+ * @param keep Array that keeps the owner alive
+ * @param count the number of blobs
+ * @return the blobs
+ */
+static void **
+batch_blobs(VALUE keep, long count)
+{
+    BatchBlobs *blobs;
+
+    blobs = ALLOC(BatchBlobs);
+    blobs->count = 0;
+    blobs->blobs = NULL;
+    (void) rb_ary_push(keep, Data_Wrap_Struct(0, NULL, destroy_BatchBlobs, blobs));
+    blobs->blobs = ZALLOC_N(void *, max(1, count));
+    blobs->count = count;
+
+    return blobs->blobs;
+}
+
+
+/**
+ * Return the value of a Hash option, or nil.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param hash the Hash
+ * @param name the option name
+ * @return the value
+ */
+static VALUE
+batch_option(VALUE hash, const char *name)
+{
+    return rb_hash_aref(hash, ID2SYM(rb_intern(name)));
+}
+
+
+/**
+ * Read an input and make each of its thumbnails. Called from rm_parallel,
+ * without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Doesn't call Ruby.
+ *   - Only the first frame of a multi-frame input is read.
+ *   - Stops at the first error, which is left in item->exception.
+ *
+ * @param data the Batch
+ * @param n the index of the input
+ */
+static void
+batch_item_task(void *data, long n)
+{
+    Batch *batch = (Batch *)data;
+    BatchItem *item = &batch->items[n];
+    BatchSpec *spec;
+    Info *info;
+    Image *image, *thumbnail;
+    long s;
+
+    info = CloneImageInfo(NULL);
+    info->subimage = 0;
+    info->subrange = 1;
+    if (batch->limited)
+    {
+        rm_set_info_limits(info, &batch->limits);
+    }
+    if (item->filename)
+    {
+        strncpy(info->filename, item->filename, MaxTextExtent-1);
+        image = rm_ping_within_limits(info, NULL, 0, item->exception) ? ReadImage(info, item->exception) : NULL;
+    }
+    else
+    {
+        image = rm_ping_within_limits(info, item->blob, item->length, item->exception)
+                ? BlobToImage(info, item->blob, item->length, item->exception) : NULL;
+    }
+    image = rm_limit_images(info, image, item->exception);
+    (void) DestroyImageInfo(info);
+
+    if (!image)
+    {
+        return;
+    }
+    if (item->exception->severity >= ErrorException)
+    {
+        (void) DestroyImageList(image);
+        return;
+    }
+
+    for (s = 0; s < batch->nspecs; s++)
+    {
+        spec = &batch->specs[s];
+
+        thumbnail = rm_thumbnail_image(image, spec->geometry, item->exception);
+        if (!thumbnail)
+        {
+            break;
+        }
+
+        info = CloneImageInfo(NULL);
+        info->quality = spec->quality;
+        rm_sync_image_options(thumbnail, info);
+
+        if (item->outputs[s])
+        {
+            strncpy(thumbnail->filename, item->outputs[s], MaxTextExtent-1);
+            (void) WriteImage(info, thumbnail);
+            InheritException(item->exception, &thumbnail->exception);
+        }
+        else
+        {
+            if (spec->magick)
+            {
+                strncpy(thumbnail->magick, spec->magick, MaxTextExtent-1);
+            }
+            item->lengths[s] = 0;
+            item->blobs[s] = ImageToBlob(info, thumbnail, &item->lengths[s], item->exception);
+        }
+
+        (void) DestroyImageInfo(info);
+        (void) DestroyImage(thumbnail);
+
+        if (item->exception->severity >= ErrorException)
+        {
+            break;
+        }
+        item->done += 1;
+    }
+
+    (void) DestroyImageList(image);
+}
+
+
+/**
+ * Make the result for an input and free its blobs.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param batch the batch
+ * @param n the index of the input
+ * @param names Array of output filenames
+ * @return the result
+ */
+static VALUE
+batch_item_results(Batch *batch, long n, VALUE names)
+{
+    BatchItem *item = &batch->items[n];
+    VALUE result;
+    long s;
+
+    if (item->done == batch->nspecs)
+    {
+        // Issue any warnings
+        rm_check_exceptions(&item->exception, 1, NULL, RetainOnError);
+
+        result = rb_ary_new2(batch->nspecs);
+        for (s = 0; s < batch->nspecs; s++)
+        {
+            if (item->outputs[s])
+            {
+                (void) rb_ary_push(result, rb_ary_entry(names, n * batch->nspecs + s));
+            }
+            else
+            {
+                (void) rb_ary_push(result, rb_str_new(item->blobs[s], (long)item->lengths[s]));
+            }
+        }
+    }
+    else if (item->exception->severity >= ErrorException)
+    {
+        result = rm_exception_new(item->exception);
+    }
+    else
+    {
+        result = rb_funcall(Class_ImageMagickError, rm_ID_new, 1,
+                            rb_str_new2(MagickPackageName " library function failed to return a result."));
+    }
+
+    for (s = 0; s < batch->nspecs; s++)
+    {
+        if (item->blobs[s])
+        {
+            magick_free(item->blobs[s]);
+            item->blobs[s] = NULL;
+        }
+    }
+
+    RB_GC_GUARD(result);
+
+    return result;
+}
+
+
+/**
+ * Thumbnail a list of images on a pool of worker threads.
+ *
+ * Ruby usage:
+ *   - @verbatim Magick.thumbnail_batch(inputs, specs) @endverbatim
+ *   - @verbatim Magick.thumbnail_batch(inputs, specs, threads) @endverbatim
+ *
+ * Notes:
+ *   - Each input is a filename or a Hash with a :blob key.
+ *   - Each spec is a geometry string or a Hash with these keys:
+ *     - :geometry - required. Interpreted like Image#change_geometry.
+ *     - :format - the output format. Default is the input format.
+ *     - :quality - the output quality.
+ *     - :filename - write the thumbnail to this file instead of returning a
+ *       blob. A "%s" in the filename is replaced by the input's base name
+ *       (without its extension), or its index in inputs if it's a blob.
+ *   - Default threads is the ImageMagick thread resource limit.
+ *   - Only the first frame of each input is used.
+ *   - Returns one result per input, in order. A result is an Array with
+ *     the blob or filename of each spec, or the ImageMagickError for the
+ *     input if any of its specs failed. Errors don't stop the batch.
+ *   - The GVL is released while the workers decode, thumbnail and encode.
+ *     See rm_parallel.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param class Magick
+ * @return an Array of results
+ */
+VALUE
+Magick_thumbnail_batch(int argc, VALUE *argv, VALUE class)
+{
+    Batch batch;
+    BatchItem *item;
+    ExceptionInfo *exception;
+    ExceptionInfo **exceptions;
+    void **blobs;
+    VALUE inputs, specs, input, spec, value, name, base, keep, results, names;
+    const MagickInfo *magick_info;
+    long nthreads = 0, n, s;
+
+    switch (argc)
+    {
+        case 3:
+            nthreads = NUM2LONG(argv[2]);
+            if (nthreads < 1)
+            {
+                rb_raise(rb_eArgError, "threads must be >= 1 (%ld given)", nthreads);
+            }
+        case 2:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 2 or 3)", argc);
+            break;
+    }
+
+    inputs = rb_Array(argv[0]);
+    specs = rb_Array(argv[1]);
+    if (RARRAY_LEN(specs) == 0)
+    {
+        rb_raise(rb_eArgError, "no thumbnail specs");
+    }
+
+    keep = rb_ary_new();
+    memset(&batch, 0, sizeof(batch));
+    batch.nitems = RARRAY_LEN(inputs);
+    batch.nspecs = RARRAY_LEN(specs);
+    batch.limited = rm_get_limits(&batch.limits);
+    results = rb_ary_new2(batch.nitems);
+    names = rb_ary_new2(batch.nitems * batch.nspecs);
+
+    // Convert the specs
+    batch.specs = rm_buffer_new(keep, batch.nspecs * sizeof(BatchSpec));
+    exception = rm_exceptions_new(keep, 1)[0];
+    for (s = 0; s < batch.nspecs; s++)
+    {
+        spec = rb_ary_entry(specs, s);
+        if (TYPE(spec) != T_HASH)
+        {
+            spec = rb_hash_new();
+            (void) rb_hash_aset(spec, ID2SYM(rb_intern("geometry")), rb_ary_entry(specs, s));
+        }
+
+        value = batch_option(spec, "geometry");
+        if (NIL_P(value))
+        {
+            rb_raise(rb_eArgError, "thumbnail spec %ld has no geometry", s);
+        }
+        batch.specs[s].geometry = batch_string(keep, rm_to_s(value));
+        if (!IsGeometry(batch.specs[s].geometry))
+        {
+            rb_raise(rb_eArgError, "invalid geometry `%s'", batch.specs[s].geometry);
+        }
+
+        value = batch_option(spec, "format");
+        if (!NIL_P(value))
+        {
+            batch.specs[s].magick = batch_string(keep, value);
+            magick_info = GetMagickInfo(batch.specs[s].magick, exception);
+            rm_check_exceptions(&exception, 1, NULL, RetainOnError);
+            if (!magick_info || !magick_info->encoder)
+            {
+                rb_raise(rb_eArgError, "unknown format: %s", batch.specs[s].magick);
+            }
+        }
+
+        value = batch_option(spec, "quality");
+        if (!NIL_P(value))
+        {
+            batch.specs[s].quality = NUM2ULONG(value);
+        }
+    }
+
+    // Convert the inputs and resolve the output filenames
+    batch.items = rm_buffer_new(keep, batch.nitems * sizeof(BatchItem));
+    exceptions = rm_exceptions_new(keep, batch.nitems);
+    blobs = batch_blobs(keep, batch.nitems * batch.nspecs);
+    for (n = 0; n < batch.nitems; n++)
+    {
+        item = &batch.items[n];
+        input = rb_ary_entry(inputs, n);
+        if (TYPE(input) == T_HASH)
+        {
+            value = rm_pin_string(keep, batch_option(input, "blob"));
+            item->blob = RSTRING_PTR(value);
+            item->length = (size_t)RSTRING_LEN(value);
+            base = rb_funcall(LONG2NUM(n), rb_intern("to_s"), 0);
+        }
+        else
+        {
+            item->filename = batch_string(keep, input);
+            base = rb_funcall(rb_cFile, rb_intern("basename"), 2, input, rb_str_new2(".*"));
+        }
+
+        item->outputs = rm_buffer_new(keep, batch.nspecs * sizeof(char *));
+        item->blobs = &blobs[n * batch.nspecs];
+        item->lengths = rm_buffer_new(keep, batch.nspecs * sizeof(size_t));
+        item->exception = exceptions[n];
+
+        for (s = 0; s < batch.nspecs; s++)
+        {
+            spec = rb_ary_entry(specs, s);
+            value = TYPE(spec) == T_HASH ? batch_option(spec, "filename") : Qnil;
+            name = NIL_P(value) ? Qnil : rb_funcall(value, rb_intern("%"), 1, base);
+            rb_ary_store(names, n * batch.nspecs + s, name);
+            if (!NIL_P(name))
+            {
+                // Let a :format override the filename extension
+                value = batch.specs[s].magick ? rb_str_plus(rb_str_new2(batch.specs[s].magick), rb_str_new2(":")) : rb_str_new2("");
+                item->outputs[s] = batch_string(keep, rb_str_plus(value, name));
+            }
+        }
+    }
+
+    rm_parallel(batch_item_task, &batch, batch.nitems, nthreads);
+
+    for (n = 0; n < batch.nitems; n++)
+    {
+        rb_ary_store(results, n, batch_item_results(&batch, n, names));
+    }
+
+    RB_GC_GUARD(inputs);
+    RB_GC_GUARD(specs);
+    RB_GC_GUARD(keep);
+    RB_GC_GUARD(names);
+
+    class = class;  // defeat gcc message
+    return results;
+}
@@ -15,12 +15,19 @@
 
 static void mark_Draw(void *);
 static void destroy_Draw(void *);
+static size_t Draw_memsize(const void *);
 static VALUE new_DrawOptions(void);
 
 /** Method that gets type metrics */
 typedef MagickBooleanType (get_type_metrics_func_t)(Image *, const DrawInfo *, TypeMetric *);
 static VALUE get_type_metrics(int, VALUE *, VALUE, get_type_metrics_func_t);
 
+//! The data type of Magick::Draw, Magick::Image::DrawOptions and Magick::Image::PolaroidOptions
+const rb_data_type_t rm_Draw_data_type = {
+    "Magick::Draw",
+    { mark_Draw, destroy_Draw, Draw_memsize, },
+};
+
 
 /**
  * Set the affine matrix from an Magick::AffineMatrix.
@@ -38,7 +45,7 @@ Draw_affine_eq(VALUE self, VALUE matrix)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     Export_AffineMatrix(&draw->info->affine, matrix);
     return self;
 }
@@ -60,7 +67,7 @@ Draw_align_eq(VALUE self, VALUE align)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     VALUE_TO_ENUM(align, draw->info->align, AlignType);
     return self;
 }
@@ -82,7 +89,7 @@ Draw_decorate_eq(VALUE self, VALUE decorate)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     VALUE_TO_ENUM(decorate, draw->info->decorate, DecorationType);
     return self;
 }
@@ -104,7 +111,7 @@ Draw_density_eq(VALUE self, VALUE density)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     magick_clone_string(&draw->info->density, StringValuePtr(density));
 
     return self;
@@ -127,7 +134,7 @@ Draw_encoding_eq(VALUE self, VALUE encoding)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     magick_clone_string(&draw->info->encoding, StringValuePtr(encoding));
 
     return self;
@@ -150,7 +157,7 @@ Draw_fill_eq(VALUE self, VALUE fill)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     Color_to_PixelPacket(&draw->info->fill, fill);
     return self;
 }
@@ -175,7 +182,7 @@ Draw_fill_pattern_eq(VALUE self, VALUE pattern)
     Image *image;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     if (draw->info->fill_pattern != NULL)
     {
@@ -212,7 +219,7 @@ Draw_font_eq(VALUE self, VALUE font)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     magick_clone_string(&draw->info->font, StringValuePtr(font));
 
     return self;
@@ -235,7 +242,7 @@ Draw_font_family_eq(VALUE self, VALUE family)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     magick_clone_string(&draw->info->family, StringValuePtr(family));
 
     return self;
@@ -258,7 +265,7 @@ Draw_font_stretch_eq(VALUE self, VALUE stretch)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     VALUE_TO_ENUM(stretch, draw->info->stretch, StretchType);
     return self;
 }
@@ -280,7 +287,7 @@ Draw_font_style_eq(VALUE self, VALUE style)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     VALUE_TO_ENUM(style, draw->info->style, StyleType);
     return self;
 }
@@ -307,7 +314,7 @@ Draw_font_weight_eq(VALUE self, VALUE weight)
     WeightType w;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     if (FIXNUM_P(weight))
     {
@@ -379,7 +386,7 @@ Draw_gravity_eq(VALUE self, VALUE grav)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     VALUE_TO_ENUM(grav, draw->info->gravity, GravityType);
 
     return self;
@@ -406,7 +413,7 @@ Draw_kerning_eq(VALUE self, VALUE kerning)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->kerning = NUM2DBL(kerning);
     return self;
 #else
@@ -438,7 +445,7 @@ Draw_interline_spacing_eq(VALUE self, VALUE spacing)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->interline_spacing = NUM2DBL(spacing);
     return self;
 #else
@@ -470,7 +477,7 @@ Draw_interword_spacing_eq(VALUE self, VALUE spacing)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->interword_spacing = NUM2DBL(spacing);
     return self;
 #else
@@ -578,7 +585,7 @@ Draw_marshal_dump(VALUE self)
     Draw *draw;
     VALUE ddraw;
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     // Raise an exception if the Draw has a non-NULL gradient or element_reference field
     if (draw->info->element_reference.type != UndefinedReference
@@ -668,7 +675,7 @@ Draw_marshal_load(VALUE self, VALUE ddraw)
     Pixel *pixel;
     VALUE val;
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     draw->info = magick_malloc(sizeof(DrawInfo));
     if (!draw->info)
@@ -688,11 +695,11 @@ Draw_marshal_load(VALUE self, VALUE ddraw)
     draw->info->gravity = (GravityType) FIX2INT(rb_hash_aref(ddraw, CSTR2SYM("gravity")));
 
     val = rb_hash_aref(ddraw, CSTR2SYM("fill"));
-    Data_Get_Struct(val, Pixel, pixel);
+    TypedData_Get_Struct(val, Pixel, &rm_Pixel_data_type, pixel);
     draw->info->fill =  *pixel;
 
     val = rb_hash_aref(ddraw, CSTR2SYM("stroke"));
-    Data_Get_Struct(val, Pixel, pixel);
+    TypedData_Get_Struct(val, Pixel, &rm_Pixel_data_type, pixel);
     draw->info->stroke = *pixel;
 
     draw->info->stroke_width = NUM2DBL(rb_hash_aref(ddraw, CSTR2SYM("stroke_width")));
@@ -713,7 +720,7 @@ Draw_marshal_load(VALUE self, VALUE ddraw)
     draw->info->align = (AlignType) FIX2INT(rb_hash_aref(ddraw, CSTR2SYM("align")));
 
     val = rb_hash_aref(ddraw, CSTR2SYM("undercolor"));
-    Data_Get_Struct(val, Pixel, pixel);
+    TypedData_Get_Struct(val, Pixel, &rm_Pixel_data_type, pixel);
     draw->info->undercolor = *pixel;
 
     draw->info->clip_units = FIX2INT(rb_hash_aref(ddraw, CSTR2SYM("clip_units")));
@@ -749,7 +756,7 @@ Draw_pointsize_eq(VALUE self, VALUE pointsize)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->pointsize = NUM2DBL(pointsize);
     return self;
 }
@@ -778,7 +785,7 @@ Draw_rotation_eq(VALUE self, VALUE deg)
     AffineMatrix affine, current;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     degrees = NUM2DBL(deg);
     if (fabs(degrees) > DBL_EPSILON)
@@ -823,7 +830,7 @@ Draw_stroke_eq(VALUE self, VALUE stroke)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     Color_to_PixelPacket(&draw->info->stroke, stroke);
     return self;
 }
@@ -847,7 +854,7 @@ Draw_stroke_pattern_eq(VALUE self, VALUE pattern)
     Image *image;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     if (draw->info->stroke_pattern != NULL)
     {
@@ -885,7 +892,7 @@ Draw_stroke_width_eq(VALUE self, VALUE stroke_width)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->stroke_width = NUM2DBL(stroke_width);
     return self;
 }
@@ -907,7 +914,7 @@ Draw_text_antialias_eq(VALUE self, VALUE text_antialias)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->text_antialias = (MagickBooleanType) RTEST(text_antialias);
     return self;
 }
@@ -946,7 +953,7 @@ Draw_undercolor_eq(VALUE self, VALUE undercolor)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     Color_to_PixelPacket(&draw->info->undercolor, undercolor);
     return self;
 }
@@ -989,7 +996,7 @@ VALUE Draw_annotate(
 
     // Save the affine matrix in case it is modified by
     // Draw#rotation=
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     keep = draw->info->affine;
 
     image_arg = rm_cur_image(image_arg);
@@ -1324,10 +1331,10 @@ Draw_composite(int argc, VALUE *argv, VALUE self)
         }
     }
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     // Create a temp copy of the composite image
-    Data_Get_Struct(image, Image, comp_img);
+    TypedData_Get_Struct(image, Image, &rm_Image_data_type, comp_img);
     rm_write_temp_image(comp_img, name);
 
     // Add the temp filename to the filename array.
@@ -1370,7 +1377,7 @@ Draw_draw(VALUE self, VALUE image_arg)
     image_arg = rm_cur_image(image_arg);
     image = rm_check_frozen(image_arg);
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     if (draw->primitives == 0)
     {
         rb_raise(rb_eArgError, "nothing to draw");
@@ -1411,7 +1418,7 @@ Draw_dup(VALUE self)
 
     draw = ALLOC(Draw);
     memset(draw, 0, sizeof(Draw));
-    dup = Data_Wrap_Struct(CLASS_OF(self), mark_Draw, destroy_Draw, draw);
+    dup = TypedData_Wrap_Struct(CLASS_OF(self), &rm_Draw_data_type, draw);
     if (rb_obj_tainted(self))
     {
         (void)rb_obj_taint(dup);
@@ -1493,8 +1500,8 @@ VALUE Draw_init_copy(VALUE self, VALUE orig)
 {
     Draw *copy, *original;
 
-    Data_Get_Struct(orig, Draw, original);
-    Data_Get_Struct(self, Draw, copy);
+    TypedData_Get_Struct(orig, Draw, &rm_Draw_data_type, original);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, copy);
 
     copy->info = CloneDrawInfo(NULL, original->info);
     if (!copy->info)
@@ -1526,10 +1533,10 @@ Draw_initialize(VALUE self)
     Draw *draw, *draw_options;
     VALUE options;
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     options = new_DrawOptions();
-    Data_Get_Struct(options, Draw, draw_options);
+    TypedData_Get_Struct(options, Draw, &rm_Draw_data_type, draw_options);
     draw->info = draw_options->info;
     draw_options->info = NULL;
 
@@ -1554,7 +1561,7 @@ Draw_inspect(VALUE self)
 {
     Draw *draw;
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     return draw->primitives ? draw->primitives : rb_str_new2("(no primitives defined)");
 }
 
@@ -1577,7 +1584,7 @@ VALUE Draw_alloc(VALUE class)
 
     draw = ALLOC(Draw);
     memset(draw, 0, sizeof(Draw));
-    draw_obj = Data_Wrap_Struct(class, mark_Draw, destroy_Draw, draw);
+    draw_obj = TypedData_Wrap_Struct(class, &rm_Draw_data_type, draw);
 
     RB_GC_GUARD(draw_obj);
 
@@ -1601,7 +1608,7 @@ Draw_primitive(VALUE self, VALUE primitive)
     Draw *draw;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     if (draw->primitives == (VALUE)0)
     {
@@ -1668,6 +1675,34 @@ destroy_Draw(void *drawptr)
 }
 
 
+/**
+ * Return the number of bytes used by a Draw object, for
+ * ObjectSpace.memsize_of.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param drawptr pointer to a Draw object
+ * @return the size in bytes
+ */
+static size_t
+Draw_memsize(const void *drawptr)
+{
+    const Draw *draw = (const Draw *)drawptr;
+    size_t size = sizeof(Draw);
+
+    if (draw->info)
+    {
+        size += sizeof(DrawInfo);
+        if (draw->info->primitive)
+        {
+            size += strlen(draw->info->primitive);
+        }
+    }
+
+    return size;
+}
+
+
 /**
  * Allocate & initialize a DrawOptions object.
  *
@@ -1704,7 +1739,7 @@ DrawOptions_alloc(VALUE class)
 
     draw_options = ALLOC(Draw);
     memset(draw_options, 0, sizeof(Draw));
-    draw_options_obj = Data_Wrap_Struct(class, mark_Draw, destroy_Draw, draw_options);
+    draw_options_obj = TypedData_Wrap_Struct(class, &rm_Draw_data_type, draw_options);
 
     RB_GC_GUARD(draw_options_obj);
 
@@ -1726,7 +1761,7 @@ DrawOptions_initialize(VALUE self)
 {
     Draw *draw_options;
 
-    Data_Get_Struct(self, Draw, draw_options);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw_options);
     draw_options->info = magick_malloc(sizeof(DrawInfo));
     if (!draw_options->info)
     {
@@ -1774,7 +1809,7 @@ PolaroidOptions_alloc(VALUE class)
     draw->info=CloneDrawInfo(image_info,(DrawInfo *) NULL);
     (void)(void) DestroyImageInfo(image_info);
 
-    polaroid_obj = Data_Wrap_Struct(class, NULL, destroy_Draw, draw);
+    polaroid_obj = TypedData_Wrap_Struct(class, &rm_Draw_data_type, draw);
 
     RB_GC_GUARD(polaroid_obj);
 
@@ -1798,7 +1833,7 @@ PolaroidOptions_initialize(VALUE self)
     ExceptionInfo *exception;
 
     // Default shadow color
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
 
     exception = AcquireExceptionInfo();
     (void) QueryColorDatabase("gray75", &draw->shadow_color, exception);
@@ -1843,7 +1878,7 @@ PolaroidOptions_shadow_color_eq(VALUE self, VALUE shadow)
 {
     Draw *draw;
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     Color_to_PixelPacket(&draw->shadow_color, shadow);
     return self;
 }
@@ -1864,7 +1899,7 @@ PolaroidOptions_border_color_eq(VALUE self, VALUE border)
 {
     Draw *draw;
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     Color_to_PixelPacket(&draw->info->border_color, border);
     return self;
 }
@@ -1978,7 +2013,7 @@ get_type_metrics(
                 }
             }
 
-            Data_Get_Struct(get_dummy_tm_img(CLASS_OF(self)), Image, image);
+            TypedData_Get_Struct(get_dummy_tm_img(CLASS_OF(self)), Image, &rm_Image_data_type, image);
             break;
         case 2:
             t = rm_cur_image(argv[0]);
@@ -1995,7 +2030,7 @@ get_type_metrics(
         rb_raise(rb_eArgError, "no text to measure");
     }
 
-    Data_Get_Struct(self, Draw, draw);
+    TypedData_Get_Struct(self, Draw, &rm_Draw_data_type, draw);
     draw->info->text = InterpretImageProperties(NULL, image, text);
     if (!draw->info->text)
     {
@@ -570,7 +570,7 @@ CompositeOperator_new(CompositeOperator op)
  * @param ct the CompressionType
  * @return the name
  */
-static const char *
+const char *
 CompressionType_name(CompressionType ct)
 {
     switch (ct)
@@ -12,15 +12,35 @@
 
 #include "rmagick.h"
 
+/** The shape of a GradientFill */
+typedef enum
+{
+    LinearGradientFill,     /**< from a point or a line, see GradientFill#initialize */
+    RadialGradientFill,     /**< out from a center to a radius */
+    ConicGradientFill       /**< around a center */
+} GradientFillType;
+
+/** A color stop of a GradientFill */
+typedef struct
+{
+    double offset; /**< where the color is, from 0.0 to 1.0 */
+    PixelPacket color; /**< the color */
+} GradientStop;
+
 /** Data associated with a GradientFill */
 typedef struct
 {
-    double x1; /**< x position of first point */
-    double y1; /**< y position of first point */
+    GradientFillType type; /**< the shape of the gradient */
+    double x1; /**< x position of first point, or of the center */
+    double y1; /**< y position of first point, or of the center */
     double x2; /**< x position of second point */
     double y2; /**< y position of second point */
+    double radius; /**< the radius of a radial gradient */
+    double angle; /**< the start angle of a conic gradient, in degrees */
     PixelPacket start_color; /**< the start color */
     PixelPacket stop_color; /**< the stop color */
+    GradientStop *stops; /**< the color stops, or NULL for start_color to stop_color */
+    long nstops; /**< the number of color stops */
 } rm_GradientFill;
 
 /** Data associated with a TextureFill */
@@ -29,6 +49,45 @@ typedef struct
     Image *texture; /**< the texture */
 } rm_TextureFill;
 
+/** How a GradientRun measures the distance of a pixel */
+typedef enum
+{
+    PointDistance,          /**< from a point */
+    VerticalDistance,       /**< from a vertical line */
+    HorizontalDistance,     /**< from a horizontal line */
+    VDiagonalDistance,      /**< up or down from a diagonal line, in whole rows */
+    HDiagonalDistance,      /**< left or right of a diagonal line, in whole columns */
+    AngleDistance           /**< clockwise around a point, in degrees */
+} GradientDistance;
+
+/** A gradient being drawn, shared by the row band tasks */
+typedef struct
+{
+    Image *image;                   /**< the image */
+    GradientDistance distance;      /**< how to measure distance */
+    double x0;                      /**< x position of the point or vertical line */
+    double y0;                      /**< y position of the point or horizontal line */
+    double m;                       /**< the slope of the diagonal line */
+    double b;                       /**< the y intercept of the diagonal line */
+    double angle;                   /**< the angle where AngleDistance is 0 */
+    double steps;                   /**< the distance of the stop color */
+    int clamp;                      /**< whether pixels past steps get the stop color */
+    PixelPacket start_color;        /**< the start color */
+    MagickRealType red_step;        /**< the change in red per step */
+    MagickRealType green_step;      /**< the change in green per step */
+    MagickRealType blue_step;       /**< the change in blue per step */
+    const GradientStop *stops;      /**< the color stops, or NULL */
+    long nstops;                    /**< the number of color stops */
+    PixelPacket *master;            /**< the row every row is copied from, VerticalDistance only */
+    double *distances;              /**< a row of distances for each task */
+    long ntasks;                    /**< the number of row bands */
+    ExceptionInfo **exceptions;     /**< an exception for each task */
+} GradientRun;
+
+//! The least number of rows in a GradientFill row band
+#define GRADIENT_BAND_ROWS 64
+
+
 /**
  * Free Fill or Fill subclass object (except for TextureFill).
  *
@@ -41,6 +100,21 @@ static void free_Fill(void *fill)
     xfree(fill);
 }
 
+/**
+ * Free a GradientFill and its color stops.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param fill_obj the GradientFill
+ */
+static void free_GradientFill(void *fill_obj)
+{
+    rm_GradientFill *fill = (rm_GradientFill *)fill_obj;
+
+    xfree(fill->stops);
+    free_Fill(fill);
+}
+
 /**
  * Create new GradientFill object.
  *
@@ -54,7 +128,7 @@ GradientFill_alloc(VALUE class)
 {
     rm_GradientFill *fill;
 
-    return Data_Make_Struct(class, rm_GradientFill, NULL, free_Fill, fill);
+    return Data_Make_Struct(class, rm_GradientFill, NULL, free_GradientFill, fill);
 }
 
 
@@ -87,6 +161,7 @@ GradientFill_initialize(
 
     Data_Get_Struct(self, rm_GradientFill, fill);
 
+    fill->type = LinearGradientFill;
     fill->x1 = NUM2DBL(x1);
     fill->y1 = NUM2DBL(y1);
     fill->x2 = NUM2DBL(x2);
@@ -98,248 +173,588 @@ GradientFill_initialize(
 }
 
 /**
- * Do a gradient that radiates from a point.
+ * Create a gradient that radiates from a center out to a radius. Pixels past
+ * the radius are the stop color.
  *
- * No Ruby usage (internal function)
+ * Ruby usage:
+ *   - @verbatim GradientFill.radial(x, y, radius, start_color, stop_color) @endverbatim
  *
- * @param image the image on which to do the gradient
- * @param x0 x position of the point
- * @param y0 y position of the point
+ * @param class this class
+ * @param x x position of the center
+ * @param y y position of the center
+ * @param radius the radius
+ * @param start_color the color at the center
+ * @param stop_color the color at the radius
+ * @return a new GradientFill
+ */
+VALUE
+GradientFill_radial(
+                   VALUE class,
+                   VALUE x,
+                   VALUE y,
+                   VALUE radius,
+                   VALUE start_color,
+                   VALUE stop_color)
+{
+    rm_GradientFill *fill;
+    VALUE self;
+
+    self = rb_obj_alloc(class);
+    Data_Get_Struct(self, rm_GradientFill, fill);
+
+    fill->type = RadialGradientFill;
+    fill->x1 = NUM2DBL(x);
+    fill->y1 = NUM2DBL(y);
+    fill->radius = NUM2DBL(radius);
+    if (fill->radius <= 0.0)
+    {
+        rb_raise(rb_eArgError, "radius must be positive (%g given)", fill->radius);
+    }
+    Color_to_PixelPacket(&fill->start_color, start_color);
+    Color_to_PixelPacket(&fill->stop_color, stop_color);
+
+    return self;
+}
+
+/**
+ * Create a gradient that sweeps clockwise around a center, from the start
+ * color at the start angle to the stop color one turn later.
+ *
+ * Ruby usage:
+ *   - @verbatim GradientFill.conic(x, y, angle, start_color, stop_color) @endverbatim
+ *
+ * Notes:
+ *   - The angle is in degrees. 0 points to the right of the center, 90 down.
+ *
+ * @param class this class
+ * @param x x position of the center
+ * @param y y position of the center
+ * @param angle the start angle
  * @param start_color the start color
  * @param stop_color the stop color
+ * @return a new GradientFill
  */
-static void
-point_fill(
-          Image *image,
-          double x0,
-          double y0,
-          PixelPacket *start_color,
-          PixelPacket *stop_color)
+VALUE
+GradientFill_conic(
+                  VALUE class,
+                  VALUE x,
+                  VALUE y,
+                  VALUE angle,
+                  VALUE start_color,
+                  VALUE stop_color)
 {
-    double steps, distance;
-    unsigned long x, y;
-    MagickRealType red_step, green_step, blue_step;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo *exception;
+    rm_GradientFill *fill;
+    VALUE self;
 
-    exception = AcquireExceptionInfo();
-#endif
+    self = rb_obj_alloc(class);
+    Data_Get_Struct(self, rm_GradientFill, fill);
 
-    steps = sqrt((double)((image->columns-x0)*(image->columns-x0)
-                          + (image->rows-y0)*(image->rows-y0)));
+    fill->type = ConicGradientFill;
+    fill->x1 = NUM2DBL(x);
+    fill->y1 = NUM2DBL(y);
+    fill->angle = NUM2DBL(angle);
+    Color_to_PixelPacket(&fill->start_color, start_color);
+    Color_to_PixelPacket(&fill->stop_color, stop_color);
+
+    return self;
+}
+
+/**
+ * Return the color stops.
+ *
+ * Ruby usage:
+ *   - @verbatim GradientFill#stops @endverbatim
+ *
+ * @param self this object
+ * @return an array of [offset, pixel] pairs, empty if there are no stops
+ */
+VALUE
+GradientFill_stops(VALUE self)
+{
+    rm_GradientFill *fill;
+    VALUE stops;
+    long n;
 
-    red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+    Data_Get_Struct(self, rm_GradientFill, fill);
 
-    for (y = 0; y < image->rows; y++)
+    stops = rb_ary_new2(fill->nstops);
+    for (n = 0; n < fill->nstops; n++)
     {
-        PixelPacket *row_pixels;
+        (void) rb_ary_push(stops, rb_assoc_new(rb_float_new(fill->stops[n].offset)
+                                               , Pixel_from_PixelPacket(&fill->stops[n].color)));
+    }
 
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, exception);
-        CHECK_EXCEPTION()
-#else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        for (x = 0; x < image->columns; x++)
+    return stops;
+}
+
+/**
+ * Replace the start and stop colors with a list of color stops.
+ *
+ * Ruby usage:
+ *   - @verbatim GradientFill#stops = [[offset, color], ...] @endverbatim
+ *
+ * Notes:
+ *   - The offsets run from 0.0, the start of the gradient, to 1.0, the
+ *     distance where the stop color would be, and must not decrease.
+ *   - The colors can be names or Pixels, and their opacity is used.
+ *   - Before the first offset the gradient is the first color, and after the
+ *     last offset it is the last color.
+ *   - An empty array goes back to the start and stop colors.
+ *
+ * @param self this object
+ * @param stops_arg the color stops
+ * @return self
+ */
+VALUE
+GradientFill_stops_eq(VALUE self, VALUE stops_arg)
+{
+    rm_GradientFill *fill;
+    GradientStop *stops = NULL;
+    VALUE stop, keep;
+    long nstops, n;
+
+    Data_Get_Struct(self, rm_GradientFill, fill);
+
+    stops_arg = rb_Array(stops_arg);
+    nstops = RARRAY_LEN(stops_arg);
+    if (nstops == 1)
+    {
+        rb_raise(rb_eArgError, "a gradient needs at least 2 color stops");
+    }
+
+    keep = rb_ary_new();
+    if (nstops > 0)
+    {
+        // Build the stops in a GC-owned buffer, so nothing leaks if a color is invalid
+        stops = (GradientStop *) rm_buffer_new(keep, nstops * sizeof(GradientStop));
+        for (n = 0; n < nstops; n++)
         {
-            distance = sqrt((double)((x-x0)*(x-x0)+(y-y0)*(y-y0)));
-            row_pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-            row_pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-            row_pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-            row_pixels[x].opacity = OpaqueOpacity;
+            stop = rb_Array(rb_ary_entry(stops_arg, n));
+            if (RARRAY_LEN(stop) != 2)
+            {
+                rb_raise(rb_eArgError, "color stop must be [offset, color]");
+            }
+            stops[n].offset = NUM2DBL(rb_ary_entry(stop, 0));
+            if (stops[n].offset < 0.0 || stops[n].offset > 1.0)
+            {
+                rb_raise(rb_eArgError, "color stop offset out of range (%g given)", stops[n].offset);
+            }
+            if (n > 0 && stops[n].offset < stops[n-1].offset)
+            {
+                rb_raise(rb_eArgError, "color stop offsets must not decrease");
+            }
+            Color_to_PixelPacket(&stops[n].color, rb_ary_entry(stop, 1));
         }
+    }
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
+    xfree(fill->stops);
+    fill->stops = NULL;
+    fill->nstops = 0;
+    if (nstops > 0)
+    {
+        fill->stops = ALLOC_N(GradientStop, nstops);
+        memcpy(fill->stops, stops, nstops * sizeof(GradientStop));
+        fill->nstops = nstops;
     }
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(exception);
-#endif
+    RB_GC_GUARD(keep);
+
+    return self;
 }
 
+
 /**
- * Do a gradient fill that proceeds from a vertical line to the right and left
- * sides of the image.
+ * Set the change in color per step from the start to the stop color.
  *
  * No Ruby usage (internal function)
  *
- * @param image the image on which to do the gradient
- * @param x1 x position of the vertical line
+ * @param run the gradient, with steps set
  * @param start_color the start color
  * @param stop_color the stop color
  */
 static void
-vertical_fill(
-             Image *image,
-             double x1,
-             PixelPacket *start_color,
-             PixelPacket *stop_color)
+gradient_colors(GradientRun *run, const PixelPacket *start_color, const PixelPacket *stop_color)
 {
-    double steps;
-    unsigned long x, y;
-    PixelPacket *master;
-    MagickRealType red_step, green_step, blue_step;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo *exception;
-
-    exception = AcquireExceptionInfo();
-#endif
+    run->start_color = *start_color;
+    run->red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / run->steps;
+    run->green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / run->steps;
+    run->blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / run->steps;
+}
 
-    steps = FMAX(x1, ((long)image->columns)-x1);
+/**
+ * Measure the distance of each pixel in a row.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Each case is a plain loop over the row with no calls but sqrt and
+ *     atan2, so the compiler can vectorize it.
+ *
+ * @param run the gradient
+ * @param y the row
+ * @param distances the distances, one per column
+ */
+static void
+gradient_distances(const GradientRun *run, long y, double *distances)
+{
+    const unsigned long columns = run->image->columns;
+    const double x0 = run->x0, m = run->m, b = run->b;
+    double dy, dy2, a, degrees;
+    unsigned long x;
 
-    // If x is to the left of the x-axis, add that many steps so that
-    // the color at the right side will be that many steps away from
-    // the stop color.
-    if (x1 < 0)
+    switch (run->distance)
     {
-        steps -= x1;
+        case PointDistance:
+            dy = y - run->y0;
+            dy2 = dy * dy;
+            for (x = 0; x < columns; x++)
+            {
+                distances[x] = sqrt((x-x0)*(x-x0) + dy2);
+            }
+            break;
+        case VerticalDistance:
+            for (x = 0; x < columns; x++)
+            {
+                distances[x] = fabs(x0 - x);
+            }
+            break;
+        case HorizontalDistance:
+            dy = fabs(run->y0 - y);
+            for (x = 0; x < columns; x++)
+            {
+                distances[x] = dy;
+            }
+            break;
+        case VDiagonalDistance:
+            for (x = 0; x < columns; x++)
+            {
+                distances[x] = (double) abs((int)(y - (m * x + b)));
+            }
+            break;
+        case HDiagonalDistance:
+            dy = (y - b) / m;
+            for (x = 0; x < columns; x++)
+            {
+                distances[x] = (double) abs((int)(x - dy));
+            }
+            break;
+        case AngleDistance:
+            dy = y - run->y0;
+            degrees = 45.0 / atan(1.0);
+            for (x = 0; x < columns; x++)
+            {
+                a = fmod(atan2(dy, x - x0) * degrees - run->angle, 360.0);
+                distances[x] = a < 0.0 ? a + 360.0 : a;
+            }
+            break;
     }
+}
 
-    red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
-
-    // All the rows are the same. Make a "master row" and simply copy
-    // it to each actual row.
-    master = ALLOC_N(PixelPacket, image->columns);
+/**
+ * Color a row of pixels from their distances.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the gradient
+ * @param distances the distances
+ * @param pixels the pixels to set
+ * @param n the number of pixels
+ */
+static void
+gradient_shade(const GradientRun *run, const double *distances, PixelPacket *pixels, unsigned long n)
+{
+    const PixelPacket *start_color = &run->start_color;
+    const GradientStop *s0, *s1;
+    double distance, t, f;
+    unsigned long x;
+    long k;
 
-    for (x = 0; x < image->columns; x++)
+    if (!run->stops)
     {
-        double distance   = fabs(x1 - x);
-        master[x].red     = ROUND_TO_QUANTUM(start_color->red   + (red_step * distance));
-        master[x].green   = ROUND_TO_QUANTUM(start_color->green + (green_step * distance));
-        master[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (blue_step * distance));
-        master[x].opacity = OpaqueOpacity;
+        for (x = 0; x < n; x++)
+        {
+            distance = run->clamp ? FMIN(distances[x], run->steps) : distances[x];
+            pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * run->red_step));
+            pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * run->green_step));
+            pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * run->blue_step));
+            pixels[x].opacity = OpaqueOpacity;
+        }
+        return;
     }
 
-    // Now copy the master row to each actual row.
-    for (y = 0; y < image->rows; y++)
+    for (x = 0; x < n; x++)
     {
-        PixelPacket *row_pixels;
+        t = distances[x] / run->steps;
+
+        // Find the stops on either side of t
+        for (k = 1; k < run->nstops - 1 && t > run->stops[k].offset; k++)
+        {
+            ;
+        }
+        s0 = &run->stops[k-1];
+        s1 = &run->stops[k];
+        f = s1->offset > s0->offset ? (t - s0->offset) / (s1->offset - s0->offset) : 1.0;
+        f = FMAX(0.0, FMIN(f, 1.0));
+
+        pixels[x].red     = ROUND_TO_QUANTUM(s0->color.red     + f * ((MagickRealType)s1->color.red     - s0->color.red));
+        pixels[x].green   = ROUND_TO_QUANTUM(s0->color.green   + f * ((MagickRealType)s1->color.green   - s0->color.green));
+        pixels[x].blue    = ROUND_TO_QUANTUM(s0->color.blue    + f * ((MagickRealType)s1->color.blue    - s0->color.blue));
+        pixels[x].opacity = ROUND_TO_QUANTUM(s0->color.opacity + f * ((MagickRealType)s1->color.opacity - s0->color.opacity));
+    }
+}
+
+/**
+ * Draw one band of rows. Called from rm_parallel, without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param data the GradientRun
+ * @param task the band
+ */
+static void
+gradient_task(void *data, long task)
+{
+    GradientRun *run = (GradientRun *)data;
+    Image *image = run->image;
+    ExceptionInfo *exception = run->exceptions[task];
+    double *distances = run->distances + task * image->columns;
+    PixelPacket *pixels;
+    unsigned long x;
+    long y, y1;
+#if defined(RM_THREADED_CACHE_VIEWS)
+    CacheView *view;
+
+    view = rm_acquire_authentic_cache_view(image, exception);
+#endif
 
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, exception);
-        CHECK_EXCEPTION()
+    y = (long)(image->rows * task / run->ntasks);
+    y1 = (long)(image->rows * (task + 1) / run->ntasks);
+    for (; y < y1; y++)
+    {
+#if defined(RM_THREADED_CACHE_VIEWS)
+        pixels = QueueCacheViewAuthenticPixels(view, 0, y, image->columns, 1, exception);
+#elif defined(HAVE_QUEUEAUTHENTICPIXELS)
+        pixels = QueueAuthenticPixels(image, 0, y, image->columns, 1, exception);
 #else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
+        pixels = SetImagePixels(image, 0, y, image->columns, 1);
 #endif
+        if (!pixels)
+        {
+            break;
+        }
 
-        memcpy(row_pixels, master, image->columns * sizeof(PixelPacket));
+        switch (run->distance)
+        {
+            case VerticalDistance:
+                // All the rows are the same
+                memcpy(pixels, run->master, image->columns * sizeof(PixelPacket));
+                break;
+            case HorizontalDistance:
+                // All the pixels in a row are the same
+                gradient_distances(run, y, distances);
+                gradient_shade(run, distances, pixels, 1);
+                for (x = 1; x < image->columns; x++)
+                {
+                    pixels[x] = pixels[0];
+                }
+                break;
+            default:
+                gradient_distances(run, y, distances);
+                gradient_shade(run, distances, pixels, image->columns);
+                break;
+        }
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, exception);
-        CHECK_EXCEPTION()
+#if defined(RM_THREADED_CACHE_VIEWS)
+        if (!SyncCacheViewAuthenticPixels(view, exception))
+#elif defined(HAVE_SYNCAUTHENTICPIXELS)
+        if (!SyncAuthenticPixels(image, exception))
 #else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
+        if (!SyncImagePixels(image))
 #endif
+        {
+            break;
+        }
     }
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(exception);
+#if defined(RM_THREADED_CACHE_VIEWS)
+    view = DestroyCacheView(view);
 #endif
-
-    xfree((void *)master);
 }
 
 /**
- * Do a gradient fill that starts from a horizontal line.
+ * Draw a gradient on every row of the image, in row bands spread over a pool
+ * of threads.
  *
  * No Ruby usage (internal function)
  *
- * @param image the image on which to do the gradient
- * @param y1 y position of the horizontal line
- * @param start_color the start color
- * @param stop_color the stop color
+ * Notes:
+ *   - The buffers, the ExceptionInfos and a reference to the image belong to
+ *     keep, so they're freed if an exception is raised, and the image can't
+ *     be destroyed while the bands run.
+ *   - Each band writes through its own cache view. Without cache views there
+ *     is only one band.
+ *   - Turns on the image's matte channel if any color stop isn't opaque.
+ *
+ * @param keep Array that owns the buffers
+ * @param run the gradient, with everything but the buffers set
  */
 static void
-horizontal_fill(
-               Image *image,
-               double y1,
-               PixelPacket *start_color,
-               PixelPacket *stop_color)
+gradient_run(VALUE keep, GradientRun *run)
 {
-    double steps;
-    unsigned long x, y;
-    PixelPacket *master;
-    MagickRealType red_step, green_step, blue_step;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo *exception;
-
-    exception = AcquireExceptionInfo();
+    Image *image;
+    GradientStop *stops;
+    long n;
+
+    image = run->image = rm_keep_image(keep, run->image);
+
+    run->ntasks = 1;
+#if defined(RM_THREADED_CACHE_VIEWS)
+    run->ntasks = (long) GetMagickResourceLimit(ThreadResource);
+    run->ntasks = max(1, min(run->ntasks, (long)(image->rows / GRADIENT_BAND_ROWS)));
 #endif
 
-    steps = FMAX(y1, ((long)image->rows)-y1);
+    run->distances = (double *) rm_buffer_new(keep, run->ntasks * image->columns * sizeof(double));
 
-    // If the line is below the y-axis, add that many steps so the color
-    // at the bottom of the image is that many steps away from the stop color
-    if (y1 < 0)
+    // Copy the stops, so GradientFill#stops= can't free them while the bands run
+    if (run->stops)
     {
-        steps -= y1;
+        stops = (GradientStop *) rm_buffer_new(keep, run->nstops * sizeof(GradientStop));
+        memcpy(stops, run->stops, run->nstops * sizeof(GradientStop));
+        run->stops = stops;
+
+        for (n = 0; n < run->nstops; n++)
+        {
+            if (stops[n].color.opacity != OpaqueOpacity)
+            {
+                image->matte = MagickTrue;
+                break;
+            }
+        }
     }
 
-    red_step   = ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step  = ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
+    if (run->distance == VerticalDistance)
+    {
+        run->master = (PixelPacket *) rm_buffer_new(keep, image->columns * sizeof(PixelPacket));
+        gradient_distances(run, 0, run->distances);
+        gradient_shade(run, run->distances, run->master, image->columns);
+    }
 
-    // All the columns are the same, so make a master column and copy it to
-    // each of the "real" columns.
-    master = ALLOC_N(PixelPacket, image->rows);
+    run->exceptions = rm_exceptions_new(keep, run->ntasks);
 
-    for (y = 0; y < image->rows; y++)
+    // Getting an authentic pixel makes the pixel cache private to this image
+    // before the bands write to it.
+#if defined(HAVE_GETAUTHENTICPIXELS)
+    if (GetAuthenticPixels(image, 0, 0, 1, 1, run->exceptions[0]))
     {
-        double distance   = fabs(y1 - y);
-        master[y].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-        master[y].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-        master[y].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-        master[y].opacity = OpaqueOpacity;
+        (void) SyncAuthenticPixels(image, run->exceptions[0]);
     }
+#endif
 
-    for (x = 0; x < image->columns; x++)
-    {
-        PixelPacket *col_pixels;
+    rm_parallel(gradient_task, run, run->ntasks, run->ntasks);
 
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        col_pixels = QueueAuthenticPixels(image, (long int)x, 0, 1, image->rows, exception);
-#else
-        col_pixels = SetImagePixels(image, (long int)x, 0, 1, image->rows);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        memcpy(col_pixels, master, image->rows * sizeof(PixelPacket));
+    rm_check_exceptions(run->exceptions, run->ntasks, NULL, RetainOnError);
+}
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
+/**
+ * Set up a gradient that radiates from a point.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the gradient
+ * @param x0 x position of the point
+ * @param y0 y position of the point
+ * @param start_color the start color
+ * @param stop_color the stop color
+ */
+static void
+point_fill(
+          GradientRun *run,
+          double x0,
+          double y0,
+          PixelPacket *start_color,
+          PixelPacket *stop_color)
+{
+    Image *image = run->image;
+
+    run->distance = PointDistance;
+    run->x0 = x0;
+    run->y0 = y0;
+    run->steps = sqrt((double)((image->columns-x0)*(image->columns-x0)
+                               + (image->rows-y0)*(image->rows-y0)));
+    gradient_colors(run, start_color, stop_color);
+}
+
+/**
+ * Set up a gradient fill that proceeds from a vertical line to the right and
+ * left sides of the image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the gradient
+ * @param x1 x position of the vertical line
+ * @param start_color the start color
+ * @param stop_color the stop color
+ */
+static void
+vertical_fill(
+             GradientRun *run,
+             double x1,
+             PixelPacket *start_color,
+             PixelPacket *stop_color)
+{
+    run->distance = VerticalDistance;
+    run->x0 = x1;
+    run->steps = FMAX(x1, ((long)run->image->columns)-x1);
+
+    // If x is to the left of the x-axis, add that many steps so that
+    // the color at the right side will be that many steps away from
+    // the stop color.
+    if (x1 < 0)
+    {
+        run->steps -= x1;
     }
 
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(exception);
-#endif
+    gradient_colors(run, start_color, stop_color);
+}
+
+/**
+ * Set up a gradient fill that starts from a horizontal line.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the gradient
+ * @param y1 y position of the horizontal line
+ * @param start_color the start color
+ * @param stop_color the stop color
+ */
+static void
+horizontal_fill(
+               GradientRun *run,
+               double y1,
+               PixelPacket *start_color,
+               PixelPacket *stop_color)
+{
+    run->distance = HorizontalDistance;
+    run->y0 = y1;
+    run->steps = FMAX(y1, ((long)run->image->rows)-y1);
+
+    // If the line is below the y-axis, add that many steps so the color
+    // at the bottom of the image is that many steps away from the stop color
+    if (y1 < 0)
+    {
+        run->steps -= y1;
+    }
 
-    xfree((PixelPacket *)master);
+    gradient_colors(run, start_color, stop_color);
 }
 
 /**
- * Do a gradient fill that starts from a diagonal line and ends at the top and
- * bottom of the image.
+ * Set up a gradient fill that starts from a diagonal line and ends at the top
+ * and bottom of the image.
  *
  * No Ruby usage (internal function)
  *
- * @param image the image on which to do the gradient
+ * @param run the gradient
  * @param x1 x position of the start of the diagonal line
  * @param y1 y position of the start of the diagonal line
  * @param x2 x position of the end of the diagonal line
@@ -349,7 +764,7 @@ horizontal_fill(
  */
 static void
 v_diagonal_fill(
-               Image *image,
+               GradientRun *run,
                double x1,
                double y1,
                double x2,
@@ -357,15 +772,9 @@ v_diagonal_fill(
                PixelPacket *start_color,
                PixelPacket *stop_color)
 {
-    unsigned long x, y;
-    MagickRealType red_step, green_step, blue_step;
+    Image *image = run->image;
     double m, b, steps = 0.0;
     double d1, d2;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo *exception;
-
-    exception = AcquireExceptionInfo();
-#endif
 
     // Compute the equation of the line: y=mx+b
     m = ((double)(y2 - y1))/((double)(x2 - x1));
@@ -399,52 +808,20 @@ v_diagonal_fill(
         steps = -steps;
     }
 
-    red_step =   ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step =  ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
-
-    for (y = 0; y < image->rows; y++)
-    {
-        PixelPacket *row_pixels;
-
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, exception);
-        CHECK_EXCEPTION()
-#else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        for (x = 0; x < image->columns; x++)
-        {
-            double distance = (double) abs((int)(y-(m * x + b)));
-            row_pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-            row_pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-            row_pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-            row_pixels[x].opacity = OpaqueOpacity;
-        }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-    }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(exception);
-#endif
-
+    run->distance = VDiagonalDistance;
+    run->m = m;
+    run->b = b;
+    run->steps = steps;
+    gradient_colors(run, start_color, stop_color);
 }
 
 /**
- * Do a gradient fill that starts from a diagonal line and ends at the sides of
- * the image.
+ * Set up a gradient fill that starts from a diagonal line and ends at the
+ * sides of the image.
  *
  * No Ruby usage (internal function)
  *
- * @param image the image on which to do the gradient
+ * @param run the gradient
  * @param x1 x position of the start of the diagonal line
  * @param y1 y position of the start of the diagonal line
  * @param x2 x position of the end of the diagonal line
@@ -454,7 +831,7 @@ v_diagonal_fill(
  */
 static void
 h_diagonal_fill(
-               Image *image,
+               GradientRun *run,
                double x1,
                double y1,
                double x2,
@@ -462,15 +839,9 @@ h_diagonal_fill(
                PixelPacket *start_color,
                PixelPacket *stop_color)
 {
-    unsigned long x, y;
+    Image *image = run->image;
     double m, b, steps = 0.0;
-    MagickRealType red_step, green_step, blue_step;
     double d1, d2;
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    ExceptionInfo *exception;
-
-    exception = AcquireExceptionInfo();
-#endif
 
     // Compute the equation of the line: y=mx+b
     m = ((double)(y2 - y1))/((double)(x2 - x1));
@@ -506,42 +877,11 @@ h_diagonal_fill(
         steps = -steps;
     }
 
-    red_step =   ((MagickRealType)stop_color->red   - (MagickRealType)start_color->red)   / steps;
-    green_step = ((MagickRealType)stop_color->green - (MagickRealType)start_color->green) / steps;
-    blue_step =  ((MagickRealType)stop_color->blue  - (MagickRealType)start_color->blue)  / steps;
-
-    for (y = 0; y < image->rows; y++)
-    {
-        PixelPacket *row_pixels;
-
-#if defined(HAVE_QUEUEAUTHENTICPIXELS)
-        row_pixels = QueueAuthenticPixels(image, 0, (long int)y, image->columns, 1, exception);
-        CHECK_EXCEPTION()
-#else
-        row_pixels = SetImagePixels(image, 0, (long int)y, image->columns, 1);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-        for (x = 0; x < image->columns; x++)
-        {
-            double distance = (double) abs((int)(x-((y-b)/m)));
-            row_pixels[x].red     = ROUND_TO_QUANTUM(start_color->red   + (distance * red_step));
-            row_pixels[x].green   = ROUND_TO_QUANTUM(start_color->green + (distance * green_step));
-            row_pixels[x].blue    = ROUND_TO_QUANTUM(start_color->blue  + (distance * blue_step));
-            row_pixels[x].opacity = OpaqueOpacity;
-        }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS)
-        SyncAuthenticPixels(image, exception);
-        CHECK_EXCEPTION()
-#else
-        SyncImagePixels(image);
-        rm_check_image_exception(image, RetainOnError);
-#endif
-    }
-
-#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_QUEUEAUTHENTICPIXELS)
-    DestroyExceptionInfo(exception);
-#endif
+    run->distance = HDiagonalDistance;
+    run->m = m;
+    run->b = b;
+    run->steps = steps;
+    gradient_colors(run, start_color, stop_color);
 }
 
 /**
@@ -551,6 +891,9 @@ h_diagonal_fill(
  * Ruby usage:
  *   - @verbatim GradientFill#fill(image) @endverbatim
  *
+ * Notes:
+ *   - The rows are drawn in bands on a pool of threads, without the GVL.
+ *
  * @param self this object
  * @param image_obj the image
  * @return self
@@ -559,12 +902,19 @@ VALUE
 GradientFill_fill(VALUE self, VALUE image_obj)
 {
     rm_GradientFill *fill;
-    Image *image;
+    GradientRun *run;
     PixelPacket start_color, stop_color;
     double x1, y1, x2, y2;          // points on the line
+    VALUE keep;
 
     Data_Get_Struct(self, rm_GradientFill, fill);
-    image = rm_check_destroyed(image_obj);
+
+    // Not on the stack, with the bands running on other threads
+    keep = rb_ary_new();
+    run = (GradientRun *) rm_buffer_new(keep, sizeof(GradientRun));
+    run->image = rm_check_destroyed(image_obj);
+    run->stops = fill->stops;
+    run->nstops = fill->nstops;
 
     x1 = fill->x1;
     y1 = fill->y1;
@@ -573,25 +923,44 @@ GradientFill_fill(VALUE self, VALUE image_obj)
     start_color = fill->start_color;
     stop_color  = fill->stop_color;
 
-    if (fabs(x2-x1) < 0.5)       // vertical?
+    if (fill->type == RadialGradientFill)
+    {
+        run->distance = PointDistance;
+        run->x0 = x1;
+        run->y0 = y1;
+        run->steps = fill->radius;
+        run->clamp = True;
+        gradient_colors(run, &start_color, &stop_color);
+    }
+    else if (fill->type == ConicGradientFill)
+    {
+        run->distance = AngleDistance;
+        run->x0 = x1;
+        run->y0 = y1;
+        run->angle = fill->angle;
+        run->steps = 360.0;
+        gradient_colors(run, &start_color, &stop_color);
+    }
+
+    else if (fabs(x2-x1) < 0.5)       // vertical?
     {
         // If the x1,y1 and x2,y2 points are essentially the same
         if (fabs(y2-y1) < 0.5)
         {
-            point_fill(image, x1, y1, &start_color, &stop_color);
+            point_fill(run, x1, y1, &start_color, &stop_color);
         }
 
         // A vertical line is a special case.
         else
         {
-            vertical_fill(image, x1, &start_color, &stop_color);
+            vertical_fill(run, x1, &start_color, &stop_color);
         }
     }
 
     // A horizontal line is a special case.
     else if (fabs(y2-y1) < 0.5)
     {
-        horizontal_fill(image, y1, &start_color, &stop_color);
+        horizontal_fill(run, y1, &start_color, &stop_color);
     }
 
     // This is the general case - a diagonal line. If the line is more horizontal
@@ -600,17 +969,21 @@ GradientFill_fill(VALUE self, VALUE image_obj)
     else
     {
         double m = ((double)(y2 - y1))/((double)(x2 - x1));
-        double diagonal = ((double)image->rows)/image->columns;
+        double diagonal = ((double)run->image->rows)/run->image->columns;
         if (fabs(m) <= diagonal)
         {
-            v_diagonal_fill(image, x1, y1, x2, y2, &start_color, &stop_color);
+            v_diagonal_fill(run, x1, y1, x2, y2, &start_color, &stop_color);
         }
         else
         {
-            h_diagonal_fill(image, x1, y1, x2, y2, &start_color, &stop_color);
+            h_diagonal_fill(run, x1, y1, x2, y2, &start_color, &stop_color);
         }
     }
 
+    gradient_run(keep, run);
+
+    RB_GC_GUARD(keep);
+
     return self;
 }
 
@@ -14,12 +14,16 @@
 
 static Image *clone_imagelist(Image *);
 static Image *images_from_imagelist(VALUE);
+static VALUE imagelist_frames(VALUE);
 static long imagelist_length(VALUE);
 static long check_imagelist_length(VALUE);
 static VALUE imagelist_scene_eq(VALUE, VALUE);
 static void imagelist_push(VALUE, VALUE);
 static VALUE ImageList_new(void);
 
+DEFINE_GVL_STUB4(ImagesToBlob, const Info *, Image *, size_t *, ExceptionInfo *)
+DEFINE_GVL_VOID_STUB2(WriteImage, const Info *, Image *)
+
 
 
 
@@ -69,7 +73,7 @@ ImageList_animate(int argc, VALUE *argv, VALUE self)
         }
     }
 
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
     (void) AnimateImages(info, images);
     rm_check_image_exception(images, RetainOnError);
     rm_split(images);
@@ -297,7 +301,7 @@ ImageList_display(VALUE self)
 
     // Create a new Info object to use with this call
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
     // Convert the images array to an images sequence.
     images = images_from_imagelist(self);
@@ -509,7 +513,7 @@ ImageList_montage(VALUE self)
         (void) rb_obj_instance_eval(0, NULL, montage_obj);
     }
 
-    Data_Get_Struct(montage_obj, Montage, montage);
+    TypedData_Get_Struct(montage_obj, Montage, &rm_Montage_data_type, montage);
 
     images = images_from_imagelist(self);
 
@@ -734,6 +738,170 @@ ImageList_optimize_layers(VALUE self, VALUE method)
 }
 
 
+/**
+ * The state shared by the parallel_map tasks. Task n works on frame n.
+ */
+typedef struct
+{
+    Image **frames;             /**< the source frames */
+    Image **results;            /**< the result frames */
+    ExceptionInfo **exceptions; /**< the exception for each frame */
+    FrameOp *ops;               /**< the operations */
+    long nops;                  /**< the number of operations */
+} FrameMap;
+
+
+/**
+ * Apply the operations of a parallel_map to one frame.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called without the GVL by rm_parallel. Doesn't call Ruby.
+ *   - The delay, dispose, iterations, ticks_per_second and page of the
+ *     source frame are copied to the result.
+ *
+ * @param data the FrameMap
+ * @param n the index of the frame
+ */
+static void
+frame_map_task(void *data, long n)
+{
+    FrameMap *map = (FrameMap *)data;
+    Image *source = map->frames[n], *image;
+
+    image = rm_apply_frame_ops(source, map->ops, map->nops, MagickFalse, map->exceptions[n]);
+    if (!image)
+    {
+        return;
+    }
+
+    image->delay = source->delay;
+    image->dispose = source->dispose;
+    image->iterations = source->iterations;
+    image->ticks_per_second = source->ticks_per_second;
+    image->page = source->page;
+    map->results[n] = image;
+}
+
+
+/**
+ * Apply a chain of operations to every frame, processing the frames on a
+ * pool of threads without the GVL.
+ *
+ * Ruby usage:
+ *   - @verbatim ImageList#parallel_map(ops) @endverbatim
+ *   - @verbatim ImageList#parallel_map(ops, threads) @endverbatim
+ *
+ * Notes:
+ *   - ops is an Array of operations applied in order. An operation is a
+ *     Symbol, or an Array of a Symbol and its arguments, which are the same
+ *     as the Image method's:
+ *     - [:resize, scale] or [:resize, columns, rows, filter, blur]
+ *     - [:sample, scale] or [:sample, columns, rows], also :scale and
+ *       :thumbnail
+ *     - [:crop, x, y, width, height]
+ *     - [:blur_image, radius, sigma] and [:sharpen, radius, sigma]
+ *     - [:modulate, brightness, saturation, hue]
+ *     - [:quantize, number_colors]
+ *     - [:rotate, degrees]
+ *     - :flip and :flop
+ *   - Default threads is the ImageMagick thread resource limit.
+ *   - The frames keep their order, delay, dispose, iterations,
+ *     ticks_per_second and page.
+ *   - Sets \@scene to 0.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new imagelist
+ */
+VALUE
+ImageList_parallel_map(int argc, VALUE *argv, VALUE self)
+{
+    VALUE ops, frames, keep;
+    FrameMap *map;
+    Image *new_images = NULL, *tail = NULL;
+    MagickBooleanType failed = MagickFalse;
+    long nthreads = 0, nframes, n;
+
+    switch (argc)
+    {
+        case 2:
+            nthreads = NUM2LONG(argv[1]);
+        case 1:
+            ops = rb_Array(argv[0]);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 or 2)", argc);
+            break;
+    }
+
+    nframes = check_imagelist_length(self);
+    frames = imagelist_frames(self);
+
+    // Everything the tasks use belongs to keep, so an exception can't leak it
+    keep = rb_ary_new();
+    map = (FrameMap *) rm_buffer_new(keep, sizeof(FrameMap));
+    map->nops = RARRAY_LEN(ops);
+    map->ops = (FrameOp *) rm_buffer_new(keep, map->nops * sizeof(FrameOp));
+    for (n = 0; n < map->nops; n++)
+    {
+        rm_frame_op(rb_ary_entry(ops, n), &map->ops[n]);
+    }
+
+    // Hold the frames, so they can't be destroyed while the tasks run
+    map->frames = (Image **) rm_buffer_new(keep, nframes * sizeof(Image *));
+    for (n = 0; n < nframes; n++)
+    {
+        map->frames[n] = rm_keep_image(keep, rm_check_destroyed(rb_ary_entry(frames, n)));
+    }
+
+    map->results = rm_images_new(keep, nframes);
+    map->exceptions = rm_exceptions_new(keep, nframes);
+
+    rm_parallel(frame_map_task, map, nframes, nthreads);
+
+    // Take the results in order
+    for (n = 0; n < nframes; n++)
+    {
+        if (map->exceptions[n]->severity >= ErrorException)
+        {
+            failed = MagickTrue;
+        }
+        if (map->results[n])
+        {
+            if (tail)
+            {
+                tail->next = map->results[n];
+                map->results[n]->previous = tail;
+            }
+            else
+            {
+                new_images = map->results[n];
+            }
+            tail = map->results[n];
+            map->results[n] = NULL;
+        }
+    }
+
+    if (!failed && GetImageListLength(new_images) != (size_t)nframes)
+    {
+        (void) ThrowMagickException(map->exceptions[0], GetMagickModule(), ResourceLimitError
+                             , "MemoryAllocationFailed", "`%s'", "parallel_map");
+    }
+    rm_check_exceptions(map->exceptions, nframes, new_images, DestroyOnError);
+
+    rm_ensure_result(new_images);
+
+    RB_GC_GUARD(ops);
+    RB_GC_GUARD(frames);
+    RB_GC_GUARD(keep);
+
+    return rm_imagelist_from_images(new_images);
+}
+
+
 /**
  * Create a new ImageList object with no images.
  *
@@ -766,7 +934,7 @@ ImageList_new(void)
 VALUE
 rm_imagelist_from_images(Image *images)
 {
-    VALUE new_imagelist;
+    VALUE new_imagelist, frames;
     Image *image;
 
     if (!images)
@@ -776,26 +944,63 @@ rm_imagelist_from_images(Image *images)
 
     new_imagelist = ImageList_new();
 
+    // Fill @images directly instead of calling ImageList#push once per frame.
+    frames = rb_ary_new2((long)GetImageListLength(images));
     while (images)
     {
         image = RemoveFirstImageFromList(&images);
-        imagelist_push(new_imagelist, rm_image_new(image));
+        rb_ary_push(frames, rm_image_new(image));
     }
 
+    (void) rb_iv_set(new_imagelist, "@images", frames);
     (void) rb_iv_set(new_imagelist, "@scene", INT2FIX(0));
 
     RB_GC_GUARD(new_imagelist);
+    RB_GC_GUARD(frames);
 
     return new_imagelist;
 }
 
 
+/**
+ * Return the frames of an imagelist.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - A list read with ImageList#read_lazy holds pinged frames. The frames
+ *     are decoded, see ImageList#decoded_images in rmagick_internal.rb.
+ *
+ * @param imagelist the imagelist
+ * @return an Array of images
+ */
+static VALUE
+imagelist_frames(VALUE imagelist)
+{
+    ID lazy = rb_intern("@lazy");
+
+    if (rb_ivar_defined(imagelist, lazy) && RTEST(rb_ivar_get(imagelist, lazy)))
+    {
+        return rb_funcall(imagelist, rb_intern("decoded_images"), 0);
+    }
+    return rb_iv_get(imagelist, "@images");
+}
+
+
 /**
  * Convert an array of Image *s to an ImageMagick scene sequence (i.e. a
  * doubly-linked list of Images).
  *
  * No Ruby usage (internal function)
  *
+ * Notes:
+ *   - The frames are linked in place; a frame is cloned only when it is
+ *     already part of a sequence, e.g. when it appears twice in \@images.
+ *   - The tail of the sequence is tracked so linking is linear in the number
+ *     of frames (AppendImageToList walks to the end of the list each time).
+ *   - The caller must unlink the frames with rm_split when it is done.
+ *   - The frames of a lazily read list are decoded first.
+ *
  * @param imagelist the imagelist
  * @return a pointer to the head of the scene sequence list
  * @see rm_imagelist_from_images
@@ -804,12 +1009,12 @@ static Image *
 images_from_imagelist(VALUE imagelist)
 {
     long x, len;
-    Image *head = NULL;
+    Image *head = NULL, *tail = NULL;
     VALUE images, t;
 
     len = check_imagelist_length(imagelist);
 
-    images = rb_iv_get(imagelist, "@images");
+    images = imagelist_frames(imagelist);
     for (x = 0; x < len; x++)
     {
         Image *image;
@@ -817,11 +1022,23 @@ images_from_imagelist(VALUE imagelist)
         t = rb_ary_entry(images, x);
         image = rm_check_destroyed(t);
         // avoid a loop in this linked imagelist, issue #202
-        if (head == image || GetPreviousImageInList(image) != NULL)
+        if (image == head || image == tail
+            || GetPreviousImageInList(image) != NULL
+            || GetNextImageInList(image) != NULL)
         {
             image = rm_clone_image(image);
         }
-        AppendImageToList(&head, image);
+
+        if (tail)
+        {
+            tail->next = image;
+            image->previous = tail;
+        }
+        else
+        {
+            head = image;
+        }
+        tail = image;
     }
 
     RB_GC_GUARD(images);
@@ -927,8 +1144,9 @@ clone_imagelist(Image *images)
     while (image)
     {
         clone = CloneImage(image, 0, 0, MagickTrue, exception);
-        rm_check_exception(exception, new_imagelist, DestroyOnError);
+        rm_unshare_pinned(image, clone, exception);
         AppendImageToList(&new_imagelist, clone);
+        rm_check_exception(exception, new_imagelist, DestroyOnError);
         image = GetNextImageInList(image);
     }
 
@@ -1044,7 +1262,8 @@ ImageList_quantize(int argc, VALUE *argv, VALUE self)
  * Notes:
  *   - Default remap_image is nil
  *   - Default dither_method is RiemersmaDitherMethod
- *   - Modifies images in-place.
+ *   - Modifies images in-place, so raises if a frame is frozen, e.g. a
+ *     decoded frame of a list read with ImageList#read_lazy.
  *
  * @param argc number of input arguments
  * @param argv array of input arguments
@@ -1057,6 +1276,8 @@ ImageList_remap(int argc, VALUE *argv, VALUE self)
 #if defined(HAVE_REMAPIMAGES) || defined(HAVE_AFFINITYIMAGES)
     Image *images, *remap_image = NULL;
     QuantizeInfo quantize_info;
+    VALUE frames;
+    long x;
 
 
     if (argc > 0 && argv[0] != Qnil)
@@ -1078,6 +1299,12 @@ ImageList_remap(int argc, VALUE *argv, VALUE self)
         rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 or 2)", argc);
     }
 
+    frames = imagelist_frames(self);
+    for (x = 0; x < RARRAY_LEN(frames); x++)
+    {
+        (void) rm_check_frozen(rb_ary_entry(frames, x));
+    }
+
     images = images_from_imagelist(self);
 
 #if defined(HAVE_REMAPIMAGE)
@@ -1088,6 +1315,8 @@ ImageList_remap(int argc, VALUE *argv, VALUE self)
     rm_check_image_exception(images, RetainOnError);
     rm_split(images);
 
+    RB_GC_GUARD(frames);
+
     return self;
 #else
     self = self;
@@ -1122,9 +1351,10 @@ ImageList_to_blob(VALUE self)
     void *blob = NULL;
     size_t length = 0;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(ImagesToBlob) args;
 
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
     // Convert the images array to an images sequence.
     images = images_from_imagelist(self);
@@ -1151,7 +1381,11 @@ ImageList_to_blob(VALUE self)
     // can happen is that there's only one image or the format
     // doesn't support multi-image files.
     info->adjoin = MagickTrue;
-    blob = ImagesToBlob(info, images, &length, exception);
+    args.arg1 = info;
+    args.arg2 = images;
+    args.arg3 = &length;
+    args.arg4 = exception;
+    blob = CALL_FUNC_WITHOUT_GVL(ImagesToBlob, &args);
     if (blob && exception->severity >= ErrorException)
     {
         magick_free((void*)blob);
@@ -1159,6 +1393,7 @@ ImageList_to_blob(VALUE self)
         length = 0;
     }
     rm_split(images);
+    rm_check_interrupts(exception, NULL);
     CHECK_EXCEPTION()
     (void) DestroyExceptionInfo(exception);
 
@@ -1200,9 +1435,10 @@ ImageList_write(VALUE self, VALUE file)
     VALUE info_obj;
     unsigned long scene;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(WriteImage) args;
 
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
 
     if (TYPE(file) == T_FILE)
@@ -1253,7 +1489,22 @@ ImageList_write(VALUE self, VALUE file)
     for (img = images; img; img = GetNextImageInList(img))
     {
         rm_sync_image_options(img, info);
-        (void) WriteImage(info, img);
+        args.arg1 = info;
+        args.arg2 = img;
+        // Keep the GVL when writing to a Ruby IO (see Image_write)
+        if (info->file)
+        {
+            (void) GVL_FUNC(WriteImage)(&args);
+        }
+        else
+        {
+            (void) CALL_FUNC_WITHOUT_GVL(WriteImage, &args);
+            if (!NIL_P(rb_thread_local_aref(rb_thread_current(), rm_ID_pending_exception)))
+            {
+                rm_split(images);
+                rm_check_interrupts(NULL, NULL);
+            }
+        }
         // images will be split before raising an exception
         rm_check_image_exception(images, RetainOnError);
         if (info->adjoin)
@@ -27,20 +27,255 @@ typedef Image *(scaler_t)(const Image *, const size_t, const size_t, ExceptionIn
 typedef MagickBooleanType (thresholder_t)(Image *, const char *);
 /** Method that transforms an image */
 typedef Image *(xformer_t)(const Image *, const RectangleInfo *, ExceptionInfo *);
+/** Method that effects the selected channels of an image */
+typedef Image *(channel_effector_t)(const Image *, const ChannelType, const double, const double, ExceptionInfo *);
+/** Method that blurs an image in one direction */
+typedef Image *(motion_blurrer_t)(const Image *, const double, const double, const double, ExceptionInfo *);
 
 static VALUE cropper(int, int, VALUE *, VALUE);
 static VALUE effect_image(VALUE, int, VALUE *, effector_t);
 static VALUE flipflop(int, VALUE, flipper_t);
-static VALUE rd_image(VALUE, VALUE, reader_t);
+static VALUE rd_image(VALUE, VALUE, reader_t, VALUE);
 static VALUE rotate(int, int, VALUE *, VALUE);
 static VALUE scale(int, int, VALUE *, VALUE, scaler_t);
 static VALUE threshold_image(int, VALUE *, VALUE, thresholder_t);
 static VALUE xform_image(int, VALUE, VALUE, VALUE, VALUE, VALUE, xformer_t);
+static Image *point_op_target(int, VALUE);
+static Image *composite_layer(VALUE, Image *, ChannelType, CompositeOperator, Image *, long, long, unsigned long, unsigned long);
+static VALUE point_op_result(int, VALUE, Image *);
 static VALUE array_from_images(Image *);
+static VALUE get_size_hint(int *, VALUE *);
+static VALUE file_arg_rescue(VALUE);
 static void call_trace_proc(Image *, const char *);
 
 static const char *BlackPointCompensationKey = "PROFILE:black-point-compensation";
 
+//! The least number of rows in the band composite_tiled places down the image
+#define TILED_BAND_ROWS 256
+
+//! How much bigger than an Image#resize_many output its source must be
+#define RESIZE_CASCADE_RATIO 2
+
+//! The Magick::Image data type. dsize reports the pixel cache to the GC.
+const rb_data_type_t rm_Image_data_type = {
+    "Magick::Image",
+    { NULL, rm_image_destroy, rm_image_memsize, },
+};
+
+
+/*
+ * GVL-free stubs for the ImageMagick functions called through function
+ * pointers. See rm_call_without_gvl.
+ */
+//! Arguments for a flipper_t or magnifier_t called without the GVL
+typedef struct
+{
+    flipper_t *fp; /**< the function to call */
+    const Image *image; /**< the image */
+    ExceptionInfo *exception; /**< the exception */
+} flipper_args_t;
+
+//! Call a flipper_t or magnifier_t without the GVL
+static void *flipper_gvl(void *p)
+{
+    flipper_args_t *args = (flipper_args_t *)p;
+    return (void *)(args->fp)(args->image, args->exception);
+}
+
+//! Arguments for an effector_t called without the GVL
+typedef struct
+{
+    effector_t *fp; /**< the function to call */
+    const Image *image; /**< the image */
+    double radius; /**< the radius */
+    double sigma; /**< the sigma */
+    ExceptionInfo *exception; /**< the exception */
+} effector_args_t;
+
+//! Call an effector_t without the GVL
+static void *effector_gvl(void *p)
+{
+    effector_args_t *args = (effector_args_t *)p;
+    return (void *)(args->fp)(args->image, args->radius, args->sigma, args->exception);
+}
+
+//! Arguments for a channel_effector_t called without the GVL
+typedef struct
+{
+    channel_effector_t *fp; /**< the function to call */
+    const Image *image; /**< the image */
+    ChannelType channels; /**< the channels */
+    double radius; /**< the radius */
+    double sigma; /**< the sigma */
+    ExceptionInfo *exception; /**< the exception */
+} channel_effector_args_t;
+
+//! Call a channel_effector_t without the GVL
+static void *channel_effector_gvl(void *p)
+{
+    channel_effector_args_t *args = (channel_effector_args_t *)p;
+    return (void *)(args->fp)(args->image, args->channels, args->radius, args->sigma, args->exception);
+}
+
+//! Arguments for a motion_blurrer_t called without the GVL
+typedef struct
+{
+    motion_blurrer_t *fp; /**< the function to call */
+    const Image *image; /**< the image */
+    double radius; /**< the radius */
+    double sigma; /**< the sigma */
+    double angle; /**< the angle */
+    ExceptionInfo *exception; /**< the exception */
+} motion_blurrer_args_t;
+
+//! Call a motion_blurrer_t without the GVL
+static void *motion_blurrer_gvl(void *p)
+{
+    motion_blurrer_args_t *args = (motion_blurrer_args_t *)p;
+    return (void *)(args->fp)(args->image, args->radius, args->sigma, args->angle, args->exception);
+}
+
+//! Arguments for a reader_t called without the GVL
+typedef struct
+{
+    reader_t *fp; /**< the function to call */
+    const Info *info; /**< the info */
+    ExceptionInfo *exception; /**< the exception */
+} reader_args_t;
+
+//! Call a reader_t without the GVL
+static void *reader_gvl(void *p)
+{
+    reader_args_t *args = (reader_args_t *)p;
+    return (void *)(args->fp)(args->info, args->exception);
+}
+
+//! Arguments for a scaler_t called without the GVL
+typedef struct
+{
+    scaler_t *fp; /**< the function to call */
+    const Image *image; /**< the image */
+    size_t columns; /**< the new number of columns */
+    size_t rows; /**< the new number of rows */
+    ExceptionInfo *exception; /**< the exception */
+} scaler_args_t;
+
+//! Call a scaler_t without the GVL
+static void *scaler_gvl(void *p)
+{
+    scaler_args_t *args = (scaler_args_t *)p;
+    return (void *)(args->fp)(args->image, args->columns, args->rows, args->exception);
+}
+
+//! Arguments for an xformer_t called without the GVL
+typedef struct
+{
+    xformer_t *fp; /**< the function to call */
+    const Image *image; /**< the image */
+    const RectangleInfo *rect; /**< the region */
+    ExceptionInfo *exception; /**< the exception */
+} xformer_args_t;
+
+//! Call an xformer_t without the GVL
+static void *xformer_gvl(void *p)
+{
+    xformer_args_t *args = (xformer_args_t *)p;
+    return (void *)(args->fp)(args->image, args->rect, args->exception);
+}
+
+//! Arguments for composite_layer_gvl
+typedef struct
+{
+    Image *image; /**< the destination image */
+    ChannelType channels; /**< the channels to composite */
+    CompositeOperator operator; /**< the composite operator */
+    const Image *layer; /**< the image composited at each position */
+    long x; /**< column of the first position */
+    long y; /**< row of the first position */
+    unsigned long x_step; /**< columns between positions, 0 for one column */
+    unsigned long y_step; /**< rows between positions, 0 for one row */
+} composite_layer_args_t;
+
+//! Composite a layer at each position of a grid without the GVL
+static void *composite_layer_gvl(void *p)
+{
+    composite_layer_args_t *args = (composite_layer_args_t *)p;
+    MagickBooleanType status;
+    long x, y;
+
+    y = args->y;
+    do
+    {
+        x = args->x;
+        do
+        {
+            status = CompositeImageChannel(args->image, args->channels, args->operator, args->layer, x, y);
+            x += (long)args->x_step;
+        } while (status && args->x_step && x < (long)args->image->columns);
+        y += (long)args->y_step;
+    } while (status && args->y_step && y < (long)args->image->rows);
+
+    return status ? (void *)args->image : NULL;
+}
+
+/**
+ * Read an image from a blob, at the Info's decode size.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Enforces the Magick.with_limits limits stored in the Info.
+ *
+ * @param info the info
+ * @param blob the blob
+ * @param length the length of the blob
+ * @param exception the exception info
+ * @return the images
+ * @see rm_select_decode_size
+ */
+static Image *
+decode_blob(Info *info, const void *blob, size_t length, ExceptionInfo *exception)
+{
+    rm_select_decode_size(info, blob, length);
+    if (!rm_ping_within_limits(info, blob, length, exception))
+    {
+        return NULL;
+    }
+    return rm_limit_images(info, BlobToImage(info, blob, length, exception), exception);
+}
+
+/**
+ * Read an image file, at the Info's decode size.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Enforces the Magick.with_limits limits stored in the Info.
+ *
+ * @param info the info
+ * @param exception the exception info
+ * @return the images
+ * @see rm_select_decode_size
+ */
+static Image *
+decode_image(const Info *info, ExceptionInfo *exception)
+{
+    rm_select_decode_size((Info *)info, NULL, 0);
+    if (!rm_ping_within_limits(info, NULL, 0, exception))
+    {
+        return NULL;
+    }
+    return rm_limit_images(info, ReadImage(info, exception), exception);
+}
+
+DEFINE_GVL_STUB4(decode_blob, Info *, const void *, size_t, ExceptionInfo *)
+DEFINE_GVL_STUB4(ImageToBlob, const Info *, Image *, size_t *, ExceptionInfo *)
+DEFINE_GVL_VOID_STUB2(WriteImage, const Info *, Image *)
+DEFINE_GVL_STUB3(RotateImage, const Image *, double, ExceptionInfo *)
+DEFINE_GVL_STUB6(DistortImage, const Image *, DistortImageMethod, size_t, const double *, MagickBooleanType, ExceptionInfo *)
+DEFINE_GVL_STUB6(ResampleImage, const Image *, double, double, FilterTypes, double, ExceptionInfo *)
+DEFINE_GVL_STUB6(ResizeImage, const Image *, size_t, size_t, FilterTypes, double, ExceptionInfo *)
+
 
 
 
@@ -56,13 +291,13 @@ static const char *BlackPointCompensationKey = "PROFILE:black-point-compensation
  * @return a new image
  */
 static VALUE
-adaptive_method(int argc, VALUE *argv, VALUE self
-                , Image *fp(const Image *, const double, const double, ExceptionInfo *))
+adaptive_method(int argc, VALUE *argv, VALUE self, effector_t fp)
 {
     Image *image, *new_image;
     double radius = 0.0;
     double sigma = 1.0;
     ExceptionInfo *exception;
+    effector_args_t args;
 
     image = rm_check_destroyed(self);
 
@@ -81,7 +316,14 @@ adaptive_method(int argc, VALUE *argv, VALUE self
 
     exception = AcquireExceptionInfo();
 
-    new_image = (fp)(image, radius, sigma, exception);
+    args.fp = fp;
+    args.image = ReferenceImage(image);
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(effector_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -105,14 +347,14 @@ adaptive_method(int argc, VALUE *argv, VALUE self
  * @return a new image
  */
 static VALUE
-adaptive_channel_method(int argc, VALUE *argv, VALUE self
-                        , Image *fp(const Image *, const ChannelType, const double, const double, ExceptionInfo *))
+adaptive_channel_method(int argc, VALUE *argv, VALUE self, channel_effector_t fp)
 {
     Image *image, *new_image;
     double radius = 0.0;
     double sigma = 1.0;
     ExceptionInfo *exception;
     ChannelType channels;
+    channel_effector_args_t args;
 
     image = rm_check_destroyed(self);
     channels = extract_channels(&argc, argv);
@@ -132,7 +374,15 @@ adaptive_channel_method(int argc, VALUE *argv, VALUE self
 
     exception = AcquireExceptionInfo();
 
-    new_image = (fp)(image, channels, radius, sigma, exception);
+    args.fp = fp;
+    args.image = ReferenceImage(image);
+    args.channels = channels;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(channel_effector_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -214,6 +464,7 @@ Image_adaptive_resize(int argc, VALUE *argv, VALUE self)
     unsigned long rows, columns;
     double scale_val, drows, dcols;
     ExceptionInfo *exception;
+    scaler_args_t args;
 
     image = rm_check_destroyed(self);
 
@@ -243,8 +494,16 @@ Image_adaptive_resize(int argc, VALUE *argv, VALUE self)
             break;
     }
 
+    rm_check_size_limits(columns, rows);
     exception = AcquireExceptionInfo();
-    new_image = AdaptiveResizeImage(image, columns, rows, exception);
+    args.fp = AdaptiveResizeImage;
+    args.image = ReferenceImage(image);
+    args.columns = columns;
+    args.rows = rows;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(scaler_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -844,15 +1103,21 @@ Image_aset(VALUE self, VALUE key_arg, VALUE attr_arg)
  * @return self if bang, otherwise a new image
  */
 static VALUE
-crisscross(int bang, VALUE self, Image *fp(const Image *, ExceptionInfo *))
+crisscross(int bang, VALUE self, flipper_t fp)
 {
     Image *image, *new_image;
     ExceptionInfo *exception;
+    flipper_args_t args;
 
-    Data_Get_Struct(self, Image, image);
+    image = rm_check_destroyed(self);
     exception = AcquireExceptionInfo();
 
-    new_image = (fp)(image, exception);
+    args.fp = fp;
+    args.image = ReferenceImage(image);
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(flipper_gvl, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -862,7 +1127,10 @@ crisscross(int bang, VALUE self, Image *fp(const Image *, ExceptionInfo *))
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
 
@@ -981,7 +1249,7 @@ auto_orient(int bang, VALUE self)
     VALUE new_image;
     VALUE degrees[1];
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     switch (image->orientation)
     {
@@ -1022,7 +1290,7 @@ auto_orient(int bang, VALUE self)
     }
 
 
-    Data_Get_Struct(new_image, Image, image);
+    TypedData_Get_Struct(new_image, Image, &rm_Image_data_type, image);
     image->orientation = TopLeftOrientation;
 
     RB_GC_GUARD(new_image);
@@ -1790,6 +2058,7 @@ Image_blur_channel(int argc, VALUE *argv, VALUE self)
 {
     Image *image, *new_image;
     ExceptionInfo *exception;
+    channel_effector_args_t args;
     ChannelType channels;
     double radius = 0.0, sigma = 1.0;
 
@@ -1811,7 +2080,15 @@ Image_blur_channel(int argc, VALUE *argv, VALUE self)
     }
 
     exception = AcquireExceptionInfo();
-    new_image = BlurImageChannel(image, channels, radius, sigma, exception);
+    args.fp = BlurImageChannel;
+    args.image = ReferenceImage(image);
+    args.channels = channels;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(channel_effector_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -1870,7 +2147,7 @@ border(int bang, VALUE self, VALUE width, VALUE height, VALUE color)
     ExceptionInfo *exception;
     RectangleInfo rect;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     memset(&rect, 0, sizeof(rect));
     rect.width = NUM2UINT(width);
@@ -2068,7 +2345,7 @@ Image_capture(int argc, VALUE *argv, VALUE self)
     // Set info->server_name to the server name
     // Also info->colorspace, depth, dither, interlace, type
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, image_info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, image_info);
 
     // If an error occurs, IM will call our error handler and we raise an exception.
     image = XImportImage(image_info, &ximage_info);
@@ -2493,7 +2770,7 @@ Image_clut_channel(int argc, VALUE *argv, VALUE self)
         rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 or more)", argc);
     }
 
-    Data_Get_Struct(argv[0], Image, clut);
+    TypedData_Get_Struct(argv[0], Image, &rm_Image_data_type, clut);
 
     okay = ClutImageChannel(image, channels, clut);
     rm_check_image_exception(image, RetainOnError);
@@ -2507,6 +2784,276 @@ Image_clut_channel(int argc, VALUE *argv, VALUE self)
 }
 
 
+//! What a histogram pass counts
+typedef enum
+{
+    IndexHistogram,     /**< colormap indexes */
+    ChannelHistogram,   /**< Image#histogram bins */
+    DominantHistogram   /**< Image#dominant_colors buckets */
+} HistogramType;
+
+//! Image#dominant_colors buckets, 5 bits each of red, green and blue
+#define DOMINANT_BUCKETS 32768
+
+//! A histogram pass
+typedef struct
+{
+    Image *image;                   /**< the image */
+    HistogramType type;             /**< what to count */
+    unsigned long bins;             /**< the number of bins per channel */
+    long nchannels;                 /**< the number of channels */
+    long ntasks;                    /**< the number of row stripes */
+    size_t task_size;               /**< the number of counts per stripe */
+    MagickSizeType *counts;         /**< the counts, task_size for each stripe */
+    double *sums;                   /**< the bucket color sums, for DominantHistogram */
+    ExceptionInfo **exceptions;     /**< the exception for each stripe */
+} Histogram;
+
+
+/**
+ * Return true if a histogram can be computed from the colormap indexes.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The colormap doesn't have per-pixel opacity, and the index of a CMYK
+ *     image is its black channel.
+ *
+ * @param image the image
+ * @return true or false
+ */
+static MagickBooleanType
+histogram_uses_colormap(const Image *image)
+{
+    return image->storage_class == PseudoClass && image->colormap && image->colors > 0
+           && !image->matte && image->colorspace != CMYKColorspace;
+}
+
+
+/**
+ * Return the histogram bin for a channel value.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param value the channel value
+ * @param bins 256 or 65536
+ * @return the bin
+ */
+static unsigned long
+histogram_bin(Quantum value, unsigned long bins)
+{
+    if (bins == 256)
+    {
+        return (unsigned long) ScaleQuantumToChar(value);
+    }
+    return (unsigned long) ScaleQuantumToShort(value);
+}
+
+
+/**
+ * Return the Image#dominant_colors bucket for a pixel.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param pixel the pixel
+ * @return the bucket
+ */
+static size_t
+histogram_bucket(const PixelPacket *pixel)
+{
+    return ((size_t)(ScaleQuantumToChar(pixel->red) >> 3) << 10)
+           | ((size_t)(ScaleQuantumToChar(pixel->green) >> 3) << 5)
+           | (size_t)(ScaleQuantumToChar(pixel->blue) >> 3);
+}
+
+
+/**
+ * Add a color to an Image#dominant_colors bucket.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param counts the bucket counts
+ * @param sums the bucket color sums
+ * @param pixel the color
+ * @param count the number of pixels with this color
+ */
+static void
+histogram_add_color(MagickSizeType *counts, double *sums, const PixelPacket *pixel, MagickSizeType count)
+{
+    size_t bucket = histogram_bucket(pixel);
+
+    counts[bucket] += count;
+    sums[4*bucket]   += (double) count * pixel->red;
+    sums[4*bucket+1] += (double) count * pixel->green;
+    sums[4*bucket+2] += (double) count * pixel->blue;
+    sums[4*bucket+3] += (double) count * pixel->opacity;
+}
+
+
+/**
+ * Count one stripe of rows. Called from rm_parallel, without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param data the Histogram
+ * @param task the stripe
+ */
+static void
+histogram_task(void *data, long task)
+{
+    Histogram *hist = (Histogram *)data;
+    Image *image = hist->image;
+    ExceptionInfo *exception = hist->exceptions[task];
+    MagickSizeType *counts = hist->counts + task * hist->task_size;
+    double *sums = hist->sums ? hist->sums + task * 4 * DOMINANT_BUCKETS : NULL;
+    const PixelPacket *pixels;
+    const IndexPacket *indexes;
+    unsigned long x, bins = hist->bins;
+    long y, y1;
+#if defined(RM_THREADED_CACHE_VIEWS)
+    CacheView *view;
+
+    view = rm_acquire_cache_view(image, exception);
+#endif
+
+    y = (long)(image->rows * task / hist->ntasks);
+    y1 = (long)(image->rows * (task + 1) / hist->ntasks);
+    for (; y < y1; y++)
+    {
+#if defined(RM_THREADED_CACHE_VIEWS)
+        pixels = GetCacheViewVirtualPixels(view, 0, y, image->columns, 1, exception);
+        indexes = GetCacheViewVirtualIndexQueue(view);
+#elif defined(HAVE_GETVIRTUALPIXELS)
+        pixels = GetVirtualPixels(image, 0, y, image->columns, 1, exception);
+        indexes = GetVirtualIndexQueue(image);
+#else
+        pixels = AcquireImagePixels(image, 0, y, image->columns, 1, exception);
+        indexes = GetIndexes(image);
+#endif
+        if (!pixels)
+        {
+            break;
+        }
+
+        switch (hist->type)
+        {
+            case IndexHistogram:
+                for (x = 0; x < image->columns; x++)
+                {
+                    if ((size_t) indexes[x] < hist->task_size)
+                    {
+                        counts[(size_t) indexes[x]] += 1;
+                    }
+                }
+                break;
+
+            case ChannelHistogram:
+                for (x = 0; x < image->columns; x++)
+                {
+                    counts[histogram_bin(pixels[x].red, bins)] += 1;
+                    counts[bins + histogram_bin(pixels[x].green, bins)] += 1;
+                    counts[2*bins + histogram_bin(pixels[x].blue, bins)] += 1;
+                    counts[3*bins + histogram_bin(pixels[x].opacity, bins)] += 1;
+                    if (hist->nchannels == 5 && indexes)
+                    {
+                        counts[4*bins + histogram_bin(indexes[x], bins)] += 1;
+                    }
+                }
+                break;
+
+            case DominantHistogram:
+                for (x = 0; x < image->columns; x++)
+                {
+                    histogram_add_color(counts, sums, &pixels[x], 1);
+                }
+                break;
+        }
+    }
+
+#if defined(RM_THREADED_CACHE_VIEWS)
+    view = DestroyCacheView(view);
+#endif
+}
+
+
+/**
+ * Count the pixels in an image in parallel row stripes and add the stripe
+ * counts together.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The buffers and ExceptionInfos belong to the returned object, so
+ *     they're freed if an exception is raised. So does a reference to the
+ *     image, so the caller can keep using it even if another thread
+ *     destroys it.
+ *   - On return hist->counts (and hist->sums) hold the totals.
+ *   - The stripes share the pixel cache through a cache view each. Without
+ *     cache views there is only one stripe.
+ *
+ * @param hist the histogram, with image, type, bins and nchannels set
+ * @return a Ruby object that owns the buffers; keep it alive while using them
+ */
+static VALUE
+histogram_count(Histogram *hist)
+{
+    VALUE keep;
+    long task;
+    size_t n;
+
+    switch (hist->type)
+    {
+        case IndexHistogram:
+            hist->task_size = hist->image->colors;
+            break;
+        case ChannelHistogram:
+            hist->task_size = hist->nchannels * hist->bins;
+            break;
+        case DominantHistogram:
+            hist->task_size = DOMINANT_BUCKETS;
+            break;
+    }
+
+    hist->ntasks = 1;
+#if defined(RM_THREADED_CACHE_VIEWS)
+    hist->ntasks = (long) GetMagickResourceLimit(ThreadResource);
+    hist->ntasks = max(1, min(hist->ntasks, (long)(hist->image->rows / 64)));
+#endif
+
+    keep = rb_ary_new();
+    (void) rm_keep_image(keep, hist->image);
+    hist->counts = (MagickSizeType *) rm_buffer_new(keep, hist->ntasks * hist->task_size * sizeof(MagickSizeType));
+
+    hist->sums = NULL;
+    if (hist->type == DominantHistogram)
+    {
+        hist->sums = (double *) rm_buffer_new(keep, hist->ntasks * 4 * DOMINANT_BUCKETS * sizeof(double));
+    }
+
+    hist->exceptions = rm_exceptions_new(keep, hist->ntasks);
+
+    rm_parallel(histogram_task, hist, hist->ntasks, hist->ntasks);
+
+    for (task = 1; task < hist->ntasks; task++)
+    {
+        for (n = 0; n < hist->task_size; n++)
+        {
+            hist->counts[n] += hist->counts[task * hist->task_size + n];
+        }
+        if (hist->sums)
+        {
+            for (n = 0; n < 4 * DOMINANT_BUCKETS; n++)
+            {
+                hist->sums[n] += hist->sums[task * 4 * DOMINANT_BUCKETS + n];
+            }
+        }
+    }
+    rm_check_exceptions(hist->exceptions, hist->ntasks, NULL, RetainOnError);
+
+    return keep;
+}
+
+
 /**
  * Call GetImageHistogram.
  *
@@ -2530,6 +3077,42 @@ Image_color_histogram(VALUE self)
 
     image = rm_check_destroyed(self);
 
+    // Count the colormap indexes instead of making a DirectClass copy.
+    if (histogram_uses_colormap(image))
+    {
+        Histogram hist;
+        PixelPacket color;
+        VALUE keep, count = Qnil;
+
+        memset(&hist, 0, sizeof(hist));
+        hist.image = image;
+        hist.type = IndexHistogram;
+        keep = histogram_count(&hist);
+
+        hash = rb_hash_new();
+        for (x = 0; x < image->colors; x++)
+        {
+            if (hist.counts[x] == 0)
+            {
+                continue;
+            }
+            color = image->colormap[x];
+            color.opacity = OpaqueOpacity;
+            pixel = Pixel_from_PixelPacket(&color);
+            // The colormap may have duplicate colors
+            count = rb_hash_aref(hash, pixel);
+            colors = NIL_P(count) ? 0 : NUM2ULONG(count);
+            (void) rb_hash_aset(hash, pixel, ULONG2NUM((unsigned long)(colors + hist.counts[x])));
+        }
+
+        RB_GC_GUARD(keep);
+        RB_GC_GUARD(count);
+        RB_GC_GUARD(hash);
+        RB_GC_GUARD(pixel);
+
+        return hash;
+    }
+
     // If image not DirectClass make a DirectClass copy.
     if (image->storage_class != DirectClass)
     {
@@ -2586,54 +3169,290 @@ Image_color_histogram(VALUE self)
 
 
 /**
- * Store all the profiles in the profile in the target image. Called from
- * Image_color_profile_eq and Image_iptc_profile_eq.
+ * Compare Image#dominant_colors buckets for qsort, most pixels first.
  *
  * No Ruby usage (internal function)
- * 
- * @param self this object
- * @param name profile name
- * @param profile an IPTC or ICC profile
- * @return self
+ *
+ * @param a the first bucket
+ * @param b the second bucket
+ * @return <0, 0 or >0
  */
-static VALUE
-set_profile(VALUE self, const char *name, VALUE profile)
+static int
+compare_buckets(const void *a, const void *b)
 {
-    Image *image, *profile_image;
-    ImageInfo *info;
-    const MagickInfo *m;
-    ExceptionInfo *exception;
-    char *profile_name;
-    char *profile_blob;
-    long profile_length;
-    const StringInfo *profile_data;
-
-    image = rm_check_frozen(self);
-
-    profile_blob = rm_str2cstr(profile, &profile_length);
-
-    exception = AcquireExceptionInfo();
-    m = GetMagickInfo(name, exception);
-    CHECK_EXCEPTION()
+    const MagickSizeType *bucket_a = (const MagickSizeType *)a;
+    const MagickSizeType *bucket_b = (const MagickSizeType *)b;
 
-    info = CloneImageInfo(NULL);
-    if (!info)
+    if (bucket_a[0] != bucket_b[0])
     {
-        rb_raise(rb_eNoMemError, "not enough memory to continue");
+        return bucket_a[0] > bucket_b[0] ? -1 : 1;
     }
+    return bucket_a[1] < bucket_b[1] ? -1 : (bucket_a[1] > bucket_b[1] ? 1 : 0);
+}
 
-    strncpy(info->magick, m->name, MaxTextExtent);
-    info->magick[MaxTextExtent-1] = '\0';
-
-    profile_image = BlobToImage(info, profile_blob, (size_t)profile_length, exception);
-    (void) DestroyImageInfo(info);
-    CHECK_EXCEPTION()
-    (void) DestroyExceptionInfo(exception);
 
-    ResetImageProfileIterator(profile_image);
-    profile_name = GetNextImageProfile(profile_image);
-    while (profile_name)
-    {
+/**
+ * Find the most common colors in the image, without building a histogram of
+ * every distinct color.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#dominant_colors @endverbatim
+ *   - @verbatim Image#dominant_colors(count) @endverbatim
+ *
+ * Notes:
+ *   - Default count is 8
+ *   - Colors are grouped into 32768 buckets by the high 5 bits of their
+ *     red, green and blue channels. Returns an array of up to count
+ *     [pixel, number of pixels] pairs for the fullest buckets, fullest first.
+ *     Each pixel is the average color of its bucket.
+ *   - The pixels are counted in parallel.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return array of [pixel, count] pairs
+ */
+VALUE
+Image_dominant_colors(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    Histogram hist;
+    VALUE keep, result;
+    MagickSizeType *counts, *buckets;
+    double *sums;
+    PixelPacket color;
+    long count = 8, nbuckets, n;
+    size_t x;
+
+    image = rm_check_destroyed(self);
+
+    switch (argc)
+    {
+        case 1:
+            count = NUM2LONG(argv[0]);
+            if (count <= 0)
+            {
+                rb_raise(rb_eArgError, "count must be > 0 (%ld given)", count);
+            }
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+            break;
+    }
+
+    memset(&hist, 0, sizeof(hist));
+    hist.image = image;
+    if (histogram_uses_colormap(image))
+    {
+        hist.type = IndexHistogram;
+        keep = histogram_count(&hist);
+
+        counts = (MagickSizeType *) rm_buffer_new(keep, DOMINANT_BUCKETS * sizeof(MagickSizeType));
+        sums = (double *) rm_buffer_new(keep, 4 * DOMINANT_BUCKETS * sizeof(double));
+
+        for (x = 0; x < image->colors; x++)
+        {
+            color = image->colormap[x];
+            color.opacity = OpaqueOpacity;
+            histogram_add_color(counts, sums, &color, hist.counts[x]);
+        }
+    }
+    else
+    {
+        hist.type = DominantHistogram;
+        keep = histogram_count(&hist);
+        counts = hist.counts;
+        sums = hist.sums;
+    }
+
+    // [count, bucket] pairs for the buckets that aren't empty
+    buckets = (MagickSizeType *) rm_buffer_new(keep, 2 * DOMINANT_BUCKETS * sizeof(MagickSizeType));
+    nbuckets = 0;
+    for (x = 0; x < DOMINANT_BUCKETS; x++)
+    {
+        if (counts[x] > 0)
+        {
+            buckets[2*nbuckets] = counts[x];
+            buckets[2*nbuckets+1] = x;
+            nbuckets += 1;
+        }
+    }
+    qsort(buckets, (size_t)nbuckets, 2 * sizeof(MagickSizeType), compare_buckets);
+
+    count = min(count, nbuckets);
+    result = rb_ary_new2(count);
+    for (n = 0; n < count; n++)
+    {
+        x = (size_t) buckets[2*n+1];
+        color.red     = ROUND_TO_QUANTUM(sums[4*x] / counts[x]);
+        color.green   = ROUND_TO_QUANTUM(sums[4*x+1] / counts[x]);
+        color.blue    = ROUND_TO_QUANTUM(sums[4*x+2] / counts[x]);
+        color.opacity = ROUND_TO_QUANTUM(sums[4*x+3] / counts[x]);
+        (void) rb_ary_push(result, rb_assoc_new(Pixel_from_PixelPacket(&color), ULL2NUM(counts[x])));
+    }
+
+    RB_GC_GUARD(keep);
+    RB_GC_GUARD(result);
+
+    return result;
+}
+
+
+/**
+ * Count the values of each channel.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#histogram @endverbatim
+ *   - @verbatim Image#histogram(bins) @endverbatim
+ *   - @verbatim Image#histogram(bins, packed) @endverbatim
+ *
+ * Notes:
+ *   - Default bins is 256. The only other choice is 65536.
+ *   - Returns an array of histograms for the red, green, blue and opacity
+ *     channels, plus black for CMYK images.
+ *   - If packed is true each histogram is a String of native 64-bit counts
+ *     (use unpack('Q*')). Otherwise it's an array of Integers.
+ *   - The pixels are counted in parallel. PseudoClass images without
+ *     opacity are counted by colormap index.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return array of histograms
+ */
+VALUE
+Image_histogram(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    Histogram hist;
+    VALUE keep, result, channel = Qnil;
+    MagickSizeType *totals;
+    unsigned long bins = 256, x;
+    int packed = 0;
+    long ch;
+    size_t n;
+
+    image = rm_check_destroyed(self);
+
+    switch (argc)
+    {
+        case 2:
+            packed = RTEST(argv[1]);
+        case 1:
+            bins = NUM2ULONG(argv[0]);
+            if (bins != 256 && bins != 65536)
+            {
+                rb_raise(rb_eArgError, "bins must be 256 or 65536 (%lu given)", bins);
+            }
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 to 2)", argc);
+            break;
+    }
+
+    memset(&hist, 0, sizeof(hist));
+    hist.image = image;
+    hist.bins = bins;
+    hist.nchannels = image->colorspace == CMYKColorspace ? 5 : 4;
+
+    if (histogram_uses_colormap(image))
+    {
+        hist.type = IndexHistogram;
+        keep = histogram_count(&hist);
+
+        totals = (MagickSizeType *) rm_buffer_new(keep, hist.nchannels * bins * sizeof(MagickSizeType));
+        for (n = 0; n < image->colors; n++)
+        {
+            totals[histogram_bin(image->colormap[n].red, bins)] += hist.counts[n];
+            totals[bins + histogram_bin(image->colormap[n].green, bins)] += hist.counts[n];
+            totals[2*bins + histogram_bin(image->colormap[n].blue, bins)] += hist.counts[n];
+            totals[3*bins + histogram_bin(OpaqueOpacity, bins)] += hist.counts[n];
+        }
+    }
+    else
+    {
+        hist.type = ChannelHistogram;
+        keep = histogram_count(&hist);
+        totals = hist.counts;
+    }
+
+    result = rb_ary_new2(hist.nchannels);
+    for (ch = 0; ch < hist.nchannels; ch++)
+    {
+        if (packed)
+        {
+            channel = rb_str_new((const char *)(totals + ch * bins), (long)(bins * sizeof(MagickSizeType)));
+        }
+        else
+        {
+            channel = rb_ary_new2((long)bins);
+            for (x = 0; x < bins; x++)
+            {
+                (void) rb_ary_push(channel, ULL2NUM(totals[ch * bins + x]));
+            }
+        }
+        (void) rb_ary_push(result, channel);
+    }
+
+    RB_GC_GUARD(keep);
+    RB_GC_GUARD(channel);
+    RB_GC_GUARD(result);
+
+    return result;
+}
+
+
+/**
+ * Store all the profiles in the profile in the target image. Called from
+ * Image_color_profile_eq and Image_iptc_profile_eq.
+ *
+ * No Ruby usage (internal function)
+ * 
+ * @param self this object
+ * @param name profile name
+ * @param profile an IPTC or ICC profile
+ * @return self
+ */
+static VALUE
+set_profile(VALUE self, const char *name, VALUE profile)
+{
+    Image *image, *profile_image;
+    ImageInfo *info;
+    const MagickInfo *m;
+    ExceptionInfo *exception;
+    char *profile_name;
+    char *profile_blob;
+    long profile_length;
+    const StringInfo *profile_data;
+
+    image = rm_check_frozen(self);
+
+    profile_blob = rm_str2cstr(profile, &profile_length);
+
+    exception = AcquireExceptionInfo();
+    m = GetMagickInfo(name, exception);
+    CHECK_EXCEPTION()
+
+    info = CloneImageInfo(NULL);
+    if (!info)
+    {
+        rb_raise(rb_eNoMemError, "not enough memory to continue");
+    }
+
+    strncpy(info->magick, m->name, MaxTextExtent);
+    info->magick[MaxTextExtent-1] = '\0';
+
+    profile_image = BlobToImage(info, profile_blob, (size_t)profile_length, exception);
+    (void) DestroyImageInfo(info);
+    CHECK_EXCEPTION()
+    (void) DestroyExceptionInfo(exception);
+
+    ResetImageProfileIterator(profile_image);
+    profile_name = GetNextImageProfile(profile_image);
+    while (profile_name)
+    {
         if (rm_strcasecmp(profile_name, name) == 0)
         {
             profile_data = GetImageProfile(profile_image, profile_name);
@@ -2811,24 +3630,154 @@ Image_color_flood_fill( VALUE self, VALUE target_color, VALUE fill_color
 }
 
 
+/**
+ * Return the image a point operation writes to.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Call after the arguments have been converted, so that nothing is
+ *     cloned if the conversion raises.
+ *   - The bang methods change the pixels of this image. If its pixel cache is
+ *     still shared with a copy, ImageMagick makes a private one for it the
+ *     first time a pixel is written. Otherwise no pixels are copied at all.
+ *
+ * @param bang whether the bang (!) version of the method was called
+ * @param self this object
+ * @return the image itself if bang, otherwise a clone of it
+ * @see point_op_result
+ */
+static Image *
+point_op_target(int bang, VALUE self)
+{
+    if (bang)
+    {
+        return rm_check_frozen(self);
+    }
+    return rm_clone_image(rm_check_destroyed(self));
+}
+
+
+/**
+ * Check the image written by a point operation and return the result.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param bang whether the bang (!) version of the method was called
+ * @param self this object
+ * @param new_image the image returned by point_op_target
+ * @return self if bang, otherwise a new image
+ * @see point_op_target
+ */
+static VALUE
+point_op_result(int bang, VALUE self, Image *new_image)
+{
+    if (bang)
+    {
+        rm_check_image_exception(new_image, RetainOnError);
+        return self;
+    }
+
+    rm_check_image_exception(new_image, DestroyOnError);
+    return rm_image_new(new_image);
+}
+
+
+/**
+ * Blend the target color with each pixel of the image in place.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Computes the same blend as ColorizeImage, which can only return a new
+ *     image. Like ColorizeImage, a gray image colorized with a color that
+ *     isn't gray becomes sRGB, and the matte channel is turned on if the
+ *     color isn't opaque.
+ *
+ * @param image the image
+ * @param red percentage of red to blend
+ * @param green percentage of green to blend
+ * @param blue percentage of blue to blend
+ * @param matte percentage of opacity to blend
+ * @param target the color
+ * @param exception the exception info
+ */
+static void
+colorize_pixels(Image *image, double red, double green, double blue, double matte
+                , const PixelPacket *target, ExceptionInfo *exception)
+{
+    PixelPacket *q;
+    long x, y;
+
+    if (!SetImageStorageClass(image, DirectClass))
+    {
+        InheritException(exception, &image->exception);
+        return;
+    }
+    if ((image->colorspace == GRAYColorspace || image->colorspace == Rec601LumaColorspace)
+        && (target->red != target->green || target->green != target->blue))
+    {
+        (void) SetImageColorspace(image, sRGBColorspace);
+    }
+    if (!image->matte && target->opacity != OpaqueOpacity)
+    {
+#if defined(HAVE_SETIMAGEALPHACHANNEL)
+        (void) SetImageAlphaChannel(image, OpaqueAlphaChannel);
+#else
+        (void) SetImageOpacity(image, OpaqueOpacity);
+#endif
+    }
+
+    for (y = 0; y < (long)image->rows; y++)
+    {
+#if defined(HAVE_GETAUTHENTICPIXELS)
+        q = GetAuthenticPixels(image, 0, y, image->columns, 1, exception);
+#else
+        q = GetImagePixels(image, 0, y, image->columns, 1);
+#endif
+        if (!q)
+        {
+            break;
+        }
+
+        for (x = 0; x < (long)image->columns; x++, q++)
+        {
+            q->red = ClampToQuantum((q->red*(100.0-red) + target->red*red) / 100.0);
+            q->green = ClampToQuantum((q->green*(100.0-green) + target->green*green) / 100.0);
+            q->blue = ClampToQuantum((q->blue*(100.0-blue) + target->blue*blue) / 100.0);
+            q->opacity = ClampToQuantum((q->opacity*(100.0-matte) + target->opacity*matte) / 100.0);
+        }
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+        if (!SyncAuthenticPixels(image, exception))
+#else
+        if (!SyncImagePixels(image))
+#endif
+        {
+            break;
+        }
+    }
+}
+
+
 /**
  * Blend the fill color specified by "target" with each pixel in the image.
- * Specify the percentage blend for each r, g, b component.
  *
- * Ruby usage:
- *   - @verbatim Image#colorize(r, g, b, target) @endverbatim
- *   - @verbatim Image#colorize(r, g, b, matte, target) @endverbatim
+ * No Ruby usage (internal function)
  *
+ * @param bang whether the bang (!) version of the method was called
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return a new image
+ * @return self if bang, otherwise a new image
+ * @see Image_colorize
+ * @see Image_colorize_bang
  */
-VALUE
-Image_colorize(int argc, VALUE *argv, VALUE self)
+static VALUE
+colorize(int bang, int argc, VALUE *argv, VALUE self)
 {
     Image *image, *new_image;
-    double red, green, blue, matte;
+    double red, green, blue, matte = 0.0;
     char opacity[50];
     PixelPacket target;
     ExceptionInfo *exception;
@@ -2858,6 +3807,16 @@ Image_colorize(int argc, VALUE *argv, VALUE self)
     }
 
     exception = AcquireExceptionInfo();
+    if (bang)
+    {
+        image = rm_check_frozen(self);
+        colorize_pixels(image, red, green, blue, matte, &target, exception);
+        CHECK_EXCEPTION()
+
+        (void) DestroyExceptionInfo(exception);
+        return self;
+    }
+
     new_image = ColorizeImage(image, opacity, target, exception);
     rm_check_exception(exception, new_image, DestroyOnError);
 
@@ -2870,7 +3829,48 @@ Image_colorize(int argc, VALUE *argv, VALUE self)
 
 
 /**
- * Return the color in the colormap at the specified index. If a new color is
+ * Blend the fill color specified by "target" with each pixel in the image.
+ * Specify the percentage blend for each r, g, b component.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#colorize(r, g, b, target) @endverbatim
+ *   - @verbatim Image#colorize(r, g, b, matte, target) @endverbatim
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ * @see colorize
+ */
+VALUE
+Image_colorize(int argc, VALUE *argv, VALUE self)
+{
+    return colorize(False, argc, argv, self);
+}
+
+
+/**
+ * Blend the fill color with each pixel in place.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#colorize!(r, g, b, target) @endverbatim
+ *   - @verbatim Image#colorize!(r, g, b, matte, target) @endverbatim
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see colorize
+ */
+VALUE
+Image_colorize_bang(int argc, VALUE *argv, VALUE self)
+{
+    return colorize(True, argc, argv, self);
+}
+
+
+/**
+ * Return the color in the colormap at the specified index. If a new color is
  * specified, replaces the color at the index with the new color.
  *
  * Ruby usage:
@@ -2924,7 +3924,7 @@ Image_colormap(int argc, VALUE *argv, VALUE self)
 
     // This is a "set" operation. Things are different.
 
-    rb_check_frozen(self);
+    (void) rm_check_frozen(self);
 
     // Replace with new color? The arg can be either a color name or
     // a Magick::Pixel.
@@ -3231,6 +4231,52 @@ Image_compose_eq(VALUE self, VALUE compose_arg)
     return self;
 }
 
+/**
+ * Composite a layer onto the image at each position of a grid, with the GVL
+ * released.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The layer is always composited once at (x, y). A zero step means only
+ *     one position in that direction.
+ *   - Errors are left in image->exception for the caller to check. Call
+ *     rm_check_interrupts first.
+ *   - If image belongs to self (the bang methods), another thread may destroy
+ *     or replace it while the GVL is released, so use the returned image.
+ *
+ * @param self the object that owns image, or Qnil if image is a private copy
+ * @param image the destination image
+ * @param channels the channels to composite
+ * @param operator the composite operator
+ * @param layer the image to composite
+ * @param x column of the first position
+ * @param y row of the first position
+ * @param x_step columns between positions
+ * @param y_step rows between positions
+ * @return the destination image, or NULL if self was destroyed
+ */
+static Image *
+composite_layer(VALUE self, Image *image, ChannelType channels, CompositeOperator operator, Image *layer
+                , long x, long y, unsigned long x_step, unsigned long y_step)
+{
+    composite_layer_args_t args;
+
+    args.image = NIL_P(self) ? image : ReferenceImage(image);
+    args.channels = channels;
+    args.operator = operator;
+    args.layer = ReferenceImage(layer);
+    args.x = x;
+    args.y = y;
+    args.x_step = x_step;
+    args.y_step = y_step;
+    (void) rm_call_without_gvl(composite_layer_gvl, &args);
+
+    (void) rm_release_image(Qnil, layer);
+    return NIL_P(self) ? image : rm_release_image(self, image);
+}
+
+
 /**
  * Call CompositeImage.
  *
@@ -3267,7 +4313,7 @@ composite(int bang, int argc, VALUE *argv, VALUE self, ChannelType channels)
 
     if (bang)
     {
-        rb_check_frozen(self);
+        (void) rm_check_frozen(self);
     }
     if (argc < 3 || argc > 5)
     {
@@ -3383,8 +4429,12 @@ composite(int bang, int argc, VALUE *argv, VALUE self, ChannelType channels)
 
     if (bang)
     {
-        (void) CompositeImageChannel(image, channels, operator, comp_image, x_offset, y_offset);
-        rm_check_image_exception(image, RetainOnError);
+        image = composite_layer(self, image, channels, operator, comp_image, x_offset, y_offset, 0, 0);
+        rm_check_interrupts(NULL, NULL);
+        if (image)
+        {
+            rm_check_image_exception(image, RetainOnError);
+        }
 
         return self;
     }
@@ -3392,7 +4442,8 @@ composite(int bang, int argc, VALUE *argv, VALUE self, ChannelType channels)
     {
         new_image = rm_clone_image(image);
 
-        (void) CompositeImageChannel(new_image, channels, operator, comp_image, x_offset, y_offset);
+        (void) composite_layer(Qnil, new_image, channels, operator, comp_image, x_offset, y_offset, 0, 0);
+        rm_check_interrupts(NULL, new_image);
         rm_check_image_exception(new_image, DestroyOnError);
 
         return rm_image_new(new_image);
@@ -3634,6 +4685,58 @@ Image_composite_mathematics(int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Build the layer that composite_tiled places down the image: a band as wide as
+ * the image, filled with copies of the tile.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The band is a whole number of tiles high, at least TILED_BAND_ROWS rows
+ *     unless the image is shorter, so a 64x64 tile over a 10000x10000 image
+ *     takes 40 composites instead of 24649.
+ *   - The band is a clone of the tile, so it keeps the tile's artifacts, such
+ *     as compose:args.
+ *
+ * @param image the destination image
+ * @param tile the tile
+ * @param exception the exception info
+ * @return the band, or NULL if it could not be made
+ */
+static Image *
+tiled_band(const Image *image, const Image *tile, ExceptionInfo *exception)
+{
+    Image *band;
+    unsigned long tiles_down, band_tiles;
+
+    tiles_down = (image->rows + tile->rows - 1) / tile->rows;
+    band_tiles = (TILED_BAND_ROWS + tile->rows - 1) / tile->rows;
+    if (band_tiles > tiles_down)
+    {
+        band_tiles = tiles_down;
+    }
+
+    band = CloneImage(tile, image->columns, band_tiles * tile->rows, MagickTrue, exception);
+    if (!band)
+    {
+        return NULL;
+    }
+
+    // Copy the tile's pixels as they are, alpha included.
+    band->compose = CopyCompositeOp;
+    band->page.x = band->page.y = 0;
+    if (!SetImageStorageClass(band, DirectClass) || !TextureImage(band, tile))
+    {
+        InheritException(exception, &band->exception);
+        (void) DestroyImage(band);
+        return NULL;
+    }
+    band->compose = tile->compose;
+
+    return band;
+}
+
+
 /**
  * Emulate the -tile option to the composite command.
  *
@@ -3642,6 +4745,11 @@ Image_composite_mathematics(int argc, VALUE *argv, VALUE self)
  * Notes:
  *   - Default composite_op is Magick::OverCompositeOp
  *   - Default channel is AllChannels
+ *   - The tile is copied across a band once (see tiled_band), and the band is
+ *     composited down the image. Each CompositeImageChannel call spreads its
+ *     rows over ImageMagick's threads.
+ *   - The operators that use the size of the source image (Blur, Displace and
+ *     Distort) still composite tile by tile.
  *
  * @param bang whether the bang (!) version of the method was called
  * @param argc number of input arguments
@@ -3657,11 +4765,10 @@ composite_tiled(int bang, int argc, VALUE *argv, VALUE self)
 {
     Image *image;
     Image *comp_image;
+    Image *band;
     CompositeOperator operator = OverCompositeOp;
-    long x, y;
-    unsigned long columns;
     ChannelType channels;
-    MagickStatusType status;
+    ExceptionInfo *exception;
 
     // Ensure image and composite_image aren't destroyed.
     if (bang)
@@ -3705,17 +4812,38 @@ composite_tiled(int bang, int argc, VALUE *argv, VALUE self)
     (void) SetImageAttribute(comp_image, "[modify-outside-overlay]", "false");
 #endif
 
-    status = MagickTrue;
-    columns = comp_image->columns;
+    switch (operator)
+    {
+#if defined(HAVE_ENUM_BLURCOMPOSITEOP)
+        case BlurCompositeOp:
+#endif
+#if defined(HAVE_ENUM_DISTORTCOMPOSITEOP)
+        case DistortCompositeOp:
+#endif
+        case DisplaceCompositeOp:
+            image = composite_layer(bang ? self : Qnil, image, channels, operator, comp_image
+                                    , 0, 0, comp_image->columns, comp_image->rows);
+            break;
+        default:
+            exception = AcquireExceptionInfo();
+            band = tiled_band(image, comp_image, exception);
+            // The checks below raise without the clone, so free it first
+            if (!bang && (!band || exception->severity >= ErrorException))
+            {
+                (void) DestroyImage(image);
+            }
+            rm_check_exception(exception, band, DestroyOnError);
+            (void) DestroyExceptionInfo(exception);
+            rm_ensure_result(band);
 
-    // Tile
-    for (y = 0; y < (long) image->rows; y += comp_image->rows)
+            image = composite_layer(bang ? self : Qnil, image, channels, operator, band, 0, 0, 0, band->rows);
+            (void) DestroyImage(band);
+            break;
+    }
+    rm_check_interrupts(NULL, bang ? NULL : image);
+    if (image)
     {
-        for (x = 0; status == MagickTrue && x < (long) image->columns; x += columns)
-        {
-            status = CompositeImageChannel(image, channels, operator, comp_image, x, y);
-            rm_check_image_exception(image, bang ? RetainOnError: DestroyOnError);
-        }
+        rm_check_image_exception(image, bang ? RetainOnError: DestroyOnError);
     }
 
     return bang ? self : rm_image_new(image);
@@ -4733,7 +5861,8 @@ Image_destroy_bang(VALUE self)
     Image *image;
 
     rb_check_frozen(self);
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
+    rm_check_pinned(image, NULL);
     rm_image_destroy(image);
     DATA_PTR(self) = NULL;
     return self;
@@ -4754,7 +5883,7 @@ Image_destroyed_q(VALUE self)
 {
     Image *image;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
     return image ? Qfalse : Qtrue;
 }
 
@@ -4942,7 +6071,7 @@ Image_dispatch(int argc, VALUE *argv, VALUE self)
     // Create the Ruby array for the pixels. Return this even if ExportImagePixels fails.
     pixels_ary = rb_ary_new();
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     exception = AcquireExceptionInfo();
     okay = ExportImagePixels(image, x, y, columns, rows, map, stg_type, (void *)pixels.v, exception);
@@ -5005,7 +6134,7 @@ Image_display(VALUE self)
     }
 
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
     (void) DisplayImages(info, image);
     rm_check_image_exception(image, RetainOnError);
@@ -5154,6 +6283,7 @@ Image_distort(int argc, VALUE *argv, VALUE self)
     double *points;
     MagickBooleanType bestfit = MagickFalse;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(DistortImage) args;
 
     image = rm_check_destroyed(self);
     rm_get_optional_arguments(self);
@@ -5183,8 +6313,16 @@ Image_distort(int argc, VALUE *argv, VALUE self)
     }
 
     exception = AcquireExceptionInfo();
-    new_image = DistortImage(image, distortion_method, npoints, points, bestfit, exception);
+    args.arg1 = ReferenceImage(image);
+    args.arg2 = distortion_method;
+    args.arg3 = npoints;
+    args.arg4 = points;
+    args.arg5 = bestfit;
+    args.arg6 = exception;
+    new_image = (Image *) CALL_FUNC_WITHOUT_GVL(DistortImage, &args);
+    (void) rm_release_image(self, image);
     xfree(points);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
     (void) DestroyExceptionInfo(exception);
     rm_ensure_result(new_image);
@@ -5248,6 +6386,45 @@ Image_distortion_channel(int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Append a 32-bit length to a dumped image, most significant byte first.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param str the dumped image
+ * @param length the length
+ */
+static void
+dump_length(VALUE str, size_t length)
+{
+    unsigned char buffer[4];
+
+    buffer[0] = (unsigned char) (length >> 24);
+    buffer[1] = (unsigned char) (length >> 16);
+    buffer[2] = (unsigned char) (length >> 8);
+    buffer[3] = (unsigned char) length;
+    (void) rb_str_buf_cat(str, (char *)buffer, 4);
+}
+
+
+/**
+ * Append a string and its length to a dumped image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param str the dumped image
+ * @param string the string
+ */
+static void
+dump_string(VALUE str, const char *string)
+{
+    size_t length = strlen(string);
+
+    dump_length(str, length);
+    (void) rb_str_buf_cat(str, string, (long)length);
+}
+
+
 /**
  * Implement marshalling.
  *
@@ -5255,48 +6432,82 @@ Image_distortion_channel(int argc, VALUE *argv, VALUE self)
  *   - @verbatim Image#_dump(aDepth) @endverbatim
  *
  * Notes:
- *   - Uses ImageToBlob - use the MIFF format in the blob since it's the most
- *     general
+ *   - Writes a version 2 dump: the header, the image's compression type and
+ *     depth, the image as a MIFF blob, then the image's artifacts. MIFF holds
+ *     the raw pixels, properties and profiles, so nothing is re-encoded in
+ *     the image's own (possibly lossy) format.
+ *   - The MIFF pixels are written at MAGICKCORE_QUANTUM_DEPTH, as floating
+ *     point when ImageMagick is built with HDRI, so pixels that don't fit the
+ *     image's depth survive. The image's own depth is restored by _load.
+ *   - The MIFF pixels are compressed with Magick.marshal_compression.
+ *   - Lengths are 32-bit, most significant byte first.
  *
  * @param self this object
  * @param depth the depth to which to dump (unused)
  * @return a string representing the dumped image
+ * @see Image__load
  */
 VALUE
 Image__dump(VALUE self, VALUE depth)
 {
-    Image *image;
+    Image *image, *clone;
     ImageInfo *info;
     void *blob;
-    size_t length;
+    size_t length, count;
     DumpedImage mi;
     VALUE str;
     ExceptionInfo *exception;
+    char magick[MaxTextExtent];
+    unsigned char compression, image_depth;
+    const char *key, *value;
+    GVL_STRUCT_TYPE(ImageToBlob) args;
 
     depth = depth;  // Suppress "never referenced" message from icc
 
     image = rm_check_destroyed(self);
 
+    // Write a clone, which shares the pixel cache, so changing the depth
+    // and ImageToBlob changing the magick leave the image alone
+    exception = AcquireExceptionInfo();
+    clone = CloneImage(image, 0, 0, MagickTrue, exception);
+    rm_check_exception(exception, clone, DestroyOnError);
+    rm_ensure_result(clone);
+
+    strcpy(magick, image->magick);
+    compression = (unsigned char) image->compression;
+    image_depth = (unsigned char) image->depth;
+
     info = CloneImageInfo(NULL);
     if (!info)
     {
+        (void) DestroyImage(clone);
+        (void) DestroyExceptionInfo(exception);
         rb_raise(rb_eNoMemError, "not enough memory to continue");
     }
-    strcpy(info->magick, image->magick);
+    strcpy(info->magick, "MIFF");
+    info->compression = rm_marshal_compression();
+#if defined(MAGICKCORE_HDRI_SUPPORT) && MAGICKCORE_HDRI_SUPPORT
+    (void) SetImageOption(info, "quantum:format", "floating-point");
+    clone->depth = MAGICKCORE_QUANTUM_DEPTH <= 32 ? 32 : 64;
+#else
+    clone->depth = MAGICKCORE_QUANTUM_DEPTH;
+#endif
 
-    exception = AcquireExceptionInfo();
-    blob = ImageToBlob(info, image, &length, exception);
+    args.arg1 = info;
+    args.arg2 = clone;
+    args.arg3 = &length;
+    args.arg4 = exception;
+    blob = CALL_FUNC_WITHOUT_GVL(ImageToBlob, &args);
 
     // Free ImageInfo first - error handling may raise an exception
     (void) DestroyImageInfo(info);
 
-    CHECK_EXCEPTION()
-
-    (void) DestroyExceptionInfo(exception);
-
-    if (!blob)
+    if (blob && length > 0xffffffffUL)
     {
-        rb_raise(rb_eNoMemError, "not enough memory to continue");
+        magick_free(blob);
+        (void) DestroyImage(clone);
+        (void) DestroyExceptionInfo(exception);
+        rb_raise(rb_eRangeError, "image too big to dump");
     }
 
     // Create a header for the blob: ID and version
@@ -5304,15 +6515,53 @@ Image__dump(VALUE self, VALUE depth)
     // string stored as a byte, followed by the
     // magick string itself.
     mi.id = DUMPED_IMAGE_ID;
-    mi.mj = DUMPED_IMAGE_MAJOR_VERS;
-    mi.mi = DUMPED_IMAGE_MINOR_VERS;
-    strcpy(mi.magick, image->magick);
+    mi.mj = DUMPED_IMAGE_V2_MAJOR_VERS;
+    mi.mi = DUMPED_IMAGE_V2_MINOR_VERS;
+    strcpy(mi.magick, magick);
     mi.len = (unsigned char) min((size_t)UCHAR_MAX, strlen(mi.magick));
 
-    // Concatenate the blob onto the header & return the result
     str = rb_str_new((char *)&mi, (long)(mi.len+offsetof(DumpedImage,magick)));
-    str = rb_str_buf_cat(str, (char *)blob, (long)length);
-    magick_free((void*)blob);
+
+    // MIFF stores its own compression and depth, so keep the image's
+    (void) rb_str_buf_cat(str, (char *)&compression, 1);
+    (void) rb_str_buf_cat(str, (char *)&image_depth, 1);
+
+    if (blob)
+    {
+        dump_length(str, length);
+        (void) rb_str_buf_cat(str, (char *)blob, (long)length);
+        magick_free(blob);
+    }
+
+    rm_check_interrupts(exception, clone);
+    rm_check_exception(exception, clone, DestroyOnError);
+    (void) DestroyExceptionInfo(exception);
+
+    if (!blob)
+    {
+        (void) DestroyImage(clone);
+        rb_raise(rb_eNoMemError, "not enough memory to continue");
+    }
+
+    count = 0;
+    ResetImageArtifactIterator(clone);
+    while (GetNextImageArtifact(clone))
+    {
+        count += 1;
+    }
+    dump_length(str, count);
+
+    ResetImageArtifactIterator(clone);
+    key = GetNextImageArtifact(clone);
+    while (key)
+    {
+        value = GetImageArtifact(clone, key);
+        dump_string(str, key);
+        dump_string(str, value ? value : "");
+        key = GetNextImageArtifact(clone);
+    }
+
+    (void) DestroyImage(clone);
 
     RB_GC_GUARD(str);
 
@@ -5337,7 +6586,7 @@ Image_dup(VALUE self)
     VALUE dup;
 
     (void) rm_check_destroyed(self);
-    dup = Data_Wrap_Struct(CLASS_OF(self), NULL, rm_image_destroy, NULL);
+    dup = TypedData_Wrap_Struct(CLASS_OF(self), &rm_Image_data_type, NULL);
     if (rb_obj_tainted(self))
     {
         (void) rb_obj_taint(dup);
@@ -5349,6 +6598,102 @@ Image_dup(VALUE self)
 }
 
 
+/**
+ * Copy a row of pixels into a buffer.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The image is fetched again for every row because the block called by
+ *     each_pixel or map_pixels! may have destroyed or replaced it.
+ *
+ * @param self this object
+ * @param y the row to copy
+ * @param columns the expected number of columns
+ * @param rows the expected number of rows
+ * @param row the buffer, big enough for columns PixelPackets
+ * @return the image
+ * @throw RuntimeError if the image size has changed
+ */
+static Image *
+copy_pixel_row(VALUE self, long y, unsigned long columns, unsigned long rows, PixelPacket *row)
+{
+    Image *image;
+    const PixelPacket *pixels;
+    ExceptionInfo *exception;
+
+    image = rm_check_destroyed(self);
+    if (image->columns != columns || image->rows != rows)
+    {
+        rb_raise(rb_eRuntimeError, "image size changed during iteration");
+    }
+
+    exception = AcquireExceptionInfo();
+#if defined(HAVE_GETVIRTUALPIXELS)
+    pixels = GetVirtualPixels(image, 0, y, columns, 1, exception);
+#else
+    pixels = AcquireImagePixels(image, 0, y, columns, 1, exception);
+#endif
+    CHECK_EXCEPTION()
+    (void) DestroyExceptionInfo(exception);
+
+    if (!pixels)
+    {
+        rm_magick_error("can't get image pixels", NULL);
+    }
+
+    memcpy(row, pixels, columns * sizeof(PixelPacket));
+
+    return image;
+}
+
+
+/**
+ * Yield each pixel in the image, with its x and y coordinates.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#each_pixel { |pixel, x, y| ... } @endverbatim
+ *
+ * Notes:
+ *   - The pixels are read one row at a time, so memory use doesn't depend on
+ *     the size of the image.
+ *
+ * @param self this object
+ * @return self
+ * @see Image_map_pixels_bang
+ */
+VALUE
+Image_each_pixel(VALUE self)
+{
+    Image *image;
+    unsigned long columns, rows;
+    long x, y;
+    VALUE keep;
+    PixelPacket *row;
+
+    image = rm_check_destroyed(self);
+    columns = image->columns;
+    rows = image->rows;
+
+    // The row buffer is freed by the GC if the block raises
+    keep = rb_ary_new();
+    row = (PixelPacket *) rm_buffer_new(keep, columns * sizeof(PixelPacket));
+
+    for (y = 0; y < (long)rows; y++)
+    {
+        (void) copy_pixel_row(self, y, columns, rows, row);
+        for (x = 0; x < (long)columns; x++)
+        {
+            (void) rb_yield_values(3, Pixel_from_PixelPacket(&row[x]), LONG2NUM(x), LONG2NUM(y));
+        }
+    }
+
+    RB_GC_GUARD(keep);
+
+    return self;
+}
+
+
 /**
  * Iterate over image profiles.
  *
@@ -5448,31 +6793,34 @@ Image_edge(int argc, VALUE *argv, VALUE self)
 
 
 /**
- * Call one of the effects methods.
+ * Get the radius and sigma arguments of one of the effects methods.
  *
  * No Ruby usage (internal function)
  *
- * @param self this object
+ * Notes:
+ *   - Default radius is 0.0
+ *   - Default sigma is 1.0
+ *   - Also used for the blur_image and sharpen operations of Image#pipeline
+ *     and ImageList#parallel_map.
+ *
  * @param argc number of input arguments
  * @param argv array of input arguments
- * @param effector the effector to call
- * @return a new image
+ * @param radius the radius
+ * @param sigma the sigma
+ * @throw ArgumentError
  */
-static VALUE
-effect_image(VALUE self, int argc, VALUE *argv, effector_t effector)
+void
+rm_effect_args(int argc, VALUE *argv, double *radius, double *sigma)
 {
-    Image *image, *new_image;
-    ExceptionInfo *exception;
-    double radius = 0.0, sigma = 1.0;
-
-    image = rm_check_destroyed(self);
+    *radius = 0.0;
+    *sigma = 1.0;
 
     switch (argc)
     {
         case 2:
-            sigma = NUM2DBL(argv[1]);
+            *sigma = NUM2DBL(argv[1]);
         case 1:
-            radius = NUM2DBL(argv[0]);
+            *radius = NUM2DBL(argv[0]);
         case 0:
             break;
         default:
@@ -5480,33 +6828,65 @@ effect_image(VALUE self, int argc, VALUE *argv, effector_t effector)
             break;
     }
 
-    if (sigma == 0.0)
+    if (*sigma == 0.0)
     {
         rb_raise(rb_eArgError, "sigma must be != 0.0");
     }
-
-    exception = AcquireExceptionInfo();
-    new_image = (effector)(image, radius, sigma, exception);
-    rm_check_exception(exception, new_image, DestroyOnError);
-
-    (void) DestroyExceptionInfo(exception);
-
-    rm_ensure_result(new_image);
-
-    return rm_image_new(new_image);
 }
 
 
 /**
- * Create a grayscale image with a three-dimensional effect.
+ * Call one of the effects methods.
  *
- * Ruby usage:
- *   - @verbatim Image#emboss @endverbatim
- *   - @verbatim Image#emboss(radius) @endverbatim
- *   - @verbatim Image#emboss(radius, sigma) @endverbatim
+ * No Ruby usage (internal function)
  *
- * Notes:
- *   - Default radius is 0.0
+ * @param self this object
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param effector the effector to call
+ * @return a new image
+ * @see rm_effect_args
+ */
+static VALUE
+effect_image(VALUE self, int argc, VALUE *argv, effector_t effector)
+{
+    Image *image, *new_image;
+    ExceptionInfo *exception;
+    effector_args_t args;
+    double radius, sigma;
+
+    image = rm_check_destroyed(self);
+    rm_effect_args(argc, argv, &radius, &sigma);
+
+    exception = AcquireExceptionInfo();
+    args.fp = effector;
+    args.image = ReferenceImage(image);
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(effector_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
+    rm_check_exception(exception, new_image, DestroyOnError);
+
+    (void) DestroyExceptionInfo(exception);
+
+    rm_ensure_result(new_image);
+
+    return rm_image_new(new_image);
+}
+
+
+/**
+ * Create a grayscale image with a three-dimensional effect.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#emboss @endverbatim
+ *   - @verbatim Image#emboss(radius) @endverbatim
+ *   - @verbatim Image#emboss(radius, sigma) @endverbatim
+ *
+ * Notes:
+ *   - Default radius is 0.0
  *   - Default sigma is 1.0
  *
  * @param argc number of input arguments
@@ -5769,7 +7149,7 @@ excerpt(int bang, VALUE self, VALUE x, VALUE y, VALUE width, VALUE height)
     rect.width = NUM2ULONG(width);
     rect.height = NUM2ULONG(height);
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     exception = AcquireExceptionInfo();
     new_image = ExcerptImage(image, &rect, exception);
@@ -6001,7 +7381,7 @@ Image_extent(int argc, VALUE *argv, VALUE self)
     }
 
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
     exception = AcquireExceptionInfo();
 
     new_image = ExtentImage(image, &geometry, exception);
@@ -6325,11 +7705,17 @@ flipflop(int bang, VALUE self, flipper_t flipflopper)
 {
     Image *image, *new_image;
     ExceptionInfo *exception;
+    flipper_args_t args;
 
-    Data_Get_Struct(self, Image, image);
+    image = rm_check_destroyed(self);
     exception = AcquireExceptionInfo();
 
-    new_image = (flipflopper)(image, exception);
+    args.fp = flipflopper;
+    args.image = ReferenceImage(image);
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(flipper_gvl, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -6339,7 +7725,10 @@ flipflop(int bang, VALUE self, flipper_t flipflopper)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
 
@@ -6600,32 +7989,56 @@ Image_frame(int argc, VALUE *argv, VALUE self)
  *
  * Ruby usage:
  *   - @verbatim Image.from_blob(blob) <{ parm block }> @endverbatim
+ *   - @verbatim Image.from_blob(blob, :size_hint => geometry) <{ parm block }> @endverbatim
+ *
+ * Notes:
+ *   - size_hint sets Info#decode_size
  *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
  * @param class the Ruby Image class (unused)
- * @param blob_arg the blog as a Ruby string
  * @return an array of new images
  */
 VALUE
-Image_from_blob(VALUE class, VALUE blob_arg)
+Image_from_blob(int argc, VALUE *argv, VALUE class)
 {
     Image *images;
     Info *info;
-    VALUE info_obj;
+    VALUE info_obj, blob_arg, size_hint;
     ExceptionInfo *exception;
     void *blob;
     long length;
+    GVL_STRUCT_TYPE(decode_blob) args;
 
     class = class;          // defeat gcc message
-            blob_arg = blob_arg;    // defeat gcc message
 
+    size_hint = get_size_hint(&argc, argv);
+    if (argc != 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1)", argc);
+    }
+    blob_arg = argv[0];
+
+    // BlobToImage runs without the GVL. Decode from a frozen copy that shares
+    // the blob's buffer so that other threads can't modify it under us.
+    blob_arg = rb_str_new_frozen(StringValue(blob_arg));
     blob = (void *) rm_str2cstr(blob_arg, &length);
 
     // Get a new Info object - run the parm block if supplied
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
+    if (!NIL_P(size_hint))
+    {
+        (void) Info_decode_size_eq(info_obj, size_hint);
+    }
 
     exception = AcquireExceptionInfo();
-    images = BlobToImage(info,  blob, (size_t)length, exception);
+    args.arg1 = info;
+    args.arg2 = blob;
+    args.arg3 = (size_t)length;
+    args.arg4 = exception;
+    images = (Image *) CALL_FUNC_WITHOUT_GVL(decode_blob, &args);
+    rm_check_interrupts(exception, images);
     rm_check_exception(exception, images, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -6634,6 +8047,8 @@ Image_from_blob(VALUE class, VALUE blob_arg)
     rm_set_user_artifact(images, info);
 
     RB_GC_GUARD(info_obj);
+    RB_GC_GUARD(blob_arg);
+    RB_GC_GUARD(size_hint);
 
     return array_from_images(images);
 }
@@ -6819,29 +8234,24 @@ Image_gamma_channel(int argc, VALUE *argv, VALUE self)
 /**
  * gamma-correct an image.
  *
- * Ruby usage:
- *   - @verbatim Image#gamma_correct(red_gamma) @endverbatim
- *   - @verbatim Image#gamma_correct(red_gamma, green_gamma) @endverbatim
- *   - @verbatim Image#gamma_correct(red_gamma, green_gamma, blue_gamma) @endverbatim
- *
- * Notes:
- *   - Default green_gamma is red_gamma
- *   - Default blue_gamma is green_gamma
- *   - For backward compatibility accept a 4th argument but ignore it.
+ * No Ruby usage (internal function)
  *
+ * @param bang whether the bang (!) version of the method was called
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return a new image
+ * @return self if bang, otherwise a new image
+ * @see Image_gamma_correct
+ * @see Image_gamma_correct_bang
  */
-VALUE
-Image_gamma_correct(int argc, VALUE *argv, VALUE self)
+static VALUE
+gamma_correct(int bang, int argc, VALUE *argv, VALUE self)
 {
-    Image *image, *new_image;
+    Image *new_image;
     double red_gamma, green_gamma, blue_gamma;
     char gamma_arg[50];
 
-    image = rm_check_destroyed(self);
+    (void) rm_check_destroyed(self);
     switch (argc)
     {
         case 1:
@@ -6873,12 +8283,57 @@ Image_gamma_correct(int argc, VALUE *argv, VALUE self)
 
     sprintf(gamma_arg, "%f,%f,%f", red_gamma, green_gamma, blue_gamma);
 
-    new_image = rm_clone_image(image);
+    new_image = point_op_target(bang, self);
 
     (void) GammaImage(new_image, gamma_arg);
-    rm_check_image_exception(new_image, DestroyOnError);
+    return point_op_result(bang, self, new_image);
+}
 
-    return rm_image_new(new_image);
+
+/**
+ * gamma-correct an image.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#gamma_correct(red_gamma) @endverbatim
+ *   - @verbatim Image#gamma_correct(red_gamma, green_gamma) @endverbatim
+ *   - @verbatim Image#gamma_correct(red_gamma, green_gamma, blue_gamma) @endverbatim
+ *
+ * Notes:
+ *   - Default green_gamma is red_gamma
+ *   - Default blue_gamma is green_gamma
+ *   - For backward compatibility accept a 4th argument but ignore it.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ * @see gamma_correct
+ */
+VALUE
+Image_gamma_correct(int argc, VALUE *argv, VALUE self)
+{
+    return gamma_correct(False, argc, argv, self);
+}
+
+
+/**
+ * Gamma-correct the image in place.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#gamma_correct!(red_gamma) @endverbatim
+ *   - @verbatim Image#gamma_correct!(red_gamma, green_gamma) @endverbatim
+ *   - @verbatim Image#gamma_correct!(red_gamma, green_gamma, blue_gamma) @endverbatim
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see gamma_correct
+ */
+VALUE
+Image_gamma_correct_bang(int argc, VALUE *argv, VALUE self)
+{
+    return gamma_correct(True, argc, argv, self);
 }
 
 
@@ -6930,6 +8385,7 @@ Image_gaussian_blur_channel(int argc, VALUE *argv, VALUE self)
     Image *image, *new_image;
     ChannelType channels;
     ExceptionInfo *exception;
+    channel_effector_args_t args;
     double radius = 0.0, sigma = 1.0;
 
     image = rm_check_destroyed(self);
@@ -6951,7 +8407,15 @@ Image_gaussian_blur_channel(int argc, VALUE *argv, VALUE self)
     }
 
     exception = AcquireExceptionInfo();
-    new_image = GaussianBlurImageChannel(image, channels, radius, sigma, exception);
+    args.fp = GaussianBlurImageChannel;
+    args.image = ReferenceImage(image);
+    args.channels = channels;
+    args.radius = radius;
+    args.sigma = sigma;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(channel_effector_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -7007,86 +8471,486 @@ Image_geometry_eq(
     {
         rb_raise(rb_eTypeError, "invalid geometry: %s", geom);
     }
-    magick_clone_string(&image->geometry, geom);
+    magick_clone_string(&image->geometry, geom);
+
+    RB_GC_GUARD(geom_str);
+
+    return self;
+}
+
+
+/**
+ * Call AcquireImagePixels.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#get_pixels(x, y, columns. rows) @endverbatim
+ *
+ * Notes:
+ *   - This is the complement of store_pixels. Notice that the return value is
+ *     an array object even when only one pixel is returned. store_pixels calls
+ *     GetImagePixels, then SyncImage
+ *
+ * @param self this object
+ * @param x_arg x position of start of region
+ * @param y_arg y position of start of region
+ * @param cols_arg width of region
+ * @param rows_arg height of region
+ * @return An array of Magick::Pixel objects corresponding to the pixels in the
+ * rectangle defined by the geometry parameters.
+ * @see Image_store_pixels
+ */
+VALUE
+Image_get_pixels(VALUE self, VALUE x_arg, VALUE y_arg, VALUE cols_arg, VALUE rows_arg)
+{
+    Image *image;
+    const PixelPacket *pixels;
+    ExceptionInfo *exception;
+    long x, y;
+    unsigned long columns, rows;
+    long size, n;
+    VALUE pixel_ary;
+
+    image = rm_check_destroyed(self);
+    x       = NUM2LONG(x_arg);
+    y       = NUM2LONG(y_arg);
+    columns = NUM2ULONG(cols_arg);
+    rows    = NUM2ULONG(rows_arg);
+
+    if ((x+columns) > image->columns || (y+rows) > image->rows)
+    {
+        rb_raise(rb_eRangeError, "geometry (%lux%lu%+ld%+ld) exceeds image bounds"
+                 , columns, rows, x, y);
+    }
+
+    // Cast AcquireImagePixels to get rid of the const qualifier. We're not going
+    // to change the pixels but I don't want to make "pixels" const.
+    exception = AcquireExceptionInfo();
+#if defined(HAVE_GETVIRTUALPIXELS)
+    pixels = GetVirtualPixels(image, x, y, columns, rows, exception);
+#else
+    pixels = AcquireImagePixels(image, x, y, columns, rows, exception);
+#endif
+    CHECK_EXCEPTION()
+
+    (void) DestroyExceptionInfo(exception);
+
+    // If the function failed, return a 0-length array.
+    if (!pixels)
+    {
+        return rb_ary_new();
+    }
+
+    // Allocate an array big enough to contain the PixelPackets.
+    size = (long)(columns * rows);
+    pixel_ary = rb_ary_new2(size);
+
+    // Convert the PixelPackets to Magick::Pixel objects
+    for (n = 0; n < size; n++)
+    {
+        rb_ary_store(pixel_ary, n, Pixel_from_PixelPacket(&pixels[n]));
+    }
+
+    return pixel_ary;
+}
+
+
+/**
+ * Return the size of one channel value in a packed pixel buffer.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param type the storage type
+ * @return the size in bytes
+ * @throw ArgumentError
+ */
+size_t
+rm_packed_type_size(StorageType type)
+{
+    switch (type)
+    {
+        case CharPixel:
+            return sizeof(unsigned char);
+        case ShortPixel:
+            return sizeof(unsigned short);
+        case IntegerPixel:
+            return sizeof(unsigned int);
+        case LongPixel:
+            return sizeof(unsigned long);
+        case FloatPixel:
+            return sizeof(float);
+        case DoublePixel:
+            return sizeof(double);
+        case QuantumPixel:
+            return sizeof(Quantum);
+        default:
+            rb_raise(rb_eArgError, "unsupported storage type %s", StorageType_name(type));
+            break;
+    }
+
+    return 0;
+}
+
+
+/**
+ * Validate a packed pixel channel map.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The channels are the same as ExportImagePixels': R, G, B, A (alpha),
+ *     O (opacity), C, M, Y, K, I (intensity) and P (pad). K is only allowed
+ *     for CMYK images.
+ *
+ * @param image the image, or NULL if the image isn't known yet (no K)
+ * @param map the channel map
+ * @return the number of channels in the map
+ * @throw ArgumentError
+ */
+size_t
+rm_check_packed_map(Image *image, const char *map)
+{
+    const char *p;
+
+    if (*map == '\0')
+    {
+        rb_raise(rb_eArgError, "empty channel map");
+    }
+
+    for (p = map; *p; p++)
+    {
+        switch (toupper(*p))
+        {
+            case 'R': case 'G': case 'B': case 'A': case 'O':
+            case 'C': case 'M': case 'Y': case 'I': case 'P':
+                break;
+            case 'K':
+                if (!image || image->colorspace != CMYKColorspace)
+                {
+                    rb_raise(rb_eArgError, "channel map `%s' requires a CMYK image", map);
+                }
+                break;
+            default:
+                rb_raise(rb_eArgError, "invalid channel `%c' in channel map `%s'", *p, map);
+                break;
+        }
+    }
+
+    return strlen(map);
+}
+
+
+/**
+ * Store one channel value in a packed pixel buffer.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param buffer the buffer
+ * @param n the index of the value in the buffer
+ * @param type the storage type
+ * @param q the channel value
+ */
+static void
+pack_quantum(void *buffer, size_t n, StorageType type, Quantum q)
+{
+    switch (type)
+    {
+        case CharPixel:
+            ((unsigned char *)buffer)[n] = ScaleQuantumToChar(q);
+            break;
+        case ShortPixel:
+            ((unsigned short *)buffer)[n] = ScaleQuantumToShort(q);
+            break;
+        case IntegerPixel:
+            ((unsigned int *)buffer)[n] = (unsigned int) ScaleQuantumToLong(q);
+            break;
+        case LongPixel:
+            ((unsigned long *)buffer)[n] = (unsigned long) ScaleQuantumToLong(q);
+            break;
+        case FloatPixel:
+            ((float *)buffer)[n] = (float) (QuantumScale * q);
+            break;
+        case DoublePixel:
+            ((double *)buffer)[n] = QuantumScale * q;
+            break;
+        case QuantumPixel:
+        default:
+            ((Quantum *)buffer)[n] = q;
+            break;
+    }
+}
+
+
+/**
+ * Fetch one channel value from a packed pixel buffer.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Float and Double values are normalized (0.0 to 1.0) and are clamped to
+ *     that range.
+ *
+ * @param buffer the buffer
+ * @param n the index of the value in the buffer
+ * @param type the storage type
+ * @return the channel value
+ */
+static Quantum
+unpack_quantum(const void *buffer, size_t n, StorageType type)
+{
+    double v;
+
+    switch (type)
+    {
+        case CharPixel:
+            return ScaleCharToQuantum(((const unsigned char *)buffer)[n]);
+        case ShortPixel:
+            return ScaleShortToQuantum(((const unsigned short *)buffer)[n]);
+        case IntegerPixel:
+            return ScaleLongToQuantum(((const unsigned int *)buffer)[n]);
+        case LongPixel:
+            return ScaleLongToQuantum(((const unsigned long *)buffer)[n]);
+        case FloatPixel:
+        case DoublePixel:
+            v = type == FloatPixel ? ((const float *)buffer)[n] : ((const double *)buffer)[n];
+            v = v < 0.0 ? 0.0 : v * QuantumRange;
+            return ROUND_TO_QUANTUM(v);
+        case QuantumPixel:
+        default:
+            return ((const Quantum *)buffer)[n];
+    }
+}
+
+
+/**
+ * Pack a row of pixels into a buffer.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image
+ * @param pixels the pixels
+ * @param indexes the black channel (CMYK images only), or NULL
+ * @param columns the number of pixels
+ * @param map the channel map
+ * @param type the storage type
+ * @param buffer the buffer
+ */
+void
+rm_pack_pixels(const Image *image, const PixelPacket *pixels, const IndexPacket *indexes
+               , unsigned long columns, const char *map, StorageType type, void *buffer)
+{
+    unsigned long x;
+    size_t n = 0;
+    const char *p;
+    Quantum q;
+
+    for (x = 0; x < columns; x++)
+    {
+        for (p = map; *p; p++)
+        {
+            switch (toupper(*p))
+            {
+                case 'R':
+                case 'C':
+                    q = pixels[x].red;
+                    break;
+                case 'G':
+                case 'M':
+                    q = pixels[x].green;
+                    break;
+                case 'B':
+                case 'Y':
+                    q = pixels[x].blue;
+                    break;
+                case 'A':
+                    q = image->matte ? QuantumRange - pixels[x].opacity : QuantumRange;
+                    break;
+                case 'O':
+                    q = image->matte ? pixels[x].opacity : OpaqueOpacity;
+                    break;
+                case 'K':
+                    q = indexes ? (Quantum) indexes[x] : 0;
+                    break;
+                case 'I':
+                    q = ROUND_TO_QUANTUM((0.299*pixels[x].red)
+                                         + (0.587*pixels[x].green)
+                                         + (0.114*pixels[x].blue));
+                    break;
+                default:
+                    q = 0;
+                    break;
+            }
+            pack_quantum(buffer, n++, type, q);
+        }
+    }
+}
 
-    RB_GC_GUARD(geom_str);
 
-    return self;
+/**
+ * Unpack a row of pixels from a buffer.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param pixels the pixels
+ * @param indexes the black channel (CMYK images only), or NULL
+ * @param columns the number of pixels
+ * @param map the channel map
+ * @param type the storage type
+ * @param buffer the buffer
+ */
+static void
+unpack_pixels(PixelPacket *pixels, IndexPacket *indexes, unsigned long columns
+              , const char *map, StorageType type, const void *buffer)
+{
+    unsigned long x;
+    size_t n = 0;
+    const char *p;
+    Quantum q;
+
+    for (x = 0; x < columns; x++)
+    {
+        for (p = map; *p; p++)
+        {
+            q = unpack_quantum(buffer, n++, type);
+            switch (toupper(*p))
+            {
+                case 'R':
+                case 'C':
+                    pixels[x].red = q;
+                    break;
+                case 'G':
+                case 'M':
+                    pixels[x].green = q;
+                    break;
+                case 'B':
+                case 'Y':
+                    pixels[x].blue = q;
+                    break;
+                case 'A':
+                    pixels[x].opacity = QuantumRange - q;
+                    break;
+                case 'O':
+                    pixels[x].opacity = q;
+                    break;
+                case 'K':
+                    if (indexes)
+                    {
+                        indexes[x] = (IndexPacket) q;
+                    }
+                    break;
+                case 'I':
+                    pixels[x].red = pixels[x].green = pixels[x].blue = q;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
 }
 
 
 /**
- * Call AcquireImagePixels.
+ * Return the pixels in the specified rectangle as a packed binary String.
  *
  * Ruby usage:
- *   - @verbatim Image#get_pixels(x, y, columns. rows) @endverbatim
+ *   - @verbatim Image#get_pixels_packed(x, y, columns, rows) @endverbatim
+ *   - @verbatim Image#get_pixels_packed(x, y, columns, rows, map) @endverbatim
+ *   - @verbatim Image#get_pixels_packed(x, y, columns, rows, map, type) @endverbatim
  *
  * Notes:
- *   - This is the complement of store_pixels. Notice that the return value is
- *     an array object even when only one pixel is returned. store_pixels calls
- *     GetImagePixels, then SyncImage
+ *   - Default map is "RGB"
+ *   - Default type is Magick::CharPixel
+ *   - The String is filled one row at a time from the pixel cache, so no
+ *     Pixel objects and no intermediate buffer are created.
+ *   - This is the complement of store_pixels_packed.
  *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
  * @param self this object
- * @param x_arg x position of start of region
- * @param y_arg y position of start of region
- * @param cols_arg width of region
- * @param rows_arg height of region
- * @return An array of Magick::Pixel objects corresponding to the pixels in the
- * rectangle defined by the geometry parameters.
- * @see Image_store_pixels
+ * @return the pixels, channel by channel, in the storage type
+ * @see Image_store_pixels_packed
  */
 VALUE
-Image_get_pixels(VALUE self, VALUE x_arg, VALUE y_arg, VALUE cols_arg, VALUE rows_arg)
+Image_get_pixels_packed(int argc, VALUE *argv, VALUE self)
 {
     Image *image;
     const PixelPacket *pixels;
+    const IndexPacket *indexes = NULL;
     ExceptionInfo *exception;
-    long x, y;
+    long x, y, row;
     unsigned long columns, rows;
-    long size, n;
-    VALUE pixel_ary;
+    const char *map = "RGB";
+    StorageType type = CharPixel;
+    size_t map_l, row_l;
+    VALUE packed;
+    char *buffer;
 
     image = rm_check_destroyed(self);
-    x       = NUM2LONG(x_arg);
-    y       = NUM2LONG(y_arg);
-    columns = NUM2ULONG(cols_arg);
-    rows    = NUM2ULONG(rows_arg);
 
-    if ((x+columns) > image->columns || (y+rows) > image->rows)
+    switch (argc)
+    {
+        case 6:
+            VALUE_TO_ENUM(argv[5], type, StorageType);
+        case 5:
+            map = StringValuePtr(argv[4]);
+        case 4:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 4 to 6)", argc);
+            break;
+    }
+
+    x       = NUM2LONG(argv[0]);
+    y       = NUM2LONG(argv[1]);
+    columns = NUM2ULONG(argv[2]);
+    rows    = NUM2ULONG(argv[3]);
+
+    if (x < 0 || y < 0
+        || (unsigned long)x > image->columns || (unsigned long)y > image->rows
+        || columns > image->columns - x || rows > image->rows - y)
     {
         rb_raise(rb_eRangeError, "geometry (%lux%lu%+ld%+ld) exceeds image bounds"
                  , columns, rows, x, y);
     }
 
-    // Cast AcquireImagePixels to get rid of the const qualifier. We're not going
-    // to change the pixels but I don't want to make "pixels" const.
+    map_l = rm_check_packed_map(image, map);
+    row_l = columns * map_l * rm_packed_type_size(type);
+
+    packed = rb_str_new(NULL, (long)(row_l * rows));
+    buffer = RSTRING_PTR(packed);
+
     exception = AcquireExceptionInfo();
+
+    for (row = 0; row < (long)rows; row++)
+    {
 #if defined(HAVE_GETVIRTUALPIXELS)
-    pixels = GetVirtualPixels(image, x, y, columns, rows, exception);
+        pixels = GetVirtualPixels(image, x, y+row, columns, 1, exception);
 #else
-    pixels = AcquireImagePixels(image, x, y, columns, rows, exception);
+        pixels = AcquireImagePixels(image, x, y+row, columns, 1, exception);
 #endif
-    CHECK_EXCEPTION()
+        CHECK_EXCEPTION()
+        if (!pixels)
+        {
+            (void) DestroyExceptionInfo(exception);
+            rm_magick_error("can't get image pixels", NULL);
+        }
 
-    (void) DestroyExceptionInfo(exception);
+        if (image->colorspace == CMYKColorspace)
+        {
+#if defined(HAVE_GETVIRTUALINDEXQUEUE)
+            indexes = GetVirtualIndexQueue(image);
+#else
+            indexes = AcquireIndexes(image);
+#endif
+        }
 
-    // If the function failed, return a 0-length array.
-    if (!pixels)
-    {
-        return rb_ary_new();
+        rm_pack_pixels(image, pixels, indexes, columns, map, type, buffer + row*row_l);
     }
 
-    // Allocate an array big enough to contain the PixelPackets.
-    size = (long)(columns * rows);
-    pixel_ary = rb_ary_new2(size);
+    (void) DestroyExceptionInfo(exception);
 
-    // Convert the PixelPackets to Magick::Pixel objects
-    for (n = 0; n < size; n++)
-    {
-        rb_ary_store(pixel_ary, n, Pixel_from_PixelPacket(&pixels[n]));
-    }
+    RB_GC_GUARD(packed);
 
-    return pixel_ary;
+    return packed;
 }
 
 
@@ -7536,7 +9400,7 @@ Image_inspect(VALUE self)
     Image *image;
     char buffer[MaxTextExtent];          // image description buffer
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
     if (!image)
     {
         return rb_str_new2("#<Magick::Image: (destroyed)>");
@@ -7646,30 +9510,24 @@ DEF_ATTR_ACCESSOR(Image, iterations, int)
 /**
  * Adjust the levels of an image given these points: black, mid, and white.
  *
- * Ruby usage:
- *   - @verbatim Image#level @endverbatim
- *   - @verbatim Image#level(black_point) @endverbatim
- *   - @verbatim Image#level(black_point, white_point) @endverbatim
- *   - @verbatim Image#level(black_point, white_point, gamma) @endverbatim
- *
- * Notes:
- *   - Default black_point is 0.0
- *   - Default white_point is QuantumRange
- *   - Default gamma is 1.0
+ * No Ruby usage (internal function)
  *
+ * @param bang whether the bang (!) version of the method was called
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return a new image
+ * @return self if bang, otherwise a new image
+ * @see Image_level2
+ * @see Image_level2_bang
  */
-VALUE
-Image_level2(int argc, VALUE *argv, VALUE self)
+static VALUE
+level2(int bang, int argc, VALUE *argv, VALUE self)
 {
-    Image *image, *new_image;
+    Image *new_image;
     double black_point = 0.0, gamma_val = 1.0, white_point = (double)QuantumRange;
     char level[50];
 
-    image = rm_check_destroyed(self);
+    (void) rm_check_destroyed(self);
     switch (argc)
     {
         case 0:             // take all the defaults
@@ -7692,13 +9550,60 @@ Image_level2(int argc, VALUE *argv, VALUE self)
             break;
     }
 
-    new_image = rm_clone_image(image);
+    new_image = point_op_target(bang, self);
 
     sprintf(level, "%gx%g+%g", black_point, white_point, gamma_val);
     (void) LevelImage(new_image, level);
-    rm_check_image_exception(new_image, DestroyOnError);
+    return point_op_result(bang, self, new_image);
+}
 
-    return rm_image_new(new_image);
+
+/**
+ * Adjust the levels of an image given these points: black, mid, and white.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#level @endverbatim
+ *   - @verbatim Image#level(black_point) @endverbatim
+ *   - @verbatim Image#level(black_point, white_point) @endverbatim
+ *   - @verbatim Image#level(black_point, white_point, gamma) @endverbatim
+ *
+ * Notes:
+ *   - Default black_point is 0.0
+ *   - Default white_point is QuantumRange
+ *   - Default gamma is 1.0
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ * @see level2
+ */
+VALUE
+Image_level2(int argc, VALUE *argv, VALUE self)
+{
+    return level2(False, argc, argv, self);
+}
+
+
+/**
+ * Adjust the levels of the image in place.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#level! @endverbatim
+ *   - @verbatim Image#level!(black_point) @endverbatim
+ *   - @verbatim Image#level!(black_point, white_point) @endverbatim
+ *   - @verbatim Image#level!(black_point, white_point, gamma) @endverbatim
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see level2
+ */
+VALUE
+Image_level2_bang(int argc, VALUE *argv, VALUE self)
+{
+    return level2(True, argc, argv, self);
 }
 
 
@@ -8033,6 +9938,149 @@ Image_liquid_rescale(int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Read a 32-bit length written by dump_length.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param blob the dumped data, advanced past the length
+ * @param length the number of bytes left, reduced by 4
+ * @return the length
+ * @throw TypeError if the dump is too short
+ */
+static size_t
+load_length(const unsigned char **blob, long *length)
+{
+    const unsigned char *p = *blob;
+
+    if (*length < 4)
+    {
+        rb_raise(rb_eTypeError, "image is invalid or corrupted (too short)");
+    }
+
+    *blob += 4;
+    *length -= 4;
+    return ((size_t)p[0] << 24) | ((size_t)p[1] << 16) | ((size_t)p[2] << 8) | (size_t)p[3];
+}
+
+
+/**
+ * Read a string written by dump_string.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param blob the dumped data, advanced past the string
+ * @param length the number of bytes left, reduced by the string's size
+ * @return the string
+ * @throw TypeError if the dump is too short
+ */
+static VALUE
+load_string(const unsigned char **blob, long *length)
+{
+    size_t string_length = load_length(blob, length);
+    VALUE string;
+
+    if ((size_t)*length < string_length)
+    {
+        rb_raise(rb_eTypeError, "image is invalid or corrupted (too short)");
+    }
+
+    string = rb_str_new((const char *)*blob, (long)string_length);
+    *blob += string_length;
+    *length -= (long)string_length;
+    return string;
+}
+
+
+/**
+ * Construct an image from a version 2 dump.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The whole dump is checked before anything is allocated, so a
+ *     corrupted dump doesn't leak.
+ *
+ * @param magick the image's magick
+ * @param blob the dump, after the header
+ * @param length the length of the dump after the header
+ * @return the image
+ * @see Image__dump
+ */
+static Image *
+load_dumped_image(const char *magick, const unsigned char *blob, long length)
+{
+    Image *image;
+    ImageInfo *info;
+    ExceptionInfo *exception;
+    CompressionType compression;
+    size_t depth;
+    const unsigned char *pixels;
+    size_t pixels_length, count, n;
+    VALUE artifacts;
+
+    if (length < 2)
+    {
+        rb_raise(rb_eTypeError, "image is invalid or corrupted (too short)");
+    }
+    compression = (CompressionType) blob[0];
+    if (compression != UndefinedCompression
+        && strcmp(CompressionType_name(compression), "UndefinedCompression") == 0)
+    {
+        rb_raise(rb_eTypeError, "image is invalid or corrupted (unknown compression)");
+    }
+    depth = (size_t) blob[1];
+    if (depth < 1 || depth > 64)
+    {
+        rb_raise(rb_eTypeError, "image is invalid or corrupted (invalid depth)");
+    }
+    blob += 2;
+    length -= 2;
+
+    pixels_length = load_length(&blob, &length);
+    if ((size_t)length < pixels_length)
+    {
+        rb_raise(rb_eTypeError, "image is invalid or corrupted (too short)");
+    }
+    pixels = blob;
+    blob += pixels_length;
+    length -= (long)pixels_length;
+
+    count = load_length(&blob, &length);
+    artifacts = rb_ary_new();
+    for (n = 0; n < count; n++)
+    {
+        (void) rb_ary_push(artifacts, load_string(&blob, &length));
+        (void) rb_ary_push(artifacts, load_string(&blob, &length));
+    }
+
+    info = CloneImageInfo(NULL);
+    strcpy(info->magick, "MIFF");
+
+    exception = AcquireExceptionInfo();
+    image = BlobToImage(info, pixels, pixels_length, exception);
+    (void) DestroyImageInfo(info);
+
+    rm_check_exception(exception, image, DestroyOnError);
+    (void) DestroyExceptionInfo(exception);
+
+    rm_ensure_result(image);
+
+    strcpy(image->magick, magick);
+    image->compression = compression;
+    image->depth = depth;
+    for (n = 0; n < count; n++)
+    {
+        (void) SetImageArtifact(image, RSTRING_PTR(rb_ary_entry(artifacts, 2*n))
+                                , RSTRING_PTR(rb_ary_entry(artifacts, 2*n+1)));
+    }
+
+    RB_GC_GUARD(artifacts);
+
+    return image;
+}
+
+
 /**
  * Implement marshalling.
  *
@@ -8040,7 +10088,9 @@ Image_liquid_rescale(int argc, VALUE *argv, VALUE self)
  *   - @verbatim Image._load @endverbatim
  *
  * Notes:
- *   - calls BlobToImage
+ *   - Reads version 2 dumps, see Image__dump, and version 1 dumps, which
+ *     hold the image as a blob in its own format and are read with
+ *     BlobToImage.
  *
  * @param class Ruby class for Image
  * @param str the marshalled string
@@ -8059,8 +10109,6 @@ Image__load(VALUE class, VALUE str)
 
     class = class;  // Suppress "never referenced" message from icc
 
-    info = CloneImageInfo(NULL);
-
     blob = rm_str2cstr(str, &length);
 
     // Must be as least as big as the 1st 4 fields in DumpedImage
@@ -8078,12 +10126,13 @@ Image__load(VALUE class, VALUE str)
 
     mi.mj = ((DumpedImage *)blob)->mj;
     mi.mi = ((DumpedImage *)blob)->mi;
-    if (   mi.mj != DUMPED_IMAGE_MAJOR_VERS
-           || mi.mi > DUMPED_IMAGE_MINOR_VERS)
+    if (   !(mi.mj == DUMPED_IMAGE_MAJOR_VERS && mi.mi <= DUMPED_IMAGE_MINOR_VERS)
+           && !(mi.mj == DUMPED_IMAGE_V2_MAJOR_VERS && mi.mi <= DUMPED_IMAGE_V2_MINOR_VERS))
     {
         rb_raise(rb_eTypeError, "incompatible image format (can't be read)\n"
-                 "\tformat version %d.%d required; %d.%d given"
+                 "\tformat version %d.%d or %d.%d required; %d.%d given"
                  , DUMPED_IMAGE_MAJOR_VERS, DUMPED_IMAGE_MINOR_VERS
+                 , DUMPED_IMAGE_V2_MAJOR_VERS, DUMPED_IMAGE_V2_MINOR_VERS
                  , mi.mj, mi.mi);
     }
 
@@ -8095,21 +10144,33 @@ Image__load(VALUE class, VALUE str)
         rb_raise(rb_eTypeError, "image is invalid or corrupted (too short)");
     }
 
-    memcpy(info->magick, ((DumpedImage *)blob)->magick, mi.len);
-    info->magick[mi.len] = '\0';
-
-    exception = AcquireExceptionInfo();
+    memcpy(mi.magick, ((DumpedImage *)blob)->magick, mi.len);
+    mi.magick[mi.len] = '\0';
 
     blob += offsetof(DumpedImage,magick) + mi.len;
     length -= offsetof(DumpedImage,magick) + mi.len;
-    image = BlobToImage(info, blob, (size_t) length, exception);
-    (void) DestroyImageInfo(info);
 
-    rm_check_exception(exception, image, DestroyOnError);
+    if (mi.mj == DUMPED_IMAGE_V2_MAJOR_VERS)
+    {
+        image = load_dumped_image(mi.magick, (const unsigned char *)blob, length);
+    }
+    else
+    {
+        info = CloneImageInfo(NULL);
+        strcpy(info->magick, mi.magick);
+
+        exception = AcquireExceptionInfo();
+        image = BlobToImage(info, blob, (size_t) length, exception);
+        (void) DestroyImageInfo(info);
+
+        rm_check_exception(exception, image, DestroyOnError);
 
-    (void) DestroyExceptionInfo(exception);
+        (void) DestroyExceptionInfo(exception);
 
-    rm_ensure_result(image);
+        rm_ensure_result(image);
+    }
+
+    RB_GC_GUARD(str);
 
     return rm_image_new(image);
 }
@@ -8131,11 +10192,17 @@ magnify(int bang, VALUE self, magnifier_t magnifier)
     Image *image;
     Image *new_image;
     ExceptionInfo *exception;
+    flipper_args_t args;
 
-    Data_Get_Struct(self, Image, image);
+    image = rm_check_destroyed(self);
     exception = AcquireExceptionInfo();
 
-    new_image = (magnifier)(image, exception);
+    args.fp = magnifier;
+    args.image = ReferenceImage(image);
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(flipper_gvl, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -8145,7 +10212,10 @@ magnify(int bang, VALUE self, magnifier_t magnifier)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
 
@@ -8253,6 +10323,102 @@ Image_map(int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Replace each pixel in the image with the value returned by the block.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#map_pixels! { |pixel, x, y| ... } @endverbatim
+ *
+ * Notes:
+ *   - The block can return a Pixel or a color name.
+ *   - The same Pixel object is passed to the block for every pixel, so it can
+ *     be changed in place and returned. Use Pixel#dup to keep it.
+ *   - Each row is written back through GetAuthenticPixels and
+ *     SyncAuthenticPixels after the block has been called for all its pixels.
+ *     Memory use doesn't depend on the size of the image.
+ *
+ * @param self this object
+ * @return self
+ * @see Image_each_pixel
+ */
+VALUE
+Image_map_pixels_bang(VALUE self)
+{
+    Image *image;
+    unsigned long columns, rows;
+    long x, y;
+    VALUE keep, pixel_obj, new_pixel = Qnil;
+    PixelPacket *row, *pixels;
+    Pixel *pixel;
+    ExceptionInfo *exception;
+    unsigned int okay;
+
+    image = rm_check_frozen(self);
+    columns = image->columns;
+    rows = image->rows;
+
+    okay = SetImageStorageClass(image, DirectClass);
+    rm_check_image_exception(image, RetainOnError);
+    if (!okay)
+    {
+        rb_raise(Class_ImageMagickError, "SetImageStorageClass failed. Can't map pixels.");
+    }
+
+    // The row buffer is freed by the GC if the block raises
+    keep = rb_ary_new();
+    row = (PixelPacket *) rm_buffer_new(keep, columns * sizeof(PixelPacket));
+
+    pixel_obj = Pixel_from_PixelPacket(&image->background_color);
+    TypedData_Get_Struct(pixel_obj, Pixel, &rm_Pixel_data_type, pixel);
+
+    for (y = 0; y < (long)rows; y++)
+    {
+        (void) copy_pixel_row(self, y, columns, rows, row);
+        for (x = 0; x < (long)columns; x++)
+        {
+            *pixel = row[x];
+            new_pixel = rb_yield_values(3, pixel_obj, LONG2NUM(x), LONG2NUM(y));
+            Color_to_PixelPacket(&row[x], new_pixel);
+        }
+
+        // The block may have changed the image
+        image = rm_check_frozen(self);
+        if (image->columns != columns || image->rows != rows)
+        {
+            rb_raise(rb_eRuntimeError, "image size changed during iteration");
+        }
+
+        exception = AcquireExceptionInfo();
+#if defined(HAVE_GETAUTHENTICPIXELS)
+        pixels = GetAuthenticPixels(image, 0, y, columns, 1, exception);
+#else
+        pixels = GetImagePixels(image, 0, y, columns, 1);
+#endif
+        CHECK_EXCEPTION()
+        if (!pixels)
+        {
+            (void) DestroyExceptionInfo(exception);
+            rm_magick_error("can't store image pixels", NULL);
+        }
+
+        memcpy(pixels, row, columns * sizeof(PixelPacket));
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+        (void) SyncAuthenticPixels(image, exception);
+#else
+        (void) SyncImagePixels(image);
+#endif
+        CHECK_EXCEPTION()
+        (void) DestroyExceptionInfo(exception);
+    }
+
+    RB_GC_GUARD(keep);
+    RB_GC_GUARD(pixel_obj);
+    RB_GC_GUARD(new_pixel);
+
+    return self;
+}
+
+
 /**
  * Support Marshal.dump >= 1.8.
  *
@@ -8441,7 +10607,7 @@ Image_mask(int argc, VALUE *argv, VALUE self)
         rb_raise(rb_eArgError, "wrong number of arguments (expected 0 or 1, got %d)", argc);
     }
 
-    rb_check_frozen(self);
+    (void) rm_check_frozen(self);
     mask = argv[0];
 
     if (mask != Qnil)
@@ -8844,33 +11010,26 @@ Image_minify_bang(VALUE self)
 /**
  * Control the brightness, saturation, and hue of an image.
  *
- * Ruby usage:
- *   - @verbatim Image#modulate @endverbatim
- *   - @verbatim Image#modulate(brightness) @endverbatim
- *   - @verbatim Image#modulate(brightness, saturation) @endverbatim
- *   - @verbatim Image#modulate(brightness, saturation, hue) @endverbatim
- *
- * Notes:
- *   - Default brightness is 100.0
- *   - Default saturation is 100.0
- *   - Default hue is 100.0
- *   - all three arguments are optional and default to 100%
+ * No Ruby usage (internal function)
  *
+ * @param bang whether the bang (!) version of the method was called
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return a new image
+ * @return self if bang, otherwise a new image
+ * @see Image_modulate
+ * @see Image_modulate_bang
  */
-VALUE
-Image_modulate(int argc, VALUE *argv, VALUE self)
+static VALUE
+modulate(int bang, int argc, VALUE *argv, VALUE self)
 {
-    Image *image, *new_image;
+    Image *new_image;
     double pct_brightness = 100.0,
     pct_saturation = 100.0,
     pct_hue        = 100.0;
     char modulate[100];
 
-    image = rm_check_destroyed(self);
+    (void) rm_check_destroyed(self);
     switch (argc)
     {
         case 3:
@@ -8893,12 +11052,60 @@ Image_modulate(int argc, VALUE *argv, VALUE self)
     }
     sprintf(modulate, "%f%%,%f%%,%f%%", pct_brightness, pct_saturation, pct_hue);
 
-    new_image = rm_clone_image(image);
+    new_image = point_op_target(bang, self);
 
     (void) ModulateImage(new_image, modulate);
-    rm_check_image_exception(new_image, DestroyOnError);
+    return point_op_result(bang, self, new_image);
+}
 
-    return rm_image_new(new_image);
+
+/**
+ * Control the brightness, saturation, and hue of an image.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#modulate @endverbatim
+ *   - @verbatim Image#modulate(brightness) @endverbatim
+ *   - @verbatim Image#modulate(brightness, saturation) @endverbatim
+ *   - @verbatim Image#modulate(brightness, saturation, hue) @endverbatim
+ *
+ * Notes:
+ *   - Default brightness is 100.0
+ *   - Default saturation is 100.0
+ *   - Default hue is 100.0
+ *   - all three arguments are optional and default to 100%
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ * @see modulate
+ */
+VALUE
+Image_modulate(int argc, VALUE *argv, VALUE self)
+{
+    return modulate(False, argc, argv, self);
+}
+
+
+/**
+ * Change the brightness, saturation, and hue of the image in place.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#modulate! @endverbatim
+ *   - @verbatim Image#modulate!(brightness) @endverbatim
+ *   - @verbatim Image#modulate!(brightness, saturation) @endverbatim
+ *   - @verbatim Image#modulate!(brightness, saturation, hue) @endverbatim
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see modulate
+ */
+VALUE
+Image_modulate_bang(int argc, VALUE *argv, VALUE self)
+{
+    return modulate(True, argc, argv, self);
 }
 
 
@@ -8979,14 +11186,14 @@ DEF_ATTR_READER(Image, montage, str)
  * @see Image_sketch
  */
 static VALUE
-motion_blur(int argc, VALUE *argv, VALUE self
-            , Image *fp(const Image *, const double, const double, const double, ExceptionInfo *))
+motion_blur(int argc, VALUE *argv, VALUE self, motion_blurrer_t fp)
 {
     Image *image, *new_image;
     double radius = 0.0;
     double sigma = 1.0;
     double angle = 0.0;
     ExceptionInfo *exception;
+    motion_blurrer_args_t args;
 
     switch (argc)
     {
@@ -9008,10 +11215,18 @@ motion_blur(int argc, VALUE *argv, VALUE self
         rb_raise(rb_eArgError, "sigma must be != 0.0");
     }
 
-    Data_Get_Struct(self, Image, image);
+    image = rm_check_destroyed(self);
 
     exception = AcquireExceptionInfo();
-    new_image = (fp)(image, radius, sigma, angle, exception);
+    args.fp = fp;
+    args.image = ReferenceImage(image);
+    args.radius = radius;
+    args.sigma = sigma;
+    args.angle = angle;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(motion_blurrer_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -9053,28 +11268,25 @@ Image_motion_blur(int argc, VALUE *argv, VALUE self)
 
 
 /**
- * Negate the colors in the reference image. The grayscale option means that
- * only grayscale values within the image are negated.
- *
- * Ruby usage:
- *   - @verbatim Image#negate @endverbatim
- *   - @verbatim Image#negate(grayscale) @endverbatim
+ * Negate the colors in the reference image.
  *
- * Notes:
- *   - Default grayscale is false.
+ * No Ruby usage (internal function)
  *
+ * @param bang whether the bang (!) version of the method was called
  * @param argc number of input arguments
  * @param argv array of input arguments
  * @param self this object
- * @return a new image
+ * @return self if bang, otherwise a new image
+ * @see Image_negate
+ * @see Image_negate_bang
  */
-VALUE
-Image_negate(int argc, VALUE *argv, VALUE self)
+static VALUE
+negate(int bang, int argc, VALUE *argv, VALUE self)
 {
-    Image *image, *new_image;
+    Image *new_image;
     unsigned int grayscale = MagickFalse;
 
-    image = rm_check_destroyed(self);
+    (void) rm_check_destroyed(self);
     if (argc == 1)
     {
         grayscale = RTEST(argv[0]);
@@ -9084,12 +11296,54 @@ Image_negate(int argc, VALUE *argv, VALUE self)
         rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
     }
 
-    new_image = rm_clone_image(image);
+    new_image = point_op_target(bang, self);
 
     (void) NegateImage(new_image, grayscale);
-    rm_check_image_exception(new_image, DestroyOnError);
+    return point_op_result(bang, self, new_image);
+}
 
-    return rm_image_new(new_image);
+
+/**
+ * Negate the colors in the reference image. The grayscale option means that
+ * only grayscale values within the image are negated.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#negate @endverbatim
+ *   - @verbatim Image#negate(grayscale) @endverbatim
+ *
+ * Notes:
+ *   - Default grayscale is false.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ * @see negate
+ */
+VALUE
+Image_negate(int argc, VALUE *argv, VALUE self)
+{
+    return negate(False, argc, argv, self);
+}
+
+
+/**
+ * Negate the colors of the image in place.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#negate! @endverbatim
+ *   - @verbatim Image#negate!(grayscale) @endverbatim
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see negate
+ */
+VALUE
+Image_negate_bang(int argc, VALUE *argv, VALUE self)
+{
+    return negate(True, argc, argv, self);
 }
 
 
@@ -9135,7 +11389,7 @@ Image_negate_channel(int argc, VALUE *argv, VALUE self)
         grayscale = RTEST(argv[0]);
     }
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     new_image = rm_clone_image(image);
 
@@ -9163,7 +11417,7 @@ Image_alloc(VALUE class)
 {
     VALUE image_obj;
 
-    image_obj = Data_Wrap_Struct(class, NULL, rm_image_destroy, NULL);
+    image_obj = TypedData_Wrap_Struct(class, &rm_Image_data_type, NULL);
 
     RB_GC_GUARD(image_obj);
 
@@ -9207,10 +11461,11 @@ Image_initialize(int argc, VALUE *argv, VALUE self)
             rb_raise(rb_eArgError, "wrong number of arguments (%d for 2 or 3)", argc);
             break;
     }
+    rm_check_size_limits(cols, rows);
 
     // Create a new Info object to use when creating this image.
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
     image = AcquireImage(info);
     if (!image)
@@ -9266,8 +11521,10 @@ rm_image_new(Image *image)
     }
 
     (void) rm_trace_creation(image);
+    rm_image_memory_usage(image, 1);
+    rm_sync_managed_memory();
 
-    return Data_Wrap_Struct(Class_Image, NULL, rm_image_destroy, image);
+    return TypedData_Wrap_Struct(Class_Image, &rm_Image_data_type, image);
 }
 
 
@@ -9805,30 +12062,128 @@ Image_paint_transparent(int argc, VALUE *argv, VALUE self)
         rm_ensure_result(NULL);
     }
 
-    return rm_image_new(new_image);
-#else
-    argc = argc;    // defeat "unused parameter" messages
-    argv = argv;
-    self = self;
-    rm_not_implemented();
-    return(VALUE)0;
-#endif
+    return rm_image_new(new_image);
+#else
+    argc = argc;    // defeat "unused parameter" messages
+    argv = argv;
+    self = self;
+    rm_not_implemented();
+    return(VALUE)0;
+#endif
+}
+
+
+/**
+ * Return true if the image is PseudoClass and has 256 unique colors or less.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#palette? @endverbatim
+ *
+ * @param self this object
+ * @return true if palette, otherwise false
+ */
+VALUE
+Image_palette_q(VALUE self)
+{
+    return has_attribute(self, IsPaletteImage);
+}
+
+
+/**
+ * Return the filename of a persistent pixel cache, with an "mpc:" prefix.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param path the path
+ * @return the filename
+ */
+static VALUE
+mpc_filename(VALUE path)
+{
+    VALUE filename;
+
+    path = rb_rescue(rb_String, path, file_arg_rescue, path);
+    if (RSTRING_LEN(path) > 4 && LocaleNCompare(RSTRING_PTR(path), "mpc:", 4) == 0)
+    {
+        return path;
+    }
+
+    filename = rb_str_new2("mpc:");
+    (void) rb_str_append(filename, path);
+    if (RSTRING_LEN(filename) >= MaxTextExtent)
+    {
+        rb_raise(rb_eArgError, "path too long (%ld characters)", RSTRING_LEN(path));
+    }
+    return filename;
+}
+
+
+/**
+ * Write the image as an MPC persistent pixel cache.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#persist(path) @endverbatim
+ *
+ * Notes:
+ *   - Writes path and, next to it, the pixel cache file with the extension
+ *     .cache. Both files are needed by Image.map.
+ *   - Writing an MPC points the written image at the new pixel cache and
+ *     changes its format and filename, so a clone is written and the image
+ *     is left unchanged.
+ *
+ * @param self this object
+ * @param path the path of the .mpc file
+ * @return self
+ * @see Image_map_persisted
+ */
+VALUE
+Image_persist(VALUE self, VALUE path)
+{
+    Image *image;
+    VALUE mpc, copy;
+
+    image = rm_check_destroyed(self);
+    mpc = mpc_filename(path);
+
+    copy = rm_image_new(rm_clone_image(image));
+    (void) Image_write(copy, mpc);
+
+    RB_GC_GUARD(mpc);
+    RB_GC_GUARD(copy);
+
+    return self;
 }
 
 
 /**
- * Return true if the image is PseudoClass and has 256 unique colors or less.
+ * Open an MPC persistent pixel cache written by Image#persist.
  *
  * Ruby usage:
- *   - @verbatim Image#palette? @endverbatim
+ *   - @verbatim Image.map(path) @endverbatim
  *
- * @param self this object
- * @return true if palette, otherwise false
+ * Notes:
+ *   - Nothing is decoded. ImageMagick maps the .cache file read-only, so
+ *     processes that map the same file share its pages.
+ *   - The first change to the image's pixels copies them to a private
+ *     pixel cache (copy-on-write). The files aren't changed.
+ *   - The .cache file must not be changed or removed while it's mapped.
+ *   - Yields to a block to get Image::Info attributes, like Image.read.
+ *
+ * @param class the Ruby class for an Image
+ * @param path the path of the .mpc file
+ * @return a new image
+ * @see Image_persist
  */
 VALUE
-Image_palette_q(VALUE self)
+Image_map_persisted(VALUE class, VALUE path)
 {
-    return has_attribute(self, IsPaletteImage);
+    VALUE images;
+
+    images = rd_image(class, mpc_filename(path), decode_image, Qnil);
+
+    RB_GC_GUARD(images);
+
+    return rb_ary_entry(images, 0);
 }
 
 
@@ -9847,7 +12202,7 @@ Image_palette_q(VALUE self)
 VALUE
 Image_ping(VALUE class, VALUE file_arg)
 {
-    return rd_image(class, file_arg, PingImage);
+    return rd_image(class, file_arg, PingImage, Qnil);
 }
 
 
@@ -9886,7 +12241,7 @@ Image_pixel_color(int argc, VALUE *argv, VALUE self)
     switch (argc)
     {
         case 3:
-            rb_check_frozen(self);
+            (void) rm_check_frozen(self);
             set = True;
             // Replace with new color? The arg can be either a color name or
             // a Magick::Pixel.
@@ -10069,7 +12424,7 @@ Image_polaroid(int argc, VALUE *argv, VALUE self)
     }
 
     options = rm_polaroid_new();
-    Data_Get_Struct(options, Draw, draw);
+    TypedData_Get_Struct(options, Draw, &rm_Draw_data_type, draw);
 
     clone = rm_clone_image(image);
     clone->background_color = draw->shadow_color;
@@ -10687,16 +13042,69 @@ Image_raise(int argc, VALUE *argv, VALUE self)
  *
  * Ruby usage:
  *   - @verbatim Image.read(file) @endverbatim
+ *   - @verbatim Image.read(file, :size_hint => geometry) @endverbatim
+ *
+ * Notes:
+ *   - size_hint sets Info#decode_size
  *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
  * @param class the Ruby class for an Image
- * @param file_arg the file containing image data
  * @return an array of 1 or more new image objects
  * @see rd_image
  */
 VALUE
-Image_read(VALUE class, VALUE file_arg)
+Image_read(int argc, VALUE *argv, VALUE class)
+{
+    VALUE size_hint;
+
+    size_hint = get_size_hint(&argc, argv);
+    if (argc != 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1)", argc);
+    }
+    return rd_image(class, argv[0], decode_image, size_hint);
+}
+
+
+/**
+ * Extract the :size_hint option from the optional Hash argument of
+ * Image.read, Image.from_blob and Image.read_inline.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param argc number of input arguments, decremented if there's a Hash
+ * @param argv array of input arguments
+ * @return the size hint, or nil
+ * @throw ArgumentError if the Hash has any other key
+ */
+static VALUE
+get_size_hint(int *argc, VALUE *argv)
 {
-    return rd_image(class, file_arg, ReadImage);
+    VALUE opts, keys, key, size_hint;
+    long x;
+
+    if (*argc > 1 && TYPE(argv[*argc-1]) == T_HASH)
+    {
+        opts = argv[*argc-1];
+        *argc -= 1;
+
+        size_hint = ID2SYM(rb_intern("size_hint"));
+        keys = rb_funcall(opts, rb_intern("keys"), 0);
+        for (x = 0; x < RARRAY_LEN(keys); x++)
+        {
+            key = rb_ary_entry(keys, x);
+            if (key != size_hint)
+            {
+                rb_raise(rb_eArgError, "unknown option: %s", RSTRING_PTR(rb_inspect(key)));
+            }
+        }
+
+        RB_GC_GUARD(keys);
+
+        return rb_hash_aref(opts, size_hint);
+    }
+    return Qnil;
 }
 
 
@@ -10728,14 +13136,15 @@ file_arg_rescue(VALUE arg)
  *
  * @param class the Ruby class for an Image
  * @param file the file containing image data
- * @param reader which image reader to use (ReadImage or PingImage)
+ * @param reader which image reader to use (decode_image or PingImage)
+ * @param size_hint the decode size, or nil
  * @return an array of 1 or more new image objects
  * @see Image_read
  * @see Image_ping
  * @see array_from_images
  */
 static VALUE
-rd_image(VALUE class, VALUE file, reader_t reader)
+rd_image(VALUE class, VALUE file, reader_t reader, VALUE size_hint)
 {
     char *filename;
     long filename_l;
@@ -10743,12 +13152,17 @@ rd_image(VALUE class, VALUE file, reader_t reader)
     VALUE info_obj;
     Image *images;
     ExceptionInfo *exception;
+    reader_args_t args;
 
     class = class;  // defeat gcc message
 
     // Create a new Info structure for this read/ping
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
+    if (!NIL_P(size_hint))
+    {
+        (void) Info_decode_size_eq(info_obj, size_hint);
+    }
 
     if (TYPE(file) == T_FILE)
     {
@@ -10773,7 +13187,20 @@ rd_image(VALUE class, VALUE file, reader_t reader)
 
     exception = AcquireExceptionInfo();
 
-    images = (reader)(info, exception);
+    // Only release the GVL when ImageMagick opens the file itself. A Ruby IO
+    // could be closed by another thread while we're reading from it.
+    args.fp = reader;
+    args.info = info;
+    args.exception = exception;
+    if (info->file)
+    {
+        images = (Image *) reader_gvl(&args);
+    }
+    else
+    {
+        images = (Image *) rm_call_without_gvl(reader_gvl, &args);
+        rm_check_interrupts(exception, images);
+    }
     rm_check_exception(exception, images, DestroyOnError);
     rm_set_user_artifact(images, info);
     (void) DestroyExceptionInfo(exception);
@@ -10849,21 +13276,24 @@ Image_recolor(VALUE self, VALUE color_matrix)
  *
  * Ruby usage:
  *   - @verbatim Image.read_inline(content) @endverbatim
+ *   - @verbatim Image.read_inline(content, :size_hint => geometry) @endverbatim
  *
  * Notes:
  *   - This is similar to, but not the same as ReadInlineImage. ReadInlineImage
  *     requires a comma preceeding the image data. This method allows but does
  *     not require a comma.
+ *   - size_hint sets Info#decode_size
  *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
  * @param self this object
- * @param content the content
  * @return an array of new images
  * @see array_from_images
  */
 VALUE
-Image_read_inline(VALUE self, VALUE content)
+Image_read_inline(int argc, VALUE *argv, VALUE self)
 {
-    VALUE info_obj;
+    VALUE info_obj, size_hint;
     Image *images;
     ImageInfo *info;
     char *image_data;
@@ -10871,10 +13301,17 @@ Image_read_inline(VALUE self, VALUE content)
     unsigned char *blob;
     size_t blob_l;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(decode_blob) args;
 
     self = self;    // defeat gcc message
 
-    image_data = rm_str2cstr(content, &image_data_l);
+    size_hint = get_size_hint(&argc, argv);
+    if (argc != 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1)", argc);
+    }
+
+    image_data = rm_str2cstr(argv[0], &image_data_l);
 
     // Search for a comma. If found, we'll set the start of the
     // image data just following the comma. Otherwise we'll assume
@@ -10900,12 +13337,21 @@ Image_read_inline(VALUE self, VALUE content)
     exception = AcquireExceptionInfo();
 
     // Create a new Info structure for this read. About the
-    // only useful attribute that can be set is `format'.
+    // only useful attributes that can be set are `format' and `decode_size'.
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
+    if (!NIL_P(size_hint))
+    {
+        (void) Info_decode_size_eq(info_obj, size_hint);
+    }
 
-    images = BlobToImage(info, blob, blob_l, exception);
+    args.arg1 = info;
+    args.arg2 = blob;
+    args.arg3 = blob_l;
+    args.arg4 = exception;
+    images = (Image *) CALL_FUNC_WITHOUT_GVL(decode_blob, &args);
     magick_free((void *)blob);
+    rm_check_interrupts(exception, images);
 
     rm_check_exception(exception, images, DestroyOnError);
 
@@ -11102,8 +13548,9 @@ resample(int bang, int argc, VALUE *argv, VALUE self)
     double x_resolution, y_resolution, blur;
     double width, height;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(ResampleImage) args;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     // Set up defaults
     filter  = image->filter;
@@ -11150,7 +13597,15 @@ resample(int bang, int argc, VALUE *argv, VALUE self)
     }
 
     exception = AcquireExceptionInfo();
-    new_image = ResampleImage(image, x_resolution, y_resolution, filter, blur, exception);
+    args.arg1 = ReferenceImage(image);
+    args.arg2 = x_resolution;
+    args.arg3 = y_resolution;
+    args.arg4 = filter;
+    args.arg5 = blur;
+    args.arg6 = exception;
+    new_image = (Image *) CALL_FUNC_WITHOUT_GVL(ResampleImage, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -11160,7 +13615,10 @@ resample(int bang, int argc, VALUE *argv, VALUE self)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
     return rm_image_new(new_image);
@@ -11226,6 +13684,67 @@ Image_resample_bang(int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Get the arguments of Image#resize.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - With 1 argument, sets scale and sets columns and rows to 0. Otherwise
+ *     sets columns and rows and sets scale to 0.0.
+ *   - filter and blur are only set when they're given, so set them to the
+ *     defaults first.
+ *   - Also used for the resize operation of Image#pipeline and
+ *     ImageList#parallel_map.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param scale the scale factor
+ * @param columns the new number of columns
+ * @param rows the new number of rows
+ * @param filter the filter
+ * @param blur the blur factor
+ * @throw ArgumentError
+ */
+void
+rm_resize_args(int argc, VALUE *argv, double *scale, unsigned long *columns, unsigned long *rows
+               , FilterTypes *filter, double *blur)
+{
+    long c, r;
+
+    *scale = 0.0;
+    *columns = *rows = 0;
+
+    switch (argc)
+    {
+        case 4:
+            *blur = NUM2DBL(argv[3]);
+        case 3:
+            VALUE_TO_ENUM(argv[2], *filter, FilterTypes);
+        case 2:
+            r = NUM2LONG(argv[1]);
+            c = NUM2LONG(argv[0]);
+            if (c <= 0 || r <= 0)
+            {
+                rb_raise(rb_eArgError, "invalid result dimension (%ld, %ld given)", c, r);
+            }
+            *columns = (unsigned long) c;
+            *rows = (unsigned long) r;
+            break;
+        case 1:
+            *scale = NUM2DBL(argv[0]);
+            if (*scale < 0.0)
+            {
+                rb_raise(rb_eArgError, "invalid scale_arg value (%g given)", *scale);
+            }
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 to 4)", argc);
+            break;
+    }
+}
+
+
 /**
  * Scale an image to the desired dimensions using the specified filter and blur
  * factor.
@@ -11239,6 +13758,7 @@ Image_resample_bang(int argc, VALUE *argv, VALUE self)
  * @return self if bang, otherwise a new image
  * @see Image_resize
  * @see Image_resize_bang
+ * @see rm_resize_args
  */
 static VALUE
 resize(int bang, int argc, VALUE *argv, VALUE self)
@@ -11249,51 +13769,38 @@ resize(int bang, int argc, VALUE *argv, VALUE self)
     unsigned long rows, columns;
     double blur, drows, dcols;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(ResizeImage) args;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     // Set up defaults
     filter  = image->filter;
     blur    = image->blur;
-    rows    = image->rows;
-    columns = image->columns;
 
-    switch (argc)
+    rm_resize_args(argc, argv, &scale_arg, &columns, &rows, &filter, &blur);
+    if (argc == 1)
     {
-        case 4:
-            blur = NUM2DBL(argv[3]);
-        case 3:
-            VALUE_TO_ENUM(argv[2], filter, FilterTypes);
-        case 2:
-            rows = NUM2ULONG(argv[1]);
-            columns = NUM2ULONG(argv[0]);
-            if (columns == 0 || rows == 0)
-            {
-                rb_raise(rb_eArgError, "invalid result dimension (%lu, %lu given)", columns, rows);
-            }
-            break;
-        case 1:
-            scale_arg = NUM2DBL(argv[0]);
-            if (scale_arg < 0.0)
-            {
-                rb_raise(rb_eArgError, "invalid scale_arg value (%g given)", scale_arg);
-            }
-            drows = scale_arg * image->rows + 0.5;
-            dcols = scale_arg * image->columns + 0.5;
-            if (drows > (double)ULONG_MAX || dcols > (double)ULONG_MAX)
-            {
-                rb_raise(rb_eRangeError, "resized image too big");
-            }
-            rows = (unsigned long) drows;
-            columns = (unsigned long) dcols;
-            break;
-        default:
-            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 to 4)", argc);
-            break;
+        drows = scale_arg * image->rows + 0.5;
+        dcols = scale_arg * image->columns + 0.5;
+        if (drows > (double)ULONG_MAX || dcols > (double)ULONG_MAX)
+        {
+            rb_raise(rb_eRangeError, "resized image too big");
+        }
+        rows = (unsigned long) drows;
+        columns = (unsigned long) dcols;
     }
+    rm_check_size_limits(columns, rows);
 
     exception = AcquireExceptionInfo();
-    new_image = ResizeImage(image, columns, rows, filter, blur, exception);
+    args.arg1 = ReferenceImage(image);
+    args.arg2 = columns;
+    args.arg3 = rows;
+    args.arg4 = filter;
+    args.arg5 = blur;
+    args.arg6 = exception;
+    new_image = (Image *) CALL_FUNC_WITHOUT_GVL(ResizeImage, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -11303,7 +13810,10 @@ resize(int bang, int argc, VALUE *argv, VALUE self)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
     return rm_image_new(new_image);
@@ -11368,6 +13878,266 @@ Image_resize_bang(int argc, VALUE *argv, VALUE self)
 }
 
 
+//! One output of Image#resize_many
+typedef struct
+{
+    unsigned long columns;  /**< the width */
+    unsigned long rows;     /**< the height */
+    long source;            /**< the output it's resized from, -1 for the image */
+} ResizeOutput;
+
+//! Arguments for resize_many_gvl
+typedef struct
+{
+    Image *image;               /**< the image */
+    ResizeOutput *outputs;      /**< the outputs, in the order requested */
+    Image **results;            /**< the resized images, in the order requested */
+    long *order;                /**< the outputs, largest first */
+    long noutputs;              /**< the number of outputs */
+    FilterTypes filter;         /**< the filter */
+    double blur;                /**< the blur factor */
+    ExceptionInfo *exception;   /**< the exception */
+} ResizeMany;
+
+//! Resize the outputs largest first, without the GVL
+static void *resize_many_gvl(void *p)
+{
+    ResizeMany *many = (ResizeMany *)p;
+    ResizeOutput *output;
+    const Image *source;
+    long n, x;
+
+    for (n = 0; n < many->noutputs; n++)
+    {
+        x = many->order[n];
+        output = &many->outputs[x];
+        source = output->source < 0 ? many->image : many->results[output->source];
+        many->results[x] = ResizeImage(source, output->columns, output->rows, many->filter, many->blur, many->exception);
+        if (!many->results[x])
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Get the dimensions of one Image#resize_many output.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The size is [columns, rows] or just columns. A nil (or missing)
+ *     dimension keeps the aspect ratio of the image.
+ *
+ * @param image the image
+ * @param size the size
+ * @param output the output to set
+ */
+static void
+resize_output(const Image *image, VALUE size, ResizeOutput *output)
+{
+    VALUE cols, rows;
+    long c = 1, r = 1;
+    double d;
+
+    size = rb_Array(size);
+    if (RARRAY_LEN(size) < 1 || RARRAY_LEN(size) > 2)
+    {
+        rb_raise(rb_eArgError, "size must be [columns, rows] (%ld elements given)", RARRAY_LEN(size));
+    }
+    cols = rb_ary_entry(size, 0);
+    rows = rb_ary_entry(size, 1);
+    if (NIL_P(cols) && NIL_P(rows))
+    {
+        rb_raise(rb_eArgError, "size must have columns or rows");
+    }
+
+    if (!NIL_P(cols))
+    {
+        c = NUM2LONG(cols);
+    }
+    if (!NIL_P(rows))
+    {
+        r = NUM2LONG(rows);
+    }
+    if (c <= 0 || r <= 0)
+    {
+        rb_raise(rb_eArgError, "invalid result dimension (%ld, %ld given)", c, r);
+    }
+
+    if (NIL_P(cols))
+    {
+        output->rows = (unsigned long) r;
+        d = (double)output->rows * image->columns / image->rows + 0.5;
+        output->columns = d < 1.0 ? 1 : (unsigned long)d;
+    }
+    else if (NIL_P(rows))
+    {
+        output->columns = (unsigned long) c;
+        d = (double)output->columns * image->rows / image->columns + 0.5;
+        output->rows = d < 1.0 ? 1 : (unsigned long)d;
+    }
+    else
+    {
+        output->columns = (unsigned long) c;
+        output->rows = (unsigned long) r;
+    }
+    output->source = -1;
+}
+
+
+/**
+ * Resize the image to several sizes in one call.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#resize_many(sizes) @endverbatim
+ *   - @verbatim Image#resize_many(sizes, filter) @endverbatim
+ *   - @verbatim Image#resize_many(sizes, filter, blur) @endverbatim
+ *   - @verbatim Image#resize_many(sizes, filter, blur, exact) @endverbatim
+ *
+ * Notes:
+ *   - sizes is an Array of [columns, rows] sizes. Either dimension can be nil
+ *     to keep the aspect ratio, and a lone number is the columns.
+ *   - Default filter is image->filter
+ *   - Default blur is image->blur
+ *   - The outputs are made largest first, and each one is resized from the
+ *     smallest output already made that is at least RESIZE_CASCADE_RATIO times
+ *     its size in both dimensions, or else from the image. A filter pass over
+ *     a source that much bigger loses next to nothing, and costs a fraction
+ *     of a pass over the full image.
+ *   - If exact is true, every output is resized from the image, as if by
+ *     Image#resize.
+ *   - The whole cascade runs without the GVL.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return an imagelist of the outputs, in the order of sizes
+ * @see Image_resize
+ */
+VALUE
+Image_resize_many(int argc, VALUE *argv, VALUE self)
+{
+    Image *image, *images = NULL, *tail = NULL;
+    VALUE sizes, keep;
+    ResizeMany many;
+    ResizeOutput *output, *candidate;
+    int exact = False;
+    long m, n, best;
+
+    image = rm_check_destroyed(self);
+    many.filter = image->filter;
+    many.blur = image->blur;
+
+    switch (argc)
+    {
+        case 4:
+            exact = RTEST(argv[3]);
+        case 3:
+            many.blur = NUM2DBL(argv[2]);
+        case 2:
+            VALUE_TO_ENUM(argv[1], many.filter, FilterTypes);
+        case 1:
+            sizes = rb_Array(argv[0]);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 to 4)", argc);
+            break;
+    }
+
+    many.noutputs = RARRAY_LEN(sizes);
+    if (many.noutputs == 0)
+    {
+        rb_raise(rb_eArgError, "no sizes given");
+    }
+
+    // The tables and the results are owned by keep, so an exception can't
+    // leak them
+    keep = rb_ary_new();
+    many.outputs = (ResizeOutput *) rm_buffer_new(keep, (size_t) many.noutputs * sizeof(ResizeOutput));
+    many.order = (long *) rm_buffer_new(keep, (size_t) many.noutputs * sizeof(long));
+    many.results = rm_images_new(keep, many.noutputs);
+
+    // Sort the outputs largest first
+    for (n = 0; n < many.noutputs; n++)
+    {
+        resize_output(image, rb_ary_entry(sizes, n), &many.outputs[n]);
+        output = &many.outputs[n];
+        for (m = n; m > 0; m--)
+        {
+            candidate = &many.outputs[many.order[m-1]];
+            if ((double)candidate->columns * candidate->rows >= (double)output->columns * output->rows)
+            {
+                break;
+            }
+            many.order[m] = many.order[m-1];
+        }
+        many.order[m] = n;
+    }
+
+    // Pick the source of each output from the larger ones
+    for (n = 1; !exact && n < many.noutputs; n++)
+    {
+        output = &many.outputs[many.order[n]];
+        best = -1;
+        for (m = 0; m < n; m++)
+        {
+            candidate = &many.outputs[many.order[m]];
+            if (candidate->columns >= RESIZE_CASCADE_RATIO * output->columns
+                && candidate->rows >= RESIZE_CASCADE_RATIO * output->rows)
+            {
+                best = many.order[m];
+            }
+        }
+        output->source = best;
+    }
+
+    many.image = ReferenceImage(image);
+    many.exception = AcquireExceptionInfo();
+    (void) rm_call_without_gvl(resize_many_gvl, &many);
+    (void) rm_release_image(self, image);
+
+    // Take the outputs in the order requested, so they're destroyed together on error
+    for (n = 0; n < many.noutputs; n++)
+    {
+        if (many.results[n])
+        {
+            if (tail)
+            {
+                tail->next = many.results[n];
+                many.results[n]->previous = tail;
+            }
+            else
+            {
+                images = many.results[n];
+            }
+            tail = many.results[n];
+            many.results[n] = NULL;
+        }
+    }
+
+    rm_check_interrupts(many.exception, images);
+    if (many.exception->severity < ErrorException
+        && (!images || GetImageListLength(images) != (size_t)many.noutputs))
+    {
+        (void) ThrowMagickException(many.exception, GetMagickModule(), ResourceLimitError
+                             , "MemoryAllocationFailed", "`%s'", "resize_many");
+    }
+    rm_check_exception(many.exception, images, DestroyOnError);
+    (void) DestroyExceptionInfo(many.exception);
+
+    rm_ensure_result(images);
+
+    RB_GC_GUARD(sizes);
+    RB_GC_GUARD(keep);
+
+    return rm_imagelist_from_images(images);
+}
+
+
 /**
  * Offset an image as defined by x_offset and y_offset.
  *
@@ -11420,8 +14190,9 @@ rotate(int bang, int argc, VALUE *argv, VALUE self)
     char *arrow;
     long arrow_l;
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(RotateImage) args;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     switch (argc)
     {
@@ -11449,7 +14220,12 @@ rotate(int bang, int argc, VALUE *argv, VALUE self)
 
     exception = AcquireExceptionInfo();
 
-    new_image = RotateImage(image, degrees, exception);
+    args.arg1 = ReferenceImage(image);
+    args.arg2 = degrees;
+    args.arg3 = exception;
+    new_image = (Image *) CALL_FUNC_WITHOUT_GVL(RotateImage, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -11459,7 +14235,10 @@ rotate(int bang, int argc, VALUE *argv, VALUE self)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
     return rm_image_new(new_image);
@@ -11649,8 +14428,9 @@ scale(int bang, int argc, VALUE *argv, VALUE self, scaler_t scaler)
     unsigned long columns, rows;
     double scale_arg, drows, dcols;
     ExceptionInfo *exception;
+    scaler_args_t args;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     switch (argc)
     {
@@ -11682,8 +14462,16 @@ scale(int bang, int argc, VALUE *argv, VALUE self, scaler_t scaler)
             break;
     }
 
+    rm_check_size_limits(columns, rows);
     exception = AcquireExceptionInfo();
-    new_image = (scaler)(image, columns, rows, exception);
+    args.fp = scaler;
+    args.image = ReferenceImage(image);
+    args.columns = columns;
+    args.rows = rows;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(scaler_gvl, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -11693,7 +14481,10 @@ scale(int bang, int argc, VALUE *argv, VALUE self, scaler_t scaler)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
 
@@ -13032,7 +15823,7 @@ Image_store_pixels(VALUE self, VALUE x_arg, VALUE y_arg, VALUE cols_arg
             for (n = 0; n < size; n++)
             {
                 new_pixel = rb_ary_entry(new_pixels, n);
-                Data_Get_Struct(new_pixel, Pixel, pixel);
+                TypedData_Get_Struct(new_pixel, Pixel, &rm_Pixel_data_type, pixel);
                 pixels[n] = *pixel;
             }
 #if defined(HAVE_SYNCAUTHENTICPIXELS)
@@ -13055,6 +15846,160 @@ Image_store_pixels(VALUE self, VALUE x_arg, VALUE y_arg, VALUE cols_arg
 }
 
 
+/**
+ * Replace the pixels in the specified rectangle with pixels from a packed
+ * binary String.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#store_pixels_packed(x, y, columns, rows, packed) @endverbatim
+ *   - @verbatim Image#store_pixels_packed(x, y, columns, rows, packed, map) @endverbatim
+ *   - @verbatim Image#store_pixels_packed(x, y, columns, rows, packed, map, type) @endverbatim
+ *
+ * Notes:
+ *   - Default map is "RGB"
+ *   - Default type is Magick::CharPixel
+ *   - The pixels are written one row at a time straight into the pixel
+ *     cache.
+ *   - This is the complement of get_pixels_packed. The String returned by
+ *     get_pixels_packed is suitable for use as the "packed" argument.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ * @see Image_get_pixels_packed
+ */
+VALUE
+Image_store_pixels_packed(int argc, VALUE *argv, VALUE self)
+{
+    Image *image;
+    PixelPacket *pixels;
+    IndexPacket *indexes = NULL;
+    long x, y, row;
+    unsigned long columns, rows;
+    const char *map = "RGB";
+    StorageType type = CharPixel;
+    size_t map_l, row_l;
+    VALUE packed;
+    char *buffer;
+    long buffer_l;
+    const char *p;
+    unsigned int okay;
+#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_GETAUTHENTICPIXELS)
+    ExceptionInfo *exception;
+#endif
+
+    image = rm_check_frozen(self);
+
+    switch (argc)
+    {
+        case 7:
+            VALUE_TO_ENUM(argv[6], type, StorageType);
+        case 6:
+            map = StringValuePtr(argv[5]);
+        case 5:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 5 to 7)", argc);
+            break;
+    }
+
+    x       = NUM2LONG(argv[0]);
+    y       = NUM2LONG(argv[1]);
+    columns = NUM2ULONG(argv[2]);
+    rows    = NUM2ULONG(argv[3]);
+
+    if (x < 0 || y < 0
+        || (unsigned long)x > image->columns || (unsigned long)y > image->rows
+        || columns > image->columns - x || rows > image->rows - y)
+    {
+        rb_raise(rb_eRangeError, "geometry (%lux%lu%+ld%+ld) exceeds image bounds"
+                 , columns, rows, x, y);
+    }
+
+    map_l = rm_check_packed_map(image, map);
+    row_l = columns * map_l * rm_packed_type_size(type);
+
+    packed = argv[4];
+    buffer = rm_str2cstr(packed, &buffer_l);
+    if ((unsigned long)buffer_l < row_l * rows)
+    {
+        rb_raise(rb_eArgError, "packed pixels too short (need %lu bytes, got %ld)"
+                 , (unsigned long)(row_l * rows), buffer_l);
+    }
+
+    okay = SetImageStorageClass(image, DirectClass);
+    rm_check_image_exception(image, RetainOnError);
+    if (!okay)
+    {
+        rb_raise(Class_ImageMagickError, "SetImageStorageClass failed. Can't store pixels.");
+    }
+
+    // Storing alpha or opacity values turns on the alpha channel
+    for (p = map; *p; p++)
+    {
+        if (toupper(*p) == 'A' || toupper(*p) == 'O')
+        {
+            if (!image->matte)
+            {
+                (void) SetImageOpacity(image, OpaqueOpacity);
+                rm_check_image_exception(image, RetainOnError);
+            }
+            break;
+        }
+    }
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_GETAUTHENTICPIXELS)
+    exception = AcquireExceptionInfo();
+#endif
+
+    for (row = 0; row < (long)rows; row++)
+    {
+#if defined(HAVE_GETAUTHENTICPIXELS)
+        pixels = GetAuthenticPixels(image, x, y+row, columns, 1, exception);
+        CHECK_EXCEPTION()
+#else
+        pixels = GetImagePixels(image, x, y+row, columns, 1);
+        rm_check_image_exception(image, RetainOnError);
+#endif
+        if (!pixels)
+        {
+#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_GETAUTHENTICPIXELS)
+            (void) DestroyExceptionInfo(exception);
+#endif
+            rm_magick_error("can't store image pixels", NULL);
+        }
+
+        if (image->colorspace == CMYKColorspace)
+        {
+#if defined(HAVE_GETAUTHENTICINDEXQUEUE)
+            indexes = GetAuthenticIndexQueue(image);
+#else
+            indexes = GetIndexes(image);
+#endif
+        }
+
+        unpack_pixels(pixels, indexes, columns, map, type, buffer + row*row_l);
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+        SyncAuthenticPixels(image, exception);
+        CHECK_EXCEPTION()
+#else
+        SyncImagePixels(image);
+        rm_check_image_exception(image, RetainOnError);
+#endif
+    }
+
+#if defined(HAVE_SYNCAUTHENTICPIXELS) || defined(HAVE_GETAUTHENTICPIXELS)
+    (void) DestroyExceptionInfo(exception);
+#endif
+
+    RB_GC_GUARD(packed);
+
+    return self;
+}
+
+
 /**
  * Strips an image of all profiles and comments.
  *
@@ -13230,6 +16175,33 @@ Image_texture_flood_fill(VALUE self, VALUE color_obj, VALUE texture_obj
 }
 
 
+/**
+ * Change the value of individual pixels based on the intensity of each pixel
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param bang whether the bang (!) version of the method was called
+ * @param self this object
+ * @param threshold the threshold
+ * @return self if bang, otherwise a new image
+ * @see Image_threshold
+ * @see Image_threshold_bang
+ */
+static VALUE
+bilevel_threshold(int bang, VALUE self, VALUE threshold)
+{
+    Image *new_image;
+    double level;
+
+    (void) rm_check_destroyed(self);
+    level = NUM2DBL(threshold);
+    new_image = point_op_target(bang, self);
+
+    (void) BilevelImageChannel(new_image, DefaultChannels, level);
+    return point_op_result(bang, self, new_image);
+}
+
+
 /**
  * Change the value of individual pixels based on the intensity of each pixel
  * compared to threshold. The result is a high-contrast, two color image.
@@ -13240,19 +16212,30 @@ Image_texture_flood_fill(VALUE self, VALUE color_obj, VALUE texture_obj
  * @param self this object
  * @param threshold the threshold
  * @return a new image
+ * @see bilevel_threshold
  */
 VALUE
 Image_threshold(VALUE self, VALUE threshold)
 {
-    Image *image, *new_image;
-
-    image = rm_check_destroyed(self);
-    new_image = rm_clone_image(image);
+    return bilevel_threshold(False, self, threshold);
+}
 
-    (void) BilevelImageChannel(new_image, DefaultChannels, NUM2DBL(threshold));
-    rm_check_image_exception(new_image, DestroyOnError);
 
-    return rm_image_new(new_image);
+/**
+ * Threshold the image in place.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#threshold!(threshold) @endverbatim
+ *
+ * @param self this object
+ * @param threshold the threshold
+ * @return self
+ * @see bilevel_threshold
+ */
+VALUE
+Image_threshold_bang(VALUE self, VALUE threshold)
+{
+    return bilevel_threshold(True, self, threshold);
 }
 
 
@@ -13336,8 +16319,9 @@ thumbnail(int bang, int argc, VALUE *argv, VALUE self)
     unsigned long columns, rows;
     double scale_arg, drows, dcols;
     ExceptionInfo *exception;
+    scaler_args_t args;
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     switch (argc)
     {
@@ -13369,8 +16353,16 @@ thumbnail(int bang, int argc, VALUE *argv, VALUE self)
             break;
     }
 
+    rm_check_size_limits(columns, rows);
     exception = AcquireExceptionInfo();
-    new_image = ThumbnailImage(image, columns, rows, exception);
+    args.fp = ThumbnailImage;
+    args.image = ReferenceImage(image);
+    args.columns = columns;
+    args.rows = rows;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(scaler_gvl, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -13380,7 +16372,10 @@ thumbnail(int bang, int argc, VALUE *argv, VALUE self)
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
 
@@ -13388,6 +16383,42 @@ thumbnail(int bang, int argc, VALUE *argv, VALUE self)
 }
 
 
+/**
+ * Make a thumbnail that fits a geometry string.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The geometry is interpreted the way Image#change_geometry interprets
+ *     it, so "100x100" fits the image within 100x100 keeping its aspect ratio.
+ *   - Uses the same ThumbnailImage as Image#thumbnail.
+ *   - Doesn't call Ruby, so it can be called without the GVL.
+ *
+ * @param image the image
+ * @param geometry the geometry string
+ * @param exception the exception info
+ * @return a new image, or NULL if there was an error
+ * @see thumbnail
+ */
+Image *
+rm_thumbnail_image(Image *image, const char *geometry, ExceptionInfo *exception)
+{
+    RectangleInfo rect;
+
+    memset(&rect, 0, sizeof(rect));
+    SetGeometry(image, &rect);
+    if (ParseMetaGeometry(geometry, &rect.x, &rect.y, &rect.width, &rect.height) == NoValue
+        || rect.width == 0 || rect.height == 0)
+    {
+        (void) ThrowMagickException(exception, GetMagickModule(), OptionError,
+                                    "InvalidGeometry", "`%s'", geometry);
+        return NULL;
+    }
+
+    return ThumbnailImage(image, rect.width, rect.height, exception);
+}
+
+
 /**
  * Fast resize for thumbnail images.
  *
@@ -13541,7 +16572,7 @@ Image_tint(int argc, VALUE *argv, VALUE self)
             "%g,%g,%g,%g", red_pct_opaque*100.0, green_pct_opaque*100.0
             , blue_pct_opaque*100.0, alpha_pct_opaque*100.0);
 
-    Data_Get_Struct(argv[0], Pixel, tint);
+    TypedData_Get_Struct(argv[0], Pixel, &rm_Pixel_data_type, tint);
     exception = AcquireExceptionInfo();
 
     new_image = TintImage(image, opacity, *tint, exception);
@@ -13579,12 +16610,13 @@ Image_to_blob(VALUE self)
     void *blob = NULL;
     size_t length = 2048;       // Do what Magick++ does
     ExceptionInfo *exception;
+    GVL_STRUCT_TYPE(ImageToBlob) args;
 
     // The user can specify the depth (8 or 16, if the format supports
     // both) and the image format by setting the depth and format
     // values in the info parm block.
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
     image = rm_check_destroyed(self);
 
@@ -13625,7 +16657,13 @@ Image_to_blob(VALUE self)
 
     rm_sync_image_options(image, info);
 
-    blob = ImageToBlob(info, image, &length, exception);
+    args.arg1 = info;
+    args.arg2 = ReferenceImage(image);
+    args.arg3 = &length;
+    args.arg4 = exception;
+    blob = CALL_FUNC_WITHOUT_GVL(ImageToBlob, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, NULL);
     CHECK_EXCEPTION()
 
     (void) DestroyExceptionInfo(exception);
@@ -13669,7 +16707,7 @@ Image_to_color(VALUE self, VALUE pixel_arg)
     char name[MaxTextExtent];
 
     image = rm_check_destroyed(self);
-    Data_Get_Struct(pixel_arg, Pixel, pixel);
+    TypedData_Get_Struct(pixel_arg, Pixel, &rm_Pixel_data_type, pixel);
     exception = AcquireExceptionInfo();
 
     // QueryColorname returns False if the color represented by the PixelPacket
@@ -14006,7 +17044,7 @@ trimmer(int bang, int argc, VALUE *argv, VALUE self)
             break;
     }
 
-    Data_Get_Struct(self, Image, image);
+    TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
     exception = AcquireExceptionInfo();
     new_image = TrimImage(image, exception);
@@ -14635,7 +17673,8 @@ Image_watermark(int argc, VALUE *argv, VALUE self)
 #endif
 
     new_image = rm_clone_image(image);
-    (void) CompositeImage(new_image, ModulateCompositeOp, overlay, x_offset, y_offset);
+    (void) composite_layer(Qnil, new_image, DefaultChannels, ModulateCompositeOp, overlay, x_offset, y_offset, 0, 0);
+    rm_check_interrupts(NULL, new_image);
 
     rm_check_image_exception(new_image, DestroyOnError);
 
@@ -14992,11 +18031,12 @@ Image_write(VALUE self, VALUE file)
     Image *image;
     Info *info;
     VALUE info_obj;
+    GVL_STRUCT_TYPE(WriteImage) args;
 
     image = rm_check_destroyed(self);
 
     info_obj = rm_info_new();
-    Data_Get_Struct(info_obj, Info, info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
 
     if (TYPE(file) == T_FILE)
     {
@@ -15024,8 +18064,24 @@ Image_write(VALUE self, VALUE file)
     rm_sync_image_options(image, info);
 
     info->adjoin = MagickFalse;
-    (void) WriteImage(info, image);
-    rm_check_image_exception(image, RetainOnError);
+    args.arg1 = info;
+    args.arg2 = image;
+    // Keep the GVL when writing to a Ruby IO (see rd_image)
+    if (info->file)
+    {
+        (void) GVL_FUNC(WriteImage)(&args);
+    }
+    else
+    {
+        args.arg2 = ReferenceImage(image);
+        (void) CALL_FUNC_WITHOUT_GVL(WriteImage, &args);
+        image = rm_release_image(self, image);
+        rm_check_interrupts(NULL, NULL);
+    }
+    if (image)
+    {
+        rm_check_image_exception(image, RetainOnError);
+    }
 
     RB_GC_GUARD(info_obj);
 
@@ -15092,7 +18148,7 @@ cropper(int bang, int argc, VALUE *argv, VALUE self)
     switch (argc)
     {
         case 5:
-            Data_Get_Struct(self, Image, image);
+            TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
             VALUE_TO_ENUM(argv[0], gravity, GravityType);
 
@@ -15161,7 +18217,7 @@ cropper(int bang, int argc, VALUE *argv, VALUE self)
             columns = NUM2ULONG(width);
             rows    = NUM2ULONG(height);
 
-            Data_Get_Struct(self, Image, image);
+            TypedData_Get_Struct(self, Image, &rm_Image_data_type, image);
 
             switch (gravity)
             {
@@ -15223,7 +18279,7 @@ cropper(int bang, int argc, VALUE *argv, VALUE self)
     cropped = xform_image(bang, self, x, y, width, height, CropImage);
     if (reset_page)
     {
-        Data_Get_Struct(cropped, Image, image);
+        TypedData_Get_Struct(cropped, Image, &rm_Image_data_type, image);
         ResetImagePage(image, "0x0+0+0");
     }
 
@@ -15256,8 +18312,9 @@ xform_image(int bang, VALUE self, VALUE x, VALUE y, VALUE width, VALUE height, x
     Image *image, *new_image;
     RectangleInfo rect;
     ExceptionInfo *exception;
+    xformer_args_t args;
 
-    Data_Get_Struct(self, Image, image);
+    image = rm_check_destroyed(self);
     rect.x      = NUM2LONG(x);
     rect.y      = NUM2LONG(y);
     rect.width  = NUM2ULONG(width);
@@ -15265,10 +18322,19 @@ xform_image(int bang, VALUE self, VALUE x, VALUE y, VALUE width, VALUE height, x
 
     exception = AcquireExceptionInfo();
 
-    new_image = (xformer)(image, &rect, exception);
+    args.fp = xformer;
+    args.image = ReferenceImage(image);
+    args.rect = &rect;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(xformer_gvl, &args);
+    image = rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
 
     // An exception can occur in either the old or the new images
-    rm_check_image_exception(image, RetainOnError);
+    if (image)
+    {
+        rm_check_image_exception(image, RetainOnError);
+    }
     rm_check_exception(exception, new_image, DestroyOnError);
 
     (void) DestroyExceptionInfo(exception);
@@ -15278,7 +18344,10 @@ xform_image(int bang, VALUE self, VALUE x, VALUE y, VALUE width, VALUE height, x
     if (bang)
     {
         UPDATE_DATA_PTR(self, new_image);
-        (void) rm_image_destroy(image);
+        if (image)
+        {
+            (void) rm_image_destroy(image);
+        }
         return self;
     }
 
@@ -15391,11 +18460,15 @@ static void call_trace_proc(Image *image, const char *which)
  *
  * No Ruby usage (internal function)
  *
+ * Notes:
+ *   - Also counts the image for Magick.memory_stats
+ *
  * @param image the image
  * @see call_trace_proc
  */
 void rm_trace_creation(Image *image)
 {
+    rm_count_image_created(image);
     call_trace_proc(image, "c");
 }
 
@@ -15420,8 +18493,127 @@ void rm_image_destroy(void *img)
     if (img != NULL)
     {
         call_trace_proc(image, "d");
+        rm_count_image_destroyed(image);
+        rm_forget_pinned(image);
+        rm_image_memory_usage(image, -1);
         (void) DestroyImage(image);
     }
 }
 
 
+/**
+ * Let go of the reference to an image that was taken with ReferenceImage
+ * before releasing the GVL, and return the image that self holds now.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Another thread may have destroyed or replaced self's image while the
+ *     GVL was released, in which case image may be freed here. Use the
+ *     return value instead. It is NULL if self was destroyed.
+ *
+ * @param self the image object, or Qnil if image doesn't belong to self
+ * @param image the image
+ * @return the image in self, or NULL
+ */
+Image *rm_release_image(VALUE self, Image *image)
+{
+    Image *current = NIL_P(self) ? NULL : (Image *)DATA_PTR(self);
+
+    (void) DestroyImage(image);
+    return current;
+}
+
+
+/**
+ * Return the number of bytes used by an image. Used as the dsize function of
+ * the Magick::Image data type, so ObjectSpace.memsize_of reports it.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Counts the pixel cache (pixels and indexes), the colormap, and the
+ *     blob if it is in memory.
+ *
+ * @param img the image
+ * @return the size in bytes
+ */
+size_t rm_image_memsize(const void *img)
+{
+    const Image *image = (const Image *)img;
+    size_t size, pixels;
+
+    if (img == NULL)
+    {
+        return 0;
+    }
+
+    size = sizeof(Image);
+    pixels = (size_t)image->columns * (size_t)image->rows;
+    size += pixels * sizeof(PixelPacket);
+    if (image->storage_class == PseudoClass || image->colorspace == CMYKColorspace)
+    {
+        size += pixels * sizeof(IndexPacket);
+    }
+    if (image->colormap)
+    {
+        size += image->colors * sizeof(PixelPacket);
+    }
+    if (GetBlobStreamData(image))
+    {
+        size += (size_t) GetBlobSize(image);
+    }
+
+    return size;
+}
+
+
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+//! The size reported to the GC for each wrapped image, keyed by Image *
+static st_table *reported_sizes = NULL;
+#endif
+
+/**
+ * Tell the GC that an image was wrapped (direction > 0) or destroyed
+ * (direction < 0), so that big pixel caches add to the GC's malloc pressure.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Does nothing if Ruby doesn't have rb_gc_adjust_memory_usage.
+ *   - The size added is remembered and the same size is subtracted later.
+ *     In-place operations such as crop! change what rm_image_memsize
+ *     returns, so it can't be recomputed.
+ *   - Only images that were added are subtracted, so it is safe to call
+ *     this for an image that was never wrapped.
+ *
+ * @param image the image
+ * @param direction 1 or -1
+ */
+void rm_image_memory_usage(const Image *image, int direction)
+{
+#if defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+    st_data_t key = (st_data_t)image, size = 0;
+
+    if (!reported_sizes)
+    {
+        reported_sizes = st_init_numtable();
+    }
+
+    if (st_delete(reported_sizes, &key, &size))
+    {
+        rb_gc_adjust_memory_usage(-(ssize_t)size);
+    }
+    if (direction > 0)
+    {
+        size = (st_data_t) rm_image_memsize(image);
+        st_insert(reported_sizes, (st_data_t)image, size);
+        rb_gc_adjust_memory_usage((ssize_t)size);
+    }
+#else
+    image = image;              // defeat "unused argument" message
+    direction = direction;
+#endif
+}
+
+
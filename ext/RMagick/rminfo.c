@@ -32,7 +32,7 @@ get_option(VALUE self, const char *key)
     Info *info;
     const char *value;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     value = GetImageOption(info, key);
     if (value)
@@ -60,7 +60,7 @@ set_option(VALUE self, const char *key, VALUE string)
     Info *info;
     char *value;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(string))
     {
@@ -96,7 +96,7 @@ static VALUE set_color_option(VALUE self, const char *option, VALUE color)
     ExceptionInfo *exception;
     MagickBooleanType okay;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(color))
     {
@@ -140,7 +140,7 @@ static VALUE get_dbl_option(VALUE self, const char *option)
     double d;
     long n;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     value = GetImageOption(info, option);
     if (!value)
@@ -175,7 +175,7 @@ static VALUE set_dbl_option(VALUE self, const char *option, VALUE value)
     long n;
     int len;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(value))
     {
@@ -280,7 +280,7 @@ Info_aref(int argc, VALUE *argv, VALUE self)
 
     }
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     value = GetImageOption(info, fkey);
     if (!value)
     {
@@ -324,7 +324,7 @@ Info_aset(int argc, VALUE *argv, VALUE self)
     unsigned int okay;
 
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     switch (argc)
     {
@@ -426,7 +426,7 @@ Info_authenticate(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     if (info->authenticate)
     {
         return rb_str_new2(info->authenticate);
@@ -455,7 +455,7 @@ Info_authenticate_eq(VALUE self, VALUE passwd)
     char *passwd_p = NULL;
     long passwd_l = 0;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (!NIL_P(passwd))
     {
@@ -491,7 +491,7 @@ Info_background_color(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return rm_pixelpacket_to_color_name_info(info, &info->background_color);
 }
 
@@ -516,7 +516,7 @@ Info_background_color_eq(VALUE self, VALUE bc_arg)
     Info *info;
     //char colorname[MaxTextExtent];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     Color_to_PixelPacket(&info->background_color, bc_arg);
     //SetImageOption(info, "background", pixel_packet_to_hexname(&info->background_color, colorname));
     return self;
@@ -537,7 +537,7 @@ Info_border_color(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return rm_pixelpacket_to_color_name_info(info, &info->border_color);
 }
 
@@ -561,7 +561,7 @@ Info_border_color_eq(VALUE self, VALUE bc_arg)
     Info *info;
     //char colorname[MaxTextExtent];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     Color_to_PixelPacket(&info->border_color, bc_arg);
     //SetImageOption(info, "bordercolor", pixel_packet_to_hexname(&info->border_color, colorname));
     return self;
@@ -634,7 +634,7 @@ Info_channel(int argc, VALUE *argv, VALUE self)
         raise_ChannelType_error(argv[argc-1]);
     }
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     info->channel = channels;
     return self;
@@ -655,7 +655,7 @@ Info_colorspace(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return ColorspaceType_new(info->colorspace);
 }
 
@@ -675,7 +675,7 @@ Info_colorspace_eq(VALUE self, VALUE colorspace)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     VALUE_TO_ENUM(colorspace, info->colorspace, ColorspaceType);
     return self;
 }
@@ -696,7 +696,7 @@ Info_compression(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return CompressionType_new(info->compression);
 }
 
@@ -716,11 +716,102 @@ Info_compression_eq(VALUE self, VALUE type)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     VALUE_TO_ENUM(type, info->compression, CompressionType);
     return self;
 }
 
+/**
+ * Get the decode size.
+ *
+ * Ruby usage:
+ *   - @verbatim Info#decode_size @endverbatim
+ *
+ * @param self this object
+ * @return the decode size, or nil
+ * @see Info_decode_size_eq
+ */
+VALUE
+Info_decode_size(VALUE self)
+{
+    Info *info;
+    const char *size;
+
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
+    size = GetImageOption(info, "rmagick:decode-size");
+    return size ? rb_str_new2(size) : Qnil;
+}
+
+/**
+ * Set the decode size, the smallest size (either as a Geometry object or a
+ * Geometry string, i.e. WxH) that a read needs.
+ *
+ * Ruby usage:
+ *   - @verbatim Info#decode_size= @endverbatim
+ *
+ * Notes:
+ *   - Lets the decoder make a smaller image than the one in the file, but
+ *     never smaller than the decode size. JPEG uses DCT scaling (jpeg:size),
+ *     JPEG 2000 reads a reduced resolution level, and ICO and PTIF read only
+ *     the smallest sub-image that's at least the decode size.
+ *   - Image.read, Image.from_blob, Image.read_inline and ImageList#read also
+ *     accept a :size_hint option that sets the decode size.
+ *   - The size is in pixels; percentages aren't accepted.
+ *   - A jpeg:size set with Info#define or Info#[]= is left alone. Only the
+ *     jpeg:size set by this method is replaced or removed.
+ *
+ * @param self this object
+ * @param size_arg the decode size
+ * @return self
+ * @throw ArgumentError
+ */
+VALUE
+Info_decode_size_eq(VALUE self, VALUE size_arg)
+{
+    Info *info;
+    VALUE size = Qnil;
+    char *sz = NULL;
+    const char *old_size, *jpeg_size;
+    MagickBooleanType own_jpeg_size;
+
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
+
+    if (!NIL_P(size_arg))
+    {
+        size = rm_to_s(size_arg);
+        sz = StringValuePtr(size);
+        if (!IsGeometry(sz) || strchr(sz, '%'))
+        {
+            rb_raise(rb_eArgError, "invalid decode size geometry: %s", sz);
+        }
+    }
+
+    // jpeg:size is ours if it still has the value this method gave it
+    old_size = GetImageOption(info, "rmagick:decode-size");
+    jpeg_size = GetImageOption(info, "jpeg:size");
+    own_jpeg_size = !jpeg_size || (old_size && strcmp(old_size, jpeg_size) == 0);
+
+    if (own_jpeg_size)
+    {
+        (void) RemoveImageOption(info, "jpeg:size");
+    }
+    (void) RemoveImageOption(info, "rmagick:decode-size");
+    if (!sz)
+    {
+        return self;
+    }
+
+    (void) SetImageOption(info, "rmagick:decode-size", sz);
+    if (own_jpeg_size)
+    {
+        (void) SetImageOption(info, "jpeg:size", sz);
+    }
+
+    RB_GC_GUARD(size);
+
+    return self;
+}
+
 /**
  * Call SetImageOption
  *
@@ -748,7 +839,7 @@ Info_define(int argc, VALUE *argv, VALUE self)
     unsigned int okay;
     VALUE fmt_arg;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     switch (argc)
     {
@@ -803,7 +894,7 @@ Info_delay(VALUE self)
     char *p;
     long d;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     delay = GetImageOption(info, "delay");
     if (delay)
@@ -855,7 +946,7 @@ Info_delay_eq(VALUE self, VALUE string)
     int not_num;
     char dstr[20];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(string))
     {
@@ -909,7 +1000,7 @@ Info_density_eq(VALUE self, VALUE density_arg)
     VALUE density;
     char *dens;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(density_arg))
     {
@@ -960,7 +1051,7 @@ Info_depth_eq(VALUE self, VALUE depth)
     Info *info;
     unsigned long d;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     d = NUM2ULONG(depth);
     switch (d)
     {
@@ -1049,7 +1140,7 @@ Info_dispose(VALUE self)
     ID dispose_id;
     const char *dispose;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     dispose_id = rb_intern("UndefinedDispose");
 
@@ -1088,7 +1179,7 @@ Info_dispose_eq(VALUE self, VALUE disp)
     const char *option;
     int x;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(disp))
     {
@@ -1129,7 +1220,7 @@ Info_endian(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return EndianType_new(info->endian);
 }
 
@@ -1155,7 +1246,7 @@ Info_endian_eq(VALUE self, VALUE endian)
         VALUE_TO_ENUM(endian, type, EndianType);
     }
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     info->endian = type;
     return self;
 }
@@ -1196,7 +1287,7 @@ Info_extract_eq(VALUE self, VALUE extract_arg)
     char *extr;
     VALUE extract;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(extract_arg))
     {
@@ -1238,7 +1329,7 @@ Info_filename(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return rb_str_new2(info->filename);
 }
 
@@ -1262,7 +1353,7 @@ Info_filename_eq(VALUE self, VALUE filename)
     Info *info;
     char *fname;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     // Allow "nil" - remove current filename
     if (NIL_P(filename) || StringValuePtr(filename) == NULL)
@@ -1339,7 +1430,7 @@ Info_font_eq(VALUE self, VALUE font_arg)
     Info *info;
     char *font;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     if (NIL_P(font_arg) || StringValuePtr(font_arg) == NULL)
     {
         magick_free(info->font);
@@ -1368,7 +1459,7 @@ VALUE Info_format(VALUE self)
     const MagickInfo *magick_info ;
     ExceptionInfo *exception;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     if (*info->magick)
     {
         exception = AcquireExceptionInfo();
@@ -1399,7 +1490,7 @@ Info_format_eq(VALUE self, VALUE magick)
     char *mgk;
     ExceptionInfo *exception;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     exception = AcquireExceptionInfo();
 
@@ -1445,7 +1536,7 @@ VALUE Info_fuzz_eq(VALUE self, VALUE fuzz)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     info->fuzz = rm_fuzz_to_dbl(fuzz);
     return self;
 }
@@ -1518,7 +1609,7 @@ VALUE Info_gravity(VALUE self)
     int x;
     ID gravity_id;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     gravity_id = rb_intern("UndefinedGravity");
 
@@ -1558,7 +1649,7 @@ Info_gravity_eq(VALUE self, VALUE grav)
     const char *option;
     int x;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(grav))
     {
@@ -1599,7 +1690,7 @@ Info_image_type(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return ImageType_new(info->type);
 }
 
@@ -1619,7 +1710,7 @@ Info_image_type_eq(VALUE self, VALUE type)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     VALUE_TO_ENUM(type, info->type, ImageType);
     return self;
 }
@@ -1638,7 +1729,7 @@ Info_interlace(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return InterlaceType_new(info->interlace);
 }
 
@@ -1658,7 +1749,7 @@ Info_interlace_eq(VALUE self, VALUE inter)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     VALUE_TO_ENUM(inter, info->interlace, InterlaceType);
     return self;
 }
@@ -1680,7 +1771,7 @@ Info_matte_color(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return rm_pixelpacket_to_color_name_info(info, &info->matte_color);
 }
 
@@ -1701,7 +1792,7 @@ Info_matte_color_eq(VALUE self, VALUE matte_arg)
     Info *info;
     //char colorname[MaxTextExtent];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     Color_to_PixelPacket(&info->matte_color, matte_arg);
     //SetImageOption(info, "mattecolor", pixel_packet_to_hexname(&info->matte_color, colorname));
     return self;
@@ -1723,7 +1814,7 @@ Info_monitor_eq(VALUE self, VALUE monitor)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(monitor))
     {
@@ -1759,7 +1850,7 @@ Info_orientation(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return OrientationType_new(info->orientation);
 }
 
@@ -1780,7 +1871,7 @@ Info_orientation_eq(VALUE self, VALUE inter)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     VALUE_TO_ENUM(inter, info->orientation, OrientationType);
     return self;
 }
@@ -1801,7 +1892,7 @@ Info_origin(VALUE self)
     Info *info;
     const char *origin;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     origin = GetImageOption(info, "origin");
     return origin ? rb_str_new2(origin) : Qnil;
@@ -1826,7 +1917,7 @@ Info_origin_eq(VALUE self, VALUE origin_arg)
     VALUE origin_str;
     char *origin;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(origin_arg))
     {
@@ -1864,7 +1955,7 @@ Info_page(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return info->page ? rb_str_new2(info->page) : Qnil;
 
 }
@@ -1887,7 +1978,7 @@ Info_page_eq(VALUE self, VALUE page_arg)
     VALUE geom_str;
     char *geometry;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     if (NIL_P(page_arg))
     {
         magick_free(info->page);
@@ -1926,7 +2017,7 @@ Info_sampling_factor(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     if (info->sampling_factor)
     {
         return rb_str_new2(info->sampling_factor);
@@ -1954,7 +2045,7 @@ Info_sampling_factor_eq(VALUE self, VALUE sampling_factor)
     char *sampling_factor_p = NULL;
     long sampling_factor_len = 0;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (!NIL_P(sampling_factor))
     {
@@ -1989,7 +2080,7 @@ Info_scene(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return  ULONG2NUM(info->scene);
 }
 
@@ -2010,7 +2101,7 @@ Info_scene_eq(VALUE self, VALUE scene)
     Info *info;
     char buf[25];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     info->scene = NUM2ULONG(scene);
 
 #if defined(HAVE_SNPRINTF)
@@ -2052,7 +2143,7 @@ Info_server_name_eq(VALUE self, VALUE server_arg)
     Info *info;
     char *server;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     if (NIL_P(server_arg) || StringValuePtr(server_arg) == NULL)
     {
         magick_free(info->server_name);
@@ -2096,7 +2187,7 @@ Info_size_eq(VALUE self, VALUE size_arg)
     VALUE size;
     char *sz;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(size_arg))
     {
@@ -2209,7 +2300,7 @@ Info_texture_eq(VALUE self, VALUE texture)
     Image *image;
     char name[MaxTextExtent];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     // Delete any existing texture file
     if (info->texture)
@@ -2259,7 +2350,7 @@ Info_tile_offset_eq(VALUE self, VALUE offset)
         rb_raise(rb_eArgError, "invalid tile offset geometry: %s", tile_offset);
     }
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     (void) DeleteImageOption(info, "tile-offset");
     (void) SetImageOption(info, "tile-offset", tile_offset);
@@ -2285,7 +2376,7 @@ Info_transparent_color(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return rm_pixelpacket_to_color_name_info(info, &info->transparent_color);
 }
 
@@ -2307,7 +2398,7 @@ Info_transparent_color_eq(VALUE self, VALUE tc_arg)
     Info *info;
     //char colorname[MaxTextExtent];
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     Color_to_PixelPacket(&info->transparent_color, tc_arg);
     //SetImageOption(info, "transparent", pixel_packet_to_hexname(&info->transparent_color, colorname));
     return self;
@@ -2329,7 +2420,7 @@ Info_tile_offset(VALUE self)
     Info *info;
     const char *tile_offset;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     tile_offset = GetImageOption(info, "tile-offset");
 
@@ -2371,7 +2462,7 @@ Info_undefine(VALUE self, VALUE format, VALUE key)
 
     sprintf(fkey, "%.60s:%.*s", format_p, (int)(MaxTextExtent-61), key_p);
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     /* Depending on the IM version, RemoveImageOption returns either */
     /* char * or MagickBooleanType. Ignore the return value.         */
     (void) RemoveImageOption(info, fkey);
@@ -2426,7 +2517,7 @@ Info_units(VALUE self)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     return ResolutionType_new(info->units);
 }
 
@@ -2446,7 +2537,7 @@ Info_units_eq(VALUE self, VALUE units)
 {
     Info *info;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
     VALUE_TO_ENUM(units, info->units, ResolutionType);
     return self;
 }
@@ -2478,7 +2569,7 @@ Info_view_eq(VALUE self, VALUE view_arg)
     Info *info;
     char *view;
 
-    Data_Get_Struct(self, Info, info);
+    TypedData_Get_Struct(self, Info, &rm_Info_data_type, info);
 
     if (NIL_P(view_arg) || StringValuePtr(view_arg) == NULL)
     {
@@ -2518,6 +2609,31 @@ destroy_Info(void *infoptr)
 }
 
 
+/**
+ * Return the number of bytes used by an ImageInfo object, for
+ * ObjectSpace.memsize_of.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param infoptr pointer to the Info object
+ * @return the size in bytes
+ */
+static size_t
+Info_memsize(const void *infoptr)
+{
+    const Info *info = (const Info *)infoptr;
+
+    return sizeof(Info) + (info->blob ? info->length : 0);
+}
+
+
+//! The Magick::Image::Info data type
+const rb_data_type_t rm_Info_data_type = {
+    "Magick::Image::Info",
+    { NULL, destroy_Info, Info_memsize, },
+};
+
+
 /**
  * Create an ImageInfo object.
  *
@@ -2537,7 +2653,7 @@ Info_alloc(VALUE class)
     {
         rb_raise(rb_eNoMemError, "not enough memory to initialize Info object");
     }
-    info_obj = Data_Wrap_Struct(class, NULL, destroy_Info, info);
+    info_obj = TypedData_Wrap_Struct(class, &rm_Info_data_type, info);
 
     RB_GC_GUARD(info_obj);
 
@@ -2552,6 +2668,8 @@ Info_alloc(VALUE class)
  *
  * Notes:
  *   - Takes no parameters, but runs the parm block if present
+ *   - Carries the limits of the Magick.with_limits block running in this
+ *     thread, if any
  *
  * @return a new ImageInfo object
  */
@@ -2559,8 +2677,15 @@ VALUE
 rm_info_new(void)
 {
     VALUE info_obj;
+    Info *info;
+    ImageLimits limits;
 
     info_obj = Info_alloc(Class_Info);
+    if (rm_get_limits(&limits))
+    {
+        TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
+        rm_set_info_limits(info, &limits);
+    }
 
     RB_GC_GUARD(info_obj);
 
@@ -2588,3 +2713,144 @@ Info_initialize(VALUE self)
     return self;
 }
 
+
+
+/**
+ * Return true if a frame is at least as big as a decode size. A dimension of
+ * 0 in the decode size matches anything.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param columns the width of the frame
+ * @param rows the height of the frame
+ * @param size the decode size
+ * @return true or false
+ */
+static int
+fits_decode_size(unsigned long columns, unsigned long rows, RectangleInfo *size)
+{
+    return columns >= size->width && rows >= size->height;
+}
+
+
+/**
+ * Use the decode size to pick the smallest suitable sub-image or resolution
+ * level of a multi-resolution format.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Does nothing unless Info#decode_size is set and the input is ICO, PTIF
+ *     or JPEG 2000. Those are pinged to find the sizes they contain. JPEG is
+ *     handled by the decoder itself, through jpeg:size.
+ *   - For ICO and PTIF, selects the smallest frame that's at least the decode
+ *     size, or the biggest frame if none are, unless specific scenes have
+ *     already been requested. For JPEG 2000 sets jp2:reduce-factor.
+ *   - Errors are ignored. The read that follows reports them.
+ *   - Doesn't call Ruby, so it can be called without the GVL.
+ *
+ * @param info the Info for the read
+ * @param blob the blob to be read, or NULL if reading info->filename
+ * @param length the length of the blob
+ */
+void
+rm_select_decode_size(Info *info, const void *blob, size_t length)
+{
+    const char *option;
+    Info *ping_info;
+    Image *images, *image;
+    ExceptionInfo *exception;
+    RectangleInfo size;
+    MagickStatusType flags;
+    unsigned long scene, best, best_area, area;
+    unsigned int reduce;
+    char buf[25];
+    int jp2, pyramid, fits, best_fits;
+
+    option = GetImageOption(info, "rmagick:decode-size");
+    if (!option || info->file)
+    {
+        return;
+    }
+
+    memset(&size, 0, sizeof(size));
+    flags = GetGeometry(option, &size.x, &size.y, &size.width, &size.height);
+    if (!(flags & WidthValue))
+    {
+        size.width = 0;
+    }
+    if (!(flags & HeightValue))
+    {
+        size.height = 0;
+    }
+
+    exception = AcquireExceptionInfo();
+    ping_info = CloneImageInfo(info);
+    (void) RemoveImageOption(ping_info, "jpeg:size");
+    if (blob)
+    {
+        SetImageInfoBlob(ping_info, blob, length);
+    }
+    (void) SetImageInfo(ping_info, 0, exception);
+
+    jp2 = !rm_strcasecmp(ping_info->magick, "JP2") || !rm_strcasecmp(ping_info->magick, "J2K")
+          || !rm_strcasecmp(ping_info->magick, "JPC") || !rm_strcasecmp(ping_info->magick, "JPX");
+    pyramid = !rm_strcasecmp(ping_info->magick, "ICO") || !rm_strcasecmp(ping_info->magick, "ICON")
+              || !rm_strcasecmp(ping_info->magick, "PTIF");
+    if (!(jp2 || (pyramid && info->number_scenes == 0)))
+    {
+        (void) DestroyImageInfo(ping_info);
+        (void) DestroyExceptionInfo(exception);
+        return;
+    }
+
+    images = blob ? PingBlob(ping_info, blob, length, exception) : PingImage(ping_info, exception);
+    (void) DestroyImageInfo(ping_info);
+    (void) DestroyExceptionInfo(exception);
+    if (!images)
+    {
+        return;
+    }
+
+    if (jp2)
+    {
+        // Each resolution level halves the size
+        for (reduce = 0; reduce < 31; reduce++)
+        {
+            if (!fits_decode_size(images->columns >> (reduce+1), images->rows >> (reduce+1), &size))
+            {
+                break;
+            }
+        }
+        if (reduce > 0)
+        {
+            sprintf(buf, "%u", reduce);
+            (void) SetImageOption(info, "jp2:reduce-factor", buf);
+        }
+    }
+    else
+    {
+        best = 0;
+        best_area = 0;
+        best_fits = MagickFalse;
+        for (image = images, scene = 0; image; image = GetNextImageInList(image), scene++)
+        {
+            area = image->columns * image->rows;
+            fits = fits_decode_size(image->columns, image->rows, &size);
+            if ((fits && (!best_fits || area < best_area))
+                || (!fits && !best_fits && area > best_area))
+            {
+                best = scene;
+                best_area = area;
+                best_fits = fits;
+            }
+        }
+
+        info->scene = best;
+        info->number_scenes = 1;
+        sprintf(buf, "%lu", best);
+        (void) CloneString(&info->scenes, buf);
+    }
+
+    (void) DestroyImageList(images);
+}
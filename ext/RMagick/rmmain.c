@@ -14,6 +14,9 @@
 #define MAIN                        // Define external variables
 #include "rmagick.h"
 #include "magick/version.h"
+#if defined(HAVE_SCHED_YIELD)
+#include <sched.h>
+#endif
 
 /*----------------------------------------------------------------------------\
 | External declarations
@@ -28,31 +31,296 @@ static void features_constant(void);
 
 
 /*
- *  Handle transferring ImageMagick memory allocations/frees to Ruby.
- *  These functions have the same signature as the equivalent C functions.
+ *  Managed memory. ImageMagick's allocations go through rm_malloc, rm_realloc
+ *  and rm_free, which count the bytes in use. ImageMagick calls them from its
+ *  own threads and from code running without the GVL, so they must not call
+ *  Ruby. The counts are reported to the GC by rm_sync_managed_memory, which
+ *  is called with the GVL held.
+ */
+#if defined(HAVE_SETMAGICKMEMORYMETHODS) && defined(HAVE___SYNC_ADD_AND_FETCH)
+
+//! Allocations smaller than this are never refused. ImageMagick can't
+//! recover from failing to allocate its own structures (it calls
+//! ThrowFatalException), but it can from failing to allocate a buffer.
+#define MANAGED_MEMORY_MIN_REFUSAL (64*1024)
+
+//! Marks a deleted entry in the block table
+#define MANAGED_BLOCK_DELETED ((void *)1)
+
+//! How many times to test the lock before giving up the CPU
+#define MANAGED_LOCK_SPINS 100
+
+//! An entry in the block table
+typedef struct
+{
+    void *ptr;                  /**< the block, NULL or MANAGED_BLOCK_DELETED */
+    size_t size;                /**< the size of the block */
+} ManagedBlock;
+
+static ManagedBlock *managed_blocks = NULL; /**< the blocks allocated by rm_malloc */
+static size_t managed_capacity = 0;         /**< the number of entries in managed_blocks */
+static size_t managed_used = 0;             /**< the entries in use or deleted */
+static size_t managed_live = 0;             /**< the entries in use */
+static volatile int managed_lock = 0;       /**< spin lock for managed_blocks */
+
+static size_t managed_bytes = 0;            /**< the bytes in use */
+static size_t managed_peak = 0;             /**< the most bytes ever in use */
+static size_t managed_high_water = 0;       /**< the allocation limit, 0 for none */
+static size_t managed_limit_hits = 0;       /**< the number of allocations refused */
+static size_t managed_reported = 0;         /**< the bytes reported to the GC */
+
+
+/**
+ * Lock the block table.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - A spin lock, because a mutex may allocate, and the table is only held
+ *     for a lookup.
+ *   - Waiters give up the CPU after a while, in case the holder isn't
+ *     running (ImageMagick's OpenMP threads can outnumber the cores).
  */
-#if defined(HAVE_SETMAGICKMEMORYMETHODS)
+static void lock_managed_blocks(void)
+{
+    int spins;
+
+    while (__sync_lock_test_and_set(&managed_lock, 1))
+    {
+        // managed_lock is volatile, so this reads it every time
+        for (spins = 0; managed_lock; spins++)
+        {
+            if (spins >= MANAGED_LOCK_SPINS)
+            {
+#if defined(HAVE_SCHED_YIELD)
+                (void) sched_yield();
+#endif
+                spins = 0;
+            }
+        }
+    }
+}
+
+
+/**
+ * Unlock the block table.
+ *
+ * No Ruby usage (internal function)
+ */
+static void unlock_managed_blocks(void)
+{
+    __sync_lock_release(&managed_lock);
+}
+
+
+/**
+ * Return the entry for a block, or the empty entry where it would go.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The table must be locked and must have an empty entry.
+ *
+ * @param ptr the block
+ * @return the entry
+ */
+static ManagedBlock *find_managed_block(void *ptr)
+{
+    ManagedBlock *deleted = NULL;
+    size_t mask = managed_capacity - 1;
+    size_t x = (size_t)(((unsigned long)ptr >> 4) * 2654435761UL) & mask;
+
+    while (managed_blocks[x].ptr && managed_blocks[x].ptr != ptr)
+    {
+        if (!deleted && managed_blocks[x].ptr == MANAGED_BLOCK_DELETED)
+        {
+            deleted = &managed_blocks[x];
+        }
+        x = (x + 1) & mask;
+    }
+
+    return managed_blocks[x].ptr || !deleted ? &managed_blocks[x] : deleted;
+}
+
+
+/**
+ * Add a block to the table.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param ptr the block
+ * @param size the size of the block
+ * @return false if the table couldn't grow
+ */
+static MagickBooleanType add_managed_block(void *ptr, size_t size)
+{
+    ManagedBlock *entry, *old_blocks;
+    size_t old_capacity, x;
+
+    lock_managed_blocks();
+
+    // Keep the table at most half full, counting deleted entries. Grow it
+    // only if the blocks in use fill a quarter of it, otherwise rehash at the
+    // same size to drop the deleted entries.
+    if (2 * (managed_used + 1) > managed_capacity)
+    {
+        old_blocks = managed_blocks;
+        old_capacity = managed_capacity;
+        if (!old_capacity)
+        {
+            managed_capacity = 1024;
+        }
+        else if (4 * (managed_live + 1) > old_capacity)
+        {
+            managed_capacity = 2 * old_capacity;
+        }
+        managed_blocks = calloc(managed_capacity, sizeof(ManagedBlock));
+        if (!managed_blocks)
+        {
+            managed_blocks = old_blocks;
+            managed_capacity = old_capacity;
+            unlock_managed_blocks();
+            return MagickFalse;
+        }
+
+        managed_used = 0;
+        for (x = 0; x < old_capacity; x++)
+        {
+            if (old_blocks[x].ptr && old_blocks[x].ptr != MANAGED_BLOCK_DELETED)
+            {
+                *find_managed_block(old_blocks[x].ptr) = old_blocks[x];
+                managed_used += 1;
+            }
+        }
+        free(old_blocks);
+    }
+
+    entry = find_managed_block(ptr);
+    if (!entry->ptr)
+    {
+        managed_used += 1;
+    }
+    if (entry->ptr != ptr)
+    {
+        managed_live += 1;
+    }
+    entry->ptr = ptr;
+    entry->size = size;
+
+    unlock_managed_blocks();
+    return MagickTrue;
+}
+
+
+/**
+ * Remove a block from the table.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param ptr the block
+ * @param size the size of the block (out)
+ * @return false if the block wasn't allocated by rm_malloc (ImageMagick may
+ *   have allocated it before the memory methods were set)
+ */
+static MagickBooleanType remove_managed_block(void *ptr, size_t *size)
+{
+    ManagedBlock *entry;
+    MagickBooleanType found = MagickFalse;
+
+    lock_managed_blocks();
+
+    if (managed_capacity)
+    {
+        entry = find_managed_block(ptr);
+        if (entry->ptr == ptr)
+        {
+            *size = entry->size;
+            entry->ptr = MANAGED_BLOCK_DELETED;
+            managed_live -= 1;
+            found = MagickTrue;
+        }
+    }
+
+    unlock_managed_blocks();
+    return found;
+}
+
+
+/**
+ * Count bytes allocated or freed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Refuses an allocation of at least MANAGED_MEMORY_MIN_REFUSAL bytes that
+ *     would exceed the high-water mark. The bytes are reserved with a
+ *     compare-and-swap, so concurrent allocations can't pass the mark
+ *     together.
+ *
+ * @param size the number of bytes allocated
+ * @param freed the number of bytes freed
+ * @return true if the allocation may go ahead
+ */
+static MagickBooleanType count_managed_memory(size_t size, size_t freed)
+{
+    size_t old_bytes, bytes, peak, high_water = managed_high_water;
+
+    if (high_water && size > freed && size >= MANAGED_MEMORY_MIN_REFUSAL)
+    {
+        do
+        {
+            old_bytes = managed_bytes;
+            bytes = old_bytes + size - freed;
+            if (bytes > high_water)
+            {
+                (void) __sync_add_and_fetch(&managed_limit_hits, 1);
+                return MagickFalse;
+            }
+        } while (!__sync_bool_compare_and_swap(&managed_bytes, old_bytes, bytes));
+    }
+    else
+    {
+        bytes = __sync_add_and_fetch(&managed_bytes, size - freed);
+    }
+    peak = managed_peak;
+    while (bytes > peak && !__sync_bool_compare_and_swap(&managed_peak, peak, bytes))
+    {
+        peak = managed_peak;
+    }
+
+    return MagickTrue;
+}
+
+
 /**
  * Allocate memory.
  *
  * No Ruby usage (internal function)
  *
  * @param size the size of memory to allocate
- * @return pointer to a block of memory
+ * @return pointer to a block of memory, or NULL
  */
 static void *rm_malloc(size_t size)
 {
-    void *p;
-//    int old_state;
+    void *ptr;
 
-//    old_state = rb_gc_disable();
-    p = xmalloc((long)size);
-//    if (!RTEST(old_state))
-//    {
-//        rb_gc_enable();
-//    }
+    if (!count_managed_memory(size, 0))
+    {
+        return NULL;
+    }
 
-    return p;
+    ptr = malloc(size ? size : 1);
+    if (ptr && !add_managed_block(ptr, size))
+    {
+        free(ptr);
+        ptr = NULL;
+    }
+    if (!ptr)
+    {
+        (void) count_managed_memory(0, size);
+    }
+
+    return ptr;
 }
 
 
@@ -65,21 +333,43 @@ static void *rm_malloc(size_t size)
  *
  * @param ptr pointer to the existing block of memory
  * @param size the new size of memory to allocate
- * @return pointer to a block of memory
+ * @return pointer to a block of memory, or NULL
  */
 static void *rm_realloc(void *ptr, size_t size)
 {
-    void *p;
-//    int old_state;
+    void *new_ptr;
+    size_t old_size;
+
+    if (!ptr)
+    {
+        return rm_malloc(size);
+    }
 
-//    old_state = rb_gc_disable();
-    p = xrealloc(ptr, (long)size);
-//    if (!RTEST(old_state))
-//    {
-//        rb_gc_enable();
-//    }
+    if (!remove_managed_block(ptr, &old_size))
+    {
+        return realloc(ptr, size);
+    }
+
+    if (!count_managed_memory(size, old_size))
+    {
+        (void) add_managed_block(ptr, old_size);
+        return NULL;
+    }
 
-    return p;
+    new_ptr = realloc(ptr, size ? size : 1);
+    if (!new_ptr)
+    {
+        (void) add_managed_block(ptr, old_size);
+        (void) count_managed_memory(old_size, size);
+        return NULL;
+    }
+    if (!add_managed_block(new_ptr, size))
+    {
+        // Can't track it, so let it go as a foreign block.
+        (void) count_managed_memory(0, size);
+    }
+
+    return new_ptr;
 }
 
 
@@ -94,7 +384,18 @@ static void *rm_realloc(void *ptr, size_t size)
  */
 static void rm_free(void *ptr)
 {
-    xfree(ptr);
+    size_t size;
+
+    if (!ptr)
+    {
+        return;
+    }
+
+    if (remove_managed_block(ptr, &size))
+    {
+        (void) count_managed_memory(0, size);
+    }
+    free(ptr);
 }
 
 
@@ -102,6 +403,12 @@ static void rm_free(void *ptr)
  * Use managed memory.
  *
  * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called before MagickCoreGenesis so that ImageMagick allocates as little
+ *     as possible before the memory methods are set.
+ *   - Enabled by defining RMAGICK_ENABLE_MANAGED_MEMORY = true before
+ *     requiring RMagick.
  */
 static void set_managed_memory(void)
 {
@@ -109,16 +416,124 @@ static void set_managed_memory(void)
 
     if (RTEST(rb_const_defined(rb_cObject, enable_mm)) && RTEST(rb_const_get(rb_cObject, enable_mm)))
     {
-        rb_warning("RMagick: %s", "managed memory enabled. This is an experimental feature.");
         SetMagickMemoryMethods(rm_malloc, rm_realloc, rm_free);
-        rb_define_const(Module_Magick, "MANAGED_MEMORY", Qtrue);
+        rm_managed_memory = MagickTrue;
     }
-    else
+}
+#endif
+
+
+/**
+ * Get the managed memory counts.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - All the counts are 0 unless managed memory is enabled.
+ *
+ * @param current the bytes in use (out)
+ * @param peak the most bytes ever in use (out)
+ * @param high_water the allocation limit, 0 for none (out)
+ */
+void rm_managed_memory_usage(size_t *current, size_t *peak, size_t *high_water)
+{
+#if defined(HAVE_SETMAGICKMEMORYMETHODS) && defined(HAVE___SYNC_ADD_AND_FETCH)
+    *current = managed_bytes;
+    *peak = managed_peak;
+    *high_water = managed_high_water;
+#else
+    *current = *peak = *high_water = 0;
+#endif
+}
+
+
+/**
+ * Set the managed memory high-water mark. Allocations of at least
+ * MANAGED_MEMORY_MIN_REFUSAL bytes that would take the bytes in use past the
+ * mark fail, and the ImageMagick error they cause is raised as a
+ * Magick::MemoryLimitError.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param high_water the limit in bytes, 0 for none
+ * @return true if managed memory is enabled
+ */
+MagickBooleanType rm_set_managed_memory_high_water(size_t high_water)
+{
+#if defined(HAVE_SETMAGICKMEMORYMETHODS) && defined(HAVE___SYNC_ADD_AND_FETCH)
+    if (rm_managed_memory)
     {
-        rb_define_const(Module_Magick, "MANAGED_MEMORY", Qfalse);
+        managed_high_water = high_water;
+        return MagickTrue;
     }
+#endif
+    high_water = high_water;    // defeat "unused argument" message
+    return MagickFalse;
 }
+
+
+/**
+ * Return true if an allocation was refused because of the high-water mark
+ * since the last call in this thread, and start counting again.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Must be called with the GVL held. rm_call_without_gvl and
+ *     rm_check_exception call it, so that it covers one call to ImageMagick.
+ *   - A refusal in an ImageMagick call running in another thread at the same
+ *     time may be counted too.
+ *
+ * @return true or false
+ */
+MagickBooleanType rm_managed_memory_limit_hit(void)
+{
+#if defined(HAVE_SETMAGICKMEMORYMETHODS) && defined(HAVE___SYNC_ADD_AND_FETCH)
+    VALUE thread, seen;
+    unsigned long hits = (unsigned long) managed_limit_hits;
+
+    if (hits == 0)
+    {
+        return MagickFalse;
+    }
+
+    thread = rb_thread_current();
+    seen = rb_thread_local_aref(thread, rm_ID_managed_limit_hits);
+    if (NIL_P(seen) || NUM2ULONG(seen) != hits)
+    {
+        (void) rb_thread_local_aset(thread, rm_ID_managed_limit_hits, ULONG2NUM(hits));
+        return MagickTrue;
+    }
+#endif
+    return MagickFalse;
+}
+
+
+/**
+ * Report the change in managed memory since the last call to the GC.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Must be called with the GVL held, and not from a free function.
+ *
+ */
+void rm_sync_managed_memory(void)
+{
+#if defined(HAVE_SETMAGICKMEMORYMETHODS) && defined(HAVE___SYNC_ADD_AND_FETCH) && defined(HAVE_RB_GC_ADJUST_MEMORY_USAGE)
+    size_t current;
+
+    if (rm_managed_memory)
+    {
+        current = managed_bytes;
+        if (current != managed_reported)
+        {
+            rb_gc_adjust_memory_usage((ssize_t)current - (ssize_t)managed_reported);
+            managed_reported = current;
+        }
+    }
 #endif
+}
 
 
 
@@ -133,17 +548,17 @@ Init_RMagick2(void)
 {
     VALUE observable;
 
+#if defined(HAVE_SETMAGICKMEMORYMETHODS) && defined(HAVE___SYNC_ADD_AND_FETCH)
+    set_managed_memory();
+#endif
+
     MagickCoreGenesis("RMagick", MagickFalse);
 
     test_Magick_version();
 
     Module_Magick = rb_define_module("Magick");
 
-#if defined(HAVE_SETMAGICKMEMORYMETHODS)
-    set_managed_memory();
-#else
-    rb_define_const(Module_Magick, "MANAGED_MEMORY", Qfalse);
-#endif
+    rb_define_const(Module_Magick, "MANAGED_MEMORY", rm_managed_memory ? Qtrue : Qfalse);
 
     /*-----------------------------------------------------------------------*/
     /* Create IDs for frequently used methods, etc.                          */
@@ -163,8 +578,11 @@ Init_RMagick2(void)
     rm_ID_height           = rb_intern("height");
     rm_ID_initialize_copy  = rb_intern("initialize_copy");
     rm_ID_length           = rb_intern("length");
+    rm_ID_limits           = rb_intern("__rmagick_limits__");
     rm_ID_notify_observers = rb_intern("notify_observers");
     rm_ID_new              = rb_intern("new");
+    rm_ID_managed_limit_hits = rb_intern("__rmagick_managed_limit_hits__");
+    rm_ID_pending_exception = rb_intern("__rmagick_pending_exception__");
     rm_ID_push             = rb_intern("push");
     rm_ID_spaceship        = rb_intern("<=>");
     rm_ID_to_i             = rb_intern("to_i");
@@ -182,9 +600,17 @@ Init_RMagick2(void)
     rb_define_module_function(Module_Magick, "fonts", Magick_fonts, 0);
     rb_define_module_function(Module_Magick, "init_formats", Magick_init_formats, 0);
     rb_define_module_function(Module_Magick, "limit_resource", Magick_limit_resource, -1);
+    rb_define_module_function(Module_Magick, "marshal_compression", Magick_marshal_compression, 0);
+    rb_define_module_function(Module_Magick, "marshal_compression=", Magick_marshal_compression_eq, 1);
+    rb_define_module_function(Module_Magick, "memory_high_water", Magick_memory_high_water, 0);
+    rb_define_module_function(Module_Magick, "memory_high_water=", Magick_memory_high_water_eq, 1);
+    rb_define_module_function(Module_Magick, "memory_stats", Magick_memory_stats, 0);
+    rb_define_module_function(Module_Magick, "resource_usage", Magick_memory_stats, 0);
     rb_define_module_function(Module_Magick, "set_cache_threshold", Magick_set_cache_threshold, 1);
     rb_define_module_function(Module_Magick, "set_log_event_mask", Magick_set_log_event_mask, -1);
     rb_define_module_function(Module_Magick, "set_log_format", Magick_set_log_format, 1);
+    rb_define_module_function(Module_Magick, "thumbnail_batch", Magick_thumbnail_batch, -1);
+    rb_define_module_function(Module_Magick, "with_limits", Magick_with_limits, 1);
 
     /*-----------------------------------------------------------------------*/
     /* Class Magick::Image methods                                           */
@@ -202,10 +628,11 @@ Init_RMagick2(void)
     rb_define_singleton_method(Class_Image, "constitute", Image_constitute, 4);
     rb_define_singleton_method(Class_Image, "_load", Image__load, 1);
     rb_define_singleton_method(Class_Image, "capture", Image_capture, -1);
+    rb_define_singleton_method(Class_Image, "map", Image_map_persisted, 1);
     rb_define_singleton_method(Class_Image, "ping", Image_ping, 1);
-    rb_define_singleton_method(Class_Image, "read", Image_read, 1);
-    rb_define_singleton_method(Class_Image, "read_inline", Image_read_inline, 1);
-    rb_define_singleton_method(Class_Image, "from_blob", Image_from_blob, 1);
+    rb_define_singleton_method(Class_Image, "read", Image_read, -1);
+    rb_define_singleton_method(Class_Image, "read_inline", Image_read_inline, -1);
+    rb_define_singleton_method(Class_Image, "from_blob", Image_from_blob, -1);
 
     DCL_ATTR_WRITER(Image, alpha)
     DCL_ATTR_ACCESSOR(Image, background_color)
@@ -321,6 +748,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "color_flood_fill", Image_color_flood_fill, 5);
     rb_define_method(Class_Image, "color_histogram", Image_color_histogram, 0);
     rb_define_method(Class_Image, "colorize", Image_colorize, -1);
+    rb_define_method(Class_Image, "colorize!", Image_colorize_bang, -1);
     rb_define_method(Class_Image, "colormap", Image_colormap, -1);
     rb_define_method(Class_Image, "composite", Image_composite, -1);
     rb_define_method(Class_Image, "composite!", Image_composite_bang, -1);
@@ -354,8 +782,10 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "dissolve", Image_dissolve, -1);
     rb_define_method(Class_Image, "distort", Image_distort, -1);
     rb_define_method(Class_Image, "distortion_channel", Image_distortion_channel, -1);
+    rb_define_method(Class_Image, "dominant_colors", Image_dominant_colors, -1);
     rb_define_method(Class_Image, "_dump", Image__dump, 1);
     rb_define_method(Class_Image, "dup", Image_dup, 0);
+    rb_define_method(Class_Image, "each_pixel", Image_each_pixel, 0);
     rb_define_method(Class_Image, "each_profile", Image_each_profile, 0);
     rb_define_method(Class_Image, "edge", Image_edge, -1);
     rb_define_method(Class_Image, "emboss", Image_emboss, -1);
@@ -378,17 +808,21 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "function_channel", Image_function_channel, -1);
     rb_define_method(Class_Image, "gamma_channel", Image_gamma_channel, -1);
     rb_define_method(Class_Image, "gamma_correct", Image_gamma_correct, -1);
+    rb_define_method(Class_Image, "gamma_correct!", Image_gamma_correct_bang, -1);
     rb_define_method(Class_Image, "gaussian_blur", Image_gaussian_blur, -1);
     rb_define_method(Class_Image, "gaussian_blur_channel", Image_gaussian_blur_channel, -1);
     rb_define_method(Class_Image, "get_pixels", Image_get_pixels, 4);
+    rb_define_method(Class_Image, "get_pixels_packed", Image_get_pixels_packed, -1);
     rb_define_method(Class_Image, "gray?", Image_gray_q, 0);
     rb_define_method(Class_Image, "grey?", Image_gray_q, 0);
+    rb_define_method(Class_Image, "histogram", Image_histogram, -1);
     rb_define_method(Class_Image, "histogram?", Image_histogram_q, 0);
     rb_define_method(Class_Image, "implode", Image_implode, -1);
     rb_define_method(Class_Image, "import_pixels", Image_import_pixels, -1);
     rb_define_method(Class_Image, "initialize_copy", Image_init_copy, 1);
     rb_define_method(Class_Image, "inspect", Image_inspect, 0);
     rb_define_method(Class_Image, "level2", Image_level2, -1);
+    rb_define_method(Class_Image, "level2!", Image_level2_bang, -1);
     rb_define_method(Class_Image, "level_channel", Image_level_channel, -1);
     rb_define_method(Class_Image, "level_colors", Image_level_colors, -1);
     rb_define_method(Class_Image, "levelize_channel", Image_levelize_channel, -1);
@@ -397,6 +831,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "magnify", Image_magnify, 0);
     rb_define_method(Class_Image, "magnify!", Image_magnify_bang, 0);
     rb_define_method(Class_Image, "map", Image_map, -1);
+    rb_define_method(Class_Image, "map_pixels!", Image_map_pixels_bang, 0);
     rb_define_method(Class_Image, "marshal_dump", Image_marshal_dump, 0);
     rb_define_method(Class_Image, "marshal_load", Image_marshal_load, 1);
     rb_define_method(Class_Image, "mask", Image_mask, -1);
@@ -405,9 +840,11 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "minify", Image_minify, 0);
     rb_define_method(Class_Image, "minify!", Image_minify_bang, 0);
     rb_define_method(Class_Image, "modulate", Image_modulate, -1);
+    rb_define_method(Class_Image, "modulate!", Image_modulate_bang, -1);
     rb_define_method(Class_Image, "monochrome?", Image_monochrome_q, 0);
     rb_define_method(Class_Image, "motion_blur", Image_motion_blur, -1);
     rb_define_method(Class_Image, "negate", Image_negate, -1);
+    rb_define_method(Class_Image, "negate!", Image_negate_bang, -1);
     rb_define_method(Class_Image, "negate_channel", Image_negate_channel, -1);
     rb_define_method(Class_Image, "normalize", Image_normalize, 0);
     rb_define_method(Class_Image, "normalize_channel", Image_normalize_channel, -1);
@@ -418,6 +855,7 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "ordered_dither", Image_ordered_dither, -1);
     rb_define_method(Class_Image, "paint_transparent", Image_paint_transparent, -1);
     rb_define_method(Class_Image, "palette?", Image_palette_q, 0);
+    rb_define_method(Class_Image, "persist", Image_persist, 1);
     rb_define_method(Class_Image, "pixel_color", Image_pixel_color, -1);
     rb_define_method(Class_Image, "polaroid", Image_polaroid, -1);
     rb_define_method(Class_Image, "posterize", Image_posterize, -1);
@@ -436,9 +874,11 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "resample!", Image_resample_bang, -1);
     rb_define_method(Class_Image, "resize", Image_resize, -1);
     rb_define_method(Class_Image, "resize!", Image_resize_bang, -1);
+    rb_define_method(Class_Image, "resize_many", Image_resize_many, -1);
     rb_define_method(Class_Image, "roll", Image_roll, 2);
     rb_define_method(Class_Image, "rotate", Image_rotate, -1);
     rb_define_method(Class_Image, "rotate!", Image_rotate_bang, -1);
+    rb_define_method(Class_Image, "run_pipeline", Image_run_pipeline, -1);
     rb_define_method(Class_Image, "sample", Image_sample, -1);
     rb_define_method(Class_Image, "sample!", Image_sample_bang, -1);
     rb_define_method(Class_Image, "scale", Image_scale, -1);
@@ -467,10 +907,12 @@ Init_RMagick2(void)
     rb_define_method(Class_Image, "stereo", Image_stereo, 1);
     rb_define_method(Class_Image, "strip!", Image_strip_bang, 0);
     rb_define_method(Class_Image, "store_pixels", Image_store_pixels, 5);
+    rb_define_method(Class_Image, "store_pixels_packed", Image_store_pixels_packed, -1);
     rb_define_method(Class_Image, "swirl", Image_swirl, 1);
     rb_define_method(Class_Image, "sync_profiles", Image_sync_profiles, 0);
     rb_define_method(Class_Image, "texture_flood_fill", Image_texture_flood_fill, 5);
     rb_define_method(Class_Image, "threshold", Image_threshold, 1);
+    rb_define_method(Class_Image, "threshold!", Image_threshold_bang, 1);
     rb_define_method(Class_Image, "thumbnail", Image_thumbnail, -1);
     rb_define_method(Class_Image, "thumbnail!", Image_thumbnail_bang, -1);
     rb_define_method(Class_Image, "tint", Image_tint, -1);
@@ -518,6 +960,7 @@ Init_RMagick2(void)
     rb_define_method(Class_ImageList, "morph", ImageList_morph, 1);
     rb_define_method(Class_ImageList, "mosaic", ImageList_mosaic, 0);
     rb_define_method(Class_ImageList, "optimize_layers", ImageList_optimize_layers, 1);
+    rb_define_method(Class_ImageList, "parallel_map", ImageList_parallel_map, -1);
     rb_define_method(Class_ImageList, "quantize", ImageList_quantize, -1);
     rb_define_method(Class_ImageList, "to_blob", ImageList_to_blob, 0);
     rb_define_method(Class_ImageList, "write", ImageList_write, 1);
@@ -654,6 +1097,57 @@ Init_RMagick2(void)
     rb_define_method(Class_Pixel, "to_hsla", Pixel_to_hsla, 0);
     rb_define_method(Class_Pixel, "to_s", Pixel_to_s, 0);
 
+    /*-----------------------------------------------------------------------*/
+    /* Class Magick::Image::View methods                                     */
+    /*-----------------------------------------------------------------------*/
+
+    Class_View = rb_define_class_under(Class_Image, "View", rb_cObject);
+
+    rb_define_alloc_func(Class_View, View_alloc);
+    rb_define_method(Class_View, "initialize", View_initialize, 5);
+
+    DCL_ATTR_READER(View, x)
+    DCL_ATTR_READER(View, y)
+    DCL_ATTR_READER(View, width)
+    DCL_ATTR_READER(View, height)
+    DCL_ATTR_ACCESSOR(View, dirty)
+
+    rb_define_method(Class_View, "[]", View_aref, -1);
+    rb_define_method(Class_View, "sync", View_sync, -1);
+
+    Class_ViewRows = rb_define_class_under(Class_View, "Rows", rb_cObject);
+    rb_undef_alloc_func(Class_ViewRows);
+    rb_define_method(Class_ViewRows, "[]", ViewRows_aref, -1);
+    rb_define_method(Class_ViewRows, "[]=", ViewRows_aset, -1);
+
+    Class_ViewPixels = rb_define_class_under(Class_View, "Pixels", rb_cArray);
+    DCL_ATTR_ACCESSOR(ViewPixels, red)
+    DCL_ATTR_ACCESSOR(ViewPixels, green)
+    DCL_ATTR_ACCESSOR(ViewPixels, blue)
+    DCL_ATTR_ACCESSOR(ViewPixels, opacity)
+
+    /*-----------------------------------------------------------------------*/
+    /* Class Magick::Stream methods                                          */
+    /*-----------------------------------------------------------------------*/
+
+    Class_Stream = rb_define_class_under(Module_Magick, "Stream", rb_cObject);
+
+    rb_define_alloc_func(Class_Stream, Stream_alloc);
+    rb_define_singleton_method(Class_Stream, "open", Stream_open, 1);
+    rb_define_method(Class_Stream, "initialize", Stream_initialize, 1);
+    DCL_ATTR_READER(Stream, band_rows)
+    DCL_ATTR_READER(Stream, columns)
+    DCL_ATTR_READER(Stream, rows)
+    rb_define_method(Class_Stream, "band_rows=", Stream_band_rows_eq, 1);
+    rb_define_method(Class_Stream, "level", Stream_level, -1);
+    rb_define_method(Class_Stream, "gamma", Stream_gamma, 1);
+    rb_define_method(Class_Stream, "negate", Stream_negate, 0);
+    rb_define_method(Class_Stream, "quantum_operator", Stream_quantum_operator, -1);
+    rb_define_method(Class_Stream, "colorspace", Stream_colorspace, 1);
+    rb_define_method(Class_Stream, "each_band", Stream_each_band, -1);
+    rb_define_method(Class_Stream, "run", Stream_run, 0);
+    rb_define_method(Class_Stream, "write", Stream_write, 1);
+
     /*-----------------------------------------------------------------------*/
     /* Class Magick::ImageList::Montage methods                              */
     /*-----------------------------------------------------------------------*/
@@ -709,6 +1203,7 @@ Init_RMagick2(void)
     DCL_ATTR_ACCESSOR(Info, colorspace)
     DCL_ATTR_ACCESSOR(Info, comment)
     DCL_ATTR_ACCESSOR(Info, compression)
+    DCL_ATTR_ACCESSOR(Info, decode_size)
     DCL_ATTR_ACCESSOR(Info, delay)
     DCL_ATTR_ACCESSOR(Info, density)
     DCL_ATTR_ACCESSOR(Info, depth)
@@ -791,8 +1286,13 @@ Init_RMagick2(void)
 
     rb_define_alloc_func(Class_GradientFill, GradientFill_alloc);
 
+    rb_define_singleton_method(Class_GradientFill, "radial", GradientFill_radial, 5);
+    rb_define_singleton_method(Class_GradientFill, "conic", GradientFill_conic, 5);
+
     rb_define_method(Class_GradientFill, "initialize", GradientFill_initialize, 6);
     rb_define_method(Class_GradientFill, "fill", GradientFill_fill, 1);
+    rb_define_method(Class_GradientFill, "stops", GradientFill_stops, 0);
+    rb_define_method(Class_GradientFill, "stops=", GradientFill_stops_eq, 1);
 
     // class Magick::TextureFill
     Class_TextureFill = rb_define_class_under(Module_Magick, "TextureFill", rb_cObject);
@@ -813,6 +1313,11 @@ Init_RMagick2(void)
 
     Class_FatalImageMagickError = rb_define_class_under(Module_Magick, "FatalImageMagickError", rb_eStandardError);
 
+    /*-----------------------------------------------------------------------*/
+    /* Class Magick::MemoryLimitError < ImageMagickError                     */
+    /*-----------------------------------------------------------------------*/
+    Class_MemoryLimitError = rb_define_class_under(Module_Magick, "MemoryLimitError", Class_ImageMagickError);
+
 
     /*-----------------------------------------------------------------------*/
     /* Class Magick::DestroyedImageError < StandardError                     */
@@ -826,8 +1331,13 @@ Init_RMagick2(void)
     DEF_CONST(OpaqueOpacity);
     DEF_CONST(TransparentOpacity);
 
+    // Pixel storage sizes, which depend on the quantum depth and HDRI
+    rb_define_const(Module_Magick, "PIXEL_PACKET_SIZE", ULONG2NUM(sizeof(PixelPacket)));
+    rb_define_const(Module_Magick, "INDEX_PACKET_SIZE", ULONG2NUM(sizeof(IndexPacket)));
+
     version_constants();
     features_constant();
+    rm_define_memory_view();
 
     /*-----------------------------------------------------------------------*/
     /* Class Magick::Enum                                                    */
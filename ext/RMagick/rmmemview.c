@@ -0,0 +1,392 @@
+/**************************************************************************//**
+ * Image pixel cache access through Ruby's memory view protocol.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmmemview.c
+ * @version  $Id$
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+#if defined(HAVE_RUBY_MEMORY_VIEW_H)
+#include "ruby/memory_view.h"   // >= 3.0.0
+#endif
+
+
+/*
+ * An image is "pinned" while one or more memory views of its pixel cache are
+ * live. A pinned image can't be destroyed, replaced (which is what bang
+ * methods like resize! do) or modified in place, because that could free or
+ * move the memory the views point to. Clones of a pinned image get their own
+ * pixel cache, so that writing through a view doesn't change them.
+ *
+ * The table is locked because images are freed by the GC, and the memory
+ * view API may be used from any thread.
+ */
+static st_table *pinned_images = NULL;
+static SemaphoreInfo *pinned_semaphore = NULL;
+
+
+/**
+ * Pin an image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image
+ */
+static void
+pin_image(Image *image)
+{
+    st_data_t count = 0;
+
+    LockSemaphoreInfo(pinned_semaphore);
+    if (!pinned_images)
+    {
+        pinned_images = st_init_numtable();
+    }
+
+    (void) st_lookup(pinned_images, (st_data_t)image, &count);
+    (void) st_insert(pinned_images, (st_data_t)image, count + 1);
+    UnlockSemaphoreInfo(pinned_semaphore);
+}
+
+
+/**
+ * Unpin an image. The image can be destroyed when its pin count drops to 0.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image
+ */
+static void
+unpin_image(Image *image)
+{
+    st_data_t key = (st_data_t)image, count = 0;
+
+    LockSemaphoreInfo(pinned_semaphore);
+    if (pinned_images && st_lookup(pinned_images, key, &count))
+    {
+        if (count > 1)
+        {
+            (void) st_insert(pinned_images, key, count - 1);
+        }
+        else
+        {
+            (void) st_delete(pinned_images, &key, NULL);
+        }
+    }
+    UnlockSemaphoreInfo(pinned_semaphore);
+}
+
+
+/**
+ * Return true if the image is pinned by a memory view.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image
+ * @return true or false
+ */
+static MagickBooleanType
+is_pinned(Image *image)
+{
+    MagickBooleanType pinned = MagickFalse;
+
+    if (image && pinned_images)
+    {
+        LockSemaphoreInfo(pinned_semaphore);
+        pinned = st_lookup(pinned_images, (st_data_t)image, NULL) ? MagickTrue : MagickFalse;
+        UnlockSemaphoreInfo(pinned_semaphore);
+    }
+
+    return pinned;
+}
+
+
+/**
+ * Raise an exception if the image is pinned by a memory view.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called before an image is destroyed, replaced or modified in place. If
+ *     the caller has already made a replacement image, pass it as new_image
+ *     so it's destroyed before raising.
+ *
+ * @param image the image
+ * @param new_image the replacement image, or NULL
+ * @throw RuntimeError
+ */
+void
+rm_check_pinned(Image *image, Image *new_image)
+{
+    if (is_pinned(image))
+    {
+        if (new_image)
+        {
+            (void) DestroyImage(new_image);
+        }
+        rb_raise(rb_eRuntimeError, "can't modify image while a memory view of its pixels is live");
+    }
+}
+
+
+/**
+ * Give a clone of a pinned image its own pixel cache.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - CloneImage shares the pixel cache until one of the images is written
+ *     by ImageMagick. Writes through a memory view bypass ImageMagick, so
+ *     without this they would show in the clone too.
+ *   - Errors are reported in the exception.
+ *
+ * @param image the image that was cloned
+ * @param clone the clone
+ * @param exception the exception info
+ */
+void
+rm_unshare_pinned(Image *image, Image *clone, ExceptionInfo *exception)
+{
+    if (clone && is_pinned(image))
+    {
+        // Getting an authentic pixel gives the clone a private copy of the cache
+        if (GetAuthenticPixels(clone, 0, 0, 1, 1, exception))
+        {
+            (void) SyncAuthenticPixels(clone, exception);
+        }
+    }
+}
+
+
+/**
+ * Forget any pins on an image that's being freed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Only happens if a memory view consumer lets go of the image object
+ *     without releasing its view. Keeps a later image allocated at the same
+ *     address from looking pinned.
+ *
+ * @param image the image
+ */
+void
+rm_forget_pinned(Image *image)
+{
+    st_data_t key = (st_data_t)image;
+
+    if (pinned_images)
+    {
+        LockSemaphoreInfo(pinned_semaphore);
+        (void) st_delete(pinned_images, &key, NULL);
+        UnlockSemaphoreInfo(pinned_semaphore);
+    }
+}
+
+
+#if defined(HAVE_RB_MEMORY_VIEW_REGISTER) && defined(HAVE_ACQUIREPIXELCACHEPIXELS)
+
+// The memory view format for a single Quantum
+#if defined(MAGICKCORE_HDRI_SUPPORT) && MAGICKCORE_HDRI_SUPPORT
+#if MAGICKCORE_QUANTUM_DEPTH <= 16
+#define QUANTUM_FORMAT "f"
+#else
+#define QUANTUM_FORMAT "d"
+#endif
+#elif MAGICKCORE_QUANTUM_DEPTH == 8
+#define QUANTUM_FORMAT "C"
+#elif MAGICKCORE_QUANTUM_DEPTH == 16
+#define QUANTUM_FORMAT "S"
+#elif MAGICKCORE_QUANTUM_DEPTH == 32
+#define QUANTUM_FORMAT "L"
+#else
+#define QUANTUM_FORMAT "Q"
+#endif
+
+//! The shape and strides of a memory view, and the image it pins
+typedef struct
+{
+    ssize_t shape[3]; /**< rows, columns, channels */
+    ssize_t strides[3]; /**< bytes between rows, columns and channels */
+    Image *image; /**< the pinned image */
+} ImageMemoryView;
+
+
+/**
+ * Export an image's pixel cache as a memory view.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The view is a rows x columns x 4 array of Quantums, in the channel
+ *     order given by Magick::PixelPacketMap. The 4th channel is opacity
+ *     (0 is opaque), not alpha.
+ *   - Only pixel caches in memory (or memory-mapped) can be exported.
+ *   - A writable view can't be exported from a frozen image. PseudoClass
+ *     images are converted to DirectClass first so that the pixels written
+ *     through the view are the pixels ImageMagick uses.
+ *   - The image is given its own copy of a shared pixel cache first, so that
+ *     writing through the view doesn't change a clone's pixels and the cache
+ *     isn't copied out from under the view later.
+ *
+ * @param obj the image object
+ * @param view the memory view to fill in
+ * @param flags the RUBY_MEMORY_VIEW_* flags requested by the consumer
+ * @return true if the view was exported, otherwise false
+ */
+static bool
+image_memory_view_get(VALUE obj, rb_memory_view_t *view, int flags)
+{
+    Image *image;
+    ImageMemoryView *mv;
+    ExceptionInfo *exception;
+    MagickSizeType length;
+    ssize_t byte_size;
+    void *pixels;
+    bool readonly = OBJ_FROZEN(obj);
+
+    TypedData_Get_Struct(obj, Image, &rm_Image_data_type, image);
+    if (!image || ((flags & RUBY_MEMORY_VIEW_WRITABLE) && readonly))
+    {
+        return false;
+    }
+
+    exception = AcquireExceptionInfo();
+    if (!readonly)
+    {
+        if (image->storage_class != DirectClass
+            && !SetImageStorageClass(image, DirectClass))
+        {
+            (void) DestroyExceptionInfo(exception);
+            return false;
+        }
+        // Getting an authentic pixel makes the pixel cache private to this image
+        if (!GetAuthenticPixels(image, 0, 0, 1, 1, exception)
+            || !SyncAuthenticPixels(image, exception))
+        {
+            (void) DestroyExceptionInfo(exception);
+            return false;
+        }
+    }
+
+    // The cache may be followed by the CMYK black channel, which isn't exported
+    byte_size = (ssize_t)(image->columns * image->rows * sizeof(PixelPacket));
+    pixels = (void *) AcquirePixelCachePixels(image, &length, exception);
+    (void) DestroyExceptionInfo(exception);
+    if (!pixels || length < (MagickSizeType)byte_size)
+    {
+        return false;
+    }
+
+    if (!rb_memory_view_init_as_byte_array(view, obj, pixels, byte_size, readonly))
+    {
+        return false;
+    }
+
+    mv = ALLOC(ImageMemoryView);
+    mv->shape[0] = (ssize_t)image->rows;
+    mv->shape[1] = (ssize_t)image->columns;
+    mv->shape[2] = 4;
+    mv->strides[0] = (ssize_t)(image->columns * sizeof(PixelPacket));
+    mv->strides[1] = (ssize_t)sizeof(PixelPacket);
+    mv->strides[2] = (ssize_t)sizeof(Quantum);
+    mv->image = image;
+
+    view->format = QUANTUM_FORMAT;
+    view->item_size = (ssize_t)sizeof(Quantum);
+    view->ndim = 3;
+    view->shape = mv->shape;
+    view->strides = mv->strides;
+    view->private_data = mv;
+
+    pin_image(image);
+
+    return true;
+}
+
+
+/**
+ * Release a memory view and unpin its image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param obj the image object
+ * @param view the memory view
+ * @return true
+ */
+static bool
+image_memory_view_release(VALUE obj, rb_memory_view_t *view)
+{
+    ImageMemoryView *mv = (ImageMemoryView *)view->private_data;
+
+    obj = obj;  // defeat gcc message
+
+    if (mv)
+    {
+        unpin_image(mv->image);
+        xfree(mv);
+        view->private_data = NULL;
+    }
+
+    return true;
+}
+
+
+/**
+ * Return true if a memory view can be exported from the image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param obj the image object
+ * @return true if the image hasn't been destroyed, otherwise false
+ */
+static bool
+image_memory_view_available_p(VALUE obj)
+{
+    return DATA_PTR(obj) != NULL;
+}
+
+
+//! Memory view entry points for Magick::Image
+static const rb_memory_view_entry_t image_memory_view_entry = {
+    image_memory_view_get,
+    image_memory_view_release,
+    image_memory_view_available_p
+};
+
+#endif
+
+
+/**
+ * Register Magick::Image as a memory view exporter and define the
+ * Magick::PixelPacketMap constant. Create the lock for the pinned images.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - PixelPacketMap is the channel order of a pixel in the pixel cache, as
+ *     a get_pixels_packed map ("BGRO" on most systems).
+ */
+void
+rm_define_memory_view(void)
+{
+    char map[5];
+
+    pinned_semaphore = AcquireSemaphoreInfo();
+
+    map[offsetof(PixelPacket, red) / sizeof(Quantum)] = 'R';
+    map[offsetof(PixelPacket, green) / sizeof(Quantum)] = 'G';
+    map[offsetof(PixelPacket, blue) / sizeof(Quantum)] = 'B';
+    map[offsetof(PixelPacket, opacity) / sizeof(Quantum)] = 'O';
+    map[4] = '\0';
+    rb_define_const(Module_Magick, "PixelPacketMap", rb_obj_freeze(rb_str_new2(map)));
+
+#if defined(HAVE_RB_MEMORY_VIEW_REGISTER) && defined(HAVE_ACQUIREPIXELCACHEPIXELS)
+    (void) rb_memory_view_register(Class_Image, &image_memory_view_entry);
+#endif
+}
@@ -48,6 +48,31 @@ destroy_Montage(void *obj)
 }
 
 
+/**
+ * Return the number of bytes used by a Montage object, for
+ * ObjectSpace.memsize_of.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param obj the montage object
+ * @return the size in bytes
+ */
+static size_t
+Montage_memsize(const void *obj)
+{
+    const Montage *montage = obj;
+
+    return sizeof(Montage) + (montage->info ? sizeof(MontageInfo) : 0);
+}
+
+
+//! The Magick::ImageList::Montage data type
+const rb_data_type_t rm_Montage_data_type = {
+    "Magick::ImageList::Montage",
+    { NULL, destroy_Montage, Montage_memsize, },
+};
+
+
 /**
  * Create a new Montage object.
  *
@@ -83,7 +108,7 @@ Montage_alloc(VALUE class)
     montage = ALLOC(Montage);
     montage->info = montage_info;
     montage->compose = OverCompositeOp;
-    montage_obj = Data_Wrap_Struct(class, NULL, destroy_Montage, montage);
+    montage_obj = TypedData_Wrap_Struct(class, &rm_Montage_data_type, montage);
 
     RB_GC_GUARD(montage_obj);
 
@@ -106,7 +131,7 @@ Montage_background_color_eq(VALUE self, VALUE color)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     Color_to_PixelPacket(&montage->info->background_color, color);
     return self;
 }
@@ -127,7 +152,7 @@ Montage_border_color_eq(VALUE self, VALUE color)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     Color_to_PixelPacket(&montage->info->border_color, color);
     return self;
 }
@@ -148,7 +173,7 @@ Montage_border_width_eq(VALUE self, VALUE width)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     montage->info->border_width = NUM2ULONG(width);
     return self;
 }
@@ -169,7 +194,7 @@ Montage_compose_eq(VALUE self, VALUE compose)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     VALUE_TO_ENUM(compose, montage->compose, CompositeOperator);
     return self;
 }
@@ -190,7 +215,7 @@ Montage_filename_eq(VALUE self, VALUE filename)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     strncpy(montage->info->filename, StringValuePtr(filename), MaxTextExtent-1);
     return self;
 }
@@ -211,7 +236,7 @@ Montage_fill_eq(VALUE self, VALUE color)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     Color_to_PixelPacket(&montage->info->fill, color);
     return self;
 }
@@ -232,7 +257,7 @@ Montage_font_eq(VALUE self, VALUE font)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     magick_clone_string(&montage->info->font, StringValuePtr(font));
 
     return self;
@@ -260,7 +285,7 @@ Montage_frame_eq(VALUE self, VALUE frame_arg)
     Montage *montage;
     VALUE frame;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     frame = rm_to_s(frame_arg);
     magick_clone_string(&montage->info->frame, StringValuePtr(frame));
 
@@ -286,7 +311,7 @@ Montage_geometry_eq(VALUE self, VALUE geometry_arg)
     Montage *montage;
     VALUE geometry;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     geometry = rm_to_s(geometry_arg);
     magick_clone_string(&montage->info->geometry, StringValuePtr(geometry));
 
@@ -311,7 +336,7 @@ Montage_gravity_eq(VALUE self, VALUE gravity)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     VALUE_TO_ENUM(gravity, montage->info->gravity, GravityType);
     return self;
 }
@@ -349,7 +374,7 @@ Montage_matte_color_eq(VALUE self, VALUE color)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     Color_to_PixelPacket(&montage->info->matte_color, color);
     return self;
 }
@@ -370,7 +395,7 @@ Montage_pointsize_eq(VALUE self, VALUE size)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     montage->info->pointsize = NUM2DBL(size);
     return self;
 }
@@ -391,7 +416,7 @@ Montage_shadow_eq(VALUE self, VALUE shadow)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     montage->info->shadow = (MagickBooleanType) RTEST(shadow);
     return self;
 }
@@ -412,7 +437,7 @@ Montage_stroke_eq(VALUE self, VALUE color)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     Color_to_PixelPacket(&montage->info->stroke, color);
     return self;
 }
@@ -435,7 +460,7 @@ Montage_texture_eq(VALUE self, VALUE texture)
     Image *texture_image;
     char temp_name[MaxTextExtent];
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
 
     // If we had a previously defined temp texture image,
     // remove it now in preparation for this new one.
@@ -473,7 +498,7 @@ Montage_tile_eq(VALUE self, VALUE tile_arg)
     Montage *montage;
     VALUE tile;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     tile = rm_to_s(tile_arg);
     magick_clone_string(&montage->info->tile, StringValuePtr(tile));
 
@@ -498,7 +523,7 @@ Montage_title_eq(VALUE self, VALUE title)
 {
     Montage *montage;
 
-    Data_Get_Struct(self, Montage, montage);
+    TypedData_Get_Struct(self, Montage, &rm_Montage_data_type, montage);
     magick_clone_string(&montage->info->title, StringValuePtr(title));
     return self;
 }
@@ -0,0 +1,669 @@
+/**************************************************************************//**
+ * Operation chains for RMagick: Image#pipeline and ImageList#parallel_map.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmpipeline.c
+ * @version  $Id$
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+
+/*
+ * An operation chain is an Array of operations. Each operation is a Symbol,
+ * or an Array of a Symbol and its numeric arguments. The chain is converted
+ * to FrameOps while holding the GVL, then applied to an image without it.
+ * Each intermediate image is destroyed as soon as the next operation has
+ * made its result.
+ *
+ * The operations are not fused. Each one is a separate ImageMagick call that
+ * makes a new image, so a chain of n operations still reads and writes the
+ * pixels n times and allocates n images. What a chain saves is the Image
+ * object and GVL release for each step.
+ */
+
+
+/**
+ * Convert an operation to a FrameOp.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - An operation is a Symbol, or an Array of a Symbol and its arguments.
+ *   - The arguments of blur_image, sharpen and resize are checked the same
+ *     way as Image#blur_image, Image#sharpen and Image#resize check theirs.
+ *     A resize takes a scale, or columns and rows with an optional filter
+ *     and blur.
+ *
+ * @param spec the operation
+ * @param op the FrameOp to fill in
+ * @throw ArgumentError
+ * @see rm_effect_args
+ * @see rm_resize_args
+ */
+void
+rm_frame_op(VALUE spec, FrameOp *op)
+{
+    VALUE name;
+    VALUE argv[4];
+    ID id;
+    int x, min_args, max_args;
+    unsigned long columns, rows;
+    FilterTypes filter = UndefinedFilter;
+    double blur = 0.0;
+
+    if (TYPE(spec) == T_ARRAY)
+    {
+        if (RARRAY_LEN(spec) == 0 || RARRAY_LEN(spec) > 5)
+        {
+            rb_raise(rb_eArgError, "invalid operation (empty or too many arguments)");
+        }
+        name = rb_ary_entry(spec, 0);
+        op->nargs = (int) RARRAY_LEN(spec) - 1;
+    }
+    else
+    {
+        name = spec;
+        op->nargs = 0;
+    }
+
+    id = rb_to_id(name);
+    if (id == rb_intern("blur_image"))
+    {
+        op->type = BlurFrameOp;
+        min_args = 0;
+        max_args = 2;
+    }
+    else if (id == rb_intern("crop"))
+    {
+        op->type = CropFrameOp;
+        min_args = 4;
+        max_args = 4;
+    }
+    else if (id == rb_intern("flip"))
+    {
+        op->type = FlipFrameOp;
+        min_args = 0;
+        max_args = 0;
+    }
+    else if (id == rb_intern("flop"))
+    {
+        op->type = FlopFrameOp;
+        min_args = 0;
+        max_args = 0;
+    }
+    else if (id == rb_intern("modulate"))
+    {
+        op->type = ModulateFrameOp;
+        min_args = 0;
+        max_args = 3;
+    }
+    else if (id == rb_intern("quantize"))
+    {
+        op->type = QuantizeFrameOp;
+        min_args = 0;
+        max_args = 1;
+    }
+    else if (id == rb_intern("resize"))
+    {
+        op->type = ResizeFrameOp;
+        min_args = 1;
+        max_args = 4;
+    }
+    else if (id == rb_intern("rotate"))
+    {
+        op->type = RotateFrameOp;
+        min_args = 1;
+        max_args = 1;
+    }
+    else if (id == rb_intern("sample"))
+    {
+        op->type = SampleFrameOp;
+        min_args = 1;
+        max_args = 2;
+    }
+    else if (id == rb_intern("scale"))
+    {
+        op->type = ScaleFrameOp;
+        min_args = 1;
+        max_args = 2;
+    }
+    else if (id == rb_intern("sharpen"))
+    {
+        op->type = SharpenFrameOp;
+        min_args = 0;
+        max_args = 2;
+    }
+    else if (id == rb_intern("thumbnail"))
+    {
+        op->type = ThumbnailFrameOp;
+        min_args = 1;
+        max_args = 2;
+    }
+    else
+    {
+        rb_raise(rb_eArgError, "unsupported operation `%s'", rb_id2name(id));
+    }
+
+    if (op->nargs < min_args || op->nargs > max_args)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments to %s (%d for %d to %d)"
+                 , rb_id2name(id), op->nargs, min_args, max_args);
+    }
+
+    for (x = 0; x < op->nargs; x++)
+    {
+        argv[x] = rb_ary_entry(spec, x+1);
+    }
+
+    switch (op->type)
+    {
+        case BlurFrameOp:
+        case SharpenFrameOp:
+            rm_effect_args(op->nargs, argv, &op->args[0], &op->args[1]);
+            op->nargs = 2;
+            break;
+        case ResizeFrameOp:
+            rm_resize_args(op->nargs, argv, &op->args[0], &columns, &rows, &filter, &blur);
+            if (op->nargs > 1)
+            {
+                op->args[0] = (double) columns;
+                op->args[1] = (double) rows;
+                op->args[2] = (double) filter;
+                op->args[3] = blur;
+            }
+            break;
+        default:
+            for (x = 0; x < op->nargs; x++)
+            {
+                op->args[x] = NUM2DBL(argv[x]);
+            }
+            break;
+    }
+
+    switch (op->type)
+    {
+        case ResizeFrameOp:
+        case SampleFrameOp:
+        case ScaleFrameOp:
+        case ThumbnailFrameOp:
+            if (op->nargs == 1 ? op->args[0] <= 0.0 : (op->args[0] < 1.0 || op->args[1] < 1.0))
+            {
+                rb_raise(rb_eArgError, "invalid result dimension for %s", rb_id2name(id));
+            }
+            break;
+        case CropFrameOp:
+            if (op->args[2] < 1.0 || op->args[3] < 1.0)
+            {
+                rb_raise(rb_eArgError, "invalid crop dimension");
+            }
+            break;
+        case QuantizeFrameOp:
+            if (op->nargs == 1 && op->args[0] < 1.0)
+            {
+                rb_raise(rb_eArgError, "number of colors must be positive");
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Return true if the operation changes its image instead of making a new one.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param op the operation
+ * @return true or false
+ */
+static MagickBooleanType
+in_place_op(const FrameOp *op)
+{
+    return op->type == ModulateFrameOp || op->type == QuantizeFrameOp ? MagickTrue : MagickFalse;
+}
+
+
+/**
+ * Return true if the operation resizes its image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param op the operation
+ * @return true or false
+ */
+static MagickBooleanType
+resize_op(const FrameOp *op)
+{
+    switch (op->type)
+    {
+        case ResizeFrameOp:
+        case SampleFrameOp:
+        case ScaleFrameOp:
+        case ThumbnailFrameOp:
+            return MagickTrue;
+        default:
+            return MagickFalse;
+    }
+}
+
+
+/**
+ * Compute the size a resize operation makes.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param op the resize operation
+ * @param image the image it is applied to
+ * @param columns the result width
+ * @param rows the result height
+ */
+static void
+resize_dimensions(const FrameOp *op, const Image *image, unsigned long *columns, unsigned long *rows)
+{
+    if (op->nargs == 1)
+    {
+        *columns = max(1UL, (unsigned long)(op->args[0] * image->columns + 0.5));
+        *rows = max(1UL, (unsigned long)(op->args[0] * image->rows + 0.5));
+    }
+    else
+    {
+        *columns = (unsigned long) op->args[0];
+        *rows = (unsigned long) op->args[1];
+    }
+}
+
+
+/**
+ * Apply one operation to an image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called without the GVL. Doesn't call Ruby.
+ *   - Returns a new image, except for in-place operations, which change
+ *     image and return it.
+ *
+ * @param image the image
+ * @param op the operation
+ * @param exception the exception
+ * @return the result, or NULL on error
+ */
+static Image *
+apply_frame_op(Image *image, const FrameOp *op, ExceptionInfo *exception)
+{
+    RectangleInfo rect;
+    QuantizeInfo quantize_info;
+    unsigned long columns = 0, rows = 0;
+    char modulate[200];
+
+    if (resize_op(op))
+    {
+        resize_dimensions(op, image, &columns, &rows);
+    }
+
+    switch (op->type)
+    {
+        case BlurFrameOp:
+            return BlurImage(image, op->args[0], op->args[1], exception);
+        case CropFrameOp:
+            rect.x = (long) op->args[0];
+            rect.y = (long) op->args[1];
+            rect.width = (unsigned long) op->args[2];
+            rect.height = (unsigned long) op->args[3];
+            return CropImage(image, &rect, exception);
+        case FlipFrameOp:
+            return FlipImage(image, exception);
+        case FlopFrameOp:
+            return FlopImage(image, exception);
+        case ModulateFrameOp:
+            (void) snprintf(modulate, sizeof(modulate), "%f%%,%f%%,%f%%"
+                     , 100.0 * (op->nargs > 0 ? op->args[0] : 1.0)
+                     , 100.0 * (op->nargs > 1 ? op->args[1] : 1.0)
+                     , 100.0 * (op->nargs > 2 ? op->args[2] : 1.0));
+            (void) ModulateImage(image, modulate);
+            InheritException(exception, &image->exception);
+            return image;
+        case QuantizeFrameOp:
+            GetQuantizeInfo(&quantize_info);
+            quantize_info.number_colors = op->nargs > 0 ? (unsigned long) op->args[0] : 256;
+            (void) QuantizeImage(&quantize_info, image);
+            InheritException(exception, &image->exception);
+            return image;
+        case ResizeFrameOp:
+            return ResizeImage(image, columns, rows
+                               , op->nargs > 2 ? (FilterTypes) op->args[2] : image->filter
+                               , op->nargs > 3 ? op->args[3] : image->blur, exception);
+        case RotateFrameOp:
+            return RotateImage(image, op->args[0], exception);
+        case SampleFrameOp:
+            return SampleImage(image, columns, rows, exception);
+        case ScaleFrameOp:
+            return ScaleImage(image, columns, rows, exception);
+        case SharpenFrameOp:
+            return SharpenImage(image, op->args[0], op->args[1], exception);
+        case ThumbnailFrameOp:
+            return ThumbnailImage(image, columns, rows, exception);
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Move a crop that follows a resize in front of it.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The crop rectangle is clipped to the resized image and mapped back to
+ *     the source, and the resize makes exactly the clipped size. The result
+ *     has the same size as resize-then-crop, and only the cropped area is
+ *     resampled. Pixels near the crop edges can differ slightly because the
+ *     resize filter sees less of the image, and the page offsets are those of
+ *     the crop of the source.
+ *
+ * @param image the image
+ * @param resize the resize operation
+ * @param crop the crop operation
+ * @param new_crop the crop to apply first
+ * @param new_resize the resize to apply after it
+ * @return true if the operations were reordered
+ */
+static MagickBooleanType
+crop_before_resize(const Image *image, const FrameOp *resize, const FrameOp *crop
+                   , FrameOp *new_crop, FrameOp *new_resize)
+{
+    unsigned long columns, rows;
+    double sx, sy, x0, y0, x1, y1;
+
+    resize_dimensions(resize, image, &columns, &rows);
+    x0 = max(0.0, crop->args[0]);
+    y0 = max(0.0, crop->args[1]);
+    x1 = min((double)columns, crop->args[0] + crop->args[2]);
+    y1 = min((double)rows, crop->args[1] + crop->args[3]);
+    if (x1 <= x0 || y1 <= y0)
+    {
+        return MagickFalse;
+    }
+
+    sx = (double)image->columns / columns;
+    sy = (double)image->rows / rows;
+
+    new_crop->type = CropFrameOp;
+    new_crop->nargs = 4;
+    new_crop->args[0] = floor(x0 * sx);
+    new_crop->args[1] = floor(y0 * sy);
+    new_crop->args[2] = max(1.0, ceil(x1 * sx) - new_crop->args[0]);
+    new_crop->args[3] = max(1.0, ceil(y1 * sy) - new_crop->args[1]);
+
+    *new_resize = *resize;
+    new_resize->nargs = max(2, resize->nargs);
+    new_resize->args[0] = floor(x1) - floor(x0);
+    new_resize->args[1] = floor(y1) - floor(y0);
+    if (new_resize->args[0] < 1.0 || new_resize->args[1] < 1.0)
+    {
+        return MagickFalse;
+    }
+
+    return MagickTrue;
+}
+
+
+/**
+ * Move a shrinking resize that follows a blur or sharpen in front of it.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The radius and sigma are scaled by the resize factor so the effect
+ *     covers the same part of the picture. The result is close to, but not
+ *     the same as, filter-then-resize.
+ *
+ * @param image the image
+ * @param filter the blur or sharpen operation
+ * @param resize the resize operation
+ * @param new_filter the filter to apply after the resize
+ * @return true if the operations should be reordered
+ */
+static MagickBooleanType
+resize_before_filter(const Image *image, const FrameOp *filter, const FrameOp *resize
+                     , FrameOp *new_filter)
+{
+    unsigned long columns, rows;
+    double factor;
+
+    resize_dimensions(resize, image, &columns, &rows);
+    factor = ((double)columns / image->columns + (double)rows / image->rows) / 2.0;
+    if (factor >= 1.0)
+    {
+        return MagickFalse;
+    }
+
+    *new_filter = *filter;
+    new_filter->args[0] = filter->args[0] * factor;
+    new_filter->args[1] = max(0.01, filter->args[1] * factor);
+    return MagickTrue;
+}
+
+
+/**
+ * Apply one operation, destroying the image it consumed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called without the GVL. Doesn't call Ruby.
+ *   - The source image is never changed or destroyed. In-place operations
+ *     get a clone of it.
+ *
+ * @param source the source image
+ * @param image the current image, which may be the source
+ * @param op the operation
+ * @param exception the exception
+ * @return the new current image, or NULL on error
+ */
+static Image *
+step(Image *source, Image *image, const FrameOp *op, ExceptionInfo *exception)
+{
+    Image *new_image;
+
+    if (image == source && in_place_op(op))
+    {
+        image = CloneImage(source, 0, 0, MagickTrue, exception);
+        if (!image)
+        {
+            return NULL;
+        }
+    }
+
+    new_image = apply_frame_op(image, op, exception);
+    if (new_image != image && image != source)
+    {
+        (void) DestroyImage(image);
+    }
+    if (new_image && exception->severity >= ErrorException)
+    {
+        if (new_image != source)
+        {
+            (void) DestroyImage(new_image);
+        }
+        new_image = NULL;
+    }
+
+    return new_image;
+}
+
+
+/**
+ * Apply a chain of operations to an image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called without the GVL. Doesn't call Ruby.
+ *   - The source image isn't changed. The result is always a new image.
+ *   - Each operation makes a new image from the previous one. There is no
+ *     single-pass execution and no buffer is reused between steps.
+ *   - If reorder is true, a crop that follows a resize is done first, and
+ *     a shrinking resize that follows a blur or sharpen is done first. See
+ *     crop_before_resize and resize_before_filter.
+ *
+ * @param source the source image
+ * @param ops the operations
+ * @param nops the number of operations
+ * @param reorder whether cheap geometry operations may be moved first
+ * @param exception the exception
+ * @return the result, or NULL on error
+ */
+Image *
+rm_apply_frame_ops(Image *source, const FrameOp *ops, long nops, MagickBooleanType reorder
+                   , ExceptionInfo *exception)
+{
+    Image *image = source;
+    FrameOp first, second;
+    long x;
+
+    for (x = 0; x < nops && image; x++)
+    {
+        if (reorder && x+1 < nops)
+        {
+            if (resize_op(&ops[x]) && ops[x+1].type == CropFrameOp
+                && crop_before_resize(image, &ops[x], &ops[x+1], &first, &second))
+            {
+                image = step(source, image, &first, exception);
+                image = image ? step(source, image, &second, exception) : NULL;
+                x += 1;
+                continue;
+            }
+            if ((ops[x].type == BlurFrameOp || ops[x].type == SharpenFrameOp) && resize_op(&ops[x+1])
+                && resize_before_filter(image, &ops[x], &ops[x+1], &second))
+            {
+                image = step(source, image, &ops[x+1], exception);
+                image = image ? step(source, image, &second, exception) : NULL;
+                x += 1;
+                continue;
+            }
+        }
+
+        image = step(source, image, &ops[x], exception);
+    }
+
+    if (image == source)
+    {
+        image = CloneImage(source, 0, 0, MagickTrue, exception);
+    }
+
+    return image;
+}
+
+
+//! Arguments for run_pipeline_gvl
+typedef struct
+{
+    Image *image;                /**< the source image */
+    const FrameOp *ops;          /**< the operations */
+    long nops;                   /**< the number of operations */
+    MagickBooleanType reorder;   /**< whether operations may be reordered */
+    ExceptionInfo *exception;    /**< the exception */
+} pipeline_args_t;
+
+
+/**
+ * Call rm_apply_frame_ops. Called without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p a pipeline_args_t
+ * @return the result image
+ */
+static void *
+run_pipeline_gvl(void *p)
+{
+    pipeline_args_t *args = (pipeline_args_t *)p;
+
+    return rm_apply_frame_ops(args->image, args->ops, args->nops, args->reorder, args->exception);
+}
+
+
+/**
+ * Apply a chain of operations to a copy of the image in one call.
+ *
+ * Ruby usage:
+ *   - @verbatim Image#run_pipeline(ops) @endverbatim
+ *   - @verbatim Image#run_pipeline(ops, reorder) @endverbatim
+ *
+ * Notes:
+ *   - Used by Image#pipeline, see rmagick_internal.rb.
+ *   - The operations are the same as for ImageList#parallel_map, plus
+ *     [:modulate, brightness, saturation, hue].
+ *   - Default reorder is false. When reorder is true, cheap geometry
+ *     operations may be moved first, which can change pixels and page
+ *     offsets slightly. See rm_apply_frame_ops.
+ *   - Intermediate images are destroyed as soon as the next operation has
+ *     made its result, and no Image object is made for them. Each operation
+ *     still makes a new image, so the pixels are processed once per step.
+ *   - The GVL is released while the operations run.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a new image
+ * @see ImageList_parallel_map
+ */
+VALUE
+Image_run_pipeline(int argc, VALUE *argv, VALUE self)
+{
+    Image *image, *new_image;
+    VALUE ops, keep;
+    FrameOp *frame_ops;
+    pipeline_args_t args;
+    ExceptionInfo *exception;
+    long nops, x;
+    MagickBooleanType reorder = MagickFalse;
+
+    image = rm_check_destroyed(self);
+
+    switch (argc)
+    {
+        case 2:
+            reorder = (MagickBooleanType) RTEST(argv[1]);
+        case 1:
+            ops = rb_Array(argv[0]);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 or 2)", argc);
+            break;
+    }
+
+    nops = RARRAY_LEN(ops);
+    keep = rb_ary_new();
+    frame_ops = (FrameOp *) rm_buffer_new(keep, (size_t) max(1, nops) * sizeof(FrameOp));
+    for (x = 0; x < nops; x++)
+    {
+        rm_frame_op(rb_ary_entry(ops, x), &frame_ops[x]);
+    }
+
+    exception = AcquireExceptionInfo();
+    args.image = ReferenceImage(image);
+    args.ops = frame_ops;
+    args.nops = nops;
+    args.reorder = reorder;
+    args.exception = exception;
+    new_image = (Image *) rm_call_without_gvl(run_pipeline_gvl, &args);
+    (void) rm_release_image(self, image);
+    rm_check_interrupts(exception, new_image);
+    rm_check_exception(exception, new_image, DestroyOnError);
+    (void) DestroyExceptionInfo(exception);
+
+    rm_ensure_result(new_image);
+
+    RB_GC_GUARD(ops);
+    RB_GC_GUARD(keep);
+
+    return rm_image_new(new_image);
+}
@@ -16,6 +16,13 @@
 
 
 static void Color_Name_to_PixelPacket(PixelPacket *, VALUE);
+static size_t Pixel_memsize(const void *);
+
+//! The Magick::Pixel data type
+const rb_data_type_t rm_Pixel_data_type = {
+    "Magick::Pixel",
+    { NULL, (void (*)(void *))destroy_Pixel, Pixel_memsize, },
+};
 
 
 
@@ -34,6 +41,22 @@ destroy_Pixel(Pixel *pixel)
 }
 
 
+/**
+ * Return the number of bytes used by a Pixel object, for
+ * ObjectSpace.memsize_of.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param pixel the Pixel object
+ * @return the size in bytes
+ */
+static size_t
+Pixel_memsize(const void *pixel)
+{
+    return pixel ? sizeof(Pixel) : 0;
+}
+
+
 /**
  * Get Pixel red attribute.
  *
@@ -191,7 +214,7 @@ Color_to_PixelPacket(PixelPacket *pp, VALUE color)
     // Allow color name or Pixel
     if (CLASS_OF(color) == Class_Pixel)
     {
-        Data_Get_Struct(color, Pixel, pixel);
+        TypedData_Get_Struct(color, Pixel, &rm_Pixel_data_type, pixel);
         *pp = *pixel;
     }
     else
@@ -246,7 +269,7 @@ Pixel_alloc(VALUE class)
 
     pixel = ALLOC(Pixel);
     memset(pixel, '\0', sizeof(Pixel));
-    return Data_Wrap_Struct(class, NULL, destroy_Pixel, pixel);
+    return TypedData_Wrap_Struct(class, &rm_Pixel_data_type, pixel);
 }
 
 
@@ -268,8 +291,8 @@ Pixel_case_eq(VALUE self, VALUE other)
 
     if (CLASS_OF(self) == CLASS_OF(other))
     {
-        Data_Get_Struct(self, Pixel, this);
-        Data_Get_Struct(other, Pixel, that);
+        TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, this);
+        TypedData_Get_Struct(other, Pixel, &rm_Pixel_data_type, that);
         return (this->red == that->red
             && this->blue == that->blue
             && this->green == that->green
@@ -327,7 +350,7 @@ Pixel_dup(VALUE self)
 
     pixel = ALLOC(Pixel);
     memset(pixel, '\0', sizeof(Pixel));
-    dup = Data_Wrap_Struct(CLASS_OF(self), NULL, destroy_Pixel, pixel);
+    dup = TypedData_Wrap_Struct(CLASS_OF(self), &rm_Pixel_data_type, pixel);
     if (rb_obj_tainted(self))
     {
         (void) rb_obj_taint(dup);
@@ -396,8 +419,8 @@ Pixel_fcmp(int argc, VALUE *argv, VALUE self)
             break;
     }
 
-    Data_Get_Struct(self, Pixel, this);
-    Data_Get_Struct(argv[0], Pixel, that);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, this);
+    TypedData_Get_Struct(argv[0], Pixel, &rm_Pixel_data_type, that);
 
     // The IsColorSimilar function expects to get the
     // colorspace and fuzz parameters from an Image structure.
@@ -622,7 +645,7 @@ Pixel_from_MagickPixelPacket(const MagickPixelPacket *pp)
     pixel->blue    = ROUND_TO_QUANTUM(pp->blue);
     pixel->opacity = ROUND_TO_QUANTUM(pp->opacity);
 
-    return Data_Wrap_Struct(Class_Pixel, NULL, destroy_Pixel, pixel);
+    return TypedData_Wrap_Struct(Class_Pixel, &rm_Pixel_data_type, pixel);
 }
 
 
@@ -644,7 +667,7 @@ Pixel_from_PixelPacket(const PixelPacket *pp)
 
     pixel = ALLOC(Pixel);
     *pixel = *pp;
-    return Data_Wrap_Struct(Class_Pixel, NULL, destroy_Pixel, pixel);
+    return TypedData_Wrap_Struct(Class_Pixel, &rm_Pixel_data_type, pixel);
 }
 
 
@@ -665,7 +688,7 @@ Pixel_hash(VALUE self)
     Pixel *pixel;
     unsigned int hash;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
 
     hash  = ScaleQuantumToChar(pixel->red)   << 24;
     hash += ScaleQuantumToChar(pixel->green) << 16;
@@ -693,8 +716,8 @@ Pixel_init_copy(VALUE self, VALUE orig)
 {
     Pixel *copy, *original;
 
-    Data_Get_Struct(orig, Pixel, original);
-    Data_Get_Struct(self, Pixel, copy);
+    TypedData_Get_Struct(orig, Pixel, &rm_Pixel_data_type, original);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, copy);
 
     *copy = *original;
 
@@ -727,7 +750,7 @@ Pixel_initialize(int argc, VALUE *argv, VALUE self)
 {
     Pixel *pixel;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
 
     switch(argc)
     {
@@ -776,7 +799,7 @@ Pixel_intensity(VALUE self)
     Pixel *pixel;
     Quantum intensity;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
 
     intensity = ROUND_TO_QUANTUM((0.299*pixel->red)
                                 + (0.587*pixel->green)
@@ -801,7 +824,7 @@ Pixel_marshal_dump(VALUE self)
     Pixel *pixel;
     VALUE dpixel;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
     dpixel = rb_hash_new();
     rb_hash_aset(dpixel, CSTR2SYM("red"), QUANTUM2NUM(pixel->red));
     rb_hash_aset(dpixel, CSTR2SYM("green"), QUANTUM2NUM(pixel->green));
@@ -829,7 +852,7 @@ Pixel_marshal_load(VALUE self, VALUE dpixel)
 {
     Pixel *pixel;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
     pixel->red = NUM2QUANTUM(rb_hash_aref(dpixel, CSTR2SYM("red")));
     pixel->green = NUM2QUANTUM(rb_hash_aref(dpixel, CSTR2SYM("green")));
     pixel->blue = NUM2QUANTUM(rb_hash_aref(dpixel, CSTR2SYM("blue")));
@@ -853,8 +876,8 @@ Pixel_spaceship(VALUE self, VALUE other)
 {
     Pixel *this, *that;
 
-    Data_Get_Struct(self, Pixel, this);
-    Data_Get_Struct(other, Pixel, that);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, this);
+    TypedData_Get_Struct(other, Pixel, &rm_Pixel_data_type, that);
 
     if (this->red != that->red)
     {
@@ -902,7 +925,7 @@ Pixel_to_hsla(VALUE self)
     Pixel *pixel;
     VALUE hsla;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
 
     ConvertRGBToHSL(pixel->red, pixel->green, pixel->blue, &hue, &sat, &lum);
     hue *= 360.0;
@@ -946,7 +969,7 @@ Pixel_to_HSL(VALUE self)
     double hue, saturation, luminosity;
     VALUE hsl;
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
 
     rb_warning("Pixel#to_HSL is deprecated; use to_hsla");
     ConvertRGBToHSL(pixel->red, pixel->green, pixel->blue, &hue, &saturation, &luminosity);
@@ -1028,7 +1051,7 @@ Pixel_to_color(int argc, VALUE *argv, VALUE self)
             rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 to 2)", argc);
     }
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
 
     info = CloneImageInfo(NULL);
     image = AcquireImage(info);
@@ -1084,7 +1107,7 @@ Pixel_to_s(VALUE self)
     Pixel *pixel;
     char buff[100];
 
-    Data_Get_Struct(self, Pixel, pixel);
+    TypedData_Get_Struct(self, Pixel, &rm_Pixel_data_type, pixel);
     sprintf(buff, "red=" QuantumFormat ", green=" QuantumFormat ", blue=" QuantumFormat ", opacity=" QuantumFormat
           , pixel->red, pixel->green, pixel->blue, pixel->opacity);
     return rb_str_new2(buff);
@@ -0,0 +1,1382 @@
+/**************************************************************************//**
+ * Magick::Stream class method definitions for RMagick.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmstream.c
+ * @version  $Id$
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+
+/*
+ * A Magick::Stream reads an image with ReadStream, which hands the decoded
+ * rows to a callback instead of keeping them in a pixel cache. The rows are
+ * collected into bands, the stream's operations are applied to each band, and
+ * the band is passed on to the output. Only one band is in memory at a time,
+ * except when the output format needs a full image (see Stream#write) or the
+ * source format isn't decoded from the top down (see stream_by_row). Both
+ * cases are reported with a warning.
+ */
+
+//! Row-local stream operations
+typedef enum
+{
+    LevelStreamOp,      /**< Stream#level */
+    GammaStreamOp,      /**< Stream#gamma */
+    NegateStreamOp,     /**< Stream#negate */
+    QuantumStreamOp,    /**< Stream#quantum_operator */
+    GrayStreamOp,       /**< Stream#colorspace(GRAYColorspace) */
+    BandStreamOp        /**< Stream#each_band */
+} StreamOpType;
+
+//! A stream operation
+typedef struct
+{
+    StreamOpType type;                  /**< the operation */
+    ChannelType channels;               /**< the channels to change */
+    QuantumExpressionOperator operator; /**< the Stream#quantum_operator operator */
+    double args[3];                     /**< the numeric arguments */
+    char map[16];                       /**< the Stream#each_band channel map */
+    StorageType storage;                /**< the Stream#each_band storage type */
+    long block;                         /**< the Stream#each_band block index */
+} StreamOp;
+
+//! Magick::Stream
+typedef struct
+{
+    VALUE source;               /**< the source filename */
+    VALUE ops;                  /**< String buffer of StreamOps */
+    VALUE blocks;               /**< Array of Stream#each_band blocks */
+    unsigned long band_rows;    /**< the number of rows in a band */
+    unsigned long columns;      /**< the width of the last image streamed */
+    unsigned long rows;         /**< the height of the last image streamed */
+} Stream;
+
+//! The state of a running stream
+typedef struct
+{
+    Stream *stream;             /**< the stream */
+    StreamOp *ops;              /**< the operations */
+    long nops;                  /**< the number of operations */
+    unsigned long columns;      /**< the image width */
+    unsigned long rows;         /**< the image height */
+    unsigned long y;            /**< the first row in the band */
+    unsigned long band_count;   /**< the number of rows in the band */
+    PixelPacket *band;          /**< the band */
+    FILE *raw;                  /**< the raw output file, or NULL */
+    MagickBooleanType pnm;      /**< true if the raw output has a PGM or PPM header */
+    char raw_map[16];           /**< the raw output channel map */
+    StorageType raw_storage;    /**< the raw output storage type */
+    size_t raw_size;            /**< the size of one raw output pixel */
+    unsigned char *raw_buffer;  /**< the raw output band */
+    Info *write_info;           /**< the encoded output info, or NULL */
+    Image *output;              /**< the encoded output image */
+    ExceptionInfo *exception;   /**< the output exception */
+    VALUE pending;              /**< exception raised by a Stream#each_band block */
+    MagickBooleanType failed;   /**< true if the stream was stopped */
+} StreamRun;
+
+//! Arguments for stream_read_gvl
+typedef struct
+{
+    Info *info;                 /**< the read info */
+    ExceptionInfo *exception;   /**< the read exception */
+} stream_read_args_t;
+
+
+/**
+ * Mark the Ruby objects referenced by a Stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param s the stream
+ */
+static void
+mark_Stream(void *s)
+{
+    Stream *stream = (Stream *)s;
+
+    rb_gc_mark(stream->source);
+    rb_gc_mark(stream->ops);
+    rb_gc_mark(stream->blocks);
+}
+
+
+//! The Magick::Stream data type
+const rb_data_type_t rm_Stream_data_type = {
+    "Magick::Stream",
+    { mark_Stream, RUBY_DEFAULT_FREE, NULL, },
+};
+
+
+/**
+ * Create a new, empty, Stream object.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param class the Ruby Stream class
+ * @return a new Stream object
+ */
+VALUE
+Stream_alloc(VALUE class)
+{
+    Stream *stream;
+
+    stream = ALLOC(Stream);
+    memset(stream, 0, sizeof(Stream));
+    stream->source = Qnil;
+    stream->ops = rb_str_new(NULL, 0);
+    stream->blocks = rb_ary_new();
+    stream->band_rows = 64;
+
+    return TypedData_Wrap_Struct(class, &rm_Stream_data_type, stream);
+}
+
+
+/**
+ * Initialize a Stream.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#initialize(source) @endverbatim
+ *
+ * @param self this object
+ * @param source the source filename
+ * @return self
+ */
+VALUE
+Stream_initialize(VALUE self, VALUE source)
+{
+    Stream *stream;
+
+    TypedData_Get_Struct(self, Stream, &rm_Stream_data_type, stream);
+    stream->source = rb_str_new_frozen(rb_String(source));
+    return self;
+}
+
+
+/**
+ * Create a Stream and yield it to a block to add operations.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream.open(source) @endverbatim
+ *   - @verbatim Stream.open(source) { |stream| ... } @endverbatim
+ *
+ * Notes:
+ *   - Nothing is read until Stream#write or Stream#run is called, so
+ *     Stream.open(source) { |rows| rows.gamma(1.2) }.write(dest) reads,
+ *     transforms and writes the image one band at a time.
+ *   - JPEG, PNG, MIFF, the PNM formats, raw GRAY, RGB and RGBA, and TIFF
+ *     stored in strips are decoded one row at a time. Other sources, such as
+ *     BMP, TGA, GIF and tiled TIFF, are read whole first, with a warning,
+ *     because ImageMagick doesn't decode them from the top down.
+ *
+ * @param class the Ruby Stream class
+ * @param source the source filename
+ * @return a new Stream
+ */
+VALUE
+Stream_open(VALUE class, VALUE source)
+{
+    VALUE stream_obj;
+
+    stream_obj = rb_class_new_instance(1, &source, class);
+    if (rb_block_given_p())
+    {
+        (void) rb_yield(stream_obj);
+    }
+
+    RB_GC_GUARD(stream_obj);
+
+    return stream_obj;
+}
+
+
+DEF_ATTR_READER(Stream, band_rows, ulong)
+DEF_ATTR_READER(Stream, columns, ulong)
+DEF_ATTR_READER(Stream, rows, ulong)
+
+
+/**
+ * Set the number of rows in a band.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#band_rows= @endverbatim
+ *
+ * Notes:
+ *   - Default is 64
+ *
+ * @param self this object
+ * @param band_rows the number of rows
+ * @return band_rows
+ */
+VALUE
+Stream_band_rows_eq(VALUE self, VALUE band_rows)
+{
+    Stream *stream;
+    unsigned long rows = NUM2ULONG(band_rows);
+
+    if (rows == 0)
+    {
+        rb_raise(rb_eArgError, "band_rows must be > 0");
+    }
+    TypedData_Get_Struct(self, Stream, &rm_Stream_data_type, stream);
+    stream->band_rows = rows;
+    return band_rows;
+}
+
+
+/**
+ * Add an operation to a stream.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param self this object
+ * @param op the operation
+ * @return self
+ */
+static VALUE
+add_op(VALUE self, StreamOp *op)
+{
+    Stream *stream;
+
+    rb_check_frozen(self);
+    TypedData_Get_Struct(self, Stream, &rm_Stream_data_type, stream);
+    (void) rb_str_cat(stream->ops, (const char *)op, (long)sizeof(StreamOp));
+    return self;
+}
+
+
+/**
+ * Adjust the levels of each band like Image#level.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#level @endverbatim
+ *   - @verbatim Stream#level(black_point) @endverbatim
+ *   - @verbatim Stream#level(black_point, white_point) @endverbatim
+ *   - @verbatim Stream#level(black_point, white_point, gamma) @endverbatim
+ *
+ * Notes:
+ *   - Default black_point is 0.0
+ *   - Default white_point is QuantumRange
+ *   - Default gamma is 1.0
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ */
+VALUE
+Stream_level(int argc, VALUE *argv, VALUE self)
+{
+    StreamOp op;
+
+    memset(&op, 0, sizeof(op));
+    op.type = LevelStreamOp;
+    op.args[0] = 0.0;
+    op.args[1] = (double) QuantumRange;
+    op.args[2] = 1.0;
+
+    switch (argc)
+    {
+        case 3:
+            op.args[2] = NUM2DBL(argv[2]);
+        case 2:
+            op.args[1] = NUM2DBL(argv[1]);
+        case 1:
+            op.args[0] = NUM2DBL(argv[0]);
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 to 3)", argc);
+            break;
+    }
+    if (op.args[2] <= 0.0)
+    {
+        rb_raise(rb_eArgError, "gamma must be > 0.0 (%g given)", op.args[2]);
+    }
+
+    return add_op(self, &op);
+}
+
+
+/**
+ * Gamma-correct each band.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#gamma(gamma) @endverbatim
+ *
+ * @param self this object
+ * @param gamma the gamma
+ * @return self
+ */
+VALUE
+Stream_gamma(VALUE self, VALUE gamma)
+{
+    StreamOp op;
+
+    memset(&op, 0, sizeof(op));
+    op.type = GammaStreamOp;
+    op.args[0] = NUM2DBL(gamma);
+    if (op.args[0] <= 0.0)
+    {
+        rb_raise(rb_eArgError, "gamma must be > 0.0 (%g given)", op.args[0]);
+    }
+
+    return add_op(self, &op);
+}
+
+
+/**
+ * Negate the colors in each band.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#negate @endverbatim
+ *
+ * @param self this object
+ * @return self
+ */
+VALUE
+Stream_negate(VALUE self)
+{
+    StreamOp op;
+
+    memset(&op, 0, sizeof(op));
+    op.type = NegateStreamOp;
+    return add_op(self, &op);
+}
+
+
+/**
+ * Apply a QuantumExpressionOperator to each band like Image#quantum_operator.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#quantum_operator(operator, rvalue) @endverbatim
+ *   - @verbatim Stream#quantum_operator(operator, rvalue, channel) @endverbatim
+ *
+ * Notes:
+ *   - Default channel is AllChannels
+ *   - Supports the Add, Subtract, Multiply, Divide, Min, Max, And, Or, Xor,
+ *     LShift and RShift operators.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ */
+VALUE
+Stream_quantum_operator(int argc, VALUE *argv, VALUE self)
+{
+    StreamOp op;
+
+    memset(&op, 0, sizeof(op));
+    op.type = QuantumStreamOp;
+    op.channels = AllChannels;
+
+    switch (argc)
+    {
+        case 3:
+            VALUE_TO_ENUM(argv[2], op.channels, ChannelType);
+        case 2:
+            op.args[0] = NUM2DBL(argv[1]);
+            VALUE_TO_ENUM(argv[0], op.operator, QuantumExpressionOperator);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 2 or 3)", argc);
+            break;
+    }
+
+    switch (op.operator)
+    {
+        case AddQuantumOperator:
+        case SubtractQuantumOperator:
+        case MultiplyQuantumOperator:
+        case DivideQuantumOperator:
+        case MinQuantumOperator:
+        case MaxQuantumOperator:
+        case AndQuantumOperator:
+        case OrQuantumOperator:
+        case XorQuantumOperator:
+        case LShiftQuantumOperator:
+        case RShiftQuantumOperator:
+            break;
+        default:
+            rb_raise(rb_eArgError, "operator not supported by Stream");
+            break;
+    }
+
+    return add_op(self, &op);
+}
+
+
+/**
+ * Convert each band to a colorspace.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#colorspace(colorspace) @endverbatim
+ *
+ * Notes:
+ *   - Only GRAYColorspace (Rec. 601 luma) and the RGB colorspaces, which
+ *     don't change the pixels, can be converted one row at a time.
+ *
+ * @param self this object
+ * @param colorspace_arg the ColorspaceType
+ * @return self
+ */
+VALUE
+Stream_colorspace(VALUE self, VALUE colorspace_arg)
+{
+    StreamOp op;
+    ColorspaceType colorspace;
+
+    VALUE_TO_ENUM(colorspace_arg, colorspace, ColorspaceType);
+
+    switch (colorspace)
+    {
+        case GRAYColorspace:
+        case Rec601LumaColorspace:
+            memset(&op, 0, sizeof(op));
+            op.type = GrayStreamOp;
+            return add_op(self, &op);
+        case RGBColorspace:
+        case sRGBColorspace:
+            return self;
+        default:
+            rb_raise(rb_eArgError, "colorspace not supported by Stream");
+            break;
+    }
+
+    return self;
+}
+
+
+/**
+ * Yield each band, packed like Image#get_pixels_packed.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#each_band { |packed, y, rows| ... } @endverbatim
+ *   - @verbatim Stream#each_band(map) { |packed, y, rows| ... } @endverbatim
+ *   - @verbatim Stream#each_band(map, type) { |packed, y, rows| ... } @endverbatim
+ *
+ * Notes:
+ *   - Default map is "RGB"
+ *   - Default type is CharPixel
+ *   - The block is called when the stream runs, with the band as it is at
+ *     this point in the operations.
+ *   - The GVL is held for the whole read if the stream has any each_band
+ *     blocks.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return self
+ */
+VALUE
+Stream_each_band(int argc, VALUE *argv, VALUE self)
+{
+    Stream *stream;
+    StreamOp op;
+    const char *map = "RGB";
+
+    memset(&op, 0, sizeof(op));
+    op.type = BandStreamOp;
+    op.storage = CharPixel;
+
+    switch (argc)
+    {
+        case 2:
+            VALUE_TO_ENUM(argv[1], op.storage, StorageType);
+        case 1:
+            map = StringValueCStr(argv[0]);
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 to 2)", argc);
+            break;
+    }
+
+    if (!rb_block_given_p())
+    {
+        rb_raise(rb_eArgError, "no block given");
+    }
+    if (strlen(map) >= sizeof(op.map))
+    {
+        rb_raise(rb_eArgError, "channel map too long");
+    }
+    (void) rm_check_packed_map(NULL, map);
+    (void) rm_packed_type_size(op.storage);
+    strcpy(op.map, map);
+
+    TypedData_Get_Struct(self, Stream, &rm_Stream_data_type, stream);
+    op.block = RARRAY_LEN(stream->blocks);
+    (void) rb_ary_push(stream->blocks, rb_block_proc());
+
+    return add_op(self, &op);
+}
+
+
+/**
+ * Clamp a value to the Quantum range.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param value the value
+ * @return the Quantum
+ */
+static Quantum
+stream_clamp(double value)
+{
+    if (value <= 0.0)
+    {
+        return 0;
+    }
+    return ROUND_TO_QUANTUM(value);
+}
+
+
+/**
+ * Apply a QuantumExpressionOperator to one channel value.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param operator the operator
+ * @param value the channel value
+ * @param rvalue the operand
+ * @return the new channel value
+ */
+static Quantum
+stream_quantum(QuantumExpressionOperator operator, Quantum value, double rvalue)
+{
+    double v = (double) value;
+
+    switch (operator)
+    {
+        case AddQuantumOperator:
+            return stream_clamp(v + rvalue);
+        case SubtractQuantumOperator:
+            return stream_clamp(v - rvalue);
+        case MultiplyQuantumOperator:
+            return stream_clamp(v * rvalue);
+        case DivideQuantumOperator:
+            return rvalue == 0.0 ? value : stream_clamp(v / rvalue);
+        case MinQuantumOperator:
+            return stream_clamp(min(v, rvalue));
+        case MaxQuantumOperator:
+            return stream_clamp(max(v, rvalue));
+        case AndQuantumOperator:
+            return stream_clamp((double)((unsigned long) v & (unsigned long) rvalue));
+        case OrQuantumOperator:
+            return stream_clamp((double)((unsigned long) v | (unsigned long) rvalue));
+        case XorQuantumOperator:
+            return stream_clamp((double)((unsigned long) v ^ (unsigned long) rvalue));
+        case LShiftQuantumOperator:
+            return stream_clamp((double)((unsigned long) v << (unsigned int) rvalue));
+        case RShiftQuantumOperator:
+            return stream_clamp((double)((unsigned long) v >> (unsigned int) rvalue));
+        default:
+            return value;
+    }
+}
+
+
+/**
+ * Apply an operation to the pixels in a band.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param op the operation
+ * @param pixels the pixels
+ * @param n the number of pixels
+ */
+static void
+stream_apply(StreamOp *op, PixelPacket *pixels, size_t n)
+{
+    size_t x;
+    double scale, gamma, intensity;
+    Quantum q;
+
+    switch (op->type)
+    {
+        case LevelStreamOp:
+            scale = op->args[1] != op->args[0] ? 1.0 / (op->args[1] - op->args[0]) : 1.0;
+            gamma = 1.0 / op->args[2];
+            for (x = 0; x < n; x++)
+            {
+                pixels[x].red   = stream_clamp(QuantumRange * pow(max(0.0, scale * (pixels[x].red - op->args[0])), gamma));
+                pixels[x].green = stream_clamp(QuantumRange * pow(max(0.0, scale * (pixels[x].green - op->args[0])), gamma));
+                pixels[x].blue  = stream_clamp(QuantumRange * pow(max(0.0, scale * (pixels[x].blue - op->args[0])), gamma));
+            }
+            break;
+
+        case GammaStreamOp:
+            gamma = 1.0 / op->args[0];
+            for (x = 0; x < n; x++)
+            {
+                pixels[x].red   = stream_clamp(QuantumRange * pow(QuantumScale * pixels[x].red, gamma));
+                pixels[x].green = stream_clamp(QuantumRange * pow(QuantumScale * pixels[x].green, gamma));
+                pixels[x].blue  = stream_clamp(QuantumRange * pow(QuantumScale * pixels[x].blue, gamma));
+            }
+            break;
+
+        case NegateStreamOp:
+            for (x = 0; x < n; x++)
+            {
+                pixels[x].red   = QuantumRange - pixels[x].red;
+                pixels[x].green = QuantumRange - pixels[x].green;
+                pixels[x].blue  = QuantumRange - pixels[x].blue;
+            }
+            break;
+
+        case QuantumStreamOp:
+            for (x = 0; x < n; x++)
+            {
+                if (op->channels & RedChannel)
+                {
+                    pixels[x].red = stream_quantum(op->operator, pixels[x].red, op->args[0]);
+                }
+                if (op->channels & GreenChannel)
+                {
+                    pixels[x].green = stream_quantum(op->operator, pixels[x].green, op->args[0]);
+                }
+                if (op->channels & BlueChannel)
+                {
+                    pixels[x].blue = stream_quantum(op->operator, pixels[x].blue, op->args[0]);
+                }
+                if (op->channels & OpacityChannel)
+                {
+                    pixels[x].opacity = stream_quantum(op->operator, pixels[x].opacity, op->args[0]);
+                }
+            }
+            break;
+
+        case GrayStreamOp:
+            for (x = 0; x < n; x++)
+            {
+                intensity = (0.299*pixels[x].red) + (0.587*pixels[x].green) + (0.114*pixels[x].blue);
+                q = ROUND_TO_QUANTUM(intensity);
+                pixels[x].red = pixels[x].green = pixels[x].blue = q;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Call a Stream#each_band block.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Called from rb_protect. args is [block, packed, y, rows].
+ *
+ * @param args the block and its arguments
+ * @return the block's result
+ */
+static VALUE
+call_band_block(VALUE args)
+{
+    return rb_funcall(rb_ary_entry(args, 0), rb_intern("call"), 3,
+                      rb_ary_entry(args, 1), rb_ary_entry(args, 2), rb_ary_entry(args, 3));
+}
+
+
+/**
+ * Yield the current band to a Stream#each_band block.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Only called when the stream holds the GVL. An exception raised by the
+ *     block is saved and the stream is stopped, because the exception can't
+ *     be allowed to jump out of ImageMagick.
+ *
+ * @param run the stream state
+ * @param image the image being read
+ * @param op the each_band operation
+ * @return true if the stream should go on
+ */
+static MagickBooleanType
+stream_yield(StreamRun *run, const Image *image, StreamOp *op)
+{
+    VALUE packed, args;
+    size_t row_l;
+    unsigned long row;
+    int state = 0;
+
+    row_l = run->columns * strlen(op->map) * rm_packed_type_size(op->storage);
+    packed = rb_str_new(NULL, (long)(row_l * run->band_count));
+    for (row = 0; row < run->band_count; row++)
+    {
+        rm_pack_pixels(image, run->band + row * run->columns, NULL, run->columns
+                       , op->map, op->storage, RSTRING_PTR(packed) + row * row_l);
+    }
+
+    args = rb_ary_new3(4, rb_ary_entry(run->stream->blocks, op->block), packed
+                       , ULONG2NUM(run->y), ULONG2NUM(run->band_count));
+    (void) rb_protect(call_band_block, args, &state);
+    if (state)
+    {
+        run->pending = rb_errinfo();
+        rb_set_errinfo(Qnil);
+        return MagickFalse;
+    }
+
+    RB_GC_GUARD(packed);
+    RB_GC_GUARD(args);
+
+    return MagickTrue;
+}
+
+
+/**
+ * Set up the outputs when the first row arrives.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the stream state
+ * @param image the image being read
+ * @return true if the stream should go on
+ */
+static MagickBooleanType
+stream_start(StreamRun *run, const Image *image)
+{
+    run->columns = image->columns;
+    run->rows = image->rows;
+    run->band = (PixelPacket *) AcquireQuantumMemory(run->stream->band_rows * run->columns
+                                                     , sizeof(PixelPacket));
+    if (!run->band)
+    {
+        return MagickFalse;
+    }
+
+    if (run->raw)
+    {
+        run->raw_buffer = (unsigned char *) AcquireQuantumMemory(run->stream->band_rows * run->columns
+                                                                 , run->raw_size);
+        if (!run->raw_buffer)
+        {
+            return MagickFalse;
+        }
+        if (run->pnm
+            && fprintf(run->raw, "P%c\n%lu %lu\n%u\n", strcmp(run->raw_map, "I") == 0 ? '5' : '6'
+                       , run->columns, run->rows, run->raw_storage == ShortPixel ? 65535U : 255U) < 0)
+        {
+            return MagickFalse;
+        }
+    }
+    else if (run->write_info)
+    {
+        run->output = AcquireImage(run->write_info);
+        if (!run->output)
+        {
+            return MagickFalse;
+        }
+        (void) SetImageExtent(run->output, run->columns, run->rows);
+        run->output->matte = image->matte;
+        rm_sync_image_options(run->output, run->write_info);
+    }
+
+    return MagickTrue;
+}
+
+
+/**
+ * Apply the operations to the current band and pass it to the output.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the stream state
+ * @param image the image being read
+ * @return true if the stream should go on
+ */
+static MagickBooleanType
+stream_flush(StreamRun *run, const Image *image)
+{
+    PixelPacket *pixels;
+    unsigned long row;
+    long n;
+    size_t x, length;
+    unsigned char byte;
+    const unsigned short one = 1;
+
+    for (n = 0; n < run->nops; n++)
+    {
+        if (run->ops[n].type == BandStreamOp)
+        {
+            if (!stream_yield(run, image, &run->ops[n]))
+            {
+                return MagickFalse;
+            }
+        }
+        else
+        {
+            stream_apply(&run->ops[n], run->band, run->band_count * run->columns);
+        }
+    }
+
+    if (run->raw)
+    {
+        for (row = 0; row < run->band_count; row++)
+        {
+            rm_pack_pixels(image, run->band + row * run->columns, NULL, run->columns, run->raw_map
+                           , run->raw_storage, run->raw_buffer + row * run->columns * run->raw_size);
+        }
+        // 16-bit PGM and PPM samples are stored most significant byte first
+        if (run->pnm && run->raw_storage == ShortPixel && *(const unsigned char *)&one == 1)
+        {
+            length = run->band_count * run->columns * run->raw_size;
+            for (x = 0; x < length; x += 2)
+            {
+                byte = run->raw_buffer[x];
+                run->raw_buffer[x] = run->raw_buffer[x+1];
+                run->raw_buffer[x+1] = byte;
+            }
+        }
+        if (fwrite(run->raw_buffer, run->raw_size * run->columns, run->band_count, run->raw) != run->band_count)
+        {
+            return MagickFalse;
+        }
+    }
+    else if (run->output)
+    {
+#if defined(HAVE_QUEUEAUTHENTICPIXELS)
+        pixels = QueueAuthenticPixels(run->output, 0, (long)run->y, run->columns, run->band_count, run->exception);
+#else
+        pixels = SetImagePixels(run->output, 0, (long)run->y, run->columns, run->band_count);
+#endif
+        if (!pixels)
+        {
+            return MagickFalse;
+        }
+        memcpy(pixels, run->band, run->band_count * run->columns * sizeof(PixelPacket));
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+        if (!SyncAuthenticPixels(run->output, run->exception))
+#else
+        if (!SyncImagePixels(run->output))
+#endif
+        {
+            return MagickFalse;
+        }
+    }
+
+    run->y += run->band_count;
+    run->band_count = 0;
+
+    return MagickTrue;
+}
+
+
+/**
+ * The ReadStream handler. Called for each decoded row.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Returning 0 stops the read.
+ *   - Only the first image in the source is streamed.
+ *
+ * @param image the image being read
+ * @param pixels the row
+ * @param columns the number of pixels in the row
+ * @return columns, or 0 to stop the stream
+ */
+static size_t
+stream_row(const Image *image, const void *pixels, const size_t columns)
+{
+    StreamRun *run = (StreamRun *)image->client_data;
+
+    if (run->failed)
+    {
+        return 0;
+    }
+    if (!run->band)
+    {
+        if (image->colorspace == CMYKColorspace || !stream_start(run, image))
+        {
+            run->failed = MagickTrue;
+            return 0;
+        }
+    }
+    if (run->y + run->band_count >= run->rows || columns != run->columns)
+    {
+        return columns;
+    }
+
+    memcpy(run->band + run->band_count * run->columns, pixels, columns * sizeof(PixelPacket));
+    run->band_count += 1;
+
+    if (run->band_count == run->stream->band_rows || run->y + run->band_count == run->rows)
+    {
+        if (!stream_flush(run, image))
+        {
+            run->failed = MagickTrue;
+            return 0;
+        }
+    }
+
+    return columns;
+}
+
+
+/**
+ * Call ReadStream without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the stream_read_args_t
+ * @return the image
+ */
+static void *
+stream_read_gvl(void *p)
+{
+    stream_read_args_t *args = (stream_read_args_t *)p;
+
+    if (!rm_ping_within_limits(args->info, NULL, 0, args->exception))
+    {
+        return NULL;
+    }
+    return (void *) ReadStream(args->info, stream_row, args->exception);
+}
+
+
+/**
+ * Read the whole source, then hand its rows to stream_row from the top.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - For formats that ReadStream doesn't decode one row at a time from the
+ *     top, such as BMP and TGA (usually bottom-up), interlaced GIF and tiled
+ *     TIFF. The ReadStream handler isn't told which rows it's given, so
+ *     their rows can't be put in place as they arrive.
+ *
+ * @param p the stream_read_args_t
+ * @return the image
+ */
+static void *
+stream_read_image_gvl(void *p)
+{
+    stream_read_args_t *args = (stream_read_args_t *)p;
+    Image *image;
+    const PixelPacket *pixels;
+    long y;
+
+    if (!rm_ping_within_limits(args->info, NULL, 0, args->exception))
+    {
+        return NULL;
+    }
+    image = rm_limit_images(args->info, ReadImage(args->info, args->exception), args->exception);
+    if (!image)
+    {
+        return NULL;
+    }
+
+    image->client_data = args->info->client_data;
+    for (y = 0; y < (long)image->rows; y++)
+    {
+#if defined(HAVE_GETVIRTUALPIXELS)
+        pixels = GetVirtualPixels(image, 0, y, image->columns, 1, args->exception);
+#else
+        pixels = AcquireImagePixels(image, 0, y, image->columns, 1, args->exception);
+#endif
+        if (!pixels || stream_row(image, pixels, image->columns) == 0)
+        {
+            break;
+        }
+    }
+
+    return (void *) image;
+}
+
+
+/**
+ * Return true if a TIFF source is stored so that ReadStream decodes it one
+ * row at a time, from the top.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - ImageMagick decodes strips of gray, palette and RGB pixels row by row.
+ *     Tiles arrive a tile wide, and JPEG-compressed, planar and other
+ *     photometric interpretations go through libtiff's RGBA interface, which
+ *     doesn't hand over the rows in order.
+ *   - The source is pinged to find out, so only its header is read.
+ *
+ * @param info the read info
+ * @return true or false
+ */
+static MagickBooleanType
+tiff_by_row(const Info *info)
+{
+    static const char *photometrics[] = {"min-is-black", "min-is-white", "palette", "RGB"};
+#define N_ROW_PHOTOMETRICS (int)(sizeof(photometrics)/sizeof(photometrics[0]))
+    Image *image;
+    ExceptionInfo *exception;
+    const char *photometric;
+    MagickBooleanType by_row = MagickFalse;
+    int x;
+
+    exception = AcquireExceptionInfo();
+    image = PingImage(info, exception);
+    (void) DestroyExceptionInfo(exception);
+    if (!image)
+    {
+        return MagickFalse;
+    }
+
+    // Tiled TIFFs have no RowsPerStrip tag
+    photometric = GetImageProperty(image, "tiff:photometric");
+    if (GetImageProperty(image, "tiff:rows-per-strip") && photometric
+        && image->compression != JPEGCompression && image->interlace != PlaneInterlace)
+    {
+        for (x = 0; x < N_ROW_PHOTOMETRICS; x++)
+        {
+            if (LocaleCompare(photometric, photometrics[x]) == 0)
+            {
+                by_row = MagickTrue;
+                break;
+            }
+        }
+    }
+    (void) DestroyImageList(image);
+
+    return by_row;
+}
+
+
+/**
+ * Return true if ReadStream decodes the source one row at a time, from the
+ * top.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Only formats known to do so are streamed. The rest are read whole by
+ *     stream_read_image_gvl.
+ *
+ * @param info the read info
+ * @return true or false
+ */
+static MagickBooleanType
+stream_by_row(const Info *info)
+{
+    static const char *formats[] = {"GRAY", "JPEG", "JPG", "MIFF", "PAM", "PBM", "PGM"
+                                  , "PNG", "PNM", "PPM", "RGB", "RGBA"};
+#define N_ROW_FORMATS (int)(sizeof(formats)/sizeof(formats[0]))
+    ImageInfo *read_info;
+    ExceptionInfo *exception;
+    MagickBooleanType by_row = MagickFalse;
+    int x;
+
+    read_info = CloneImageInfo(info);
+    exception = AcquireExceptionInfo();
+    (void) SetImageInfo(read_info, MagickTrue, exception);
+    for (x = 0; x < N_ROW_FORMATS; x++)
+    {
+        if (LocaleCompare(read_info->magick, formats[x]) == 0)
+        {
+            by_row = MagickTrue;
+            break;
+        }
+    }
+    if (LocaleCompare(read_info->magick, "TIFF") == 0 || LocaleCompare(read_info->magick, "TIF") == 0
+        || LocaleCompare(read_info->magick, "TIFF64") == 0)
+    {
+        by_row = tiff_by_row(read_info);
+    }
+    (void) DestroyExceptionInfo(exception);
+    (void) DestroyImageInfo(read_info);
+
+    return by_row;
+}
+
+
+/**
+ * Free the buffers of a stream run.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param run the stream state
+ */
+static void
+stream_cleanup(StreamRun *run)
+{
+    if (run->band)
+    {
+        run->band = (PixelPacket *) RelinquishMagickMemory(run->band);
+    }
+    if (run->raw_buffer)
+    {
+        run->raw_buffer = (unsigned char *) RelinquishMagickMemory(run->raw_buffer);
+    }
+    if (run->raw)
+    {
+        (void) fclose(run->raw);
+        run->raw = NULL;
+    }
+    if (run->output)
+    {
+        run->output = DestroyImage(run->output);
+    }
+    if (run->write_info)
+    {
+        run->write_info = DestroyImageInfo(run->write_info);
+    }
+    if (run->exception)
+    {
+        run->exception = DestroyExceptionInfo(run->exception);
+    }
+}
+
+
+/**
+ * Read the source and push it through the operations to the output.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param self this object
+ * @param run the stream state, with the output set up
+ */
+static void
+stream_run(VALUE self, StreamRun *run)
+{
+    Stream *stream;
+    Info *info;
+    VALUE info_obj;
+    Image *image;
+    ExceptionInfo *exception;
+    stream_read_args_t args;
+    gvl_function_t *read;
+    char *filename;
+    long filename_l;
+    ImageLimits limits;
+
+    TypedData_Get_Struct(self, Stream, &rm_Stream_data_type, stream);
+    if (NIL_P(stream->source))
+    {
+        stream_cleanup(run);
+        rb_raise(rb_eArgError, "stream has no source");
+    }
+
+    run->stream = stream;
+    run->ops = (StreamOp *) RSTRING_PTR(stream->ops);
+    run->nops = RSTRING_LEN(stream->ops) / (long)sizeof(StreamOp);
+    run->pending = Qnil;
+
+    // Not rm_info_new, the Stream#write block is for the output
+    info_obj = Info_alloc(Class_Info);
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
+    filename = rm_str2cstr(stream->source, &filename_l);
+    filename_l = min(filename_l, MaxTextExtent-1);
+    memcpy(info->filename, filename, (size_t)filename_l);
+    info->filename[filename_l] = '\0';
+    info->subimage = 0;
+    info->subrange = 1;
+    info->client_data = (void *) run;
+    if (rm_get_limits(&limits))
+    {
+        rm_set_info_limits(info, &limits);
+    }
+
+    exception = AcquireExceptionInfo();
+    args.info = info;
+    args.exception = exception;
+    if (stream_by_row(info))
+    {
+        read = stream_read_gvl;
+    }
+    else
+    {
+        read = stream_read_image_gvl;
+        rb_warn("Stream: `%s' is read whole, because it isn't decoded from the top down", info->filename);
+    }
+    // each_band blocks have to be called with the GVL
+    if (RARRAY_LEN(stream->blocks) > 0)
+    {
+        image = (Image *) (read)(&args);
+    }
+    else
+    {
+        image = (Image *) rm_call_without_gvl(read, &args);
+    }
+    if (image)
+    {
+        (void) DestroyImageList(image);
+    }
+
+    if (!NIL_P(run->pending))
+    {
+        (void) DestroyExceptionInfo(exception);
+        stream_cleanup(run);
+        rb_exc_raise(run->pending);
+    }
+    if (exception->severity >= ErrorException)
+    {
+        stream_cleanup(run);
+    }
+    if (run->failed || run->y < run->rows)
+    {
+        stream_cleanup(run);
+    }
+    rm_check_interrupts(exception, NULL);
+    rm_check_exception(exception, NULL, RetainOnError);
+    (void) DestroyExceptionInfo(exception);
+
+    if (run->failed && !run->band)
+    {
+        stream_cleanup(run);
+        rb_raise(rb_eArgError, "can't stream image (CMYK images aren't supported)");
+    }
+    if (run->failed || run->y < run->rows)
+    {
+        stream_cleanup(run);
+        rm_magick_error("stream stopped before the end of the image", NULL);
+    }
+
+    stream->columns = run->columns;
+    stream->rows = run->rows;
+
+    RB_GC_GUARD(info_obj);
+}
+
+
+/**
+ * Run the stream without writing an image, for Stream#each_band.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#run @endverbatim
+ *
+ * @param self this object
+ * @return self
+ */
+VALUE
+Stream_run(VALUE self)
+{
+    StreamRun run;
+
+    memset(&run, 0, sizeof(run));
+    stream_run(self, &run);
+    stream_cleanup(&run);
+    return self;
+}
+
+
+/**
+ * Run the stream and write the result.
+ *
+ * Ruby usage:
+ *   - @verbatim Stream#write(filename) @endverbatim
+ *   - @verbatim Stream#write(filename) { optional arguments } @endverbatim
+ *
+ * Notes:
+ *   - The optional arguments block sets Image::Info attributes, like
+ *     Image#write.
+ *   - The raw formats RGB, RGBA, RGBO, BGR, BGRA, BGRO and GRAY, and the
+ *     binary PGM and PPM formats, are written one band at a time, so memory
+ *     use doesn't depend on the image size. Their depth is 8 unless
+ *     Info#depth is 16.
+ *   - Other formats are encoded by ImageMagick, which needs the complete
+ *     output image, so the output (but not the input) has a full pixel cache.
+ *     A warning says so.
+ *
+ * @param self this object
+ * @param filename the output filename
+ * @return self
+ */
+VALUE
+Stream_write(VALUE self, VALUE filename)
+{
+    StreamRun run;
+    Info *info;
+    VALUE info_obj;
+    ExceptionInfo *exception;
+    char *name;
+    long name_l;
+    static const char *raw_formats[] = {"RGB", "RGBA", "RGBO", "BGR", "BGRA", "BGRO", "GRAY", "PGM", "PPM"};
+#define N_RAW_FORMATS (int)(sizeof(raw_formats)/sizeof(raw_formats[0]))
+    int x;
+
+    memset(&run, 0, sizeof(run));
+
+    info_obj = rm_info_new();
+    TypedData_Get_Struct(info_obj, Info, &rm_Info_data_type, info);
+    filename = rb_String(filename);
+    name = rm_str2cstr(filename, &name_l);
+    name_l = min(name_l, MaxTextExtent-1);
+    memcpy(info->filename, name, (size_t)name_l);
+    info->filename[name_l] = '\0';
+
+    exception = AcquireExceptionInfo();
+    (void) SetImageInfo(info, MagickTrue, exception);
+    CHECK_EXCEPTION()
+    (void) DestroyExceptionInfo(exception);
+
+    for (x = 0; x < N_RAW_FORMATS; x++)
+    {
+        if (rm_strcasecmp(info->magick, raw_formats[x]) == 0)
+        {
+            break;
+        }
+    }
+
+    if (x < N_RAW_FORMATS)
+    {
+        run.pnm = rm_strcasecmp(info->magick, "PGM") == 0 || rm_strcasecmp(info->magick, "PPM") == 0;
+        if (rm_strcasecmp(info->magick, "GRAY") == 0 || rm_strcasecmp(info->magick, "PGM") == 0)
+        {
+            strcpy(run.raw_map, "I");
+        }
+        else if (rm_strcasecmp(info->magick, "PPM") == 0)
+        {
+            strcpy(run.raw_map, "RGB");
+        }
+        else
+        {
+            strcpy(run.raw_map, info->magick);
+        }
+        run.raw_storage = info->depth == 16 ? ShortPixel : CharPixel;
+        run.raw_size = strlen(run.raw_map) * rm_packed_type_size(run.raw_storage);
+        run.raw = fopen(info->filename, "wb");
+        if (!run.raw)
+        {
+            rb_sys_fail(info->filename);
+        }
+    }
+    else
+    {
+        rb_warn("Stream#write: %s output is encoded from a full image in memory", info->magick);
+
+        // SetImageInfo removed any "format:" prefix, so put it back for WriteImage
+        run.write_info = CloneImageInfo(info);
+        (void) CopyMagickString(run.write_info->filename, name, MaxTextExtent);
+        run.exception = AcquireExceptionInfo();
+    }
+
+    stream_run(self, &run);
+
+    if (run.output)
+    {
+        strcpy(run.output->filename, run.write_info->filename);
+        (void) WriteImage(run.write_info, run.output);
+        exception = AcquireExceptionInfo();
+        InheritException(exception, &run.output->exception);
+        stream_cleanup(&run);
+        rm_check_exception(exception, NULL, RetainOnError);
+        (void) DestroyExceptionInfo(exception);
+    }
+    else
+    {
+        stream_cleanup(&run);
+    }
+
+    RB_GC_GUARD(info_obj);
+    RB_GC_GUARD(filename);
+
+    return self;
+}
@@ -292,7 +292,7 @@ Export_ColorInfo(ColorInfo *ci, VALUE st)
     m = rb_ary_entry(members, 2);
     if (m != Qnil)
     {
-        Data_Get_Struct(m, Pixel, pixel);
+        TypedData_Get_Struct(m, Pixel, &rm_Pixel_data_type, pixel);
         // For >= 6.3.0, ColorInfo.color is a MagickPixelPacket so we have to
         // convert the PixelPacket.
         GetMagickPixelPacket(NULL, &ci->color);
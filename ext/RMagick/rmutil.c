@@ -242,7 +242,7 @@ rm_check_destroyed(VALUE obj)
 {
     Image *image;
 
-    Data_Get_Struct(obj, Image, image);
+    TypedData_Get_Struct(obj, Image, &rm_Image_data_type, image);
     if (!image)
     {
         rb_raise(Class_DestroyedImageError, "destroyed image");
@@ -253,7 +253,8 @@ rm_check_destroyed(VALUE obj)
 
 
 /**
- * Raise an error if the image has been destroyed or is frozen.
+ * Raise an error if the image has been destroyed, is frozen, or is pinned by
+ * a memory view.
  *
  * No Ruby usage (internal function)
  *
@@ -265,6 +266,7 @@ rm_check_frozen(VALUE obj)
 {
     Image *image = rm_check_destroyed(obj);
     rb_check_frozen(obj);
+    rm_check_pinned(image, NULL);
     return image;
 }
 
@@ -1416,6 +1418,7 @@ rm_clone_image(Image *image)
     {
         rb_raise(rb_eNoMemError, "not enough memory to continue");
     }
+    rm_unshare_pinned(image, clone, exception);
     rm_check_exception(exception, clone, DestroyOnError);
     (void) DestroyExceptionInfo(exception);
 
@@ -1423,6 +1426,110 @@ rm_clone_image(Image *image)
 }
 
 
+//! Arguments passed to the progress monitor proc
+typedef struct
+{
+    VALUE monitor;              /**< the progress monitor proc */
+    MagickOffsetType offset;    /**< ImageMagick's offset argument */
+    MagickSizeType span;        /**< ImageMagick's span argument */
+    MagickBooleanType result;   /**< the result of calling the monitor */
+} ProgressMonitorArgs;
+
+
+/**
+ * Call the progress monitor proc. The GVL must be held.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg pointer to the ProgressMonitorArgs
+ * @return the return value of the progress monitor proc
+ */
+static VALUE
+call_progress_monitor(VALUE arg)
+{
+    ProgressMonitorArgs *args = (ProgressMonitorArgs *)arg;
+    VALUE rval;
+    VALUE method, offset, span;
+
+#if defined(HAVE_LONG_LONG)     // defined in Ruby's defines.h
+    offset = rb_ll2inum(args->offset);
+    span = rb_ull2inum(args->span);
+#else
+    offset = rb_int2big((long)args->offset);
+    span = rb_uint2big((unsigned long)args->span);
+#endif
+
+    method = rb_str_new2(rb_id2name(THIS_FUNC()));
+
+    rval = rb_funcall(args->monitor, rm_ID_call, 3, method, offset, span);
+
+    RB_GC_GUARD(rval);
+    RB_GC_GUARD(method);
+    RB_GC_GUARD(offset);
+    RB_GC_GUARD(span);
+
+    return rval;
+}
+
+
+#if defined(HAVE_RB_THREAD_CALL_WITH_GVL) && defined(HAVE_RUBY_THREAD_HAS_GVL_P)
+/**
+ * Call the progress monitor proc after reacquiring the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - We can't raise an exception here because we would jump over the
+ *     ImageMagick function that released the GVL. Save the exception in the
+ *     thread instead and tell ImageMagick to stop. rm_check_interrupts raises
+ *     it once the ImageMagick function has returned.
+ *
+ * @param arg pointer to the ProgressMonitorArgs
+ * @return NULL
+ */
+static void *
+progress_monitor_with_gvl(void *arg)
+{
+    ProgressMonitorArgs *args = (ProgressMonitorArgs *)arg;
+    VALUE thread, rval, exc;
+    int state = 0;
+
+    thread = rb_thread_current();
+
+    // The monitor already raised an exception during this call
+    if (!NIL_P(rb_thread_local_aref(thread, rm_ID_pending_exception)))
+    {
+        args->result = MagickFalse;
+        return NULL;
+    }
+
+    rval = rb_protect(call_progress_monitor, (VALUE)args, &state);
+    if (state)
+    {
+        exc = rb_errinfo();
+        if (!RTEST(rb_obj_is_kind_of(exc, rb_eException)))
+        {
+            // throw, break, etc.
+            exc = rb_exc_new2(rb_eLocalJumpError, "unexpected jump out of the progress monitor");
+        }
+        rb_set_errinfo(Qnil);
+        (void) rb_thread_local_aset(thread, rm_ID_pending_exception, exc);
+        args->result = MagickFalse;
+    }
+    else
+    {
+        args->result = RTEST(rval) ? MagickTrue : MagickFalse;
+    }
+
+    RB_GC_GUARD(thread);
+    RB_GC_GUARD(rval);
+    RB_GC_GUARD(exc);
+
+    return NULL;
+}
+#endif
+
+
 /**
  * SetImage(Info)ProgressMonitor exit.
  *
@@ -1431,6 +1538,9 @@ rm_clone_image(Image *image)
  * Notes:
  *   - ImageMagick's "tag" argument is unused. We pass along the method name
  *     instead.
+ *   - When ImageMagick is running without the GVL (see rm_call_without_gvl)
+ *     the GVL is reacquired before the monitor is called. Calls from threads
+ *     that Ruby doesn't know about (ImageMagick's OpenMP threads) are ignored.
  *
  * @param tag ImageMagick argument (unused)
  * @param of the offset type
@@ -1445,29 +1555,654 @@ rm_progress_monitor(
     const MagickSizeType sp,
     void *client_data)
 {
-    VALUE rval;
-    VALUE method, offset, span;
+    ProgressMonitorArgs args;
 
     tag = tag;      // defeat gcc message
 
-#if defined(HAVE_LONG_LONG)     // defined in Ruby's defines.h
-    offset = rb_ll2inum(of);
-    span = rb_ull2inum(sp);
+    args.monitor = (VALUE)client_data;
+    args.offset = of;
+    args.span = sp;
+    args.result = MagickTrue;
+
+#if defined(HAVE_RB_THREAD_CALL_WITH_GVL) && defined(HAVE_RUBY_THREAD_HAS_GVL_P)
+    if (!ruby_thread_has_gvl_p())
+    {
+        if (!ruby_native_thread_p())
+        {
+            return MagickTrue;
+        }
+        (void) rb_thread_call_with_gvl(progress_monitor_with_gvl, &args);
+        return args.result;
+    }
+#endif
+
+    return RTEST(call_progress_monitor((VALUE)&args)) ? MagickTrue : MagickFalse;
+}
+
+
+//! Arguments for call_gvl_function
+typedef struct
+{
+    gvl_function_t *fp;         /**< the function to call */
+    void *args;                 /**< the argument to pass to fp */
+    void *result;               /**< the return value from fp */
+    int ran;                    /**< whether fp was called */
+} gvl_call_t;
+
+
+/**
+ * Call a gvl_function_t and record that it ran.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the gvl_call_t
+ * @return NULL
+ */
+static void *
+call_gvl_function(void *p)
+{
+    gvl_call_t *call = (gvl_call_t *)p;
+
+    call->result = (call->fp)(call->args);
+    call->ran = 1;
+    return NULL;
+}
+
+
+/**
+ * Call a function that does ImageMagick work without holding the GVL, so that
+ * other Ruby threads can run in the meantime.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - fp must not call the Ruby API. Errors are reported in the ExceptionInfo
+ *     (or Image) passed in args and are checked by the caller after this
+ *     function returns, with the GVL held.
+ *   - Never raises, so the caller can always clean up. An exception raised
+ *     by the progress monitor is raised by rm_check_interrupts. Interrupts
+ *     are left pending for Ruby to handle when the method returns.
+ *   - Other threads can run while fp does. Take a reference (ReferenceImage)
+ *     to any image that fp uses before calling this, so that destroy! and the
+ *     bang methods can't free it, and let go with rm_release_image.
+ *   - fp is always called exactly once. It is called with the GVL held if
+ *     Ruby can't release it or an interrupt is pending.
+ *   - Managed memory allocated by fp is reported to the GC afterwards.
+ *   - Use CALL_FUNC_WITHOUT_GVL and the DEFINE_GVL_STUB macros to call an
+ *     ImageMagick function directly.
+ *
+ * @param fp the function to call
+ * @param args the argument to pass to fp
+ * @return the return value from fp
+ */
+void *
+rm_call_without_gvl(gvl_function_t *fp, void *args)
+{
+    gvl_call_t call;
+
+    call.fp = fp;
+    call.args = args;
+    call.result = NULL;
+    call.ran = 0;
+
+    // Count only the refusals from this call.
+    (void) rm_managed_memory_limit_hit();
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL2)
+    // Unlike rb_thread_call_without_gvl, this one doesn't check interrupts
+    // (and maybe raise) before we get to clean up. Instead it returns without
+    // calling fp if any interrupt is pending, even the timer interrupt that
+    // fires when another thread wants the GVL. The interrupt stays pending,
+    // so trying again would fail the same way: call fp with the GVL held.
+    (void) rb_thread_call_without_gvl2(call_gvl_function, &call, NULL, NULL);
+    if (!call.ran)
+    {
+        (void) call_gvl_function(&call);
+    }
+#elif defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+    (void) rb_thread_call_without_gvl(call_gvl_function, &call, NULL, NULL);
 #else
-    offset = rb_int2big((long)of);
-    span = rb_uint2big((unsigned long)sp);
+    (void) call_gvl_function(&call);
 #endif
+    rm_sync_managed_memory();
 
-    method = rb_str_new2(rb_id2name(THIS_FUNC()));
+    return call.result;
+}
 
-    rval = rb_funcall((VALUE)client_data, rm_ID_call, 3, method, offset, span);
 
-    RB_GC_GUARD(rval);
-    RB_GC_GUARD(method);
-    RB_GC_GUARD(offset);
-    RB_GC_GUARD(span);
+/**
+ * If the progress monitor raised an exception while the GVL was released,
+ * free the results of the call and raise the exception.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Call this right after rm_call_without_gvl, before rm_check_exception.
+ *   - Ruby's own interrupts (Thread#raise, Thread#kill) stay pending.
+ *     rm_call_without_gvl doesn't handle them, so Ruby does once the method
+ *     returns, after the results are owned by Ruby objects.
+ *
+ * @param exception the ExceptionInfo passed to the call, or NULL
+ * @param imglist the images the call returned, or NULL
+ */
+void
+rm_check_interrupts(ExceptionInfo *exception, Image *imglist)
+{
+    VALUE exc;
+
+    exc = rb_thread_local_aref(rb_thread_current(), rm_ID_pending_exception);
+    if (!NIL_P(exc))
+    {
+        (void) rb_thread_local_aset(rb_thread_current(), rm_ID_pending_exception, Qnil);
+        if (imglist)
+        {
+            (void) DestroyImageList(imglist);
+        }
+        if (exception)
+        {
+            (void) DestroyExceptionInfo(exception);
+        }
+        rb_exc_raise(exc);
+    }
+
+    RB_GC_GUARD(exc);
+}
+
+
+//! The state shared by the rm_parallel workers
+typedef struct
+{
+    rm_task_function_t *fp;     /**< the task function */
+    void *data;                 /**< the argument to pass to fp */
+    long ntasks;                /**< the number of tasks */
+    long next;                  /**< the next task to run */
+} Parallel;
+
+//! Arguments for parallel_task_gvl
+typedef struct
+{
+    Parallel *parallel;         /**< the shared state */
+    long task;                  /**< the task to run */
+} parallel_task_args_t;
+
 
-    return RTEST(rval) ? MagickTrue : MagickFalse;
+/**
+ * Run one rm_parallel task. Called without the GVL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the parallel_task_args_t
+ * @return NULL
+ */
+static void *
+parallel_task_gvl(void *p)
+{
+    parallel_task_args_t *args = (parallel_task_args_t *)p;
+
+    (args->parallel->fp)(args->parallel->data, args->task);
+    return NULL;
+}
+
+
+/**
+ * An rm_parallel worker thread. Run tasks until there are none left.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param arg the Parallel
+ * @return nil
+ */
+static VALUE
+parallel_worker(void *arg)
+{
+    parallel_task_args_t args;
+
+    args.parallel = (Parallel *)arg;
+
+    // Workers only take the next task while holding the GVL
+    while (args.parallel->next < args.parallel->ntasks)
+    {
+        args.task = args.parallel->next++;
+        (void) rm_call_without_gvl(parallel_task_gvl, &args);
+        rm_check_interrupts(NULL, NULL);
+    }
+
+    return Qnil;
+}
+
+
+/**
+ * Run rm_parallel tasks in the current thread. Called from rb_protect.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param parallel the Parallel
+ * @return nil
+ */
+static VALUE
+parallel_run(VALUE parallel)
+{
+    return parallel_worker((void *)parallel);
+}
+
+
+/**
+ * Wait for an rm_parallel worker thread. Called from rb_protect.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param thread the worker thread
+ * @return the thread
+ */
+static VALUE
+parallel_join(VALUE thread)
+{
+    return rb_funcall(thread, rb_intern("join"), 0);
+}
+
+
+/**
+ * Wait for an rm_parallel worker thread to finish, even if this thread is
+ * interrupted while it waits.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The first exception (or other jump) is saved in exc and state.
+ *   - An interrupted join is tried again. A join that re-raises the worker's
+ *     own exception is not, because the worker is done.
+ *
+ * @param parallel the Parallel, told to stop taking tasks on error
+ * @param thread the worker thread
+ * @param exc the first exception so far
+ * @param saved_state the jump state of the first exception so far
+ */
+static void
+parallel_wait(Parallel *parallel, VALUE thread, VALUE *exc, int *saved_state)
+{
+    int state;
+
+    do
+    {
+        state = 0;
+        (void) rb_protect(parallel_join, thread, &state);
+        if (state)
+        {
+            if (!*saved_state)
+            {
+                *saved_state = state;
+                *exc = rb_errinfo();
+            }
+            rb_set_errinfo(Qnil);
+            parallel->next = parallel->ntasks;
+        }
+    } while (state && RTEST(rb_funcall(thread, rb_intern("alive?"), 0)));
+}
+
+
+/**
+ * Run tasks 0 through ntasks-1 without the GVL on a pool of Ruby threads.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - fp is called as fp(data, task) and must not call the Ruby API. Each
+ *     task should write its results to its own part of data.
+ *   - Returns when all the tasks are done. The current thread is one of the
+ *     workers.
+ *   - If nthreads is 0 the ImageMagick thread resource limit is used.
+ *   - The tasks run one at a time if the GVL can't be released.
+ *   - Other threads run while the tasks do, so data must not point into
+ *     Ruby objects that the GC can move or free. Use rm_buffer_new and
+ *     rm_exceptions_new.
+ *   - If an exception is raised, the workers stop taking tasks and it is
+ *     raised once they have all finished.
+ *
+ * @param fp the task function
+ * @param data the argument to pass to fp
+ * @param ntasks the number of tasks
+ * @param nthreads the maximum number of threads
+ */
+void
+rm_parallel(rm_task_function_t *fp, void *data, long ntasks, long nthreads)
+{
+    Parallel parallel;
+
+    parallel.fp = fp;
+    parallel.data = data;
+    parallel.ntasks = ntasks;
+    parallel.next = 0;
+
+    if (nthreads <= 0)
+    {
+        nthreads = (long) GetMagickResourceLimit(ThreadResource);
+    }
+    nthreads = max(1, min(nthreads, ntasks));
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+    // Workers can't run at the same time if the GVL isn't released
+    if (nthreads > 1)
+    {
+        VALUE workers = rb_ary_new2(nthreads - 1);
+        VALUE exc = Qnil;
+        long n;
+        int state = 0, saved_state = 0;
+
+        for (n = 0; n < nthreads - 1; n++)
+        {
+            (void) rb_ary_push(workers, rb_thread_create(parallel_worker, &parallel));
+        }
+        (void) rb_protect(parallel_run, (VALUE)&parallel, &state);
+        if (state)
+        {
+            saved_state = state;
+            exc = rb_errinfo();
+            rb_set_errinfo(Qnil);
+            parallel.next = parallel.ntasks;
+        }
+
+        // parallel is on this stack, so every worker must finish before
+        // an exception can be raised.
+        for (n = 0; n < RARRAY_LEN(workers); n++)
+        {
+            parallel_wait(&parallel, rb_ary_entry(workers, n), &exc, &saved_state);
+        }
+
+        if (saved_state)
+        {
+            if (RTEST(rb_obj_is_kind_of(exc, rb_eException)))
+            {
+                rb_exc_raise(exc);
+            }
+            rb_jump_tag(saved_state);
+        }
+
+        RB_GC_GUARD(workers);
+        RB_GC_GUARD(exc);
+        return;
+    }
+#endif
+    (void) parallel_worker(&parallel);
+}
+
+
+/**
+ * Allocate a zeroed buffer that is freed by the GC.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Unlike the contents of a String, the buffer never moves, so it can be
+ *     used while other threads run (or the GC compacts).
+ *   - It is freed with its owner, so nothing leaks if an exception is
+ *     raised.
+ *
+ * @param keep Array that keeps the owner alive
+ * @param size the size of the buffer
+ * @return the buffer
+ */
+void *
+rm_buffer_new(VALUE keep, size_t size)
+{
+    void *buffer = (void *) ZALLOC_N(char, max(1, size));
+
+    (void) rb_ary_push(keep, Data_Wrap_Struct(0, NULL, RUBY_DEFAULT_FREE, buffer));
+    return buffer;
+}
+
+
+/**
+ * Let go of an image held by rm_keep_image.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param image the image
+ */
+static void
+release_kept_image(void *image)
+{
+    (void) DestroyImage((Image *)image);
+}
+
+
+/**
+ * Hold a reference to an image until the GC frees its owner.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Use this for an image that is read while the GVL is released, when it
+ *     is used again afterwards. Another thread can destroy! the image object
+ *     meanwhile, but the image itself stays valid.
+ *
+ * @param keep Array that keeps the owner alive
+ * @param image the image
+ * @return the image
+ */
+Image *
+rm_keep_image(VALUE keep, Image *image)
+{
+    (void) rb_ary_push(keep, Data_Wrap_Struct(0, NULL, release_kept_image, ReferenceImage(image)));
+    return image;
+}
+
+
+/**
+ * Mark a String held by rm_pin_string so that the GC can't move it.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p pointer to the String
+ */
+static void
+mark_pinned_string(void *p)
+{
+    rb_gc_mark(*(VALUE *)p);
+}
+
+
+/**
+ * Return a frozen copy of a String whose contents stay where they are until
+ * the GC frees its owner.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The contents of a short String are stored in the object itself, and
+ *     GC compaction can move it. rb_gc_mark (unlike rb_gc_mark_movable) pins
+ *     the String, so RSTRING_PTR can be used while the GVL is released.
+ *
+ * @param keep Array that keeps the owner alive
+ * @param str the String
+ * @return the pinned copy
+ */
+VALUE
+rm_pin_string(VALUE keep, VALUE str)
+{
+    VALUE *pinned;
+
+    str = rb_str_new_frozen(StringValue(str));
+    pinned = ALLOC(VALUE);
+    *pinned = str;
+    (void) rb_ary_push(keep, Data_Wrap_Struct(0, mark_pinned_string, RUBY_DEFAULT_FREE, pinned));
+
+    RB_GC_GUARD(str);
+    return str;
+}
+
+
+//! The ExceptionInfos made by rm_exceptions_new
+typedef struct
+{
+    long count;                     /**< the number of ExceptionInfos */
+    ExceptionInfo **exceptions;     /**< the ExceptionInfos */
+} ParallelExceptions;
+
+
+/**
+ * Free the ExceptionInfos made by rm_exceptions_new.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the ParallelExceptions
+ */
+static void
+destroy_ParallelExceptions(void *p)
+{
+    ParallelExceptions *list = (ParallelExceptions *)p;
+    long n;
+
+    for (n = 0; n < list->count; n++)
+    {
+        if (list->exceptions[n])
+        {
+            (void) DestroyExceptionInfo(list->exceptions[n]);
+        }
+    }
+    xfree(list->exceptions);
+    xfree(list);
+}
+
+
+/**
+ * Make one ExceptionInfo for each task of an rm_parallel call.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The ExceptionInfos are destroyed by the GC with their owner, so they
+ *     don't leak if an exception is raised. Don't destroy them yourself, and
+ *     check them with rm_check_exceptions, not rm_check_exception (which
+ *     destroys the ExceptionInfo before raising).
+ *
+ * @param keep Array that keeps the owner alive
+ * @param count the number of ExceptionInfos
+ * @return the ExceptionInfos
+ */
+ExceptionInfo **
+rm_exceptions_new(VALUE keep, long count)
+{
+    ParallelExceptions *list;
+    long n;
+
+    list = ALLOC(ParallelExceptions);
+    list->count = 0;
+    list->exceptions = NULL;
+    (void) rb_ary_push(keep, Data_Wrap_Struct(0, NULL, destroy_ParallelExceptions, list));
+    list->exceptions = ALLOC_N(ExceptionInfo *, max(1, count));
+
+    for (n = 0; n < count; n++)
+    {
+        list->exceptions[n] = AcquireExceptionInfo();
+        list->count = n + 1;
+    }
+
+    return list->exceptions;
+}
+
+
+//! The result images made by the tasks of an rm_parallel call
+typedef struct
+{
+    long count;                 /**< the number of images */
+    Image **images;             /**< the images, NULL once taken */
+} ParallelImages;
+
+
+/**
+ * Destroy the images in a ParallelImages that weren't taken.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param p the ParallelImages
+ */
+static void
+destroy_ParallelImages(void *p)
+{
+    ParallelImages *list = (ParallelImages *)p;
+    long n;
+
+    for (n = 0; n < list->count; n++)
+    {
+        if (list->images[n])
+        {
+            (void) DestroyImage(list->images[n]);
+        }
+    }
+    xfree(list->images);
+    xfree(list);
+}
+
+
+/**
+ * Make a list of slots for the images made by the tasks of an rm_parallel
+ * call, all NULL.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The images left in the slots are destroyed by the GC with their owner,
+ *     so they don't leak if an exception is raised. Set a slot to NULL when
+ *     taking its image.
+ *
+ * @param keep Array that keeps the owner alive
+ * @param count the number of slots
+ * @return the slots
+ */
+Image **
+rm_images_new(VALUE keep, long count)
+{
+    ParallelImages *list;
+
+    list = ALLOC(ParallelImages);
+    list->count = 0;
+    list->images = NULL;
+    (void) rb_ary_push(keep, Data_Wrap_Struct(0, NULL, destroy_ParallelImages, list));
+    list->images = ZALLOC_N(Image *, max(1, count));
+    list->count = count;
+
+    return list->images;
+}
+
+
+/**
+ * Check the ExceptionInfos made by rm_exceptions_new. Issue the warning or
+ * raise the error in the worst of them.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - The check is made on a copy, so the ExceptionInfos stay with their
+ *     owner.
+ *
+ * @param exceptions the ExceptionInfos
+ * @param count the number of ExceptionInfos
+ * @param imglist the images made by the call, as for rm_check_exception
+ * @param retention retention, as for rm_check_exception
+ * @see rm_check_exception
+ */
+void
+rm_check_exceptions(ExceptionInfo **exceptions, long count, Image *imglist, ErrorRetention retention)
+{
+    ExceptionInfo *exception, *worst = exceptions[0];
+    long n;
+
+    for (n = 1; n < count; n++)
+    {
+        if (exceptions[n]->severity > worst->severity)
+        {
+            worst = exceptions[n];
+        }
+    }
+    if (worst->severity == UndefinedException)
+    {
+        return;
+    }
+
+    exception = AcquireExceptionInfo();
+    InheritException(exception, worst);
+    rm_check_exception(exception, imglist, retention);
+    (void) DestroyExceptionInfo(exception);
 }
 
 
@@ -1562,6 +2297,8 @@ rm_check_exception(ExceptionInfo *exception, Image *imglist, ErrorRetention rete
 {
     if (exception->severity == UndefinedException)
     {
+        // Start counting refusals afresh for the next call.
+        (void) rm_managed_memory_limit_hit();
         return;
     }
 
@@ -1633,6 +2370,14 @@ rm_error_handler(const ExceptionType severity, const char *reason, const char *d
 void
 rm_fatal_error_handler(const ExceptionType severity, const char *reason, const char *description)
 {
+#if defined(HAVE_RUBY_THREAD_HAS_GVL_P)
+    // A thread without the GVL can't raise. ImageMagick exits when we return.
+    if (!ruby_thread_has_gvl_p())
+    {
+        fprintf(stderr, "RMagick: %s\n", GetLocaleExceptionMessage(severity, reason));
+        return;
+    }
+#endif
     rb_raise(Class_FatalImageMagickError, "%s", GetLocaleExceptionMessage(severity, reason));
     description = description;
 }
@@ -1730,11 +2475,53 @@ handle_exception(ExceptionInfo *exception, Image *imglist, ErrorRetention retent
     msg[sizeof(msg)-1] = '\0';
 
     (void) DestroyExceptionInfo(exception);
+
+    // The error was caused by the managed memory high-water mark during the call
+    if (rm_managed_memory_limit_hit())
+    {
+        rb_exc_raise(rb_funcall(Class_MemoryLimitError, rm_ID_new, 2, rb_str_new2(msg), Qnil));
+    }
     rm_magick_error(msg, NULL);
 
 }
 
 
+/**
+ * Create, but don't raise, an ImageMagickError for an ImageMagick error.
+ *
+ * No Ruby usage (internal function)
+ *
+ * Notes:
+ *   - Used when an error is returned as a result (Magick.thumbnail_batch)
+ *     instead of being raised.
+ *   - The caller destroys the ExceptionInfo.
+ *
+ * @param exception information about the exception
+ * @return a new ImageMagickError
+ */
+VALUE
+rm_exception_new(ExceptionInfo *exception)
+{
+    char msg[1020];
+    const char *reason, *desc;
+
+    reason = exception->reason ? exception->reason : "unknown error";
+    desc = exception->description;
+
+#if defined(HAVE_SNPRINTF)
+    snprintf(msg, sizeof(msg)-1, "%s%s%s",
+#else
+    sprintf(msg, "%.500s%s%.500s",
+#endif
+        GetLocaleExceptionMessage(exception->severity, reason),
+        desc ? ": " : "",
+        desc ? GetLocaleExceptionMessage(exception->severity, desc) : "");
+    msg[sizeof(msg)-1] = '\0';
+
+    return rb_funcall(Class_ImageMagickError, rm_ID_new, 2, rb_str_new2(msg), Qnil);
+}
+
+
 /**
  * RMagick expected a result. If it got NULL instead raise an exception.
  *
@@ -0,0 +1,778 @@
+/**************************************************************************//**
+ * Magick::Image::View class method definitions for RMagick.
+ *
+ * Copyright &copy; 2002 - 2009 by Timothy P. Hunter
+ *
+ * Changes since Nov. 2009 copyright &copy; by Benjamin Thomas and Omer Bar-or
+ *
+ * @file     rmview.c
+ * @version  $Id$
+ ******************************************************************************/
+
+#include "rmagick.h"
+
+
+/*
+ * A view is a copy-on-write cache of the rows in a rectangle of an image.
+ *
+ * A row is copied out of the image the first time it's used, as an Array of
+ * Pixel objects plus a snapshot of the original pixels. View#sync writes back
+ * only the rows that were assigned to through Rows#[]= or whose Pixels differ
+ * from their snapshot. Rows that were never used cost nothing.
+ */
+
+//! A row index list and the view it belongs to
+typedef struct
+{
+    VALUE view; /**< the View object */
+    VALUE rows; /**< Array of row indexes */
+    int unique; /**< true if a single row was selected */
+} ViewRows;
+
+
+static VALUE view_row(View *, long);
+static VALUE view_indexes(int, VALUE *, unsigned long, int *);
+
+
+/**
+ * Mark the Ruby objects referenced by a View.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param v the view
+ */
+static void
+mark_View(void *v)
+{
+    View *view = (View *)v;
+
+    rb_gc_mark(view->image);
+    rb_gc_mark(view->rows);
+}
+
+
+/**
+ * Free a View.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param v the view
+ */
+static void
+destroy_View(void *v)
+{
+    View *view = (View *)v;
+    unsigned long row;
+
+    if (view->originals)
+    {
+        for (row = 0; row < view->height; row++)
+        {
+            if (view->originals[row])
+            {
+                xfree(view->originals[row]);
+            }
+        }
+        xfree(view->originals);
+    }
+    if (view->dirty)
+    {
+        xfree(view->dirty);
+    }
+    xfree(view);
+}
+
+
+//! The Magick::Image::View data type
+const rb_data_type_t rm_View_data_type = {
+    "Magick::Image::View",
+    { mark_View, destroy_View, NULL, },
+};
+
+
+/**
+ * Create a new, empty, View object.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param class the Ruby View class
+ * @return a new View object
+ */
+VALUE
+View_alloc(VALUE class)
+{
+    View *view;
+
+    view = ALLOC(View);
+    memset(view, 0, sizeof(View));
+    view->image = Qnil;
+    view->rows = Qnil;
+
+    return TypedData_Wrap_Struct(class, &rm_View_data_type, view);
+}
+
+
+/**
+ * Initialize a View of a rectangle of an image.
+ *
+ * Ruby usage:
+ *   - @verbatim View#initialize(img, x, y, width, height) @endverbatim
+ *
+ * Notes:
+ *   - No pixels are copied until a row is used.
+ *   - A View can't be initialized twice.
+ *
+ * @param self this object
+ * @param img the image
+ * @param x_arg x position of start of region
+ * @param y_arg y position of start of region
+ * @param width_arg width of region
+ * @param height_arg height of region
+ * @return self
+ */
+VALUE
+View_initialize(VALUE self, VALUE img, VALUE x_arg, VALUE y_arg, VALUE width_arg, VALUE height_arg)
+{
+    View *view;
+    Image *image;
+    long x, y, width, height;
+
+    image = rm_check_destroyed(img);
+    x      = NUM2LONG(x_arg);
+    y      = NUM2LONG(y_arg);
+    width  = NUM2LONG(width_arg);
+    height = NUM2LONG(height_arg);
+
+    if (width <= 0 || height <= 0)
+    {
+        rb_raise(rb_eArgError, "invalid geometry (%ldx%ld%+ld%+ld)", width, height, x, y);
+    }
+    if (x < 0 || y < 0 || (unsigned long)(x+width) > image->columns || (unsigned long)(y+height) > image->rows)
+    {
+        rb_raise(rb_eRangeError, "geometry (%ldx%ld%+ld%+ld) exceeds image boundary", width, height, x, y);
+    }
+
+    TypedData_Get_Struct(self, View, &rm_View_data_type, view);
+    if (view->originals)
+    {
+        rb_raise(rb_eTypeError, "already initialized view");
+    }
+    view->image = img;
+    view->x = x;
+    view->y = y;
+    view->width = (unsigned long)width;
+    view->height = (unsigned long)height;
+    view->rows = rb_ary_new2(height);
+    view->originals = ALLOC_N(PixelPacket *, height);
+    memset(view->originals, 0, height * sizeof(PixelPacket *));
+    view->dirty = ALLOC_N(char, height);
+    memset(view->dirty, 0, (size_t)height);
+    view->force = MagickFalse;
+
+    return self;
+}
+
+
+DEF_ATTR_READER(View, x, long)
+DEF_ATTR_READER(View, y, long)
+DEF_ATTR_READER(View, width, ulong)
+DEF_ATTR_READER(View, height, ulong)
+
+
+/**
+ * Return the cached row, copying it out of the image first if necessary.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param view the view
+ * @param row the row, relative to the view
+ * @return an Array of Pixel objects
+ */
+static VALUE
+view_row(View *view, long row)
+{
+    Image *image;
+    const PixelPacket *pixels;
+    ExceptionInfo *exception;
+    VALUE pixel_ary;
+    unsigned long x;
+
+    pixel_ary = rb_ary_entry(view->rows, row);
+    if (!NIL_P(pixel_ary))
+    {
+        return pixel_ary;
+    }
+
+    image = rm_check_destroyed(view->image);
+    if ((unsigned long)view->x + view->width > image->columns
+        || (unsigned long)(view->y + row) >= image->rows)
+    {
+        rb_raise(rb_eRangeError, "view exceeds image boundary");
+    }
+
+    exception = AcquireExceptionInfo();
+#if defined(HAVE_GETVIRTUALPIXELS)
+    pixels = GetVirtualPixels(image, view->x, view->y + row, view->width, 1, exception);
+#else
+    pixels = AcquireImagePixels(image, view->x, view->y + row, view->width, 1, exception);
+#endif
+    CHECK_EXCEPTION()
+    (void) DestroyExceptionInfo(exception);
+
+    if (!pixels)
+    {
+        rm_magick_error("can't get image pixels", NULL);
+    }
+
+    pixel_ary = rb_ary_new2((long)view->width);
+    for (x = 0; x < view->width; x++)
+    {
+        (void) rb_ary_push(pixel_ary, Pixel_from_PixelPacket(&pixels[x]));
+    }
+
+    view->originals[row] = ALLOC_N(PixelPacket, view->width);
+    memcpy(view->originals[row], pixels, view->width * sizeof(PixelPacket));
+    rb_ary_store(view->rows, row, pixel_ary);
+
+    RB_GC_GUARD(pixel_ary);
+
+    return pixel_ary;
+}
+
+
+/**
+ * Return true if a cached row has been changed.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param view the view
+ * @param row the row, relative to the view
+ * @return true if the row has to be written back to the image
+ */
+static int
+view_row_dirty(View *view, long row)
+{
+    VALUE pixel_ary;
+    Pixel *pixel;
+    unsigned long x;
+
+    if (!view->originals[row])
+    {
+        return MagickFalse;
+    }
+    if (view->dirty[row])
+    {
+        return MagickTrue;
+    }
+
+    pixel_ary = rb_ary_entry(view->rows, row);
+    for (x = 0; x < view->width; x++)
+    {
+        TypedData_Get_Struct(rb_ary_entry(pixel_ary, (long)x), Pixel, &rm_Pixel_data_type, pixel);
+        if (memcmp(pixel, &view->originals[row][x], sizeof(PixelPacket)) != 0)
+        {
+            view->dirty[row] = 1;
+            return MagickTrue;
+        }
+    }
+
+    RB_GC_GUARD(pixel_ary);
+
+    return MagickFalse;
+}
+
+
+/**
+ * Return true if any pixel in the view has been changed.
+ *
+ * Ruby usage:
+ *   - @verbatim View#dirty @endverbatim
+ *
+ * @param self this object
+ * @return true or false
+ */
+VALUE
+View_dirty(VALUE self)
+{
+    View *view;
+    unsigned long row;
+
+    TypedData_Get_Struct(self, View, &rm_View_data_type, view);
+    if (view->force)
+    {
+        return Qtrue;
+    }
+    for (row = 0; row < view->height; row++)
+    {
+        if (view_row_dirty(view, (long)row))
+        {
+            return Qtrue;
+        }
+    }
+
+    return Qfalse;
+}
+
+
+/**
+ * Mark the view as changed (or not).
+ *
+ * Ruby usage:
+ *   - @verbatim View#dirty=(true or false) @endverbatim
+ *
+ * Notes:
+ *   - If true, View#sync writes back every cached row. If false, the rows
+ *     that have been changed are still written back.
+ *
+ * @param self this object
+ * @param dirty true or false
+ * @return dirty
+ */
+VALUE
+View_dirty_eq(VALUE self, VALUE dirty)
+{
+    View *view;
+
+    TypedData_Get_Struct(self, View, &rm_View_data_type, view);
+    view->force = RTEST(dirty) ? MagickTrue : MagickFalse;
+    return dirty;
+}
+
+
+/**
+ * Select rows in the view.
+ *
+ * Ruby usage:
+ *   - @verbatim View#[] @endverbatim
+ *   - @verbatim View#[row] @endverbatim
+ *   - @verbatim View#[rows] @endverbatim
+ *   - @verbatim View#[start, length] @endverbatim
+ *
+ * Notes:
+ *   - row is an Integer. Negative values count from the last row.
+ *   - rows is a Range or Array (or other Enumerable) of rows.
+ *   - With no arguments, all rows are selected.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a View::Rows object
+ */
+VALUE
+View_aref(int argc, VALUE *argv, VALUE self)
+{
+    View *view;
+    ViewRows *rows;
+    VALUE rows_obj;
+
+    TypedData_Get_Struct(self, View, &rm_View_data_type, view);
+
+    rows_obj = ViewRows_alloc(Class_ViewRows);
+    Data_Get_Struct(rows_obj, ViewRows, rows);
+    rows->view = self;
+    rows->rows = view_indexes(argc, argv, view->height, &rows->unique);
+
+    RB_GC_GUARD(rows_obj);
+
+    return rows_obj;
+}
+
+
+/**
+ * Write the changed rows back to the image.
+ *
+ * Ruby usage:
+ *   - @verbatim View#sync @endverbatim
+ *   - @verbatim View#sync(force) @endverbatim
+ *
+ * Notes:
+ *   - Default force is false. If true, every cached row is written.
+ *   - Only rows that have been used can have changed, so rows that were
+ *     never used are never written.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return true if any rows were written, otherwise false
+ */
+VALUE
+View_sync(int argc, VALUE *argv, VALUE self)
+{
+    View *view;
+    Image *image;
+    PixelPacket *pixels;
+    Pixel *pixel;
+    VALUE pixel_ary = Qnil;
+    ExceptionInfo *exception;
+    unsigned long row, x;
+    int force = MagickFalse, synced = MagickFalse;
+    unsigned int okay;
+
+    switch (argc)
+    {
+        case 1:
+            force = RTEST(argv[0]);
+        case 0:
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 or 1)", argc);
+            break;
+    }
+
+    TypedData_Get_Struct(self, View, &rm_View_data_type, view);
+    force = force || view->force;
+
+    for (row = 0; row < view->height; row++)
+    {
+        if (!view->originals[row] || !(force || view_row_dirty(view, (long)row)))
+        {
+            continue;
+        }
+
+        if (!synced)
+        {
+            image = rm_check_frozen(view->image);
+            okay = SetImageStorageClass(image, DirectClass);
+            rm_check_image_exception(image, RetainOnError);
+            if (!okay)
+            {
+                rb_raise(Class_ImageMagickError, "SetImageStorageClass failed. Can't sync view.");
+            }
+        }
+        image = rm_check_destroyed(view->image);
+        synced = MagickTrue;
+
+        exception = AcquireExceptionInfo();
+#if defined(HAVE_GETAUTHENTICPIXELS)
+        pixels = GetAuthenticPixels(image, view->x, view->y + (long)row, view->width, 1, exception);
+#else
+        pixels = GetImagePixels(image, view->x, view->y + (long)row, view->width, 1);
+#endif
+        CHECK_EXCEPTION()
+
+        if (pixels)
+        {
+            pixel_ary = rb_ary_entry(view->rows, (long)row);
+            for (x = 0; x < view->width; x++)
+            {
+                TypedData_Get_Struct(rb_ary_entry(pixel_ary, (long)x), Pixel, &rm_Pixel_data_type, pixel);
+                pixels[x] = *pixel;
+            }
+#if defined(HAVE_SYNCAUTHENTICPIXELS)
+            (void) SyncAuthenticPixels(image, exception);
+#else
+            (void) SyncImagePixels(image);
+#endif
+            CHECK_EXCEPTION()
+
+            // The image now matches the cache
+            memcpy(view->originals[row], pixels, view->width * sizeof(PixelPacket));
+            view->dirty[row] = 0;
+        }
+        (void) DestroyExceptionInfo(exception);
+    }
+
+    view->force = MagickFalse;
+
+    RB_GC_GUARD(pixel_ary);
+
+    return synced || force ? Qtrue : Qfalse;
+}
+
+
+/**
+ * Convert an index argument to a non-negative index, raising IndexError if
+ * it's out of range.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param index_arg the index
+ * @param size the number of rows or columns
+ * @return the index
+ */
+static long
+view_index(VALUE index_arg, unsigned long size)
+{
+    long index = NUM2LONG(rb_Integer(index_arg));
+
+    if (index < 0)
+    {
+        index += (long)size;
+    }
+    if (index < 0 || (unsigned long)index >= size)
+    {
+        rb_raise(rb_eIndexError, "index [%ld] out of range", NUM2LONG(rb_Integer(index_arg)));
+    }
+
+    return index;
+}
+
+
+/**
+ * Convert View#[] or Rows#[] arguments to an Array of row or column indexes.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param size the number of rows or columns
+ * @param unique set to true if the arguments select exactly one index
+ * @return an Array of indexes
+ */
+static VALUE
+view_indexes(int argc, VALUE *argv, unsigned long size, int *unique)
+{
+    VALUE indexes, ary;
+    long n, beg, len;
+
+    *unique = MagickFalse;
+    indexes = rb_ary_new();
+
+    switch (argc)
+    {
+        case 0:
+            beg = 0;
+            len = (long)size;
+            break;
+        case 1:
+            if (rb_obj_is_kind_of(argv[0], rb_cRange))
+            {
+                (void) rb_range_beg_len(argv[0], &beg, &len, (long)size, 1);
+            }
+            else if (rb_respond_to(argv[0], rb_intern("each")))
+            {
+                ary = rb_Array(argv[0]);
+                for (n = 0; n < RARRAY_LEN(ary); n++)
+                {
+                    (void) rb_ary_push(indexes, LONG2NUM(view_index(rb_ary_entry(ary, n), size)));
+                }
+                RB_GC_GUARD(ary);
+                return indexes;
+            }
+            else
+            {
+                *unique = MagickTrue;
+                beg = view_index(argv[0], size);
+                len = 1;
+            }
+            break;
+        case 2:
+            beg = NUM2LONG(rb_Integer(argv[0]));
+            len = NUM2LONG(rb_Integer(argv[1]));
+            if (beg < 0)
+            {
+                beg += (long)size;
+            }
+            if (beg < 0 || (unsigned long)beg > size || len < 0)
+            {
+                rb_raise(rb_eIndexError, "index [%ld] out of range", NUM2LONG(rb_Integer(argv[0])));
+            }
+            len = min(len, (long)size - beg);
+            break;
+        default:
+            rb_raise(rb_eArgError, "wrong number of arguments (%d for 0 to 2)", argc);
+            break;
+    }
+
+    for (n = beg; n < beg + len; n++)
+    {
+        (void) rb_ary_push(indexes, LONG2NUM(n));
+    }
+
+    RB_GC_GUARD(indexes);
+
+    return indexes;
+}
+
+
+/**
+ * Mark the Ruby objects referenced by a View::Rows.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param r the rows
+ */
+static void
+mark_ViewRows(void *r)
+{
+    ViewRows *rows = (ViewRows *)r;
+
+    rb_gc_mark(rows->view);
+    rb_gc_mark(rows->rows);
+}
+
+
+/**
+ * Create a new, empty, View::Rows object.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param class the Ruby View::Rows class
+ * @return a new View::Rows object
+ */
+VALUE
+ViewRows_alloc(VALUE class)
+{
+    ViewRows *rows;
+
+    rows = ALLOC(ViewRows);
+    rows->view = Qnil;
+    rows->rows = rb_ary_new();
+    rows->unique = MagickFalse;
+
+    return Data_Wrap_Struct(class, mark_ViewRows, -1, rows);
+}
+
+
+/**
+ * Select pixels in the selected rows.
+ *
+ * Ruby usage:
+ *   - @verbatim Rows#[] @endverbatim
+ *   - @verbatim Rows#[column] @endverbatim
+ *   - @verbatim Rows#[columns] @endverbatim
+ *   - @verbatim Rows#[start, length] @endverbatim
+ *
+ * Notes:
+ *   - The columns are specified the same way as the rows in View#[].
+ *   - If exactly one row and one column is selected the result is the
+ *     Magick::Pixel itself, otherwise it's a View::Pixels array.
+ *   - Changes to the pixels are written to the image by View#sync.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return a Magick::Pixel or a View::Pixels array
+ */
+VALUE
+ViewRows_aref(int argc, VALUE *argv, VALUE self)
+{
+    ViewRows *rows;
+    View *view;
+    VALUE cols, pixels, pixel_ary;
+    long r, c;
+    int unique;
+
+    Data_Get_Struct(self, ViewRows, rows);
+    TypedData_Get_Struct(rows->view, View, &rm_View_data_type, view);
+
+    cols = view_indexes(argc, argv, view->width, &unique);
+
+    if (rows->unique && unique)
+    {
+        pixel_ary = view_row(view, NUM2LONG(rb_ary_entry(rows->rows, 0)));
+        return rb_ary_entry(pixel_ary, NUM2LONG(rb_ary_entry(cols, 0)));
+    }
+
+    pixels = rb_class_new_instance(0, NULL, Class_ViewPixels);
+    for (r = 0; r < RARRAY_LEN(rows->rows); r++)
+    {
+        pixel_ary = view_row(view, NUM2LONG(rb_ary_entry(rows->rows, r)));
+        for (c = 0; c < RARRAY_LEN(cols); c++)
+        {
+            (void) rb_ary_push(pixels, rb_ary_entry(pixel_ary, NUM2LONG(rb_ary_entry(cols, c))));
+        }
+    }
+
+    RB_GC_GUARD(cols);
+    RB_GC_GUARD(pixels);
+    RB_GC_GUARD(pixel_ary);
+
+    return pixels;
+}
+
+
+/**
+ * Replace the selected pixels in the selected rows.
+ *
+ * Ruby usage:
+ *   - @verbatim Rows#[]=(color) @endverbatim
+ *   - @verbatim Rows#[column]=(color) @endverbatim
+ *   - @verbatim Rows#[columns]=(color) @endverbatim
+ *   - @verbatim Rows#[start, length]=(color) @endverbatim
+ *
+ * Notes:
+ *   - color is a Magick::Pixel or a color name.
+ *
+ * @param argc number of input arguments
+ * @param argv array of input arguments
+ * @param self this object
+ * @return color
+ */
+VALUE
+ViewRows_aset(int argc, VALUE *argv, VALUE self)
+{
+    ViewRows *rows;
+    View *view;
+    VALUE cols, pixel_ary;
+    PixelPacket color;
+    Pixel *pixel;
+    long r, c, row;
+    int unique;
+
+    if (argc < 1)
+    {
+        rb_raise(rb_eArgError, "wrong number of arguments (%d for 1 to 3)", argc);
+    }
+
+    Data_Get_Struct(self, ViewRows, rows);
+    TypedData_Get_Struct(rows->view, View, &rm_View_data_type, view);
+
+    Color_to_PixelPacket(&color, argv[argc-1]);
+    cols = view_indexes(argc-1, argv, view->width, &unique);
+
+    for (r = 0; r < RARRAY_LEN(rows->rows); r++)
+    {
+        row = NUM2LONG(rb_ary_entry(rows->rows, r));
+        pixel_ary = view_row(view, row);
+        for (c = 0; c < RARRAY_LEN(cols); c++)
+        {
+            TypedData_Get_Struct(rb_ary_entry(pixel_ary, NUM2LONG(rb_ary_entry(cols, c))), Pixel, &rm_Pixel_data_type, pixel);
+            *pixel = color;
+        }
+        view->dirty[row] = 1;
+    }
+
+    RB_GC_GUARD(cols);
+    RB_GC_GUARD(pixel_ary);
+
+    return argv[argc-1];
+}
+
+
+/**
+ * Get or set one channel of every pixel in a View::Pixels array.
+ *
+ * No Ruby usage (internal function)
+ *
+ * @param channel the channel name
+ */
+#define DEF_VIEW_PIXELS_CHANNEL_ACCESSOR(channel) \
+    VALUE ViewPixels_##channel(VALUE self) \
+    { \
+        VALUE values = rb_ary_new2(RARRAY_LEN(self)); \
+        long n; \
+        for (n = 0; n < RARRAY_LEN(self); n++) \
+        { \
+            (void) rb_ary_push(values, rb_funcall(rb_ary_entry(self, n), rb_intern(#channel), 0)); \
+        } \
+        RB_GC_GUARD(values); \
+        return values; \
+    } \
+    VALUE ViewPixels_##channel##_eq(VALUE self, VALUE v) \
+    { \
+        long n; \
+        for (n = 0; n < RARRAY_LEN(self); n++) \
+        { \
+            (void) rb_funcall(rb_ary_entry(self, n), rb_intern(#channel "="), 1, v); \
+        } \
+        return v; \
+    }
+
+/*
+ * Get/set the channels of the pixels in a View::Pixels array.
+ */
+DEF_VIEW_PIXELS_CHANNEL_ACCESSOR(red)
+DEF_VIEW_PIXELS_CHANNEL_ACCESSOR(green)
+DEF_VIEW_PIXELS_CHANNEL_ACCESSOR(blue)
+DEF_VIEW_PIXELS_CHANNEL_ACCESSOR(opacity)
@@ -15,6 +15,7 @@ module Magick
   @formats = nil
   @trace_proc = nil
   @exit_block_set_up = nil
+  @image_cache = nil
 
   class << self
     def formats(&block)
@@ -40,6 +41,19 @@ module Magick
         @trace_proc = p
       end
     end
+
+    # The ImageCache used by Image.read and Image.from_blob, or nil
+    def image_cache
+      @image_cache
+    end
+
+    # Opt in to caching decoded images process-wide. nil turns it off.
+    def image_cache=(cache)
+      unless cache.nil? || cache.is_a?(Magick::ImageCache)
+        Kernel.raise ArgumentError, "Magick::ImageCache required (#{cache.class} given)"
+      end
+      @image_cache = cache
+    end
   end
 
   # Geometry class and related enum constants
@@ -778,6 +792,77 @@ module Magick
 
     alias_method :affinity, :remap
 
+    class << self
+      alias_method :read_uncached, :read
+      alias_method :from_blob_uncached, :from_blob
+
+      # Read through Magick.image_cache when it's set
+      def read(*args, &block)
+        cache = Magick.image_cache
+        cache ? cache.read(*args, &block) : read_uncached(*args, &block)
+      end
+
+      def from_blob(*args, &block)
+        cache = Magick.image_cache
+        cache ? cache.from_blob(*args, &block) : from_blob_uncached(*args, &block)
+      end
+    end
+
+    # A chain of operations that is recorded now and run in one call when the
+    # result is needed, without an Image object for each intermediate image.
+    #   img.pipeline.crop(0, 0, 200, 200).resize(0.5).sharpen(0, 1).to_blob
+    # The steps run exactly as given. With img.pipeline(true), cheap geometry
+    # steps may be moved first: a crop after a resize, and a shrinking resize
+    # after a blur or sharpen. That can change pixels and page offsets
+    # slightly.
+    # Steps are not fused: each one still makes a new image from the last, so
+    # the pixels are processed once per step. The saving is one GVL release
+    # for the chain and no Ruby object per intermediate image.
+    class Pipeline
+      OPERATIONS = [:blur_image, :crop, :flip, :flop, :modulate, :quantize,
+                    :resize, :rotate, :sample, :scale, :sharpen, :thumbnail]
+
+      attr_reader :operations
+
+      def initialize(image, reorder = false)
+        @image = image
+        @reorder = reorder
+        @operations = []
+      end
+
+      OPERATIONS.each do |op|
+        define_method(op) do |*args|
+          @operations << [op, *args]
+          self
+        end
+      end
+
+      # Run the operations and return the new image
+      def to_image
+        @image.run_pipeline(@operations, @reorder)
+      end
+      alias_method :execute, :to_image
+
+      def to_blob(&block)
+        image = to_image
+        image.to_blob(&block)
+      ensure
+        image.destroy! if image
+      end
+
+      def write(file, &block)
+        image = to_image
+        image.write(file, &block)
+        self
+      ensure
+        image.destroy! if image
+      end
+    end
+
+    def pipeline(reorder = false)
+      Pipeline.new(self, reorder)
+    end
+
     # Provide an alternate version of Draw#annotate, for folks who
     # want to find it in this class.
     def annotate(draw, width, height, x, y, text, &block)
@@ -827,14 +912,6 @@ module Magick
       self
     end
 
-    # Thanks to Russell Norris!
-    def each_pixel
-      get_pixels(0, 0, columns, rows).each_with_index do |p, n|
-        yield(p, n%columns, n/columns)
-      end
-      self
-    end
-
     # Retrieve EXIF data by entry or all. If one or more entry names specified,
     # return the values associated with the entries. If no entries specified,
     # return all entries and values. The return value is an array of [name,value]
@@ -910,6 +987,15 @@ module Magick
 
     # (Thanks to Al Evans for the suggestion.)
     def level(black_point=0.0, white_point=nil, gamma=nil)
+      level2(*level_arguments(black_point, white_point, gamma))
+    end
+
+    # Same as level, but changes the pixels of this image.
+    def level!(black_point=0.0, white_point=nil, gamma=nil)
+      level2!(*level_arguments(black_point, white_point, gamma))
+    end
+
+    def level_arguments(black_point, white_point, gamma)
       black_point = Float(black_point)
 
       white_point ||= Magick::QuantumRange - black_point
@@ -926,8 +1012,9 @@ module Magick
         end
       end
 
-      level2(black_point, white_point, gamma)
+      [black_point, white_point, gamma]
     end
+    private :level_arguments
 
     # These four methods are equivalent to the Draw#matte method
     # with the "Point", "Replace", "Floodfill", "FilltoBorder", and
@@ -1039,251 +1126,127 @@ module Magick
         return view
       end
     end
+  end # class Magick::Image
+
+  class ImageList
+    include Comparable
+    include Enumerable
+    attr_reader :scene
 
-    # Magick::Image::View class
-    class View
-      attr_reader :x, :y, :width, :height
-      attr_accessor :dirty
+    private
 
-      def initialize(img, x, y, width, height)
-        img.check_destroyed
-        if width <= 0 || height <= 0
-          Kernel.raise ArgumentError, "invalid geometry (#{width}x#{height}+#{x}+#{y})"
-        end
-        if x < 0 || y < 0 || (x+width) > img.columns || (y+height) > img.rows
-          Kernel.raise RangeError, "geometry (#{width}x#{height}+#{x}+#{y}) exceeds image boundary"
-        end
-        @view = img.get_pixels(x, y, width, height)
-        @img = img
-        @x = x
-        @y = y
-        @width = width
-        @height = height
-        @dirty = false
-      end
-
-      def [](*args)
-        rows = Rows.new(@view, @width, @height, args)
-        rows.add_observer(self)
-        rows
-      end
-
-      # Store changed pixels back to image
-      def sync(force=false)
-        @img.store_pixels(x, y, width, height, @view) if @dirty || force
-        @dirty || force
-      end
-
-      # Get update from Rows - if @dirty ever becomes
-      # true, don't change it back to false!
-      def update(rows)
-        @dirty = true
-        rows.delete_observer(self)      # No need to tell us again.
-        nil
-      end
-
-      # Magick::Image::View::Pixels
-      # Defines channel attribute getters/setters
-      class Pixels < Array
-        include Observable
-
-        # Define a getter and a setter for each channel.
-        [:red, :green, :blue, :opacity].each do |c|
-          module_eval <<-END_EVAL
-            def #{c}
-                return collect { |p| p.#{c} }
-            end
-            def #{c}=(v)
-                each { |p| p.#{c} = v }
-                changed
-                notify_observers(self)
-                nil
-            end
-        END_EVAL
-        end
-      end # class Magick::Image::View::Pixels
+    def get_current
+      return @images[@scene].__id__ rescue nil
+    end
 
-      # Magick::Image::View::Rows
-      class Rows
-        include Observable
+    # Return the decoded frame for an element of @images. Only lists read
+    # with #read_lazy hold pinged frames that need decoding.
+    def decoded_frame(image)
+      @lazy ? @lazy.decode(image) : image
+    end
 
-        def initialize(view, width, height, rows)
-          @view = view
-          @width = width
-          @height = height
-          @rows = rows
-        end
+    # Return a new, empty list that shares the decoded frame cache.
+    def new_list
+      ilist = self.class.new
+      ilist.instance_variable_set(:@lazy, @lazy)
+      ilist
+    end
 
-        def [](*args)
-          cols(args)
-
-          # Both View::Pixels and Magick::Pixel implement Observable
-          if @unique
-            pixels = @view[@rows[0]*@width + @cols[0]]
-            pixels.add_observer(self)
-          else
-            pixels = View::Pixels.new
-            each do |x|
-              p = @view[x]
-              p.add_observer(self)
-              pixels << p
-            end
-          end
-          pixels
-        end
+    # The frames the setters that apply to every frame change. The decoded
+    # frames of a list read with #read_lazy are frozen, so they're dropped and
+    # decoded again with the pinged frames' new values.
+    def held_frames
+      @lazy.clear if @lazy
+      @images
+    end
 
-        def []=(*args)
-          rv = args.delete_at(-1)     # get rvalue
-          unless rv.is_a?(Pixel)        # must be a Pixel or a color name
-            begin
-              rv = Pixel.from_color(rv)
-            rescue TypeError
-              Kernel.raise TypeError, "cannot convert #{rv.class} into Pixel"
-            end
-          end
-          cols(args)
-          each { |x| @view[x] = rv.dup }
-          changed
-          notify_observers(self)
-          nil
-        end
+    # Called from the C methods that need the pixels of every frame.
+    def decoded_images
+      return @images unless @lazy
+      @lazy.pin(@images.collect { |image| decoded_frame(image) })
+    end
 
-        # A pixel has been modified. Tell the view.
-        def update(pixel)
-          changed
-          notify_observers(self)
-          pixel.delete_observer(self) # Don't need to hear again.
-          nil
-        end
+    # The LRU cache of the frames decoded from the pinged frames of a list
+    # read with #read_lazy. Each pinged frame carries the filename and info
+    # block it's decoded from, so nothing is kept for the frames that are
+    # gone. Decoded frames are frozen because changes to them would be lost
+    # when they're dropped from the cache.
+    class LazyFrames
+      attr_reader :max_decoded
 
-        private
-
-        def cols(*args)
-          @cols = args[0]     # remove the outermost array
-          @unique = false
-
-          # Convert @rows to an Enumerable object
-          case @rows.length
-          when 0                      # Create a Range for all the rows
-            @rows = Range.new(0, @height, true)
-          when 1                      # Range, Array, or a single integer
-            # if the single element is already an Enumerable
-            # object, get it.
-            if @rows.first.respond_to? :each
-              @rows = @rows.first
-            else
-              @rows = Integer(@rows.first)
-              if @rows < 0
-                @rows += @height
-              end
-              if @rows < 0 || @rows > @height-1
-                Kernel.raise IndexError, "index [#{@rows}] out of range"
-              end
-              # Convert back to an array
-              @rows = Array.new(1, @rows)
-              @unique = true
-            end
-          when 2
-            # A pair of integers representing the starting column and the number of columns
-            start = Integer(@rows[0])
-            length = Integer(@rows[1])
-
-            # Negative start -> start from last row
-            if start < 0
-              start += @height
-            end
-
-            if start > @height || start < 0 || length < 0
-              Kernel.raise IndexError, "index [#{@rows.first}] out of range"
-            else
-              if start + length > @height
-                length = @height - length
-                length = [length, 0].max
-              end
-            end
-            # Create a Range for the specified set of rows
-            @rows = Range.new(start, start+length, true)
-          end
+      def initialize(max_decoded)
+        @decoded = {}   # pinged frame __id__ => [pinged frame, decoded frame]
+        @lru = []       # pinged frame __id__s, least recently used first
+        @pinned = nil
+        self.max_decoded = max_decoded
+      end
 
-          case @cols.length
-          when 0                  # all rows
-            @cols = Range.new(0, @width, true)  # convert to range
-            @unique = false
-          when 1                  # Range, Array, or a single integer
-            # if the single element is already an Enumerable
-            # object, get it.
-            if @cols.first.respond_to? :each
-              @cols = @cols.first
-              @unique = false
-            else
-              @cols = Integer(@cols.first)
-              if @cols < 0
-                @cols += @width
-              end
-              if @cols < 0 || @cols > @width-1
-                Kernel.raise IndexError, "index [#{@cols}] out of range"
-              end
-              # Convert back to array
-              @cols = Array.new(1, @cols)
-              @unique &&= true
-            end
-          when 2
-            # A pair of integers representing the starting column and the number of columns
-            start = Integer(@cols[0])
-            length = Integer(@cols[1])
-
-            # Negative start -> start from last row
-            if start < 0
-              start += @width
-            end
-
-            if start > @width || start < 0 || length < 0
-              ; #nop
-            else
-              if start + length > @width
-                length = @width - length
-                length = [length, 0].max
-              end
-            end
-            # Create a Range for the specified set of columns
-            @cols = Range.new(start, start+length, true)
-            @unique = false
-          end
-        end
+      def max_decoded=(n)
+        n = Integer(n)
+        Kernel.raise ArgumentError, 'max_decoded_frames must be greater than 0' if n < 1
+        @max_decoded = n
+        trim
+      end
 
-        # iterator called from subscript methods
-        def each
-          maxrows = @height - 1
-          maxcols = @width - 1
-
-          @rows.each do |j|
-            if j > maxrows
-              Kernel.raise IndexError, "index [#{j}] out of range"
-            end
-            @cols.each do |i|
-              if i > maxcols
-                Kernel.raise IndexError, "index [#{i}] out of range"
-              end
-              yield j*@width + i
-            end
-          end
-          nil    # useless return value
-        end
-      end # class Magick::Image::View::Rows
-    end     # class Magick::Image::View
-  end # class Magick::Image
+      def add(ping, filename, info_block)
+        ping.instance_variable_set(:@lazy_source, [filename, info_block])
+      end
 
-  class ImageList
-    include Comparable
-    include Enumerable
-    attr_reader :scene
+      def decoded_count
+        @decoded.length
+      end
 
-    private
+      def decoded_images
+        @decoded.values.collect { |_, image| image }
+      end
 
-    def get_current
-      return @images[@scene].__id__ rescue nil
+      # Drop every decoded frame
+      def clear
+        @decoded.clear
+        @lru.clear
+        @pinned = nil
+      end
+
+      # Keep every frame a C method is using alive, including the ones that
+      # don't fit in the cache, until the next frame is decoded.
+      def pin(images)
+        @pinned = images
+      end
+
+      def decode(ping)
+        source = ping.instance_variable_get(:@lazy_source)
+        return ping unless source
+
+        # The cache holds the pinged frame, so its __id__ isn't reused
+        id = ping.__id__
+        @pinned = nil
+        if @decoded.key?(id)
+          image = @decoded[id][1]
+          @lru.delete(id)
+        else
+          filename, info_block = source
+          image = Magick::Image.read(filename, &info_block).first
+          Kernel.raise ImageMagickError, "can't decode #{filename}" unless image
+          image.delay = ping.delay
+          image.iterations = ping.iterations
+          image.ticks_per_second = ping.ticks_per_second
+          image.freeze
+          @decoded[id] = [ping, image]
+        end
+        @lru << id
+        trim
+        image
+      end
+
+      private
+
+      def trim
+        @decoded.delete(@lru.shift) while @lru.length > @max_decoded
+      end
     end
 
+    DEFAULT_MAX_DECODED_FRAMES = 8
+
     protected
 
     def is_an_image(obj)
@@ -1351,7 +1314,7 @@ module Magick
     %w{& + - |}.each do |op|
       module_eval <<-END_BINOPS
         def #{op}(other)
-          ilist = self.class.new
+          ilist = new_list
           begin
             a = other #{op} @images
           rescue TypeError
@@ -1373,7 +1336,7 @@ module Magick
         Kernel.raise ArgumentError, "Integer required (#{n.class} given)"
       end
       current = get_current
-      ilist = self.class.new
+      ilist = new_list
       (@images * n).each {|image| ilist << image}
       ilist.set_current current
       ilist
@@ -1415,11 +1378,11 @@ module Magick
     def [](*args)
       a = @images[*args]
       if a.respond_to?(:each)
-        ilist = self.class.new
+        ilist = new_list
         a.each {|image| ilist << image}
         a = ilist
       end
-      a
+      decoded_frame(a)
     end
 
     def []=(*args)
@@ -1436,8 +1399,7 @@ module Magick
       obj
     end
 
-    [:at, :each, :each_index, :empty?, :fetch,
-     :first, :hash, :include?, :index, :length, :rindex, :sort!].each do |mth|
+    [:each_index, :empty?, :hash, :include?, :index, :length, :rindex, :sort!].each do |mth|
       module_eval <<-END_SIMPLE_DELEGATES
         def #{mth}(*args, &block)
           @images.#{mth}(*args, &block)
@@ -1446,6 +1408,21 @@ module Magick
     end
     alias_method :size, :length
 
+    # Element accessors return decoded frames when the list was read lazily
+    [:at, :fetch, :first].each do |mth|
+      module_eval <<-END_FRAME_DELEGATES
+        def #{mth}(*args, &block)
+          a = @images.#{mth}(*args, &block)
+          a.is_a?(Array) ? a.collect { |image| decoded_frame(image) } : decoded_frame(a)
+        end
+      END_FRAME_DELEGATES
+    end
+
+    def each
+      return enum_for(:each) unless block_given?
+      @images.each { |image| yield(decoded_frame(image)) }
+    end
+
     # Array#nitems is not available in 1.9
     if Array.instance_methods.include?('nitems')
       def nitems
@@ -1467,8 +1444,8 @@ module Magick
     # override Enumerable#collect
     def collect(&block)
       current = get_current
-      a = @images.collect(&block)
-      ilist = self.class.new
+      a = @images.collect { |image| block.call(decoded_frame(image)) }
+      ilist = new_list
       a.each {|image| ilist << image}
       ilist.set_current current
       ilist
@@ -1482,8 +1459,8 @@ module Magick
 
     # Make a deep copy
     def copy
-      ditto = self.class.new
-      @images.each { |f| ditto << f.copy }
+      ditto = new_list
+      @images.each { |f| ditto << decoded_frame(f).copy }
       ditto.scene = @scene
       ditto.taint if tainted?
       ditto
@@ -1494,7 +1471,7 @@ module Magick
       unless @scene
         Kernel.raise IndexError, 'no images in this list'
       end
-      @images[@scene]
+      decoded_frame(@images[@scene])
     end
 
     # ImageList#map took over the "map" name. Use alternatives.
@@ -1507,7 +1484,7 @@ module Magick
 
     def compact
       current = get_current
-      ilist = self.class.new
+      ilist = new_list
       a = @images.compact
       a.each {|image| ilist << image}
       ilist.set_current current
@@ -1533,7 +1510,7 @@ module Magick
       if Integer(d) < 0
         fail ArgumentError, 'delay must be greater than or equal to 0'
       end
-      @images.each { |f| f.delay = Integer(d) }
+      held_frames.each { |f| f.delay = Integer(d) }
     end
 
     def delete(obj, &block)
@@ -1559,7 +1536,7 @@ module Magick
     end
 
     def dup
-      ditto = self.class.new
+      ditto = new_list
       @images.each {|img| ditto << img}
       ditto.scene = @scene
       ditto.taint if tainted?
@@ -1589,20 +1566,23 @@ module Magick
     # Override Enumerable's find_all
     def find_all(&block)
       current = get_current
-      a = @images.find_all(&block)
-      ilist = self.class.new
+      a = @images.find_all { |image| block.call(decoded_frame(image)) }
+      ilist = new_list
       a.each {|image| ilist << image}
       ilist.set_current current
       ilist
     end
     alias_method :select, :find_all
 
+    # The last argument may be a hash of options, such as :size_hint,
+    # for Image.from_blob
     def from_blob(*blobs, &block)
+      opts = blobs.last.is_a?(Hash) ? [blobs.pop] : []
       if (blobs.length == 0)
         Kernel.raise ArgumentError, 'no blobs given'
       end
       blobs.each do |b|
-        Magick::Image.from_blob(b, &block).each { |n| @images << n  }
+        Magick::Image.from_blob(b, *opts, &block).each { |n| @images << n  }
       end
       @scene = length - 1
       self
@@ -1612,6 +1592,7 @@ module Magick
     def initialize(*filenames, &block)
       @images = []
       @scene = nil
+      @lazy = nil
       filenames.each do |f|
         Magick::Image.read(f, &block).each { |n| @images << n }
       end
@@ -1642,16 +1623,16 @@ module Magick
       if n < 0 || n > 65535
         Kernel.raise ArgumentError, 'iterations must be between 0 and 65535'
       end
-      @images.each {|f| f.iterations=n}
+      held_frames.each {|f| f.iterations=n}
       self
     end
 
     def last(*args)
       if args.length == 0
-        a = @images.last
+        a = decoded_frame(@images.last)
       else
         a = @images.last(*args)
-        ilist = self.class.new
+        ilist = new_list
         a.each {|img| ilist << img}
         @scene = a.length - 1
         a = ilist
@@ -1662,12 +1643,13 @@ module Magick
     # Custom marshal/unmarshal for Ruby 1.8.
     def marshal_dump
       ary = [@scene]
-      @images.each {|i| ary << Marshal.dump(i)}
+      @images.each {|i| ary << Marshal.dump(decoded_frame(i))}
       ary
     end
 
     def marshal_load(ary)
       @scene = ary.shift
+      @lazy = nil
       @images = []
       ary.each {|a| @images << Marshal.load(a)}
     end
@@ -1678,7 +1660,7 @@ module Magick
     # it up the line. Catch a NameError and emit a useful message.
     def method_missing(methID, *args, &block)
       if @scene
-        @images[@scene].send(methID, *args, &block)
+        decoded_frame(@images[@scene]).send(methID, *args, &block)
       else
         super
       end
@@ -1695,11 +1677,11 @@ module Magick
     end
 
     def partition(&block)
-      a = @images.partition(&block)
-      t = self.class.new
+      a = @images.partition { |image| block.call(decoded_frame(image)) }
+      t = new_list
       a[0].each { |img| t << img}
       t.set_current nil
-      f = self.class.new
+      f = new_list
       a[1].each { |img| f << img}
       f.set_current nil
       [t, f]
@@ -1734,22 +1716,71 @@ module Magick
     end
 
     # Read files and concatenate the new images
+    # The last argument may be a hash of options, such as :size_hint,
+    # for Image.read
     def read(*files, &block)
+      opts = files.last.is_a?(Hash) ? [files.pop] : []
       if (files.length == 0)
         Kernel.raise ArgumentError, 'no files given'
       end
       files.each do |f|
-        Magick::Image.read(f, &block).each { |n| @images << n }
+        Magick::Image.read(f, *opts, &block).each { |n| @images << n }
+      end
+      @scene = length - 1
+      self
+    end
+
+    # Read files lazily: every frame is pinged now for its geometry and
+    # metadata, and its pixels are decoded the first time the frame is
+    # accessed or used by an ImageList method. At most max_decoded_frames
+    # decoded frames are kept, least recently used frames are dropped first.
+    #
+    # Decoded frames are frozen, so methods that would change them raise.
+    # #delay=, #iterations= and #ticks_per_second= on the list still work.
+    # Use #copy to get a list with every frame decoded and changeable.
+    def read_lazy(*files, &block)
+      if (files.length == 0)
+        Kernel.raise ArgumentError, 'no files given'
+      end
+      @lazy ||= LazyFrames.new(DEFAULT_MAX_DECODED_FRAMES)
+      files.each do |f|
+        # Only plain filenames can be re-read one frame at a time
+        if f.is_a?(String) && f !~ /\]\z/
+          frames = Magick::Image.ping(f, &block)
+          frames.each_with_index { |n, i| @lazy.add(n, "#{f}[#{i}]", block) }
+        else
+          frames = Magick::Image.read(f, &block)
+        end
+        frames.each { |n| @images << n }
       end
       @scene = length - 1
       self
     end
 
+    # true if the list was read with #read_lazy
+    def lazy?
+      !@lazy.nil?
+    end
+
+    def max_decoded_frames
+      @lazy ? @lazy.max_decoded : nil
+    end
+
+    def max_decoded_frames=(n)
+      Kernel.raise ArgumentError, 'not a lazily read image list' unless @lazy
+      @lazy.max_decoded = n
+    end
+
+    # The number of frames currently held decoded
+    def decoded_frames
+      @lazy ? @lazy.decoded_count : 0
+    end
+
     # override Enumerable's reject
     def reject(&block)
       current = get_current
-      ilist = self.class.new
-      a = @images.reject(&block)
+      ilist = new_list
+      a = @images.reject { |image| block.call(decoded_frame(image)) }
       a.each {|image| ilist << image}
       ilist.set_current current
       ilist
@@ -1786,7 +1817,7 @@ module Magick
 
     def reverse
       current = get_current
-      a = self.class.new
+      a = new_list
       @images.reverse_each {|image| a << image}
       a.set_current current
       a
@@ -1800,7 +1831,7 @@ module Magick
     end
 
     def reverse_each
-      @images.reverse_each {|image| yield(image)}
+      @images.reverse_each {|image| yield(decoded_frame(image))}
       self
     end
 
@@ -1815,7 +1846,7 @@ module Magick
       current = get_current
       slice = @images.slice(*args)
       if slice
-        ilist = self.class.new
+        ilist = new_list
         if slice.respond_to?(:each)
           slice.each {|image| ilist << image}
         else
@@ -1838,18 +1869,18 @@ module Magick
       if Integer(t) < 0
         Kernel.raise ArgumentError, 'ticks_per_second must be greater than or equal to 0'
       end
-      @images.each { |f| f.ticks_per_second = Integer(t) }
+      held_frames.each { |f| f.ticks_per_second = Integer(t) }
     end
 
     def to_a
       a = []
-      @images.each {|image| a << image}
+      @images.each {|image| a << decoded_frame(image)}
       a
     end
 
     def uniq
       current = get_current
-      a = self.class.new
+      a = new_list
       @images.uniq.each {|image| a << image}
       a.set_current current
       a
@@ -1872,7 +1903,7 @@ module Magick
 
     def values_at(*args)
       a = @images.values_at(*args)
-      a = self.class.new
+      a = new_list
       @images.values_at(*args).each {|image| a << image}
       a.scene = a.length - 1
       a
@@ -1881,6 +1912,131 @@ module Magick
     alias_method :indices, :values_at
   end # Magick::ImageList
 
+  # A cache of decoded images with a byte budget and least-recently-used
+  # eviction. Files are keyed by path, mtime and size, blobs by a SHA-256
+  # of their content. Every read returns copies of the cached images, which
+  # share the cached pixels until they are changed (copy-on-write).
+  #
+  # Reads with an Image::Info block, and reads of anything but a plain
+  # file, aren't cached. Set Magick.image_cache to use a cache for every
+  # Image.read and Image.from_blob.
+  class ImageCache
+    attr_reader :budget, :bytes, :hits, :misses
+
+    def initialize(budget)
+      @lock = Mutex.new
+      @entries = {}     # key => [images, bytes]
+      @lru = []         # keys, least recently used first
+      @bytes = 0
+      @hits = 0
+      @misses = 0
+      self.budget = budget
+    end
+
+    def budget=(budget)
+      budget = Integer(budget)
+      Kernel.raise ArgumentError, 'budget must be greater than or equal to 0' if budget < 0
+      @lock.synchronize do
+        @budget = budget
+        trim
+      end
+    end
+
+    # Image.read through the cache
+    def read(*args, &block)
+      key = file_key(args) unless block
+      return Magick::Image.read_uncached(*args, &block) unless key
+      fetch(key) { Magick::Image.read_uncached(*args) }
+    end
+
+    # Image.from_blob through the cache
+    def from_blob(*args, &block)
+      key = blob_key(args) unless block
+      return Magick::Image.from_blob_uncached(*args, &block) unless key
+      fetch(key) { Magick::Image.from_blob_uncached(*args) }
+    end
+
+    def clear
+      @lock.synchronize do
+        @entries.clear
+        @lru.clear
+        @bytes = 0
+      end
+      self
+    end
+
+    def length
+      @entries.length
+    end
+    alias_method :size, :length
+
+    def stats
+      @lock.synchronize do
+        { :hits => @hits, :misses => @misses, :entries => @entries.length,
+          :bytes => @bytes, :budget => @budget }
+      end
+    end
+
+    private
+
+    # The options Hash (e.g. :size_hint) is part of the key
+    def file_key(args)
+      path = args.first
+      return nil unless path.is_a?(String) && File.file?(path)
+      stat = File.stat(path)
+      [:file, File.expand_path(path), stat.mtime.to_f, stat.size, args[1..-1]]
+    rescue SystemCallError
+      nil
+    end
+
+    def blob_key(args)
+      blob = args.first
+      return nil unless blob.is_a?(String)
+      require 'digest/sha2'
+      [:blob, Digest::SHA256.digest(blob), blob.bytesize, args[1..-1]]
+    end
+
+    def fetch(key)
+      @lock.synchronize do
+        entry = @entries[key]
+        if entry
+          @hits += 1
+          @lru.delete(key)
+          @lru << key
+          return entry[0].collect { |image| image.copy }
+        end
+        @misses += 1
+      end
+
+      # Decode without the lock. Another thread may decode the same key.
+      images = yield
+      nbytes = images.inject(0) { |sum, image| sum + image_bytes(image) }
+      @lock.synchronize do
+        if nbytes <= @budget && !@entries.key?(key)
+          @entries[key] = [images, nbytes]
+          @lru << key
+          @bytes += nbytes
+          trim
+        end
+      end
+      images.collect { |image| image.copy }
+    end
+
+    def trim
+      while @bytes > @budget
+        entry = @entries.delete(@lru.shift)
+        @bytes -= entry[1]
+      end
+    end
+
+    # The size of the image's pixels and colormap indexes
+    def image_bytes(image)
+      pixel = Magick::PIXEL_PACKET_SIZE
+      pixel += Magick::INDEX_PACKET_SIZE if image.colorspace == Magick::CMYKColorspace || image.class_type == Magick::PseudoClass
+      image.columns * image.rows * pixel
+    end
+  end
+
   #  Collects non-specific optional method arguments
   class OptionalMethodArguments
     def initialize(img)
@@ -90,6 +90,31 @@ class Image1_UT < Test::Unit::TestCase
         assert_equal(img, res[0])
     end
 
+    # Decoding runs without the GVL, so N threads decoding N blobs should
+    # finish well before one thread decoding them one after another.
+    # The speed-up from decoding in threads is timed by examples/threaded_decode.rb
+    def test_from_blob_threads
+        blob = File.open(FLOWER_HAT, 'rb') { |f| f.read }
+        expected = Magick::Image.from_blob(blob).first
+        threads = (1..4).map do
+            Thread.new { Array.new(3) { Magick::Image.from_blob(blob).first } }
+        end
+        threads.each do |thread|
+            thread.value.each do |img|
+                assert_equal('JPEG', img.format)
+                assert_equal(expected.signature, img.signature)
+            end
+        end
+
+        threads = (1..4).map { Thread.new { Magick::Image.read(FLOWER_HAT).first } }
+        threads.each do |thread|
+            img = thread.value
+            assert_equal('JPEG', img.format)
+            assert_equal(expected.signature, img.signature)
+            assert_instance_of(String, img.to_blob)
+        end
+    end
+
     def test_ping
         res = Magick::Image.ping(IMAGES_DIR+'/Button_0.gif')
         assert_instance_of(Array, res)
@@ -100,6 +125,33 @@ class Image1_UT < Test::Unit::TestCase
         assert_match(/Button_0.gif/, res[0].filename)
     end
 
+    def test_read_size_hint
+        full = Magick::Image.ping(FLOWER_HAT).first
+        img = Magick::Image.read(FLOWER_HAT, :size_hint => '50x50').first
+        assert_operator(img.columns, :<, full.columns)
+        assert_operator(img.columns, :>=, 50)
+        assert_operator(img.rows, :>=, 50)
+
+        blob = File.open(FLOWER_HAT, 'rb') { |f| f.read }
+        res = Magick::Image.from_blob(blob, :size_hint => '50x50').first
+        assert_equal([img.columns, img.rows], [res.columns, res.rows])
+        res = Magick::Image.read_inline([blob].pack('m*'), :size_hint => Magick::Geometry.new(50, 50)).first
+        assert_equal([img.columns, img.rows], [res.columns, res.rows])
+        res = Magick::Image.read(FLOWER_HAT) { self.decode_size = '50x50' }.first
+        assert_equal([img.columns, img.rows], [res.columns, res.rows])
+
+        res = Magick::ImageList.new.read(FLOWER_HAT, FLOWER_HAT, :size_hint => '50x50')
+        assert_equal(2, res.length)
+        assert_equal(img.columns, res.columns)
+
+        assert_raise(ArgumentError) { Magick::Image.read(FLOWER_HAT, :size_hint => 'junk') }
+        assert_raise(ArgumentError) { Magick::Image.read(FLOWER_HAT, :size_hint => '10%') }
+        assert_raise(ArgumentError) { Magick::Image.read(FLOWER_HAT, :size_hnt => '50x50') }
+        assert_raise(ArgumentError) { Magick::Image.from_blob(blob, :size_hint => '50x50', :bogus => 1) }
+        assert_raise(ArgumentError) { Magick::Image.read(FLOWER_HAT, FLOWER_HAT) }
+        assert_raise(ArgumentError) { Magick::Image.from_blob(blob, blob) }
+    end
+
     def test_read_inline
         img = Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
         blob = img.to_blob
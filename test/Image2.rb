@@ -68,6 +68,18 @@ class Image2_UT < Test::Unit::TestCase
       assert_nothing_raised { bg.composite_tiled(fg, Magick::RedChannel) }
       assert_nothing_raised { bg.composite_tiled(fg, Magick::RedChannel, Magick::GreenChannel) }
 
+      # same as compositing tile by tile, over several bands and partial tiles
+      canvas = Magick::Image.read(FLOWER_HAT).first.resize(300, 700)
+      tile = Magick::Image.read(FLOWER_HAT).first.crop(40, 30, 37, 23)
+      [Magick::OverCompositeOp, Magick::MultiplyCompositeOp].each do |op|
+        res = canvas.composite_tiled(tile, op)
+        expected = canvas.copy
+        0.step(canvas.rows - 1, tile.rows) do |y|
+          0.step(canvas.columns - 1, tile.columns) { |x| expected.composite!(tile, x, y, op) }
+        end
+        assert_equal(expected.signature, res.signature, op.to_s)
+      end
+
       fg.destroy!
       assert_raise(Magick::DestroyedImageError) { bg.composite_tiled(fg) }
     end
@@ -425,6 +437,28 @@ class Image2_UT < Test::Unit::TestCase
       assert_raise(Magick::DestroyedImageError) { @img.distortion_channel(img, Magick::MeanSquaredErrorMetric) }
     end
 
+    def test_dominant_colors
+      img = Magick::Image.new(20, 20)
+      20.times { |x| 5.times { |y| img.pixel_color(x, y, 'red') } }
+      res = nil
+      assert_nothing_raised { res = img.dominant_colors }
+      assert_instance_of(Array, res)
+      assert_equal(2, res.length)
+      assert_equal([Magick::Pixel.from_color('white'), 300], res[0])
+      assert_equal([Magick::Pixel.from_color('red'), 100], res[1])
+      assert_equal(1, img.dominant_colors(1).length)
+
+      pseudo = img.quantize(2)
+      assert_equal(Magick::PseudoClass, pseudo.class_type)
+      assert_equal([300, 100], pseudo.dominant_colors.map { |pair| pair[1] })
+      assert_equal(400, pseudo.color_histogram.values.inject(:+))
+
+      assert_raise(ArgumentError) { img.dominant_colors(0) }
+      assert_raise(ArgumentError) { img.dominant_colors(1, 2) }
+      img.destroy!
+      assert_raise(Magick::DestroyedImageError) { img.dominant_colors }
+    end
+
     def test_dup
       assert_nothing_raised do
         ditto = @img.dup
@@ -463,6 +497,21 @@ class Image2_UT < Test::Unit::TestCase
       assert_raise(TypeError) { @img.edge('x') }
     end
 
+    def test_each_pixel
+      img = Magick::Image.new(3, 2)
+      img.pixel_color(2, 1, 'red')
+      coords = []
+      res = img.each_pixel do |pixel, x, y|
+        assert_instance_of(Magick::Pixel, pixel)
+        assert_equal(img.pixel_color(x, y), pixel)
+        coords << [x, y]
+      end
+      assert_same(img, res)
+      assert_equal([[0, 0], [1, 0], [2, 0], [0, 1], [1, 1], [2, 1]], coords)
+
+      assert_raise(Magick::DestroyedImageError) { img.each_pixel { img.destroy! } }
+    end
+
     def test_emboss
       assert_nothing_raised do
         res = @img.emboss
@@ -826,6 +875,32 @@ class Image2_UT < Test::Unit::TestCase
       assert_raise(RangeError) { @img.get_pixels(0,  0, @img.columns, @img.rows+1) }
     end
 
+    def test_get_pixels_packed
+      assert_nothing_raised do
+        res = @img.get_pixels_packed(0, 0, @img.columns, 1)
+        assert_instance_of(String, res)
+        assert_equal(@img.columns*'RGB'.length, res.bytesize)
+      end
+      assert_equal(10*10*'RGBA'.length*2, @img.get_pixels_packed(0, 0, 10, 10, 'RGBA', Magick::ShortPixel).bytesize)
+      assert_equal(10*10*4, @img.get_pixels_packed(0, 0, 10, 10, 'I', Magick::FloatPixel).bytesize)
+
+      red = Magick::Image.new(2, 2) { self.background_color = 'red' }
+      assert_equal([255, 0, 0, 255] * 4, red.get_pixels_packed(0, 0, 2, 2, 'RGBA').unpack('C*'))
+      assert_equal([1.0, 0.0] * 4, red.get_pixels_packed(0, 0, 2, 2, 'RB', Magick::DoublePixel).unpack('d*'))
+      assert_equal(red.export_pixels_to_str(0, 0, 2, 2, 'BGR'), red.get_pixels_packed(0, 0, 2, 2, 'BGR'))
+
+      assert_raise(ArgumentError) { @img.get_pixels_packed(0, 0, 1) }
+      assert_raise(ArgumentError) { @img.get_pixels_packed(0, 0, 1, 1, 'RGX') }
+      assert_raise(ArgumentError) { @img.get_pixels_packed(0, 0, 1, 1, 'CMYK') }
+      assert_raise(RangeError) { @img.get_pixels_packed(-1, 0, 1, 1) }
+      assert_raise(RangeError) { @img.get_pixels_packed(0, 0, @img.columns+1, 1) }
+      assert_raise(RangeError) { @img.get_pixels_packed(0, 0, @img.columns, @img.rows+1) }
+      assert_raise(RangeError) { @img.get_pixels_packed(@img.columns+1, 0, 0, 1) }
+      ulong_max = 2**(8*[0].pack('L!').size) - 1
+      assert_raise(RangeError) { @img.get_pixels_packed(1, 0, ulong_max, 1) }
+      assert_raise(RangeError) { @img.get_pixels_packed(0, 1, 1, ulong_max) }
+    end
+
     def test_gray?
       gray = Magick::Image.new(20, 20) { self.background_color = 'gray50' }
       assert(gray.gray?)
@@ -833,6 +908,33 @@ class Image2_UT < Test::Unit::TestCase
       assert(!red.gray?)
     end
 
+    def test_histogram
+      res = nil
+      assert_nothing_raised { res = @img.histogram }
+      assert_instance_of(Array, res)
+      assert_equal(4, res.length)
+      res.each { |channel| assert_equal(256, channel.length) }
+      assert_equal(400, res[0][255])
+      assert_equal(400, res[2].inject(:+))
+      assert_equal(400, res[3][0])
+
+      res = @img.histogram(65536, true)
+      assert_instance_of(String, res[1])
+      counts = res[1].unpack('Q*')
+      assert_equal(65536, counts.length)
+      assert_equal(400, counts[65535])
+
+      pseudo = Magick::Image.read(FLOWER_HAT).first.quantize(16)
+      red = pseudo.histogram[0]
+      assert_equal(pseudo.columns * pseudo.rows, red.inject(:+))
+      direct = pseudo.copy
+      direct.class_type = Magick::DirectClass
+      assert_equal(direct.histogram[0], red)
+
+      assert_raise(ArgumentError) { @img.histogram(100) }
+      assert_raise(ArgumentError) { @img.histogram(256, true, 1) }
+    end
+
     def test_histogram?
       assert_nothing_raised { @img.histogram? }
       assert(@img.histogram?)
@@ -1007,6 +1109,63 @@ class Image2_UT < Test::Unit::TestCase
       assert_raise(Magick::DestroyedImageError) { @img.map(map, true) }
     end
 
+    def test_map_pixels!
+      img = Magick::Image.new(3, 2)
+      res = img.map_pixels! do |pixel, x, y|
+        assert_instance_of(Magick::Pixel, pixel)
+        x == y ? 'red' : pixel
+      end
+      assert_same(img, res)
+      assert_equal('red', img.pixel_color(0, 0).to_color)
+      assert_equal('red', img.pixel_color(1, 1).to_color)
+      assert_equal('white', img.pixel_color(1, 0).to_color)
+
+      img.map_pixels! { |pixel| pixel.blue = 0; pixel }
+      assert_equal('yellow', img.pixel_color(1, 0).to_color)
+
+      assert_raise(TypeError) { img.map_pixels! { 42 } }
+      # the last pixel of the first row resizes the image
+      assert_raise(RuntimeError) { img.map_pixels! { |pixel, x, y| img.resize!(4, 4) if x == 2 && y == 0; pixel } }
+      assert_equal(4, img.columns)
+      img.freeze
+      assert_raise(FreezeError) { img.map_pixels! { |pixel| pixel } }
+    end
+
+    def test_pipeline
+      img = Magick::Image.read(FLOWER_HAT).first
+      pipe = img.pipeline(false).crop(10, 20, 100, 80).resize(0.5).sharpen(0, 1).flip
+      assert_instance_of(Magick::Image::Pipeline, pipe)
+      assert_equal([[:crop, 10, 20, 100, 80], [:resize, 0.5], [:sharpen, 0, 1], [:flip]], pipe.operations)
+      res = pipe.to_image
+      expected = img.crop(10, 20, 100, 80).resize(0.5).sharpen(0, 1).flip
+      assert_equal(expected.signature, res.signature)
+      assert_not_same(img, res)
+
+      # by default the steps run as given, with the same arguments as the methods
+      res = img.pipeline.resize(0.5).crop(10, 20, 100, 80).blur_image(0, 2).resize(40, 30, Magick::PointFilter, 2.0).to_image
+      expected = img.resize(0.5).crop(10, 20, 100, 80).blur_image(0, 2).resize(40, 30, Magick::PointFilter, 2.0)
+      assert_equal(expected.signature, res.signature)
+      assert_equal(expected.page, res.page)
+      assert_raise(ArgumentError) { img.pipeline.sharpen(0, 0).to_image }
+      assert_raise(ArgumentError) { img.pipeline.resize(-1, 10).to_image }
+
+      # reordered steps make the same size
+      res = img.pipeline(true).resize(0.5).crop(10, 20, 100, 80).blur_image(0, 2).resize(40, 30).to_image
+      assert_equal(40, res.columns)
+      assert_equal(30, res.rows)
+      res = img.pipeline(true).resize(0.5).crop(10, 20, 100, 80).to_image
+      assert_equal(100, res.columns)
+      assert_equal(80, res.rows)
+
+      blob = img.pipeline.modulate(1.2, 0.5).quantize(16).to_blob { self.format = 'GIF' }
+      assert_equal('GIF', Magick::Image.from_blob(blob).first.format)
+      assert_equal(img.signature, Magick::Image.read(FLOWER_HAT).first.signature)
+
+      assert_raise(ArgumentError) { img.pipeline.crop(1, 2).to_image }
+      assert_raise(ArgumentError) { img.run_pipeline([[:bogus]]) }
+      assert_raise(NoMethodError) { img.pipeline.bogus }
+    end
+
     def test_marshal
       img =  Magick::Image.read(IMAGES_DIR+'/Button_0.gif').first
       d = nil
@@ -1014,6 +1173,50 @@ class Image2_UT < Test::Unit::TestCase
       assert_nothing_raised { d = Marshal.dump(img) }
       assert_nothing_raised { img2 = Marshal.load(d) }
       assert_equal(img, img2)
+
+      # version 2 dumps don't re-encode the pixels in the image's format
+      img = Magick::Image.read(FLOWER_HAT).first
+      img['comment'] = 'marshal'
+      img.define('marshal:key', 'value')
+      img2 = Marshal.load(Marshal.dump(img))
+      assert_equal('JPEG', img2.format)
+      assert_equal(img.compression, img2.compression)
+      assert_equal(img.signature, img2.signature)
+      assert_equal('marshal', img2['comment'])
+
+      assert_equal(Magick::NoCompression, Magick.marshal_compression)
+      begin
+        Magick.marshal_compression = Magick::ZipCompression
+        assert_equal(Magick::ZipCompression, Magick.marshal_compression)
+        assert_equal(img.signature, Marshal.load(Marshal.dump(img)).signature)
+      ensure
+        Magick.marshal_compression = Magick::NoCompression
+      end
+      assert_raise(TypeError) { Magick.marshal_compression = 2 }
+
+      # processed pixels and the image's depth survive
+      processed = img.blur_image(0, 2).modulate(1.1, 0.9)
+      img2 = Marshal.load(Marshal.dump(processed))
+      assert_equal(processed.depth, img2.depth)
+      assert_equal(processed.export_pixels, img2.export_pixels)
+      assert_equal(processed.signature, img2.signature)
+
+      # the compression and depth bytes follow the magick in the header
+      d = Marshal.dump(processed)
+      bad = d.dup
+      bad.setbyte(d.index('JPEG') + 4, 0xff)
+      assert_raise(TypeError) { Marshal.load(bad) }
+      bad = d.dup
+      bad.setbyte(d.index('JPEG') + 5, 0)
+      assert_raise(TypeError) { Marshal.load(bad) }
+
+      # version 1 dumps hold a blob in the image's own format
+      blob = img.to_blob { self.format = 'MIFF' }
+      v1 = [0xd1, 1, 0, 4].pack('C4') + 'MIFF' + blob
+      assert_nothing_raised { img2 = Magick::Image._load(v1) }
+      assert_equal(img.columns, img2.columns)
+      assert_raise(TypeError) { Magick::Image._load([0xd1, 3, 0, 4].pack('C4') + 'MIFF' + blob) }
+      assert_raise(TypeError) { Magick::Image._load(Marshal.dump(img)[0, 20]) }
     end
 
     def test_mask
@@ -1073,6 +1276,18 @@ class Image2_UT < Test::Unit::TestCase
       end
     end
 
+    def test_memsize
+      require 'objspace'
+      img = Magick::Image.new(100, 100)
+      assert_operator(ObjectSpace.memsize_of(img), :>=, 100 * 100 * 4)
+      big = img.resize(200, 200)
+      assert_operator(ObjectSpace.memsize_of(big), :>, ObjectSpace.memsize_of(img))
+      img.destroy!
+      assert_operator(ObjectSpace.memsize_of(img), :<, 100 * 100)
+      assert_operator(ObjectSpace.memsize_of(Magick::Pixel.new), :>, 0)
+      assert_operator(ObjectSpace.memsize_of(Magick::Draw.new), :>, 0)
+    end
+
     def test_median_filter
       assert_nothing_raised do
         res = @img.median_filter
@@ -1084,6 +1299,57 @@ class Image2_UT < Test::Unit::TestCase
       assert_raise(TypeError) { @img.median_filter('x') }
     end
 
+    def test_memory_view
+      assert_equal(4, Magick::PixelPacketMap.length)
+      begin
+        require 'fiddle'
+      rescue LoadError
+        return
+      end
+      return unless defined?(Fiddle::MemoryView)
+
+      red = Magick::Image.new(3, 2) { self.background_color = 'red' }
+      view = Fiddle::MemoryView.new(red)
+      begin
+        assert_equal([2, 3, 4], view.shape)
+        assert_equal(2*3*4*view.item_size, view.byte_size)
+        assert_equal(Magick::QuantumRange, view[1, 2, Magick::PixelPacketMap.index('R')])
+        assert_equal(0, view[1, 2, Magick::PixelPacketMap.index('G')])
+        assert_equal(red.get_pixels_packed(0, 0, 3, 2, Magick::PixelPacketMap, Magick::QuantumPixel), view.to_s)
+
+        # The image is pinned while the view is live
+        assert_raise(RuntimeError) { red.destroy! }
+        assert_raise(RuntimeError) { red.resize!(6, 4) }
+        assert(!red.destroyed?)
+        assert_equal(3, red.columns)
+
+        # So are in-place changes, which might move the pixel cache
+        colorspace = red.colorspace
+        assert_raise(RuntimeError) { red.colorspace = Magick::CMYKColorspace }
+        assert_raise(RuntimeError) { red.pixel_color(0, 0, 'blue') }
+        assert_raise(RuntimeError) { red.store_pixels(0, 0, 1, 1, [Magick::Pixel.new]) }
+        assert_equal(colorspace, red.colorspace)
+
+        # Copies don't see writes through the view
+        copy = red.dup
+        list = Magick::ImageList.new
+        list << red
+        list_copy = list.copy
+        if view.respond_to?(:ptr)
+          Fiddle::Pointer.new(view.ptr.to_i)[0, view.byte_size] = "\0" * view.byte_size
+          assert_equal(0, red.pixel_color(0, 0).red)
+          assert_equal(Magick::QuantumRange, copy.pixel_color(0, 0).red)
+          assert_equal(Magick::QuantumRange, list_copy[0].pixel_color(0, 0).red)
+        end
+      ensure
+        view.release
+      end
+
+      assert_nothing_raised { red.resize!(6, 4) }
+      assert_nothing_raised { red.destroy! }
+      assert_raise(ArgumentError) { Fiddle::MemoryView.new(red) }
+    end
+
     def test_minify
       assert_nothing_raised do
         res = @img.minify
@@ -1136,6 +1402,62 @@ class Image2_UT < Test::Unit::TestCase
       assert_raise(ArgumentError) { @img.negate(true, 2) }
     end
 
+    def test_point_ops_bang
+      img = Magick::Image.read(FLOWER_HAT).first
+      [[:level, 0.1 * Magick::QuantumRange, 0.9 * Magick::QuantumRange, 1.2],
+       [:gamma_correct, 0.8, 1.1, 1.3],
+       [:modulate, 1.1, 0.6, 0.9],
+       [:negate, true],
+       [:threshold, Magick::QuantumRange / 2]].each do |op, *args|
+        expected = img.send(op, *args)
+        res = img.copy
+        assert_same(res, res.send("#{op}!", *args))
+        assert_equal(expected.signature, res.signature, "#{op}!")
+      end
+
+      # the copy keeps its pixels when they were shared
+      copy = img.copy
+      signature = img.signature
+      img.negate!
+      assert_equal(signature, copy.signature)
+      assert_not_equal(signature, img.signature)
+
+      expected = copy.colorize(0.25, 0.5, 0.75, 'red')
+      assert_same(copy, copy.colorize!(0.25, 0.5, 0.75, 'red'))
+      [[0, 0], [50, 60], [copy.columns - 1, copy.rows - 1]].each do |x, y|
+        want = expected.pixel_color(x, y)
+        got = copy.pixel_color(x, y)
+        assert_in_delta(want.red, got.red, 1)
+        assert_in_delta(want.green, got.green, 1)
+        assert_in_delta(want.blue, got.blue, 1)
+        assert_in_delta(want.opacity, got.opacity, 1)
+      end
+      assert_raise(ArgumentError) { copy.colorize!(0.25, 0.25, 0.25) }
+
+      # gray, translucent image: colorize! follows colorize into sRGB and alpha
+      gray = Magick::Image.new(20, 20) { self.background_color = 'gray60' }
+      gray.colorspace = Magick::GRAYColorspace
+      gray.opacity = Magick::QuantumRange / 2
+      expected = gray.colorize(0.25, 0.5, 0.75, 0.3, 'rgba(255,0,0,0.4)')
+      got = gray.copy
+      got.colorize!(0.25, 0.5, 0.75, 0.3, 'rgba(255,0,0,0.4)')
+      assert_equal(expected.colorspace, got.colorspace)
+      assert_equal(expected.matte, got.matte)
+      want = expected.export_pixels(0, 0, 20, 20, 'RGBA')
+      have = got.export_pixels(0, 0, 20, 20, 'RGBA')
+      want.each_with_index { |v, n| assert_in_delta(v, have[n], 1) }
+
+      opaque = Magick::Image.new(20, 20)
+      assert(!opaque.matte)
+      opaque.colorize!(0.25, 0.25, 0.25, 0.5, 'rgba(255,0,0,0.4)')
+      assert(opaque.matte)
+
+      img.freeze
+      assert_raise(FreezeError) { img.negate! }
+      assert_raise(FreezeError) { img.threshold!(100) }
+      assert_raise(FreezeError) { img.level! }
+    end
+
     def test_negate_channel
       assert_nothing_raised do
         res = @img.negate_channel
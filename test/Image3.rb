@@ -55,6 +55,35 @@ class Image3_UT < Test::Unit::TestCase
         @p = Magick::Image.read(IMAGE_WITH_PROFILE).first.color_profile
     end
 
+    def test_persist
+        img = Magick::Image.read(FLOWER_HAT).first
+        img.filename = 'flower.jpg'
+        signature = img.signature
+        assert_same(img, img.persist('temp.mpc'))
+        assert_equal('flower.jpg', img.filename)
+        assert_equal('JPEG', img.format)
+        # the image doesn't write through to the persisted cache
+        img.pixel_color(0, 0, 'red')
+        assert_equal(signature, Magick::Image.map('temp.mpc').signature)
+        img = Magick::Image.read(FLOWER_HAT).first
+        assert(File.exist?('temp.mpc'))
+        assert(File.exist?('temp.cache'))
+
+        mapped = nil
+        assert_nothing_raised { mapped = Magick::Image.map('temp.mpc') }
+        assert_instance_of(Magick::Image, mapped)
+        assert_equal(img.columns, mapped.columns)
+        assert_equal(img.rows, mapped.rows)
+        assert_equal(img.signature, mapped.signature)
+
+        # changes are private to the image
+        mapped.pixel_color(0, 0, 'red')
+        assert_equal(img.signature, Magick::Image.map('mpc:temp.mpc').signature)
+        assert_raise(Magick::ImageMagickError) { Magick::Image.map('nonexistent.mpc') }
+    ensure
+        FileUtils.rm_f(['temp.mpc', 'temp.cache'])
+    end
+
     def test_profile!
         assert_nothing_raised do
             res = @img.profile!('*', nil)
@@ -250,6 +279,58 @@ class Image3_UT < Test::Unit::TestCase
         assert_raise(ArgumentError) { @img.resize }
     end
 
+    def test_resize_threads
+        threads = (1..4).map do |n|
+            Thread.new { @img.resize(10 * n, 10 * n) }
+        end
+        threads.each_with_index do |thread, n|
+            res = thread.value
+            assert_instance_of(Magick::Image, res)
+            assert_equal(10 * (n + 1), res.columns)
+        end
+    end
+
+    def test_resize_many
+        img = Magick::Image.read(FLOWER_HAT).first
+        sizes = [[80, nil], [img.columns / 2, img.rows / 2], [nil, 20], 40]
+        res = img.resize_many(sizes, Magick::LanczosFilter)
+        assert_instance_of(Magick::ImageList, res)
+        assert_equal(4, res.length)
+        assert_equal([80, (80.0 * img.rows / img.columns).round], [res[0].columns, res[0].rows])
+        assert_equal([img.columns / 2, img.rows / 2], [res[1].columns, res[1].rows])
+        assert_equal(20, res[2].rows)
+        assert_equal(40, res[3].columns)
+
+        # exact outputs match Image#resize
+        res = img.resize_many(sizes, Magick::LanczosFilter, 1.0, true)
+        expected = img.resize(img.columns / 2, img.rows / 2, Magick::LanczosFilter, 1.0)
+        assert_equal(expected.signature, res[1].signature)
+        expected = img.resize(res[3].columns, res[3].rows, Magick::LanczosFilter, 1.0)
+        assert_equal(expected.signature, res[3].signature)
+
+        assert_raise(ArgumentError) { img.resize_many([]) }
+        assert_raise(ArgumentError) { img.resize_many([[nil, nil]]) }
+        assert_raise(ArgumentError) { img.resize_many([[0, 10]]) }
+        assert_raise(ArgumentError) { img.resize_many([[-10, 10]]) }
+        assert_raise(ArgumentError) { img.resize_many([[nil, -5]]) }
+        assert_raise(ArgumentError) { img.resize_many([[20, 20], [10, -1]]) }
+        assert_raise(ArgumentError) { img.resize_many([[1, 2, 3]]) }
+        assert_raise(TypeError) { img.resize_many([[10, 10]], 2) }
+        assert_raise(ArgumentError) { img.resize_many }
+    end
+
+    def test_resize_destroyed_by_other_thread
+        img = Magick::Image.new(1000, 1000)
+        thread = Thread.new { img.blur_image(0, 8).resize(100, 100) }
+        # A thread working without the GVL shows as sleeping
+        Thread.pass while thread.status == 'run'
+        img.destroy!
+        res = thread.value
+        assert_instance_of(Magick::Image, res)
+        assert_equal(100, res.columns)
+        assert(img.destroyed?)
+    end
+
     def test_resize!
         assert_nothing_raised do
             res = @img.resize!(2)
@@ -718,6 +799,32 @@ class Image3_UT < Test::Unit::TestCase
         assert_raise(IndexError) { @img.store_pixels(0, 0, @img.columns, 1, ['x']) }
     end
 
+    def test_store_pixels_packed
+        packed = [0, 0, 255] * @img.columns
+        assert_nothing_raised do
+            res = @img.store_pixels_packed(0, 0, @img.columns, 1, packed.pack('C*'))
+            assert_same(@img, res)
+        end
+        assert_equal(packed, @img.get_pixels_packed(0, 0, @img.columns, 1).unpack('C*'))
+        assert_equal('blue', @img.pixel_color(0, 0).to_color)
+
+        assert_nothing_raised do
+            @img.store_pixels_packed(0, 1, 1, 1, [1.0, 0.5].pack('d*'), 'RA', Magick::DoublePixel)
+        end
+        assert(@img.matte)
+        assert_equal([255, 128], @img.get_pixels_packed(0, 1, 1, 1, 'RA').unpack('C*'))
+
+        assert_raise(ArgumentError) { @img.store_pixels_packed(0, 0, @img.columns, 2, packed.pack('C*')) }
+        assert_raise(ArgumentError) { @img.store_pixels_packed(0, 0, 1, 1, 'xxx', 'RGX') }
+        assert_raise(RangeError) { @img.store_pixels_packed(-1, 0, 1, 1, 'xxx') }
+        assert_raise(RangeError) { @img.store_pixels_packed(0, 0, 1+@img.columns, 1, packed.pack('C*')) }
+        ulong_max = 2**(8*[0].pack('L!').size) - 1
+        assert_raise(RangeError) { @img.store_pixels_packed(1, 0, ulong_max, 1, 'xxx') }
+        assert_raise(TypeError) { @img.store_pixels_packed(0, 0, 1, 1, 42) }
+        @img.freeze
+        assert_raise(FreezeError) { @img.store_pixels_packed(0, 0, 1, 1, 'xxx') }
+    end
+
     def test_strip!
         assert_nothing_raised do
             res = @img.strip!
@@ -912,6 +1019,107 @@ class Image3_UT < Test::Unit::TestCase
         assert_raise(RangeError) { @img.view(0, 1, 5, @img.rows) }
         assert_raise(ArgumentError) { @img.view(0, 0, 0, 1) }
         assert_raise(ArgumentError) { @img.view(0, 0, 1, 0) }
+
+        view = @img.view(2, 2, 5, 5)
+        assert_equal(false, view.dirty)
+        assert_instance_of(Magick::Pixel, view[0][0])
+        assert_same(view[0][0], view[0][0])
+        assert_instance_of(Magick::Image::View::Rows, view[0])
+        assert_instance_of(Magick::Image::View::Pixels, view[0][])
+        assert_equal(5, view[0][].length)
+        assert_equal(25, view[][].length)
+        assert_equal(4, view[1, 2][1..2].length)
+        assert_equal(3, view[[0, 2, 4]][-1, 3].length)
+        assert_raise(IndexError) { view[5] }
+        assert_raise(IndexError) { view[0][-6] }
+        assert_equal(false, view.dirty)
+        assert_equal(false, view.sync)
+
+        view[1][2] = 'red'
+        assert_equal(true, view.dirty)
+        view[-1][].green = 0
+        assert_equal([0] * 5, view[4][].green)
+        assert_equal(true, view.sync)
+        assert_equal(false, view.dirty)
+        assert_equal('red', @img.pixel_color(4, 3).to_color)
+        assert_equal(0, @img.pixel_color(2, 6).green)
+        assert_equal(Magick::QuantumRange, @img.pixel_color(2, 5).green)
+
+        # Changing a pixel in place also marks its row
+        view[2][0].blue = 0
+        assert_equal(true, view.dirty)
+        view.sync
+        assert_equal(0, @img.pixel_color(2, 4).blue)
+
+        @img.view(0, 0, 1, 1) { |v| v[0][0] = 'blue' }
+        assert_equal('blue', @img.pixel_color(0, 0).to_color)
+
+        assert_raise(TypeError) { view.send(:initialize, @img, 0, 0, 5, 5) }
+        assert(!Magick::Image::View::Pixels.include?(Observable))
+    end
+
+    def test_view_sync
+        img = Magick::Image.new(10, 10)
+        view = img.view(0, 0, 10, 10)
+        3.times { |row| view[row][] }
+
+        # Only the changed row is written back. Rows 0 and 2 are cached
+        # but unchanged, so the changes made behind the view's back survive.
+        view[1][3].red = 0
+        img.pixel_color(5, 0, 'blue')
+        img.pixel_color(5, 2, 'blue')
+        assert_equal(true, view.dirty)
+        assert_equal(true, view.sync)
+        assert_equal(0, img.pixel_color(3, 1).red)
+        assert_equal('blue', img.pixel_color(5, 0).to_color)
+        assert_equal('blue', img.pixel_color(5, 2).to_color)
+        assert_equal('white', img.pixel_color(5, 1).to_color)
+        assert_equal(false, view.sync)
+
+        # A pixel changed and changed back matches its snapshot
+        view[1][4].green = 0
+        view[1][4].green = Magick::QuantumRange
+        assert_equal(false, view.dirty)
+        assert_equal(false, view.sync)
+
+        # Assigning through Rows#[]= marks the row even if the color is the same
+        view[4][0] = 'white'
+        assert_equal(true, view.dirty)
+        img.pixel_color(5, 4, 'blue')
+        assert_equal(true, view.sync)
+        assert_equal('white', img.pixel_color(5, 4).to_color)
+
+        # Forcing writes every cached row, but never an unused one
+        img.pixel_color(5, 9, 'blue')
+        view.dirty = true
+        assert_equal(true, view.dirty)
+        assert_equal(true, view.sync)
+        assert_equal('white', img.pixel_color(5, 0).to_color)
+        assert_equal('white', img.pixel_color(5, 2).to_color)
+        assert_equal('blue', img.pixel_color(5, 9).to_color)
+        assert_equal(false, view.dirty)
+        assert_equal(true, view.sync(true))
+
+        # Out-of-range rows and columns
+        assert_raise(IndexError) { view[10] }
+        assert_raise(IndexError) { view[-11] }
+        assert_raise(IndexError) { view[[0, 10]] }
+        assert_raise(IndexError) { view[11, 1] }
+        assert_equal(0, view[10, 1][].length)
+        assert_raise(IndexError) { view[0][10] }
+        assert_raise(IndexError) { view[0][-11] }
+        assert_raise(IndexError) { view[0][10] = 'red' }
+
+        # The block form syncs when the block exits, even if it raises
+        assert_nil(img.view(0, 0, 2, 2) { |v| v[1][1].blue = 0 })
+        assert_equal(0, img.pixel_color(1, 1).blue)
+        assert_raise(IndexError) { img.view(0, 0, 2, 2) { |v| v[0][0] = 'red'; raise IndexError } }
+        assert_equal('red', img.pixel_color(0, 0).to_color)
+
+        view = img.view(0, 0, 2, 2)
+        view[0][0] = 'green'
+        img.freeze
+        assert_raise(FreezeError) { view.sync }
     end
 
     def test_vignette
@@ -7,6 +7,8 @@ require 'test/unit'
 require 'test/unit/ui/console/testrunner' unless RUBY_VERSION[/^1\.9|^2/]
 
 class ImageList2_UT < Test::Unit::TestCase
+    FreezeError = RUBY_VERSION[/^1\.9|^2/] ? RuntimeError : TypeError
+
     def setup
         @ilist = Magick::ImageList.new
     end
@@ -56,6 +58,18 @@ class ImageList2_UT < Test::Unit::TestCase
         assert_equal(0, ilist.scene)
     end
 
+    def test_coalesce_repeated_frames
+        @ilist.read(IMAGES_DIR+'/Button_0.gif', IMAGES_DIR+'/Button_1.gif')
+        @ilist << @ilist[0] << @ilist[1] << @ilist[0]
+        ilist = nil
+        assert_nothing_raised { ilist = @ilist.coalesce }
+        assert_equal(5, ilist.length)
+        assert_equal(0, ilist.scene)
+        img = @ilist.append(false)
+        assert_equal(@ilist[0].columns * 3 + @ilist[1].columns * 2, img.columns)
+        assert_equal(5, @ilist.length)
+    end
+
     def test_copy
         @ilist.read(*Dir[IMAGES_DIR+'/Button_*.gif'])
         @ilist.scene = 7
@@ -281,6 +295,44 @@ class ImageList2_UT < Test::Unit::TestCase
         assert_raise(TypeError) {@ilist.optimize_layers(2)}
     end
 
+    def test_parallel_map
+        @ilist.read(*Dir[IMAGES_DIR+'/Button_*.gif'].sort[0, 6])
+        @ilist.each_with_index { |img, i| img.delay = i * 10 }
+        res = nil
+        assert_nothing_raised { res = @ilist.parallel_map([[:resize, 0.5], [:crop, 0, 0, 10, 10], :flip]) }
+        assert_instance_of(Magick::ImageList, res)
+        assert_equal(6, res.length)
+        assert_equal(0, res.scene)
+        res.each_with_index do |img, i|
+            assert_equal(10, img.columns)
+            assert_equal(10, img.rows)
+            assert_equal(i * 10, img.delay)
+            assert_equal(@ilist[i].page, img.page)
+            expected = @ilist[i].resize(0.5).crop(0, 0, 10, 10).flip
+            assert_equal(expected.signature, img.signature)
+        end
+
+        assert_nothing_raised { res = @ilist.parallel_map([[:sharpen, 0, 1], [:resize, 20, 15, Magick::PointFilter, 2.0]], 2) }
+        assert_equal(6, res.length)
+        res.each_with_index do |img, i|
+            expected = @ilist[i].sharpen(0, 1).resize(20, 15, Magick::PointFilter, 2.0)
+            assert_equal(expected.signature, img.signature)
+        end
+        assert_nothing_raised { res = @ilist.parallel_map([[:quantize, 16]], 2) }
+        assert_equal(6, res.length)
+        assert_nothing_raised { res = @ilist.parallel_map([]) }
+        assert_equal(@ilist[0].signature, res[0].signature)
+        assert_not_same(@ilist[0], res[0])
+
+        assert_raise(ArgumentError) { @ilist.parallel_map }
+        assert_raise(ArgumentError) { @ilist.parallel_map([:bogus]) }
+        assert_raise(ArgumentError) { @ilist.parallel_map([[:crop, 0, 0]]) }
+        assert_raise(ArgumentError) { @ilist.parallel_map([[:resize, 0]]) }
+        assert_raise(ArgumentError) { @ilist.parallel_map([[:resize, 10, -10]]) }
+        assert_raise(ArgumentError) { @ilist.parallel_map([[:blur_image, 1, 0]]) }
+        assert_raise(ArgumentError) { Magick::ImageList.new.parallel_map([:flip]) }
+    end
+
     def test_ping
         assert_nothing_raised { @ilist.ping(FLOWER_HAT) }
         assert_equal(1, @ilist.length)
@@ -293,6 +345,45 @@ class ImageList2_UT < Test::Unit::TestCase
         assert_equal(3, @ilist.scene)
     end
 
+    def test_read_lazy
+        files = Dir[IMAGES_DIR+'/Button_*.gif'].sort[0, 4]
+        eager = Magick::ImageList.new(*files)
+        assert_same(@ilist, @ilist.read_lazy(*files))
+        assert(@ilist.lazy?)
+        assert_equal(4, @ilist.length)
+        assert_equal(3, @ilist.scene)
+        assert_equal(0, @ilist.decoded_frames)
+        assert_equal(eager[1].columns, @ilist[1].columns)
+        assert_equal(eager[0].signature, @ilist[0].signature)
+        assert_same(@ilist[0], @ilist.first)
+
+        @ilist.max_decoded_frames = 2
+        assert_equal(2, @ilist.max_decoded_frames)
+        @ilist.each_with_index { |img, i| assert_equal(eager[i].signature, img.signature) }
+        assert_equal(2, @ilist.decoded_frames)
+        assert_raise(ArgumentError) { @ilist.max_decoded_frames = 0 }
+
+        img = nil
+        assert_nothing_raised { img = @ilist.append(false) }
+        assert_equal(eager.append(false).signature, img.signature)
+        assert_equal(eager.reverse.append(true).signature, @ilist.reverse.append(true).signature)
+
+        # decoded frames can't be changed, the list setters still work
+        assert(@ilist[0].frozen?)
+        assert_raise(FreezeError) { @ilist[0].flip! }
+        assert_raise(FreezeError) { @ilist[0]['comment'] = 'x' }
+        assert_raise(FreezeError) { @ilist.remap }
+        @ilist.delay = 20
+        @ilist.each { |img| assert_equal(20, img.delay) }
+        copy = @ilist.copy
+        assert(!copy[0].frozen?)
+        assert_nothing_raised { copy[0].flip! }
+
+        assert(!Magick::ImageList.new.lazy?)
+        assert_raise(ArgumentError) { Magick::ImageList.new.max_decoded_frames = 2 }
+        assert_raise(ArgumentError) { @ilist.read_lazy }
+    end
+
     def test_quantize
         @ilist.read(IMAGES_DIR+'/Button_0.gif', IMAGES_DIR+'/Button_1.gif')
         assert_nothing_raised do
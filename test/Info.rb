@@ -104,6 +104,27 @@ class Info_UT < Test::Unit::TestCase
       end
     end
 
+    def test_decode_size
+      assert_nil(@info.decode_size)
+      assert_nothing_raised { @info.decode_size = '200x200' }
+      assert_equal('200x200', @info.decode_size)
+      assert_equal('200x200', @info['jpeg', 'size'])
+      assert_nothing_raised { @info.decode_size = Magick::Geometry.new(100, 50) }
+      assert_equal('100x50', @info.decode_size)
+      assert_nothing_raised { @info.decode_size = nil }
+      assert_nil(@info.decode_size)
+      assert_nil(@info['jpeg', 'size'])
+      assert_raise(ArgumentError) { @info.decode_size = 'junk' }
+      assert_raise(ArgumentError) { @info.decode_size = '50%x50%' }
+
+      # a jpeg:size set by the user is left alone
+      @info['jpeg', 'size'] = '300x300'
+      @info.decode_size = '200x200'
+      assert_equal('300x300', @info['jpeg', 'size'])
+      @info.decode_size = nil
+      assert_equal('300x300', @info['jpeg', 'size'])
+    end
+
     def test_define
       assert_nothing_raised { @info.define('tiff', 'bits-per-sample', 2) }
       assert_nothing_raised { @info.undefine('tiff', 'bits-per-sample') }
@@ -233,6 +254,14 @@ class Info_UT < Test::Unit::TestCase
       img.monitor = nil
     end
 
+    def test_monitor_exception
+      monitor = proc { |mth, q, s| raise ArgumentError, 'stop' }
+      img = Magick::Image.new(2000, 2000) { self.monitor = monitor }
+      assert_raise(ArgumentError) { img.resize(20, 20) }
+      img.monitor = nil
+      assert_nothing_raised { img.resize(20, 20) }
+    end
+
     def test_monochrome
       assert_nothing_raised { @info.monochrome = true }
       assert @info.monochrome
@@ -4,6 +4,7 @@
 require 'rmagick'
 require 'test/unit'
 require 'test/unit/ui/console/testrunner' unless RUBY_VERSION[/^1\.9|^2/]
+require 'tmpdir'
 
 module Magick
   def self._tmpnam_
@@ -257,10 +258,189 @@ class Magick_UT < Test::Unit::TestCase
       assert_nothing_raised { Magick.set_log_event_mask('Module,Coder') }
     end
 
+    def test_memory_high_water
+      assert(Magick::MemoryLimitError < Magick::ImageMagickError)
+      if Magick::MANAGED_MEMORY
+        img = Magick::Image.new(1000, 1000)
+        begin
+          Magick.memory_high_water = 1024 * 1024
+          assert_equal(1024 * 1024, Magick.memory_high_water)
+          assert_raise(Magick::MemoryLimitError) { img.to_blob { self.format = 'RGB' } }
+        ensure
+          Magick.memory_high_water = nil
+        end
+        assert_nil(Magick.memory_high_water)
+        assert_nothing_raised { img.to_blob { self.format = 'RGB' } }
+      else
+        assert_nil(Magick.memory_high_water)
+        assert_raise(NotImplementedError) { Magick.memory_high_water = 1024 * 1024 }
+      end
+    end
+
+    # Managed memory has to be enabled before RMagick is loaded, so this runs
+    # in a new Ruby.
+    def test_managed_memory
+      script = <<-END_SCRIPT
+        $LOAD_PATH.replace(#{$LOAD_PATH.inspect})
+        RMAGICK_ENABLE_MANAGED_MEMORY = true
+        require 'rmagick'
+        exit 0 unless Magick::MANAGED_MEMORY
+        img = Magick::Image.new(1000, 1000)
+        threads = Array.new(2) { Thread.new { img.blur_image(0, 1).to_blob { self.format = 'RGB' }.length } }
+        exit 2 unless threads.map(&:value) == [3_000_000, 3_000_000]
+        Magick.memory_high_water = 1024 * 1024
+        begin
+          img.to_blob { self.format = 'RGB' }
+          exit 3
+        rescue Magick::MemoryLimitError
+        end
+        Magick.memory_high_water = nil
+        exit 4 unless img.to_blob { self.format = 'RGB' }.length == 3_000_000
+        exit 5 unless Magick.memory_stats[:managed][:current] > 0
+        exit 0
+      END_SCRIPT
+      ruby = File.join(RbConfig::CONFIG['bindir'], RbConfig::CONFIG['ruby_install_name'])
+      assert(system(ruby, '-e', script), "managed memory script failed: #{$?.inspect}")
+    end
+
+    def test_memory_stats
+      stats = nil
+      assert_nothing_raised { stats = Magick.memory_stats }
+      assert_instance_of(Hash, stats)
+      [:area, :memory, :map, :disk, :file].each do |resource|
+        assert_instance_of(Hash, stats[resource])
+        assert_kind_of(Integer, stats[resource][:current])
+        assert_operator(stats[resource][:peak], :>=, stats[resource][:current])
+        assert_kind_of(Integer, stats[resource][:limit])
+      end
+
+      # Other tests' images may be collected at any time, so only count
+      # changes made by the images this test owns.
+      GC.start
+      imgs = Array.new(3) { Magick::Image.new(100, 100) }
+      stats = Magick.resource_usage
+      assert_operator(stats[:images][:live], :>=, 3)
+      assert_operator(stats[:images][:peak], :>=, stats[:images][:live])
+      assert_operator(stats[:pixel_cache][:memory] + stats[:pixel_cache][:map] + stats[:pixel_cache][:disk], :>=, 3 * 100 * 100 * 4)
+      live = stats[:images][:live]
+      imgs.each(&:destroy!)
+      assert_operator(live - Magick.memory_stats[:images][:live], :>=, 3)
+
+      # Clones share the pixel cache until one is changed
+      cache_bytes = lambda do
+        stats = Magick.memory_stats[:pixel_cache]
+        stats[:memory] + stats[:map] + stats[:disk]
+      end
+      GC.start
+      before = cache_bytes.call
+      img = Magick::Image.new(200, 200)
+      copies = [img.dup, img.dup]
+      assert_operator(cache_bytes.call - before, :<, 2 * 200 * 200 * 4)
+      copies.each(&:destroy!)
+      img.destroy!
+      assert_equal(Magick::MANAGED_MEMORY, Magick.memory_stats.key?(:managed))
+    end
+
     def test_set_log_format
       assert_nothing_raised { Magick.set_log_format('format %d%e%f') }
     end
 
+    def test_gradient_fill
+      # horizontal line: the color changes down the rows, spread over bands
+      img = Magick::Image.new(40, 600, Magick::GradientFill.new(0, 0, 40, 0, 'black', 'white'))
+      assert_equal(0, img.pixel_color(20, 0).red)
+      assert_in_delta(Magick::QuantumRange, img.pixel_color(20, 599).red, Magick::QuantumRange / 100.0)
+      [0, 150, 450].each do |y|
+        assert_equal(img.pixel_color(0, y), img.pixel_color(39, y))
+        assert(img.pixel_color(0, y).red < img.pixel_color(0, y + 100).red)
+      end
+
+      img = Magick::Image.new(100, 100, Magick::GradientFill.radial(50, 50, 20, 'black', 'white'))
+      assert_equal(0, img.pixel_color(50, 50).red)
+      assert_equal(Magick::QuantumRange, img.pixel_color(80, 50).red)
+      assert_equal(Magick::QuantumRange, img.pixel_color(0, 0).red)
+      assert_in_delta(Magick::QuantumRange / 2, img.pixel_color(60, 50).red, 1)
+
+      img = Magick::Image.new(100, 100, Magick::GradientFill.conic(50, 50, 0, 'black', 'white'))
+      assert_equal(0, img.pixel_color(90, 50).red)
+      assert_in_delta(Magick::QuantumRange / 4, img.pixel_color(50, 90).red, 1)
+      assert_in_delta(Magick::QuantumRange / 2, img.pixel_color(10, 50).red, 1)
+
+      fill = Magick::GradientFill.radial(50, 50, 40, 'black', 'black')
+      fill.stops = [[0.0, 'red'], [0.5, 'white'], [1.0, 'blue']]
+      assert_equal(3, fill.stops.length)
+      assert_equal(0.5, fill.stops[1][0])
+      assert_instance_of(Magick::Pixel, fill.stops[1][1])
+      img = Magick::Image.new(100, 100, fill)
+      assert_equal(Magick::Pixel.from_color('red'), img.pixel_color(50, 50))
+      assert_equal(Magick::Pixel.from_color('white'), img.pixel_color(70, 50))
+      assert_equal(Magick::Pixel.from_color('blue'), img.pixel_color(0, 0))
+      assert(!img.matte)
+
+      # Translucent stops turn on the matte channel
+      fill.stops = [[0.0, 'red'], [1.0, 'rgba(0, 0, 255, 0.5)']]
+      img = Magick::Image.new(100, 100, fill)
+      assert(img.matte)
+      assert_equal(Magick::OpaqueOpacity, img.pixel_color(50, 50).opacity)
+      assert_in_delta(Magick::QuantumRange / 2, img.pixel_color(0, 0).opacity, Magick::QuantumRange / 100.0)
+
+      fill.stops = []
+      assert_equal([], fill.stops)
+
+      assert_raise(ArgumentError) { fill.stops = [[0.0, 'red']] }
+      assert_raise(ArgumentError) { fill.stops = [[0.5, 'red'], [0.2, 'blue']] }
+      assert_raise(ArgumentError) { fill.stops = [[0.0, 'red'], [1.5, 'blue']] }
+      assert_raise(ArgumentError) { fill.stops = [[0.0, 'red'], [1.0, 'nosuchcolor']] }
+      assert_raise(ArgumentError) { Magick::GradientFill.radial(50, 50, 0, 'black', 'white') }
+    end
+
+    def test_image_cache
+      cache = Magick::ImageCache.new(64 * 1024 * 1024)
+      img1 = cache.read(FLOWER_HAT).first
+      img2 = cache.read(FLOWER_HAT).first
+      assert_equal(1, cache.misses)
+      assert_equal(1, cache.hits)
+      assert_equal(1, cache.length)
+      assert(cache.bytes >= img1.columns * img1.rows * Magick::PIXEL_PACKET_SIZE)
+      assert_not_same(img1, img2)
+      assert_equal(img1.signature, img2.signature)
+
+      # copies are independent
+      img1.pixel_color(0, 0, 'red')
+      assert_not_equal(img1.signature, cache.read(FLOWER_HAT).first.signature)
+
+      blob = img2.to_blob
+      cache.from_blob(blob)
+      cache.from_blob(blob)
+      assert_equal(2, cache.misses)
+      assert_equal(3, cache.hits)
+
+      # blocks and non-files bypass the cache
+      cache.read(FLOWER_HAT) { self.size = '10x10' }
+      cache.read("#{FLOWER_HAT}[0]")
+      assert_equal(2, cache.misses)
+
+      cache.budget = cache.bytes - 1
+      assert_equal(1, cache.length)
+      cache.budget = 0
+      assert_equal(0, cache.length)
+      assert_equal(0, cache.bytes)
+      cache.read(FLOWER_HAT)
+      assert_equal(0, cache.length)
+      assert_equal({ :hits => 3, :misses => 3, :entries => 0, :bytes => 0, :budget => 0 }, cache.stats)
+      assert_raise(ArgumentError) { cache.budget = -1 }
+
+      begin
+        Magick.image_cache = Magick::ImageCache.new(64 * 1024 * 1024)
+        Magick::Image.read(FLOWER_HAT)
+        Magick::ImageList.new(FLOWER_HAT)
+        assert_equal(1, Magick.image_cache.hits)
+      ensure
+        Magick.image_cache = nil
+      end
+      assert_raise(ArgumentError) { Magick.image_cache = {} }
+    end
+
     def test_limit_resources
         cur = new = nil
 
@@ -298,6 +478,165 @@ class Magick_UT < Test::Unit::TestCase
         assert_raise(ArgumentError) { Magick.limit_resource }
     end
 
+    def test_stream
+      img = Magick::Image.read(FLOWER_HAT).first
+      bands = []
+      stream = Magick::Stream.open(FLOWER_HAT) do |rows|
+        rows.band_rows = 50
+        rows.gamma(1.2).negate
+        rows.each_band('I') { |packed, y, nrows| bands << [packed.bytesize, y, nrows] }
+      end
+      assert_instance_of(Magick::Stream, stream)
+      assert_same(stream, stream.run)
+      assert_equal([img.columns, img.rows], [stream.columns, stream.rows])
+      assert_equal((img.rows + 49) / 50, bands.length)
+      assert_equal([img.columns * 50, 0, 50], bands[0])
+      assert_equal(img.rows, bands.map { |band| band[2] }.inject(:+))
+
+      raw = File.join(Dir.tmpdir, 'test_stream.gray')
+      png = File.join(Dir.tmpdir, 'test_stream.png')
+      ppm = File.join(Dir.tmpdir, 'test_stream.ppm')
+      begin
+        Magick::Stream.open(FLOWER_HAT) { |rows| rows.level(0, Magick::QuantumRange, 1.5).colorspace(Magick::GRAYColorspace) }.write("gray:#{raw}")
+        assert_equal(img.columns * img.rows, File.size(raw))
+
+        [8, 16].each do |depth|
+          Magick::Stream.open(FLOWER_HAT).write(ppm) { self.depth = depth }
+          res = Magick::Image.read(ppm).first
+          assert_equal([img.columns, img.rows], [res.columns, res.rows])
+          assert_equal(img.get_pixels_packed(0, 0, img.columns, img.rows, 'RGB', Magick::CharPixel),
+                       res.get_pixels_packed(0, 0, res.columns, res.rows, 'RGB', Magick::CharPixel))
+        end
+
+        Magick::Stream.open(FLOWER_HAT).quantum_operator(Magick::AddQuantumOperator, 10, Magick::RedChannel).negate.write(png)
+        res = Magick::Image.read(png).first
+        assert_equal('PNG', res.format)
+        assert_equal([img.columns, img.rows], [res.columns, res.rows])
+        assert_equal(Magick::QuantumRange - img.pixel_color(0, 0).green, res.pixel_color(0, 0).green)
+      ensure
+        [raw, png, ppm].each { |name| File.delete(name) if File.exist?(name) }
+      end
+
+      stream = Magick::Stream.open(FLOWER_HAT)
+      assert_raise(ArgumentError) { stream.colorspace(Magick::HSLColorspace) }
+      assert_raise(ArgumentError) { stream.quantum_operator(Magick::LogQuantumOperator, 2) }
+      assert_raise(ArgumentError) { stream.gamma(0) }
+      assert_raise(ArgumentError) { stream.band_rows = 0 }
+      assert_raise(ArgumentError) { stream.each_band('RGBX') { |_packed, _y, _rows| } }
+      assert_raise(ArgumentError) { stream.each_band }
+      stream.each_band { |_packed, _y, _rows| raise IndexError }
+      assert_raise(IndexError) { stream.run }
+      assert_raise(Magick::ImageMagickError) { Magick::Stream.open('nosuchfile.jpg').run }
+    end
+
+    # BMP and TGA are usually stored bottom-up, interlaced GIF rows come out
+    # of order and tiled TIFF arrives a tile at a time, so those are read
+    # whole. PNG and TIFF strips are streamed.
+    def test_stream_formats
+      img = Magick::Image.read(FLOWER_HAT).first.resize(60, 40)
+      [['bmp', nil, nil], ['tga', nil, nil], ['gif', Magick::LineInterlace, nil], ['png', nil, nil],
+       ['tif', nil, nil], ['tif', nil, '16x16']].each do |format, interlace, tiles|
+        name = File.join(Dir.tmpdir, "test_stream.#{format}")
+        begin
+          img.write(name) do
+            self.interlace = interlace if interlace
+            define('tiff', 'tile-geometry', tiles) if tiles
+          end
+          expected = Magick::Image.read(name).first
+          packed = String.new
+          Magick::Stream.open(name) do |rows|
+            rows.band_rows = 7
+            rows.each_band('RGB') { |band, _y, _rows| packed << band }
+          end.run
+          assert_equal(expected.get_pixels_packed(0, 0, 60, 40, 'RGB', Magick::CharPixel), packed, "#{format} #{tiles}")
+        ensure
+          File.delete(name) if File.exist?(name)
+        end
+      end
+    end
+
+    def test_with_limits
+      area = Magick.limit_resource(:area)
+      res = Magick.with_limits(:width => 100, 'height' => 100) do
+        # ImageMagick's process-wide limits are untouched
+        assert_equal(area, Magick.limit_resource(:area))
+        assert_nothing_raised { Magick::Image.new(100, 100) }
+        assert_raise(Magick::ImageMagickError) { Magick::Image.new(101, 1) }
+        assert_raise(Magick::ImageMagickError) { Magick::Image.new(10, 10).resize(200, 10) }
+        assert_raise(Magick::ImageMagickError) { Magick::Image.new(10, 10).sample(20) }
+        Magick.with_limits(:width => 1000, :area => 100) do
+          assert_raise(Magick::ImageMagickError) { Magick::Image.new(101, 1) }
+          assert_raise(Magick::ImageMagickError) { Magick::Image.new(11, 10) }
+        end
+        assert_nothing_raised { Magick::Image.new(11, 10) }
+        :done
+      end
+      assert_equal(:done, res)
+      assert_nothing_raised { Magick::Image.new(101, 1) }
+
+      blob = Magick::Image.new(40, 20).to_blob { self.format = 'PNG' }
+      Magick.with_limits(:width => 30) do
+        assert_raise(Magick::ImageMagickError) { Magick::Image.from_blob(blob) }
+        # other threads aren't limited
+        assert_equal(40, Thread.new { Magick::Image.from_blob(blob).first.columns }.value)
+      end
+      Magick.with_limits(:area => 40 * 20) { assert_equal(1, Magick::Image.from_blob(blob).length) }
+
+      list = Magick::ImageList.new
+      3.times { list << Magick::Image.new(10, 10) }
+      blob = list.to_blob { self.format = 'GIF' }
+      Magick.with_limits(:list_length => 2) do
+        assert_raise(Magick::ImageMagickError) { Magick::Image.from_blob(blob) }
+      end
+
+      assert_raise(IndexError) { Magick.with_limits(:width => 100) { raise IndexError } }
+      assert_nothing_raised { Magick::Image.new(101, 1) }
+
+      assert_raise(ArgumentError) { Magick.with_limits(:memory => 100) {} }
+      assert_raise(ArgumentError) { Magick.with_limits(:xxx => 100) {} }
+      assert_raise(ArgumentError) { Magick.with_limits(:area => -1) {} }
+      assert_raise(ArgumentError) { Magick.with_limits(:area => 'x') {} }
+      assert_raise(TypeError) { Magick.with_limits([:area, 100]) {} }
+      assert_raise(LocalJumpError) { Magick.with_limits(:area => 100) }
+    end
+
+    def test_thumbnail_batch
+      blob = Magick::Image.new(40, 20).to_blob { self.format = 'PNG' }
+      res = nil
+      assert_nothing_raised do
+        res = Magick.thumbnail_batch([FLOWER_HAT, { :blob => blob }, 'nosuchfile.jpg'],
+                                     ['10x10', { :geometry => '20x20', :format => 'GIF', :quality => 50 }])
+      end
+      assert_equal(3, res.length)
+      assert_equal(2, res[0].length)
+
+      img = Magick::Image.from_blob(res[1][0]).first
+      assert_equal('PNG', img.format)
+      assert_equal([10, 5], [img.columns, img.rows])
+      img = Magick::Image.from_blob(res[1][1]).first
+      assert_equal('GIF', img.format)
+      assert_equal([20, 10], [img.columns, img.rows])
+      assert_instance_of(Magick::ImageMagickError, res[2])
+
+      tmp = File.join(Dir.tmpdir, 'thumbnail_batch_%s.png')
+      res = Magick.thumbnail_batch([FLOWER_HAT], [{ :geometry => '15x15', :filename => tmp }], 1)
+      name = format(tmp, 'Flower_Hat')
+      assert_equal([[name]], res)
+      begin
+        img = Magick::Image.read(name).first
+        assert_equal('PNG', img.format)
+        assert_equal(15, [img.columns, img.rows].max)
+      ensure
+        File.delete(name) if File.exist?(name)
+      end
+
+      assert_raise(ArgumentError) { Magick.thumbnail_batch([FLOWER_HAT], []) }
+      assert_raise(ArgumentError) { Magick.thumbnail_batch([FLOWER_HAT], ['junk']) }
+      assert_raise(ArgumentError) { Magick.thumbnail_batch([FLOWER_HAT], [{ :geometry => '10x10', :format => 'xxx' }]) }
+      assert_raise(ArgumentError) { Magick.thumbnail_batch([FLOWER_HAT], ['10x10'], 0) }
+      assert_raise(ArgumentError) { Magick.thumbnail_batch([FLOWER_HAT]) }
+    end
+
     def test_trace_proc
       Magick.trace_proc = proc do |which, description, id, method|
         assert(which == :c)